@@ -0,0 +1,240 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#pragma once
+
+#ifdef PARLO_COROUTINES
+
+#include <asio.hpp>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <vector>
+
+namespace Parlo
+{
+    /*Recycles the memory suspended coroutines are stored in, so a coroutine that awaits in a loop
+    stops allocating once it's warmed up. Thread safe.*/
+    class HandlerMemory
+    {
+    public:
+        /*Handlers up to this size are recycled. asio's coroutine handlers are a fraction of it.*/
+        static const size_t BLOCK_SIZE = 256;
+
+        HandlerMemory() {
+            freeBlocks.reserve(MAX_FREE_BLOCKS);
+        }
+
+        ~HandlerMemory() {
+            for (void* block : freeBlocks)
+                ::operator delete(block);
+        }
+
+        HandlerMemory(const HandlerMemory&) = delete;
+        HandlerMemory& operator=(const HandlerMemory&) = delete;
+
+        void* allocate(size_t size) {
+            if (size > BLOCK_SIZE)
+                return ::operator new(size);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (freeBlocks.empty())
+                return ::operator new(BLOCK_SIZE);
+
+            void* block = freeBlocks.back();
+            freeBlocks.pop_back();
+            return block;
+        }
+
+        void deallocate(void* block, size_t size) {
+            if (size <= BLOCK_SIZE) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (freeBlocks.size() < MAX_FREE_BLOCKS) {
+                    freeBlocks.push_back(block);
+                    return;
+                }
+            }
+
+            ::operator delete(block);
+        }
+
+    private:
+        /*More than this many coroutines are rarely suspended on the same connection at once.*/
+        static const size_t MAX_FREE_BLOCKS = 64;
+
+        std::mutex mutex;
+        std::vector<void*> freeBlocks;
+    };
+
+    /*A suspended coroutine, stored until whatever it's waiting for happens.
+    Results are what its co_await returns.*/
+    template <typename... Results>
+    class SuspendedCoroutine
+    {
+    public:
+        /*Resumes the coroutine on its executor, and frees this. Never resumes it inline, so this can be called with locks held.
+        @param results What the coroutine's co_await returns.*/
+        virtual void resume(Results... results) = 0;
+
+        /*Resumes the coroutine with an error, which its co_await throws as a std::system_error, and frees this.
+        @param ec The error.*/
+        virtual void fail(const std::error_code& ec) = 0;
+
+        /*Resumes the coroutine, or fails it if ec is set.*/
+        void complete(const std::error_code& ec, Results... results) {
+            if (ec)
+                fail(ec);
+            else
+                resume(std::move(results)...);
+        }
+
+        /*Stores the completion handler of a coroutine that is suspending.
+        @param memory The memory to store it in, which must outlive it.
+        @param handler The handler.*/
+        template <typename Handler>
+        static SuspendedCoroutine* create(HandlerMemory& memory, Handler&& handler);
+
+    protected:
+        virtual ~SuspendedCoroutine() = default;
+    };
+
+    template <typename Handler, typename... Results>
+    class SuspendedHandler : public SuspendedCoroutine<Results...>
+    {
+    public:
+        SuspendedHandler(HandlerMemory& memory, Handler&& handler) : memory(memory), handler(std::move(handler)) {}
+
+        void resume(Results... results) override {
+            post(nullptr, std::move(results)...);
+        }
+
+        void fail(const std::error_code& ec) override {
+            post(std::make_exception_ptr(std::system_error(ec)), Results()...);
+        }
+
+    private:
+        HandlerMemory& memory;
+        Handler handler;
+
+        void post(std::exception_ptr error, Results... results) {
+            Handler resumed(std::move(handler));
+            HandlerMemory& owner = memory;
+            this->~SuspendedHandler();
+            owner.deallocate(this, sizeof(SuspendedHandler));
+
+            auto executor = asio::get_associated_executor(resumed);
+            asio::post(executor, [resumed = std::move(resumed), error, ...results = std::move(results)]() mutable {
+                resumed(error, std::move(results)...);
+            });
+        }
+    };
+
+    template <typename... Results>
+    template <typename Handler>
+    SuspendedCoroutine<Results...>* SuspendedCoroutine<Results...>::create(HandlerMemory& memory, Handler&& handler) {
+        using Suspended = SuspendedHandler<std::decay_t<Handler>, Results...>;
+
+        void* block = memory.allocate(sizeof(Suspended));
+        return new (block) Suspended(memory, std::move(handler));
+    }
+
+    /*Suspends the calling coroutine until it's resumed by whoever is handed the SuspendedCoroutine.
+    Not a coroutine itself, so awaiting it costs no more than awaiting an asio operation.
+    @param memory The memory to store the coroutine's handler in.
+    @param suspend Called with the SuspendedCoroutine once the caller is suspended. It must be resumed exactly once.
+    @return What the SuspendedCoroutine is resumed with.
+    @throws std::system_error if it was failed.*/
+    template <typename... Results, typename Suspend>
+    auto suspendCoroutine(HandlerMemory& memory, Suspend suspend) {
+        return asio::async_initiate<const asio::use_awaitable_t<>&, void(std::exception_ptr, Results...)>(
+            [&memory, suspend = std::move(suspend)](auto handler) mutable {
+                suspend(SuspendedCoroutine<Results...>::create(memory, std::move(handler)));
+            }, asio::use_awaitable);
+    }
+
+    /*A queue that a coroutine can wait on. Items can be pushed from any thread, but only one coroutine can wait at a time.*/
+    template <typename T>
+    class AwaitableQueue
+    {
+    public:
+        /*Adds an item, or hands it straight to the coroutine waiting for one.*/
+        void push(T item) {
+            SuspendedCoroutine<T>* waiting = nullptr;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::swap(waiting, waiter);
+
+                if (!waiting)
+                    items.push_back(std::move(item));
+            }
+
+            if (waiting)
+                waiting->resume(std::move(item));
+        }
+
+        /*Makes pop() throw once the items that are left have been popped.
+        @param ec The error to throw.*/
+        void close(const std::error_code& ec) {
+            SuspendedCoroutine<T>* waiting = nullptr;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                    error = ec;
+                std::swap(waiting, waiter);
+            }
+
+            if (waiting)
+                waiting->fail(ec);
+        }
+
+        /*Undoes close().*/
+        void reopen() {
+            std::lock_guard<std::mutex> lock(mutex);
+            error.clear();
+        }
+
+        /*Waits for the next item. The queue must outlive the co_await.
+        @throws std::system_error once the queue was closed and every item has been popped,
+        or if another coroutine is already waiting.*/
+        asio::awaitable<T> pop() {
+            return suspendCoroutine<T>(memory, [this](SuspendedCoroutine<T>* suspended) {
+                std::unique_lock<std::mutex> lock(mutex);
+
+                if (!items.empty()) {
+                    T item = std::move(items.front());
+                    items.pop_front();
+                    lock.unlock();
+                    suspended->resume(std::move(item));
+                }
+                else if (error || waiter) {
+                    std::error_code ec = error ? error : std::make_error_code(std::errc::operation_in_progress);
+                    lock.unlock();
+                    suspended->fail(ec);
+                }
+                else
+                    waiter = suspended;
+            });
+        }
+
+    private:
+        std::mutex mutex;
+        std::deque<T> items;
+        std::error_code error;
+        SuspendedCoroutine<T>* waiter = nullptr;
+        HandlerMemory memory;
+    };
+}
+
+#endif
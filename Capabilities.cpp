@@ -0,0 +1,161 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include "pch.h"
+#include "Capabilities.h"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace Parlo
+{
+    /*Reads a capabilities byte array front to back, throwing if it runs out.*/
+    class CapabilityReader
+    {
+    public:
+        CapabilityReader(const std::vector<uint8_t>& bytes) : bytes(bytes) {}
+
+        uint64_t read(size_t size) {
+            if (bytes.size() - position < size)
+                throw std::runtime_error("Capabilities::fromByteArray(): Invalid byte array size for Capabilities.");
+
+            uint64_t value = 0;
+            for (size_t i = 0; i < size; i++)
+                value |= static_cast<uint64_t>(bytes[position++]) << (8 * i);
+
+            return value;
+        }
+
+        /*Reads a list, leaving out the values this version doesn't know.*/
+        template <typename T>
+        std::vector<T> readList(uint8_t lowest, uint8_t highest) {
+            std::vector<T> list;
+            for (uint64_t count = read(1); count > 0; count--) {
+                uint8_t value = static_cast<uint8_t>(read(1));
+                if (value >= lowest && value <= highest)
+                    list.push_back(static_cast<T>(value));
+            }
+
+            return list;
+        }
+
+    private:
+        const std::vector<uint8_t>& bytes;
+        size_t position = 0;
+    };
+
+    template <typename T>
+    static void appendList(std::vector<uint8_t>& bytes, const std::vector<T>& list) {
+        bytes.push_back(static_cast<uint8_t>(list.size()));
+        for (T value : list)
+            bytes.push_back(static_cast<uint8_t>(value));
+    }
+
+    /*Picks the entry both lists hold that is furthest up in both of them. Ties go to the highest value,
+    I.E the newest, so both ends pick the same one whichever list is theirs.
+    @return False if the lists have nothing in common.*/
+    template <typename T>
+    static bool pickCommon(const std::vector<T>& local, const std::vector<T>& remote, T& picked) {
+        size_t bestRank = (std::numeric_limits<size_t>::max)();
+
+        for (size_t i = 0; i < local.size(); i++) {
+            auto match = std::find(remote.begin(), remote.end(), local[i]);
+            if (match == remote.end())
+                continue;
+
+            size_t rank = i + static_cast<size_t>(match - remote.begin());
+            if (rank < bestRank || (rank == bestRank && local[i] > picked)) {
+                bestRank = rank;
+                picked = local[i];
+            }
+        }
+
+        return bestRank != (std::numeric_limits<size_t>::max)();
+    }
+
+    /*Throws std::invalid_argument if these can't be offered in a handshake.*/
+    void Capabilities::validate() const {
+        if (compressionLevel < 1 || compressionLevel > 9)
+            throw std::invalid_argument("The compression level must be between 1 and 9");
+        if (maxBatchDelay.count() < 0 || maxBatchDelay.count() > (std::numeric_limits<uint32_t>::max)())
+            throw std::invalid_argument("The batch delay must be between 0 and 2^32 - 1 microseconds");
+        if (maxFrameSize < MIN_FRAME_SIZE || maxFrameSize > static_cast<size_t>(MAX_PACKET_SIZE))
+            throw std::invalid_argument("The frame size must be between MIN_FRAME_SIZE and MAX_PACKET_SIZE");
+        if (codecs.size() > 255 || headerFormats.size() > 255 || ciphers.size() > 255)
+            throw std::invalid_argument("Too many codecs, header formats or ciphers");
+    }
+
+    /*Serializes capabilities into a byte array. Little endian.
+    [uint8_t version][codecs][uint8_t compression level][header formats][uint32_t max batch delay in microseconds]
+    [uint16_t max frame size][ciphers], where each list is [uint8_t count][uint8_t entry]...
+    @returns A byte array.*/
+    std::vector<uint8_t> Capabilities::toByteArray() const {
+        std::vector<uint8_t> bytes;
+        bytes.push_back(version);
+        appendList(bytes, codecs);
+        bytes.push_back(static_cast<uint8_t>(compressionLevel));
+        appendList(bytes, headerFormats);
+
+        uint32_t delay = static_cast<uint32_t>(maxBatchDelay.count());
+        for (size_t i = 0; i < 4; i++)
+            bytes.push_back(static_cast<uint8_t>(delay >> (8 * i)));
+        bytes.push_back(static_cast<uint8_t>(maxFrameSize));
+        bytes.push_back(static_cast<uint8_t>(maxFrameSize >> 8));
+
+        appendList(bytes, ciphers);
+        return bytes;
+    }
+
+    /*Deserializes a byte array into capabilities.
+    @param arrBytes The byte array to deserialize, I.E a ParloIDs::Hello packet's data.*/
+    Capabilities Capabilities::fromByteArray(const std::vector<uint8_t>& arrBytes) {
+        CapabilityReader reader(arrBytes);
+        Capabilities capabilities;
+
+        capabilities.version = static_cast<uint8_t>(reader.read(1));
+        capabilities.codecs = reader.readList<Codec>(static_cast<uint8_t>(Codec::Zlib), static_cast<uint8_t>(Codec::Zlib));
+        capabilities.compressionLevel = (std::clamp)(static_cast<int>(reader.read(1)), 1, 9);
+        capabilities.headerFormats = reader.readList<HeaderFormat>(static_cast<uint8_t>(HeaderFormat::Legacy),
+            static_cast<uint8_t>(HeaderFormat::Compact));
+        capabilities.maxBatchDelay = std::chrono::microseconds(reader.read(4));
+        capabilities.maxFrameSize = (std::clamp)(static_cast<size_t>(reader.read(2)), MIN_FRAME_SIZE, static_cast<size_t>(MAX_PACKET_SIZE));
+        capabilities.ciphers = reader.readList<EncryptionMode>(AES, Twofish);
+        return capabilities;
+    }
+
+    /*Works out what two ends support. Both ends come to the same result, whichever one is local.*/
+    Capabilities Capabilities::negotiate(const Capabilities& local, const Capabilities& remote) {
+        Capabilities agreed;
+        agreed.version = (std::min)(local.version, remote.version);
+
+        agreed.codecs.clear();
+        for (Codec codec : local.codecs) {
+            if (std::find(remote.codecs.begin(), remote.codecs.end(), codec) != remote.codecs.end())
+                agreed.codecs.push_back(codec);
+        }
+        agreed.compressionLevel = (std::min)(local.compressionLevel, remote.compressionLevel);
+
+        HeaderFormat format = HeaderFormat::Legacy;
+        pickCommon(local.headerFormats, remote.headerFormats, format);
+        agreed.headerFormats = { format };
+
+        if (local.maxBatchDelay.count() > 0 && remote.maxBatchDelay.count() > 0)
+            agreed.maxBatchDelay = (std::min)(local.maxBatchDelay, remote.maxBatchDelay);
+        agreed.maxFrameSize = (std::min)(local.maxFrameSize, remote.maxFrameSize);
+
+        EncryptionMode cipher = AES;
+        if (pickCommon(local.ciphers, remote.ciphers, cipher))
+            agreed.ciphers = { cipher };
+
+        return agreed;
+    }
+}
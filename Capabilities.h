@@ -0,0 +1,73 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include "Parlo.h"
+#include "Compression.h"
+#include "EncryptionMode.h"
+
+namespace Parlo
+{
+    /*The version of the protocol this build speaks in a handshake.*/
+    const uint8_t PROTOCOL_VERSION = 1;
+
+    /*The smallest frame a Capabilities may ask for, so internal packets still fit.*/
+    const size_t MIN_FRAME_SIZE = 64;
+
+    /*Codecs packets can be compressed with.*/
+    enum class Codec : uint8_t
+    {
+        Zlib = 1
+    };
+
+    /*What one end of a connection supports. Both ends of a connection that was set up with
+    NetworkClient::setCapabilities() or Listener::setCapabilities() exchange them when the connection is made,
+    and each end then uses what both of them support. Lists are in order of preference.
+    A handshake is [ParloIDs::Hello with these capabilities] from each end, and once an end has both,
+    [ParloIDs::HelloAck] as the last packet it frames the old way.*/
+    struct Capabilities
+    {
+        uint8_t version = PROTOCOL_VERSION;
+        /*Codecs this end can decompress. Packets are only compressed, if compression is applied,
+        with a codec the other end can decompress.*/
+        std::vector<Codec> codecs = { Codec::Zlib };
+        /*The zlib level to compress with, from 1 to 9. The lower of the two is used.*/
+        int compressionLevel = DEFAULT_COMPRESSION_LEVEL;
+        /*How packets may be framed. HeaderFormat::Legacy is always supported.*/
+        std::vector<HeaderFormat> headerFormats = { HeaderFormat::Compact, HeaderFormat::Legacy };
+        /*How long packets sent to this end may be held back to be batched, or 0 if they mustn't be.
+        Batching is turned on with the lower of the two if neither is 0.*/
+        std::chrono::microseconds maxBatchDelay{ 0 };
+        /*The largest packet this end wants to receive, header included. The lower of the two is used.*/
+        size_t maxFrameSize = MAX_PACKET_SIZE;
+        /*Ciphers this end can encrypt packets with, I.E as EncryptedPacket. Parlo doesn't encrypt
+        by itself, so the cipher that was agreed on is left to the application.*/
+        std::vector<EncryptionMode> ciphers;
+
+        /*Throws std::invalid_argument if these can't be offered in a handshake.*/
+        PARLO_API void validate() const;
+
+        PARLO_API std::vector<uint8_t> toByteArray() const;
+        /*Fields added by later versions are skipped.
+        @throws std::runtime_error if the byte array is too short.*/
+        PARLO_API static Capabilities fromByteArray(const std::vector<uint8_t>& arrBytes);
+
+        /*Works out what two ends support. Both ends come to the same result, whichever one is local.
+        Lists hold at most one entry, except codecs, which hold every codec both ends support in
+        the local end's order of preference.*/
+        PARLO_API static Capabilities negotiate(const Capabilities& local, const Capabilities& remote);
+    };
+}
@@ -0,0 +1,216 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include "pch.h"
+#include "Capture.h"
+#include "Compression.h"
+#include "Logger.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace Parlo
+{
+    class TrafficCapture::Impl {
+    public:
+        Impl(const std::string& path) : file(path, true, CAPTURE_INITIAL_SIZE), started(std::chrono::steady_clock::now()) {
+            CaptureFileHeader header{};
+            std::memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+            header.version = CAPTURE_VERSION;
+            header.used = sizeof(CaptureFileHeader);
+            header.startTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+
+            std::memcpy(file.data(), &header, sizeof(header));
+            used = sizeof(CaptureFileHeader);
+        }
+
+        mutable std::mutex mutex;
+        MappedFile file;
+        std::chrono::steady_clock::time_point started;
+        uint64_t used;
+        std::atomic<uint32_t> nextConnection{ 0 };
+
+        /*Writes how much of the file is in use into the header.*/
+        void writeUsed() {
+            std::memcpy(file.data() + offsetof(CaptureFileHeader, used), &used, sizeof(used));
+        }
+    };
+
+    /*Creates a capture file, replacing any file at the path.
+    @param path The file to write.
+    @throws std::runtime_error if the file couldn't be created or mapped.*/
+    TrafficCapture::TrafficCapture(const std::string& path) : pImpl(std::make_unique<Impl>(path)) {
+    }
+
+    /*Closes the capture, trimming the file to the data written.*/
+    TrafficCapture::~TrafficCapture() {
+        try {
+            std::lock_guard<std::mutex> lock(pImpl->mutex);
+            pImpl->file.resize(static_cast<size_t>(pImpl->used));
+        }
+        catch (const std::exception& e) {
+            PARLO_LOG(LogLevel::error, "TrafficCapture: Couldn't trim capture: {}", e.what());
+        }
+    }
+
+    /*Hands out a new connection number, which identifies a connection's records.*/
+    uint32_t TrafficCapture::addConnection() {
+        return pImpl->nextConnection.fetch_add(1);
+    }
+
+    /*Appends a record.
+    @param connection The connection the data was received on.
+    @param data The received data.
+    @param length The number of bytes received.
+    @throws std::runtime_error if the file couldn't be grown.*/
+    void TrafficCapture::append(uint32_t connection, const uint8_t* data, size_t length) {
+        uint64_t timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - pImpl->started).count());
+        uint32_t recordLength = static_cast<uint32_t>(length);
+
+        std::lock_guard<std::mutex> lock(pImpl->mutex);
+
+        size_t needed = static_cast<size_t>(pImpl->used) + CAPTURE_RECORD_HEADER_SIZE + length;
+        if (needed > pImpl->file.size()) {
+            size_t newSize = pImpl->file.size();
+            while (newSize < needed)
+                newSize *= 2;
+
+            pImpl->file.resize(newSize);
+        }
+
+        uint8_t* record = pImpl->file.data() + pImpl->used;
+        std::memcpy(record, &timestamp, sizeof(timestamp));
+        std::memcpy(record + sizeof(timestamp), &connection, sizeof(connection));
+        std::memcpy(record + sizeof(timestamp) + sizeof(connection), &recordLength, sizeof(recordLength));
+        std::memcpy(record + CAPTURE_RECORD_HEADER_SIZE, data, length);
+
+        pImpl->used = needed;
+        pImpl->writeUsed();
+    }
+
+    /*The number of bytes captured so far, including headers.*/
+    uint64_t TrafficCapture::size() const {
+        std::lock_guard<std::mutex> lock(pImpl->mutex);
+        return pImpl->used;
+    }
+
+    class TrafficReplay::Impl {
+    public:
+        Impl(const std::string& path) : file(path, false, 0) {
+            CaptureFileHeader header;
+            if (file.size() < sizeof(header))
+                throw std::runtime_error("TrafficReplay: " + path + " is not a capture");
+
+            std::memcpy(&header, file.data(), sizeof(header));
+            if (std::memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) != 0)
+                throw std::runtime_error("TrafficReplay: " + path + " is not a capture");
+            if (header.version != CAPTURE_VERSION)
+                throw std::runtime_error("TrafficReplay: Unsupported capture version");
+
+            end = static_cast<size_t>((std::min)(header.used, static_cast<uint64_t>(file.size())));
+        }
+
+        MappedFile file;
+        size_t end;
+    };
+
+    /*Opens a capture file.
+    @param path The file to read.
+    @throws std::runtime_error if the file couldn't be opened, or isn't a capture.*/
+    TrafficReplay::TrafficReplay(const std::string& path) : pImpl(std::make_unique<Impl>(path)) {
+    }
+
+    TrafficReplay::~TrafficReplay() {
+    }
+
+    /*Calls a function for every record, in the order they were captured.*/
+    void TrafficReplay::forEachRecord(const std::function<void(const CaptureRecord&)>& callback) const {
+        const uint8_t* data = pImpl->file.data();
+        size_t offset = sizeof(CaptureFileHeader);
+
+        while (offset + CAPTURE_RECORD_HEADER_SIZE <= pImpl->end) {
+            uint64_t timestamp;
+            CaptureRecord record;
+
+            std::memcpy(&timestamp, data + offset, sizeof(timestamp));
+            std::memcpy(&record.connection, data + offset + sizeof(timestamp), sizeof(record.connection));
+            std::memcpy(&record.length, data + offset + sizeof(timestamp) + sizeof(record.connection), sizeof(record.length));
+
+            //A truncated record means the capture wasn't closed properly.
+            if (offset + CAPTURE_RECORD_HEADER_SIZE + record.length > pImpl->end)
+                break;
+
+            record.timestamp = std::chrono::nanoseconds(timestamp);
+            record.data = data + offset + CAPTURE_RECORD_HEADER_SIZE;
+            callback(record);
+
+            offset += CAPTURE_RECORD_HEADER_SIZE + record.length;
+        }
+    }
+
+    /*Replays the capture through a ProcessingBuffer per connection.
+    @param onPacket Called for every packet, with the connection it was received on.
+    @param recordedTiming True to wait between records as long as the capture did, false to go as fast as possible.*/
+    ReplayStats TrafficReplay::replay(const std::function<void(uint32_t, const Packet&)>& onPacket, bool recordedTiming) const {
+        ReplayStats stats;
+        std::atomic<uint64_t> packets{ 0 };
+        std::map<uint32_t, std::unique_ptr<ProcessingBuffer>> buffers;
+
+        auto started = std::chrono::steady_clock::now();
+
+        forEachRecord([&](const CaptureRecord& record) {
+            auto& buffer = buffers[record.connection];
+            if (!buffer) {
+                buffer = std::make_unique<ProcessingBuffer>();
+                uint32_t connection = record.connection;
+
+                //Mirrors NetworkClient, which decompresses packets before they are handed over.
+                buffer->setOnPacketProcessedHandler([&onPacket, &packets, connection](const Packet& packet) {
+                    packets++;
+
+                    if (packet.getIsCompressed())
+                        onPacket(connection, Packet(packet.getID(), decompressData(packet.getData()), false));
+                    else
+                        onPacket(connection, packet);
+                });
+            }
+
+            if (recordedTiming)
+                std::this_thread::sleep_until(started + record.timestamp);
+
+            //A NetworkClient never reads more than a ProcessingBuffer takes at once, but split just in case.
+            for (uint32_t offset = 0; offset < record.length; offset += MAX_PACKET_SIZE) {
+                uint32_t chunk = (std::min)(record.length - offset, static_cast<uint32_t>(MAX_PACKET_SIZE));
+                buffer->addData(std::vector<uint8_t>(record.data + offset, record.data + offset + chunk));
+            }
+
+            stats.records++;
+            stats.bytes += record.length;
+        });
+
+        for (auto& buffer : buffers)
+            buffer.second->waitUntilProcessed();
+
+        stats.elapsed = std::chrono::steady_clock::now() - started;
+        stats.packets = packets;
+
+        return stats;
+    }
+}
@@ -0,0 +1,130 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Parlo.h"
+
+namespace Parlo
+{
+    /*Identifies a capture file, and its version.*/
+    const char CAPTURE_MAGIC[8] = { 'P', 'A', 'R', 'L', 'O', 'C', 'A', 'P' };
+    const uint32_t CAPTURE_VERSION = 1;
+
+    /*Capture files start out this big, and double whenever they run out of room.*/
+    const size_t CAPTURE_INITIAL_SIZE = 1024 * 1024;
+
+    /*The start of a capture file. All fields are little endian, as are the records that follow:
+    [uint64_t nanoseconds since the capture started][uint32_t connection][uint32_t length][length bytes]*/
+    struct CaptureFileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        /*Bytes of the file in use, including this header. Updated after every record, so a capture
+        that wasn't closed properly can still be read up to its last complete record.*/
+        uint64_t used;
+        /*When the capture started, in nanoseconds since the system clock's epoch.*/
+        int64_t startTime;
+    };
+
+    const size_t CAPTURE_RECORD_HEADER_SIZE = sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint32_t);
+
+    /*A single read, as captured.*/
+    struct CaptureRecord
+    {
+        std::chrono::nanoseconds timestamp;
+        uint32_t connection;
+        const uint8_t* data;
+        uint32_t length;
+    };
+
+    /*Appends the raw bytes received by one or more NetworkClients, and when they were received,
+    to a memory mapped file. Appending is a copy into the mapping under a lock, so capturing is
+    cheap enough to leave on under load. Thread safe.*/
+    class TrafficCapture
+    {
+    public:
+        /*Creates a capture file, replacing any file at the path.
+        @param path The file to write.
+        @throws std::runtime_error if the file couldn't be created or mapped.*/
+        PARLO_API TrafficCapture(const std::string& path);
+        /*Closes the capture, trimming the file to the data written.*/
+        PARLO_API ~TrafficCapture();
+
+        TrafficCapture(const TrafficCapture&) = delete;
+        TrafficCapture& operator=(const TrafficCapture&) = delete;
+
+        /*Hands out a new connection number, which identifies a connection's records.*/
+        PARLO_API uint32_t addConnection();
+
+        /*Appends a record.
+        @param connection The connection the data was received on.
+        @param data The received data.
+        @param length The number of bytes received.
+        @throws std::runtime_error if the file couldn't be grown.*/
+        PARLO_API void append(uint32_t connection, const uint8_t* data, size_t length);
+
+        /*The number of bytes captured so far, including headers.*/
+        PARLO_API uint64_t size() const;
+
+    private:
+        class Impl;
+        std::unique_ptr<Impl> pImpl;
+    };
+
+    /*Statistics from replaying a capture.*/
+    struct ReplayStats
+    {
+        uint64_t records = 0;
+        uint64_t bytes = 0;
+        uint64_t packets = 0;
+        std::chrono::nanoseconds elapsed{ 0 };
+    };
+
+    /*Reads a capture file through a read only memory mapping, and feeds it back through a
+    ProcessingBuffer per connection, the way a NetworkClient would. Nothing touches the network,
+    so replaying as fast as possible gives a deterministic throughput benchmark from real traffic.*/
+    class TrafficReplay
+    {
+    public:
+        /*Opens a capture file.
+        @param path The file to read.
+        @throws std::runtime_error if the file couldn't be opened, or isn't a capture.*/
+        PARLO_API TrafficReplay(const std::string& path);
+        PARLO_API ~TrafficReplay();
+
+        TrafficReplay(const TrafficReplay&) = delete;
+        TrafficReplay& operator=(const TrafficReplay&) = delete;
+
+        /*Calls a function for every record, in the order they were captured. The record's data
+        points into the mapping and is valid for as long as this TrafficReplay instance.*/
+        PARLO_API void forEachRecord(const std::function<void(const CaptureRecord&)>& callback) const;
+
+        /*Replays the capture. Packets are decompressed before the handler is called, like a
+        NetworkClient's onReceivedData handler. The handler is called from each connection's
+        processing thread.
+        @param onPacket Called for every packet, with the connection it was received on.
+        @param recordedTiming True to wait between records as long as the capture did, false to go as fast as possible.*/
+        PARLO_API ReplayStats replay(const std::function<void(uint32_t, const Packet&)>& onPacket, bool recordedTiming = false) const;
+
+    private:
+        class Impl;
+        std::unique_ptr<Impl> pImpl;
+    };
+}
@@ -0,0 +1,109 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include "pch.h"
+#include "Compression.h"
+#include "Trace.h"
+#include <zlib.h>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+namespace Parlo
+{
+    /*Compresses data.
+    @param data The data to compress.
+    @param level The zlib compression level, from 1 (fastest) to 9 (smallest).
+    @returns The compressed data as a std::vector<uint8_t>
+    @throws std::runtime_error if zLib couldn't be initialized or data couldn't be compressed.
+    @throws std::invalid_argument if data was null.*/
+    std::vector<uint8_t> compressData(const std::vector<uint8_t>& data, int level) {
+        PARLO_TRACE_SCOPE("compressData");
+
+        if (data.empty())
+            throw std::invalid_argument("Data cannot be null or empty");
+
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+
+        if (deflateInit(&zs, level) != Z_OK)
+            throw std::runtime_error("deflateInit failed");
+
+        zs.next_in = (Bytef*)data.data();
+        zs.avail_in = data.size();
+
+        int ret;
+        std::unique_ptr<char[]> outbuffer(new char[COMPRESSION_BUFFER_SIZE]);
+        std::vector<uint8_t> outdata;
+
+        do {
+            zs.next_out = reinterpret_cast<Bytef*>(outbuffer.get());
+            zs.avail_out = COMPRESSION_BUFFER_SIZE;
+
+            ret = deflate(&zs, Z_FINISH);
+
+            if (outdata.size() < zs.total_out) {
+                outdata.insert(outdata.end(), outbuffer.get(), outbuffer.get() + zs.total_out - outdata.size());
+            }
+        } while (ret == Z_OK);
+
+        deflateEnd(&zs);
+
+        if (ret != Z_STREAM_END)
+            throw std::runtime_error("Exception during zlib compression");
+
+        return outdata;
+    }
+
+    /*Decompresses data.
+    @param data The data to compress.
+    @returns The decompressed data as a std::vector<uint8_t>
+    @throws std::runtime_error if zLib couldn't be initialized or data couldn't be decompressed.
+    @throws std::invalid_argument if data was null.*/
+    std::vector<uint8_t> decompressData(const std::vector<uint8_t>& data) {
+        PARLO_TRACE_SCOPE("decompressData");
+
+        if (data.empty())
+            throw std::invalid_argument("Data cannot be null or empty");
+
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+
+        if (inflateInit(&zs) != Z_OK)
+            throw std::runtime_error("NetworkClient::decompressData: inflateInit failed.");
+
+        zs.next_in = (Bytef*)data.data();
+        zs.avail_in = data.size();
+
+        int ret;
+        std::unique_ptr<char[]> outBuffer(new char[COMPRESSION_BUFFER_SIZE]);
+        std::vector<uint8_t> outData;
+
+        do {
+            zs.next_out = reinterpret_cast<Bytef*>(outBuffer.get());
+            zs.avail_out = COMPRESSION_BUFFER_SIZE;
+
+            ret = inflate(&zs, 0);
+
+            if (outData.size() < zs.total_out)
+                outData.insert(outData.end(), outBuffer.get(), outBuffer.get() + zs.total_out - outData.size());
+
+        } while (ret == Z_OK);
+
+        inflateEnd(&zs);
+
+        if (ret != Z_STREAM_END)
+            throw std::runtime_error("NetworkClient::decompressData: Exception during zlib decompression.");
+
+        return outData;
+    }
+}
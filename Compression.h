@@ -0,0 +1,44 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Parlo.h"
+
+namespace Parlo
+{
+    /*Size of compression and decompression buffer.
+    Zlib benefits from having a larger buffer than
+    MAX_PACKET_SIZE (in ProcessingBuffer)
+    to compress and decompress data.*/
+    const int COMPRESSION_BUFFER_SIZE = 32768;
+
+    /*The zlib compression level used by default, I.E Z_BEST_COMPRESSION.*/
+    const int DEFAULT_COMPRESSION_LEVEL = 9;
+
+    /*Compresses data.
+    @param data The data to compress.
+    @param level The zlib compression level, from 1 (fastest) to 9 (smallest).
+    @returns The compressed data as a std::vector<uint8_t>
+    @throws std::runtime_error if zLib couldn't be initialized or data couldn't be compressed.
+    @throws std::invalid_argument if data was null.*/
+    PARLO_API std::vector<uint8_t> compressData(const std::vector<uint8_t>& data, int level = DEFAULT_COMPRESSION_LEVEL);
+
+    /*Decompresses data.
+    @param data The data to compress.
+    @returns The decompressed data as a std::vector<uint8_t>
+    @throws std::runtime_error if zLib couldn't be initialized or data couldn't be decompressed.
+    @throws std::invalid_argument if data was null.*/
+    PARLO_API std::vector<uint8_t> decompressData(const std::vector<uint8_t>& data);
+}
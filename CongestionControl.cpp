@@ -0,0 +1,158 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include "pch.h"
+#include "CongestionControl.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace Parlo
+{
+    /*CUBIC scaling constant.*/
+    const double CUBIC_C = 0.4;
+    /*Multiplicative decrease factor.*/
+    const double CUBIC_BETA = 0.7;
+
+    const size_t INITIAL_WINDOW_PACKETS = 10;
+    const size_t MINIMUM_WINDOW_PACKETS = 2;
+
+    /*How far ahead of the window the pacer runs, so ACK compression doesn't stall the sender.*/
+    const double PACING_GAIN = 1.25;
+    const double SLOW_START_PACING_GAIN = 2.0;
+
+    /*Largest burst the pacer lets through at once, in datagrams.*/
+    const size_t PACING_BURST_PACKETS = 10;
+
+    CubicCongestionControl::CubicCongestionControl(size_t maxDatagramSize) :
+        maxDatagramSize(maxDatagramSize),
+        congestionWindow(INITIAL_WINDOW_PACKETS * maxDatagramSize),
+        slowStartThreshold((std::numeric_limits<size_t>::max)()),
+        pacingBudget(static_cast<double>(PACING_BURST_PACKETS * maxDatagramSize))
+    {
+    }
+
+    /*Bytes were acknowledged.
+    @param bytes The number of bytes acknowledged.
+    @param now The current time.
+    @param smoothedRTT The current smoothed RTT.*/
+    void CubicCongestionControl::onAck(size_t bytes, Clock::time_point now, Clock::duration smoothedRTT)
+    {
+        if (isInSlowStart()) {
+            congestionWindow += bytes;
+            return;
+        }
+
+        if (!epochStarted) {
+            epochStart = now;
+            epochStarted = true;
+
+            if (windowMax < static_cast<double>(congestionWindow) / maxDatagramSize)
+                windowMax = static_cast<double>(congestionWindow) / maxDatagramSize;
+        }
+
+        double t = std::chrono::duration<double>(now - epochStart).count();
+        double rtt = std::chrono::duration<double>(smoothedRTT).count();
+        double k = std::cbrt(windowMax * (1.0 - CUBIC_BETA) / CUBIC_C);
+
+        //W_cubic(t + RTT) is the target one round trip from now.
+        double target = CUBIC_C * std::pow(t + rtt - k, 3.0) + windowMax;
+
+        //The Reno-friendly estimate keeps CUBIC at least as aggressive as standard TCP on short RTTs.
+        double estimate = windowMax * CUBIC_BETA + (3.0 * (1.0 - CUBIC_BETA) / (1.0 + CUBIC_BETA)) * (rtt > 0 ? t / rtt : 0);
+        target = (std::max)(target, estimate);
+
+        double window = static_cast<double>(congestionWindow) / maxDatagramSize;
+
+        if (target > window) {
+            double increase = (target - window) / window * (static_cast<double>(bytes) / maxDatagramSize);
+            congestionWindow += static_cast<size_t>(increase * maxDatagramSize);
+        }
+    }
+
+    /*A packet was declared lost. Only the first loss per recovery period reduces the window.
+    @param sentTime When the lost packet was sent.
+    @param now The current time.*/
+    void CubicCongestionControl::onLoss(Clock::time_point sentTime, Clock::time_point now)
+    {
+        if (sentTime <= recoveryStart)
+            return;
+
+        recoveryStart = now;
+        windowMax = static_cast<double>(congestionWindow) / maxDatagramSize;
+        congestionWindow = (std::max)(static_cast<size_t>(congestionWindow * CUBIC_BETA), MINIMUM_WINDOW_PACKETS * maxDatagramSize);
+        slowStartThreshold = congestionWindow;
+        epochStarted = false;
+    }
+
+    /*The retransmission timer fired. Collapses the window to its minimum.*/
+    void CubicCongestionControl::onRetransmissionTimeout(Clock::time_point now)
+    {
+        recoveryStart = now;
+        windowMax = static_cast<double>(congestionWindow) / maxDatagramSize;
+        slowStartThreshold = (std::max)(static_cast<size_t>(congestionWindow * CUBIC_BETA), MINIMUM_WINDOW_PACKETS * maxDatagramSize);
+        congestionWindow = MINIMUM_WINDOW_PACKETS * maxDatagramSize;
+        epochStarted = false;
+    }
+
+    /*Pacing rate in bytes per second.*/
+    double CubicCongestionControl::pacingRate(Clock::duration smoothedRTT) const
+    {
+        double rtt = std::chrono::duration<double>(smoothedRTT).count();
+        if (rtt <= 0)
+            return 0;
+
+        return (isInSlowStart() ? SLOW_START_PACING_GAIN : PACING_GAIN) * congestionWindow / rtt;
+    }
+
+    void CubicCongestionControl::refill(Clock::time_point now, Clock::duration smoothedRTT)
+    {
+        double burst = static_cast<double>(PACING_BURST_PACKETS * maxDatagramSize);
+
+        if (refilled) {
+            double elapsed = std::chrono::duration<double>(now - lastRefill).count();
+            double rate = pacingRate(smoothedRTT);
+            pacingBudget = rate > 0 ? (std::min)(burst, pacingBudget + elapsed * rate) : burst;
+        }
+
+        lastRefill = now;
+        refilled = true;
+    }
+
+    /*Can a datagram be sent now, or does the pacer want it delayed?
+    @param bytes The size of the datagram.
+    @param now The current time.*/
+    bool CubicCongestionControl::canSend(size_t bytes, Clock::time_point now, Clock::duration smoothedRTT)
+    {
+        refill(now, smoothedRTT);
+        return pacingBudget >= static_cast<double>(bytes);
+    }
+
+    /*Consumes pacing budget for a datagram that was sent.*/
+    void CubicCongestionControl::onPacketSent(size_t bytes)
+    {
+        pacingBudget -= static_cast<double>(bytes);
+    }
+
+    /*When the pacer will have budget for a datagram of the given size.*/
+    CubicCongestionControl::Clock::time_point CubicCongestionControl::nextSendTime(size_t bytes, Clock::time_point now,
+        Clock::duration smoothedRTT) const
+    {
+        double missing = static_cast<double>(bytes) - pacingBudget;
+        double rate = pacingRate(smoothedRTT);
+
+        if (missing <= 0 || rate <= 0)
+            return now;
+
+        return now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(missing / rate));
+    }
+}
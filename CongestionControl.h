@@ -0,0 +1,81 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+namespace Parlo
+{
+    /*CUBIC congestion control (RFC 8312) with a token bucket pacer.
+    The window is kept in bytes, the CUBIC function is evaluated in datagrams.*/
+    class CubicCongestionControl
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        /*@param maxDatagramSize The largest datagram that will be sent, I.E the MSS.*/
+        CubicCongestionControl(size_t maxDatagramSize);
+
+        /*The congestion window, in bytes.*/
+        size_t getCongestionWindow() const { return congestionWindow; }
+
+        bool isInSlowStart() const { return congestionWindow < slowStartThreshold; }
+
+        /*Bytes were acknowledged.
+        @param bytes The number of bytes acknowledged.
+        @param now The current time.
+        @param smoothedRTT The current smoothed RTT.*/
+        void onAck(size_t bytes, Clock::time_point now, Clock::duration smoothedRTT);
+
+        /*A packet was declared lost. Only the first loss per recovery period reduces the window.
+        @param sentTime When the lost packet was sent.
+        @param now The current time.*/
+        void onLoss(Clock::time_point sentTime, Clock::time_point now);
+
+        /*The retransmission timer fired. Collapses the window to its minimum.*/
+        void onRetransmissionTimeout(Clock::time_point now);
+
+        /*Can a datagram be sent now, or does the pacer want it delayed?
+        @param bytes The size of the datagram.
+        @param now The current time.*/
+        bool canSend(size_t bytes, Clock::time_point now, Clock::duration smoothedRTT);
+
+        /*Consumes pacing budget for a datagram that was sent.*/
+        void onPacketSent(size_t bytes);
+
+        /*When the pacer will have budget for a datagram of the given size.*/
+        Clock::time_point nextSendTime(size_t bytes, Clock::time_point now, Clock::duration smoothedRTT) const;
+
+    private:
+        size_t maxDatagramSize;
+        size_t congestionWindow;
+        size_t slowStartThreshold;
+
+        /*Window (in datagrams) before the last reduction.*/
+        double windowMax = 0;
+        /*Time at which the current congestion avoidance epoch started.*/
+        Clock::time_point epochStart;
+        bool epochStarted = false;
+        /*Packets sent before this point don't trigger another reduction.*/
+        Clock::time_point recoveryStart;
+
+        double pacingBudget;
+        Clock::time_point lastRefill;
+        bool refilled = false;
+
+        /*Pacing rate in bytes per second.*/
+        double pacingRate(Clock::duration smoothedRTT) const;
+        void refill(Clock::time_point now, Clock::duration smoothedRTT);
+    };
+}
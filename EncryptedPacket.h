@@ -12,17 +12,22 @@ Contributor(s): ______________________________________.
 
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <vector>
 #include <memory>
-#include "Packet.h"
+#include <stdexcept>
+#include <string>
+#include "Parlo.h"
 #include "EncryptionArgs.h"
+#include "Trace.h"
 #include <cryptopp/aes.h>
 #include <cryptopp/filters.h>
 #include <cryptopp/hex.h>
 #include <cryptopp/modes.h>
 #include <cryptopp/osrng.h>
 #include <cryptopp/pwdbased.h>
+#include <cryptopp/sha.h>
 #include <cryptopp/twofish.h>
 
 namespace Parlo
@@ -30,7 +35,7 @@ namespace Parlo
     /// <summary>
     /// Represents an encrypted packet.
     /// </summary>
-	class EncryptedPacket : Packet
+	class EncryptedPacket : public Packet
 	{
 	public: 
 
@@ -39,14 +44,12 @@ namespace Parlo
         /// </summary>
         /// <param name="args">The <see cref="EncryptionArgs"/> used for this packet's encryption.</param>
         /// <param name="id">The ID of the packet.</param>
-        /// <param name="serializedData">The serialized data to send.</param>
-		EncryptedPacket(EncryptionArgs *args, uint8_t id, const std::vector<uint8_t>& serializedData) : 
-            m_args(args), Packet(id, serializedData, false)
+        /// <param name="serializedData">The serialized data to send, or the encrypted data that was received.</param>
+		EncryptedPacket(std::shared_ptr<EncryptionArgs> args, uint8_t id, const std::vector<uint8_t>& serializedData) : 
+            Packet(id, serializedData, false), m_args(args)
 		{
 			if(args == nullptr)
 				throw std::invalid_argument("EncryptionArgs cannot be null!");
-			if(serializedData.empty())
-				throw std::invalid_argument("SerializedData cannot be null!");
 		};
 
         ~EncryptedPacket() {};
@@ -55,50 +58,51 @@ namespace Parlo
         /// Decrypts the serialized data of a packet.
         /// </summary>
         /// <returns>The serialied data as an array of bytes.</returns>
-        std::vector<uint8_t> decryptPacket() 
+        std::vector<uint8_t> decryptPacket() const
         {
+            PARLO_TRACE_SCOPE("EncryptedPacket::decrypt");
+
             if (m_args->Mode == EncryptionMode::AES)
-                return decryptAES(data, m_args->Key, m_args->Salt);
+                return decryptAES(getData(), m_args->Key, m_args->Salt);
             else if (m_args->Mode == EncryptionMode::Twofish) 
-                return decryptTwofish(data, m_args->Key, m_args->Salt);
+                return decryptTwofish(getData(), m_args->Key, m_args->Salt);
             else
                 throw std::runtime_error("Unsupported encryption mode");
         }
 
         /// <summary>
         /// Builds a encrypted packet ready for sending.
-        /// An encrypted packet has an extra byte after 
-        /// the length indicating that it is encrypted.
+        /// The header is the same as an unencrypted packet's, 
+        /// with the length covering the encrypted data, so 
+        /// ProcessingBuffer frames it like any other packet.
         /// </summary>
         /// <returns>The packet as an array of bytes.</returns>
-        std::vector<uint8_t> buildPacket() const override 
+        std::vector<uint8_t> buildPacket() const
         {
+            PARLO_TRACE_SCOPE("EncryptedPacket::encrypt");
+
             std::vector<uint8_t> encryptedData;
 
             if (m_args->Mode == EncryptionMode::AES)
-                encryptedData = encryptAES(data, m_args->Key, m_args->Salt);
+                encryptedData = encryptAES(getData(), m_args->Key, m_args->Salt);
             else if (m_args->Mode == EncryptionMode::Twofish)
-                encryptedData = encryptTwofish(data, m_args->Key, m_args->Salt);
+                encryptedData = encryptTwofish(getData(), m_args->Key, m_args->Salt);
             else
                 throw std::runtime_error("Unsupported encryption mode");
 
-            std::vector<uint8_t> packetData;
-            packetData.push_back(getID());
-            packetData.push_back(getIsCompressed());
-            packetData.insert(packetData.end(), encryptedData.begin(), encryptedData.end());
-            return packetData;
+            return Packet(getID(), encryptedData, getIsCompressed() != 0).buildPacket();
         }
 
     private:
         std::shared_ptr<EncryptionArgs> m_args;
 
-        std::vector<uint8_t> encryptAES(const std::vector<uint8_t>& data, const std::string& key, const std::string& salt) const
+        /*Derives a key and an IV for a block cipher from a password and salt.*/
+        template<typename Cipher>
+        static void deriveKeyAndIV(const std::string& key, const std::string& salt, 
+            CryptoPP::byte (&keyBytes)[Cipher::DEFAULT_KEYLENGTH], CryptoPP::byte (&ivBytes)[Cipher::BLOCKSIZE])
         {
-            CryptoPP::byte keyBytes[CryptoPP::AES::DEFAULT_KEYLENGTH], ivBytes[CryptoPP::AES::BLOCKSIZE];
-
-            //Deriving key and IV from password and salt
             CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA256> pbkdf;
-            CryptoPP::byte derivedBytes[CryptoPP::AES::DEFAULT_KEYLENGTH + CryptoPP::AES::BLOCKSIZE];
+            CryptoPP::byte derivedBytes[Cipher::DEFAULT_KEYLENGTH + Cipher::BLOCKSIZE];
             pbkdf.DeriveKey(
                 derivedBytes, sizeof(derivedBytes),
                 0, //Purpose byte (unused)
@@ -108,95 +112,55 @@ namespace Parlo
             );
 
             //Splitting the derived bytes into key and IV
-            std::copy(derivedBytes, derivedBytes + CryptoPP::AES::DEFAULT_KEYLENGTH, keyBytes);
-            std::copy(derivedBytes + CryptoPP::AES::DEFAULT_KEYLENGTH, derivedBytes + sizeof(derivedBytes), ivBytes);
-
-            //Setting up AES encryption
-            CryptoPP::AES::Encryption aesEncryption(keyBytes, sizeof(keyBytes));
-            CryptoPP::CBC_Mode_ExternalCipher::Encryption cbcEncryption(aesEncryption, ivBytes);
+            std::copy(derivedBytes, derivedBytes + Cipher::DEFAULT_KEYLENGTH, keyBytes);
+            std::copy(derivedBytes + Cipher::DEFAULT_KEYLENGTH, derivedBytes + sizeof(derivedBytes), ivBytes);
+        }
 
-            std::string cipher;
-            CryptoPP::StreamTransformationFilter stfEncryptor(cbcEncryption, new CryptoPP::StringSink(cipher));
-            stfEncryptor.Put(data.data(), data.size());
-            stfEncryptor.MessageEnd();
+        /*Runs data through a CBC encryption or decryption filter.*/
+        static std::vector<uint8_t> transform(CryptoPP::StreamTransformation& transformation, const std::vector<uint8_t>& data)
+        {
+            std::string output;
+            CryptoPP::StreamTransformationFilter filter(transformation, new CryptoPP::StringSink(output));
+            filter.Put(data.data(), data.size());
+            filter.MessageEnd();
 
-            std::vector<uint8_t> encryptedData(cipher.begin(), cipher.end());
-            return encryptedData;
+            return std::vector<uint8_t>(output.begin(), output.end());
         }
 
-        std::vector<uint8_t> decryptAES(const std::vector<uint8_t>& data, const std::string& key, const std::string& salt) 
+        static std::vector<uint8_t> encryptAES(const std::vector<uint8_t>& data, const std::string& key, const std::string& salt)
         {
             CryptoPP::byte keyBytes[CryptoPP::AES::DEFAULT_KEYLENGTH], ivBytes[CryptoPP::AES::BLOCKSIZE];
-            //Deriving key and IV from password and salt
-            CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA256> pbkdf;
-            CryptoPP::byte derivedBytes[CryptoPP::AES::DEFAULT_KEYLENGTH + CryptoPP::AES::BLOCKSIZE];
-            pbkdf.DeriveKey(
-                derivedBytes, sizeof(derivedBytes),
-                0, //Purpose byte (unused)
-                reinterpret_cast<const CryptoPP::byte*>(key.data()), key.size(),
-                reinterpret_cast<const CryptoPP::byte*>(salt.data()), salt.size(),
-                10000 //Iterations
-            );
+            deriveKeyAndIV<CryptoPP::AES>(key, salt, keyBytes, ivBytes);
 
-            CryptoPP::AES::Decryption aesDecryption(keyBytes, sizeof(keyBytes));
-            CryptoPP::CBC_Mode_ExternalCipher::Decryption cbcDecryption(aesDecryption, ivBytes);
+            CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption encryption(keyBytes, sizeof(keyBytes), ivBytes);
+            return transform(encryption, data);
+        }
 
-            std::string recovered;
-            CryptoPP::StreamTransformationFilter stfDecryptor(cbcDecryption, new CryptoPP::StringSink(recovered));
-            stfDecryptor.Put(data.data(), data.size());
-            stfDecryptor.MessageEnd();
+        static std::vector<uint8_t> decryptAES(const std::vector<uint8_t>& data, const std::string& key, const std::string& salt) 
+        {
+            CryptoPP::byte keyBytes[CryptoPP::AES::DEFAULT_KEYLENGTH], ivBytes[CryptoPP::AES::BLOCKSIZE];
+            deriveKeyAndIV<CryptoPP::AES>(key, salt, keyBytes, ivBytes);
 
-            return std::vector<uint8_t>(recovered.begin(), recovered.end());
+            CryptoPP::CBC_Mode<CryptoPP::AES>::Decryption decryption(keyBytes, sizeof(keyBytes), ivBytes);
+            return transform(decryption, data);
         }
 
-        std::vector<uint8_t> encryptTwofish(const std::vector<uint8_t>& data, const std::string& key, const std::string& salt) const 
+        static std::vector<uint8_t> encryptTwofish(const std::vector<uint8_t>& data, const std::string& key, const std::string& salt)
         {
             CryptoPP::byte keyBytes[CryptoPP::Twofish::DEFAULT_KEYLENGTH], ivBytes[CryptoPP::Twofish::BLOCKSIZE];
-            //Deriving key and IV from password and salt
-            CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA256> pbkdf;
-            CryptoPP::byte derivedBytes[CryptoPP::AES::DEFAULT_KEYLENGTH + CryptoPP::AES::BLOCKSIZE];
-            pbkdf.DeriveKey(
-                derivedBytes, sizeof(derivedBytes),
-                0, //Purpose byte (unused)
-                reinterpret_cast<const CryptoPP::byte*>(key.data()), key.size(),
-                reinterpret_cast<const CryptoPP::byte*>(salt.data()), salt.size(),
-                10000 //Iterations
-            );
-
-            CryptoPP::Twofish::Encryption twofishEncryption(keyBytes, sizeof(keyBytes));
-            CryptoPP::CBC_Mode_ExternalCipher::Encryption cbcEncryption(twofishEncryption, ivBytes);
+            deriveKeyAndIV<CryptoPP::Twofish>(key, salt, keyBytes, ivBytes);
 
-            std::string cipher;
-            CryptoPP::StreamTransformationFilter stfEncryptor(cbcEncryption, new CryptoPP::StringSink(cipher));
-            stfEncryptor.Put(data.data(), data.size());
-            stfEncryptor.MessageEnd();
-
-            return std::vector<uint8_t>(cipher.begin(), cipher.end());
+            CryptoPP::CBC_Mode<CryptoPP::Twofish>::Encryption encryption(keyBytes, sizeof(keyBytes), ivBytes);
+            return transform(encryption, data);
         }
 
-        std::vector<uint8_t> decryptTwofish(const std::vector<uint8_t>& data, const std::string& key, const std::string& salt) 
+        static std::vector<uint8_t> decryptTwofish(const std::vector<uint8_t>& data, const std::string& key, const std::string& salt) 
         {
             CryptoPP::byte keyBytes[CryptoPP::Twofish::DEFAULT_KEYLENGTH], ivBytes[CryptoPP::Twofish::BLOCKSIZE];
-            //Deriving key and IV from password and salt
-            CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA256> pbkdf;
-            CryptoPP::byte derivedBytes[CryptoPP::AES::DEFAULT_KEYLENGTH + CryptoPP::AES::BLOCKSIZE];
-            pbkdf.DeriveKey(
-                derivedBytes, sizeof(derivedBytes),
-                0, //Purpose byte (unused)
-                reinterpret_cast<const CryptoPP::byte*>(key.data()), key.size(),
-                reinterpret_cast<const CryptoPP::byte*>(salt.data()), salt.size(),
-                10000 //Iterations
-            );
-
-            CryptoPP::Twofish::Decryption twofishDecryption(keyBytes, sizeof(keyBytes));
-            CryptoPP::CBC_Mode_ExternalCipher::Decryption cbcDecryption(twofishDecryption, ivBytes);
-
-            std::string recovered;
-            CryptoPP::StreamTransformationFilter stfDecryptor(cbcDecryption, new CryptoPP::StringSink(recovered));
-            stfDecryptor.Put(data.data(), data.size());
-            stfDecryptor.MessageEnd();
+            deriveKeyAndIV<CryptoPP::Twofish>(key, salt, keyBytes, ivBytes);
 
-            return std::vector<uint8_t>(recovered.begin(), recovered.end());
+            CryptoPP::CBC_Mode<CryptoPP::Twofish>::Decryption decryption(keyBytes, sizeof(keyBytes), ivBytes);
+            return transform(decryption, data);
         }
 
         /// <summary>
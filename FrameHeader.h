@@ -0,0 +1,178 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include "PacketHeaders.h"
+
+namespace Parlo
+{
+    /*How the packets on a TCP connection are framed. Both ends must use the same format.*/
+    enum class HeaderFormat : uint8_t
+    {
+        /*[uint8_t ID][uint8_t compressed][uint16_t length, header included]. Always PacketHeaders::STANDARD bytes.*/
+        Legacy,
+        /*[uint8_t ID][uint8_t flags and length][varint length][uint8_t channel]. 2 bytes for payloads of up to 62 bytes,
+        and never more than PacketHeaders::STANDARD for a packet of up to MAX_PACKET_SIZE.*/
+        Compact
+    };
+
+    /*The header of a framed packet.*/
+    struct FrameHeader
+    {
+        uint8_t id = 0;
+        bool compressed = false;
+        /*0 unless the header carried a channel.*/
+        uint8_t channel = 0;
+        size_t headerSize = 0;
+        size_t payloadSize = 0;
+        /*Set if the header can't belong to any frame, I.E its length is encoded with more bytes than it needs or
+        doesn't fit in a size_t. There's no telling where the next frame starts after one.*/
+        bool malformed = false;
+    };
+
+    /*The second byte of a compact header holds these flags, and the payload's length in the remaining 6 bits.
+    A length of COMPACT_LENGTH_ESCAPE means the length is COMPACT_LENGTH_ESCAPE plus the LEB128 varint that follows.
+    The channel, if flagged, comes last.*/
+    const uint8_t COMPACT_COMPRESSED_FLAG = 0x80;
+    const uint8_t COMPACT_CHANNEL_FLAG = 0x40;
+    const uint8_t COMPACT_LENGTH_ESCAPE = 0x3F;
+
+    /*No size_t needs more than 10 varint bytes.*/
+    const size_t MAX_VARINT_SIZE = 10;
+    const size_t MAX_COMPACT_HEADER_SIZE = 2 + MAX_VARINT_SIZE + 1;
+
+    /*Writes a compact header.
+    @param out Where to write it, at least MAX_COMPACT_HEADER_SIZE bytes.
+    @param id The packet's ID.
+    @param compressed Whether the payload is compressed.
+    @param payloadSize The length of the payload.
+    @param channel The channel, or 0 to leave it out.
+    @return The length of the header.*/
+    inline size_t writeCompactHeader(uint8_t* out, uint8_t id, bool compressed, size_t payloadSize, uint8_t channel = 0) {
+        uint8_t flags = (compressed ? COMPACT_COMPRESSED_FLAG : 0) | (channel ? COMPACT_CHANNEL_FLAG : 0);
+        size_t size = 2;
+
+        out[0] = id;
+        if (payloadSize < COMPACT_LENGTH_ESCAPE)
+            out[1] = flags | static_cast<uint8_t>(payloadSize);
+        else {
+            out[1] = flags | COMPACT_LENGTH_ESCAPE;
+            size_t remainder = payloadSize - COMPACT_LENGTH_ESCAPE;
+            while (remainder >= 0x80) {
+                out[size++] = static_cast<uint8_t>(remainder | 0x80);
+                remainder >>= 7;
+            }
+            out[size++] = static_cast<uint8_t>(remainder);
+        }
+
+        if (channel)
+            out[size++] = channel;
+
+        return size;
+    }
+
+    /*Writes a legacy header, which has no room for a channel.
+    @param out Where to write it, at least PacketHeaders::STANDARD bytes.
+    @param id The packet's ID.
+    @param compressed Whether the payload is compressed.
+    @param payloadSize The length of the payload, at most 65531 bytes.
+    @return The length of the header.*/
+    inline size_t writeLegacyHeader(uint8_t* out, uint8_t id, bool compressed, size_t payloadSize) {
+        size_t length = PacketHeaders::STANDARD + payloadSize;
+
+        out[0] = id;
+        out[1] = compressed ? 1 : 0;
+        out[2] = static_cast<uint8_t>(length);
+        out[3] = static_cast<uint8_t>(length >> 8);
+        return PacketHeaders::STANDARD;
+    }
+
+    /*Reads a compact header. Small packets take a single branch; only escaped lengths loop.
+    @param bytes The bytes the header starts at. Anything with operator[], I.E a pointer or a std::deque.
+    @param available How many bytes there are.
+    @param header Set to the header.
+    @return False if the header isn't complete yet. A header that can't belong to any frame is complete as soon as
+    that's clear, and has malformed set.*/
+    template <typename Bytes>
+    bool readCompactHeader(const Bytes& bytes, size_t available, FrameHeader& header) {
+        if (available < 2)
+            return false;
+
+        uint8_t flags = bytes[1];
+        size_t payloadSize = flags & COMPACT_LENGTH_ESCAPE;
+        size_t size = 2;
+        bool malformed = false;
+
+        if (payloadSize == COMPACT_LENGTH_ESCAPE) {
+            uint64_t remainder = 0;
+            for (unsigned shift = 0;; shift += 7) {
+                if (size >= available)
+                    return false;
+
+                uint8_t byte = bytes[size++];
+
+                //The tenth byte can only hold the 64th bit, and writeCompactHeader() never ends on a zero byte.
+                if ((shift == 63 && byte > 1) || (byte == 0 && shift > 0)) {
+                    malformed = true;
+                    break;
+                }
+
+                remainder |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                if (!(byte & 0x80))
+                    break;
+            }
+
+            //The header's own length is added to this, so it has to fit too.
+            if (remainder > std::numeric_limits<size_t>::max() - COMPACT_LENGTH_ESCAPE - MAX_COMPACT_HEADER_SIZE)
+                malformed = true;
+            else
+                payloadSize += static_cast<size_t>(remainder);
+        }
+
+        size_t hasChannel = (flags & COMPACT_CHANNEL_FLAG) >> 6;
+        if (!malformed && available < size + hasChannel)
+            return false;
+
+        header.id = bytes[0];
+        header.compressed = (flags & COMPACT_COMPRESSED_FLAG) != 0;
+        header.channel = hasChannel && !malformed ? bytes[size] : 0;
+        header.headerSize = size + (malformed ? 0 : hasChannel);
+        header.payloadSize = malformed ? 0 : payloadSize;
+        header.malformed = malformed;
+        return true;
+    }
+
+    /*Reads a legacy header. A length shorter than the header itself means an empty payload.
+    @param bytes The bytes the header starts at. Anything with operator[], I.E a pointer or a std::deque.
+    @param available How many bytes there are.
+    @param header Set to the header.
+    @return False if the header isn't complete yet.*/
+    template <typename Bytes>
+    bool readLegacyHeader(const Bytes& bytes, size_t available, FrameHeader& header) {
+        if (available < PacketHeaders::STANDARD)
+            return false;
+
+        size_t length = static_cast<size_t>(bytes[3]) << 8 | bytes[2];
+
+        header.id = bytes[0];
+        header.compressed = bytes[1] != 0;
+        header.channel = 0;
+        header.headerSize = PacketHeaders::STANDARD;
+        header.payloadSize = length > PacketHeaders::STANDARD ? length - PacketHeaders::STANDARD : 0;
+        header.malformed = false;
+        return true;
+    }
+}
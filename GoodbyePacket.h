@@ -15,6 +15,7 @@ Contributor(s): ______________________________________.
 #include <chrono>
 #include <vector>
 #include <stdexcept>
+#include "Parlo.h"
 
 /*Number of seconds for server or client to disconnect by default.*/
 enum ParloDefaultTimeouts : int
@@ -35,12 +36,12 @@ class GoodbyePacket
 {
 public:
     GoodbyePacket() : timeout(0) {} //Default constructor
-    GoodbyePacket(int timeoutSeconds);
+    PARLO_API GoodbyePacket(int timeoutSeconds);
     ~GoodbyePacket() {};
 
     //Convert to and from byte array
-    std::vector<uint8_t> toByteArray() const;
-    static GoodbyePacket fromByteArray(const std::vector<uint8_t>& arrBytes);
+    PARLO_API std::vector<uint8_t> toByteArray() const;
+    PARLO_API static GoodbyePacket fromByteArray(const std::vector<uint8_t>& arrBytes);
 
     //Getters
     std::chrono::seconds getTimeOut() const;
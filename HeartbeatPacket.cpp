@@ -17,14 +17,18 @@ Contributor(s): ______________________________________.
 
 namespace Parlo
 {
+    /*Size of a serialized HeartbeatPacket: four 64 bit fields and a flags byte.*/
+    const size_t HEARTBEAT_SIZE = sizeof(int64_t) * 4 + 1;
+
+    /*Flag set in a heartbeat that should be echoed back.*/
+    const uint8_t HEARTBEAT_REQUESTS_ECHO = 0x01;
+
     /*Constructs a new HeartbeatPacket.
-    @param id The packet's id.
-    @param serializedData The packet's data.
-    @param isPacketCompressed Is the packet compressed?*/
+    @param tSinceLast The elapsed time since the last Heartbeat packet was sent.*/
     HeartbeatPacket::HeartbeatPacket(std::chrono::milliseconds tSinceLast)
     {
         timeSinceLast = tSinceLast;
-        sentTimestamp = std::chrono::system_clock::now();
+        sentTimestamp = now();
     }
 
     /*The timestamp for the elapsed time since the last Heartbeat packet was sent.*/
@@ -33,46 +37,83 @@ namespace Parlo
         return timeSinceLast;
     }
 
-    /*The timestamp for when this Heartbeat packet was sent.*/
-    std::chrono::system_clock::time_point HeartbeatPacket::getSentTimestamp() const
+    /*The sender's steady_clock timestamp for when this Heartbeat packet was sent.*/
+    std::chrono::microseconds HeartbeatPacket::getSentTimestamp() const
     {
         return sentTimestamp;
     }
 
+    bool HeartbeatPacket::getRequestsEcho() const
+    {
+        return requestsEcho;
+    }
+
+    void HeartbeatPacket::setRequestsEcho(bool requests)
+    {
+        requestsEcho = requests;
+    }
+
+    /*Echoes a received heartbeat.
+    @param timestamp The received heartbeat's sent timestamp.
+    @param delay How long the received heartbeat was held before this one was sent.*/
+    void HeartbeatPacket::setEcho(std::chrono::microseconds timestamp, std::chrono::microseconds delay)
+    {
+        echoTimestamp = timestamp;
+        echoDelay = delay;
+        requestsEcho = false;
+    }
+
+    /*Is this heartbeat an echo of one we sent?*/
+    bool HeartbeatPacket::hasEcho() const
+    {
+        return echoTimestamp.count() != 0;
+    }
+
+    std::chrono::microseconds HeartbeatPacket::getEchoTimestamp() const
+    {
+        return echoTimestamp;
+    }
+
+    std::chrono::microseconds HeartbeatPacket::getEchoDelay() const
+    {
+        return echoDelay;
+    }
+
+    /*The current steady_clock timestamp, as used for sent and echo timestamps.*/
+    std::chrono::microseconds HeartbeatPacket::now()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch());
+    }
+
     /*Serializes a HeartbeatPacket instance into a byte array.
     @returns A byte array.*/
     std::shared_ptr<std::vector<uint8_t>> HeartbeatPacket::toByteArray() const
     {
-        auto bytes = std::make_shared<std::vector<uint8_t>>(sizeof(int64_t) * 2);
-        int64_t timeSinceLastCount = timeSinceLast.count();
-        auto sentTimestampCount = std::chrono::duration_cast<std::chrono::milliseconds>(sentTimestamp.time_since_epoch()).count();
+        auto bytes = std::make_shared<std::vector<uint8_t>>(HEARTBEAT_SIZE);
+        int64_t fields[4] = { timeSinceLast.count(), sentTimestamp.count(), echoTimestamp.count(), echoDelay.count() };
 
-        std::memcpy(bytes->data(), &timeSinceLastCount, sizeof(timeSinceLastCount));
-        std::memcpy(bytes->data() + sizeof(timeSinceLastCount), &sentTimestampCount, sizeof(sentTimestampCount));
+        std::memcpy(bytes->data(), fields, sizeof(fields));
+        (*bytes)[sizeof(fields)] = requestsEcho ? HEARTBEAT_REQUESTS_ECHO : 0;
 
         return bytes;
     }
 
     /*Deserializes a byte array into a HeartbeatPacket instance.
-    @param arrBytes The byte array to deserialize.*/
+    @param arrBytes The byte array to deserialize, I.E a heartbeat packet's data.*/
     HeartbeatPacket HeartbeatPacket::byteArrayToObject(const std::shared_ptr<std::vector<uint8_t>>& arrBytes, bool isPacketCompressed)
     {
-        if (arrBytes->size() < sizeof(int64_t) * 2 + 1) { // +1 for the id byte
+        if (arrBytes->size() < HEARTBEAT_SIZE) {
             throw std::runtime_error("HeartbeatPacket::byteArrayToObject(): Invalid byte array size for HeartbeatPacket.");
         }
 
-        int64_t timeSinceLastCount;
-        int64_t sentTimestampCount;
-
-        std::memcpy(&timeSinceLastCount, arrBytes->data() + 1, sizeof(timeSinceLastCount)); // +1 to skip the id byte
-        std::memcpy(&sentTimestampCount, arrBytes->data() + 1 + sizeof(timeSinceLastCount), sizeof(sentTimestampCount));
-
-        auto timeSinceLast = std::chrono::milliseconds(timeSinceLastCount);
-        auto sentTimestamp = std::chrono::system_clock::time_point(std::chrono::milliseconds(sentTimestampCount));
+        int64_t fields[4];
+        std::memcpy(fields, arrBytes->data(), sizeof(fields));
 
-        std::vector<uint8_t> serializedData(arrBytes->begin(), arrBytes->end());
-        HeartbeatPacket packet(timeSinceLast);
-        packet.sentTimestamp = sentTimestamp;
+        HeartbeatPacket packet{ std::chrono::milliseconds(fields[0]) };
+        packet.sentTimestamp = std::chrono::microseconds(fields[1]);
+        packet.echoTimestamp = std::chrono::microseconds(fields[2]);
+        packet.echoDelay = std::chrono::microseconds(fields[3]);
+        packet.requestsEcho = ((*arrBytes)[sizeof(fields)] & HEARTBEAT_REQUESTS_ECHO) != 0;
         return packet;
     }
 }
\ No newline at end of file
@@ -16,23 +16,47 @@ Contributor(s): ______________________________________.
 #include <vector>
 #include <cstdint>
 #include <memory>
+#include "Parlo.h"
 
 namespace Parlo
 {
+    /*Heartbeats double as RTT probes. A heartbeat carries the sender's steady_clock timestamp, and
+    the receiver echoes that timestamp back along with how long it held on to it, so the sender can
+    measure the round trip time on its own clock. Clocks are never compared across machines.*/
     class HeartbeatPacket {
     public:
-        HeartbeatPacket(std::chrono::milliseconds tSinceLast);
+        PARLO_API HeartbeatPacket(std::chrono::milliseconds tSinceLast);
 
         /*The timestamp for the elapsed time since the last Heartbeat packet was sent.*/
         std::chrono::milliseconds getTimeSinceLast() const;
-        /*The timestamp for when this Heartbeat packet was sent.*/
-        std::chrono::system_clock::time_point getSentTimestamp() const;
+        /*The sender's steady_clock timestamp for when this Heartbeat packet was sent.
+        Only meaningful to the sender; the receiver should just echo it back.*/
+        std::chrono::microseconds getSentTimestamp() const;
 
-        std::shared_ptr<std::vector<uint8_t>> toByteArray() const;
-        static HeartbeatPacket byteArrayToObject(const std::shared_ptr<std::vector<uint8_t>>& arrBytes, bool isPacketCompressed = false);
+        /*Does the sender want this heartbeat echoed back? Echoes never ask for an echo themselves.*/
+        bool getRequestsEcho() const;
+        void setRequestsEcho(bool requestsEcho);
+
+        /*Echoes a received heartbeat.
+        @param timestamp The received heartbeat's sent timestamp.
+        @param delay How long the received heartbeat was held before this one was sent.*/
+        void setEcho(std::chrono::microseconds timestamp, std::chrono::microseconds delay);
+        /*Is this heartbeat an echo of one we sent?*/
+        bool hasEcho() const;
+        std::chrono::microseconds getEchoTimestamp() const;
+        std::chrono::microseconds getEchoDelay() const;
+
+        /*The current steady_clock timestamp, as used for sent and echo timestamps.*/
+        static std::chrono::microseconds now();
+
+        PARLO_API std::shared_ptr<std::vector<uint8_t>> toByteArray() const;
+        PARLO_API static HeartbeatPacket byteArrayToObject(const std::shared_ptr<std::vector<uint8_t>>& arrBytes, bool isPacketCompressed = false);
 
     private:
         std::chrono::milliseconds timeSinceLast;
-        std::chrono::system_clock::time_point sentTimestamp;
+        std::chrono::microseconds sentTimestamp;
+        std::chrono::microseconds echoTimestamp{ 0 };
+        std::chrono::microseconds echoDelay{ 0 };
+        bool requestsEcho = true;
     };
 }
\ No newline at end of file
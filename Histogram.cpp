@@ -0,0 +1,103 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include "pch.h"
+#include "Histogram.h"
+#include <algorithm>
+
+namespace Parlo
+{
+    /*The highest value a bucket holds.*/
+    uint64_t LatencyHistogram::bucketUpperBound(size_t index)
+    {
+        if (index < static_cast<size_t>(HISTOGRAM_SUB_BUCKETS) * 2)
+            return index;
+
+        int shift = static_cast<int>(index / HISTOGRAM_SUB_BUCKETS) - 1;
+        uint64_t subBucket = index % HISTOGRAM_SUB_BUCKETS;
+        uint64_t lowest = (HISTOGRAM_SUB_BUCKETS + subBucket) << shift;
+
+        return lowest + (uint64_t(1) << shift) - 1;
+    }
+
+    /*Percentiles are computed from the buckets, so they're the highest value each bucket can hold.*/
+    LatencySnapshot LatencyHistogram::snapshot() const
+    {
+        LatencySnapshot snapshot;
+        std::array<uint64_t, HISTOGRAM_BUCKET_COUNT> counts;
+        uint64_t total = 0;
+
+        for (size_t i = 0; i < HISTOGRAM_BUCKET_COUNT; i++) {
+            counts[i] = buckets[i].load(std::memory_order_relaxed);
+            total += counts[i];
+        }
+
+        if (total == 0)
+            return snapshot;
+
+        uint64_t maxValue = max.load(std::memory_order_relaxed);
+
+        snapshot.count = total;
+        snapshot.min = std::chrono::nanoseconds(min.load(std::memory_order_relaxed));
+        snapshot.max = std::chrono::nanoseconds(maxValue);
+        snapshot.mean = std::chrono::nanoseconds(sum.load(std::memory_order_relaxed) / (std::max)(count.load(std::memory_order_relaxed), uint64_t(1)));
+
+        const double percentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+        std::chrono::nanoseconds* results[] = { &snapshot.p50, &snapshot.p90, &snapshot.p99, &snapshot.p999 };
+
+        size_t bucket = 0;
+        uint64_t seen = 0;
+
+        for (int i = 0; i < 4; i++) {
+            //The rank of the percentile, rounded up so p50 of two values is the lower one.
+            uint64_t rank = (std::max)(uint64_t(1), static_cast<uint64_t>(percentiles[i] * static_cast<double>(total) + 0.999999));
+
+            while (bucket < HISTOGRAM_BUCKET_COUNT && seen + counts[bucket] < rank)
+                seen += counts[bucket++];
+
+            uint64_t value = bucket < HISTOGRAM_BUCKET_COUNT ? bucketUpperBound(bucket) : maxValue;
+            *results[i] = std::chrono::nanoseconds((std::min)(value, maxValue));
+        }
+
+        return snapshot;
+    }
+
+    /*Clears the histogram. Values recorded concurrently may be partially lost.*/
+    void LatencyHistogram::reset()
+    {
+        for (auto& bucket : buckets)
+            bucket.store(0, std::memory_order_relaxed);
+
+        count.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        min.store(UINT64_MAX, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+
+    /*The process wide rollup that every connection also records into.*/
+    LatencyHistograms& LatencyHistograms::global()
+    {
+        static LatencyHistograms histograms;
+        return histograms;
+    }
+
+    /*Latency histograms for all connections in this process.*/
+    LatencyMetrics getGlobalLatencyMetrics()
+    {
+        return LatencyHistograms::global().snapshot();
+    }
+
+    void resetGlobalLatencyMetrics()
+    {
+        LatencyHistograms::global().reset();
+    }
+}
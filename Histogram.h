@@ -0,0 +1,123 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "Parlo.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace Parlo
+{
+    /*Each power of two is split into 2^HISTOGRAM_SUB_BUCKET_BITS buckets, so recorded values
+    are within 1 / 2^HISTOGRAM_SUB_BUCKET_BITS (6.25%) of the true value.*/
+    const int HISTOGRAM_SUB_BUCKET_BITS = 4;
+    const int HISTOGRAM_SUB_BUCKETS = 1 << HISTOGRAM_SUB_BUCKET_BITS;
+
+    /*The highest power of two that is tracked. 2^45 nanoseconds is almost ten hours; larger values
+    are clamped into the last bucket.*/
+    const int HISTOGRAM_MAX_EXPONENT = 45;
+
+    const size_t HISTOGRAM_BUCKET_COUNT = (HISTOGRAM_MAX_EXPONENT - HISTOGRAM_SUB_BUCKET_BITS + 2) * HISTOGRAM_SUB_BUCKETS;
+
+    /*A log bucketed latency histogram in the style of HdrHistogram. Values below 2^(SUB_BUCKET_BITS + 1)
+    get a bucket each, after which every power of two is split into HISTOGRAM_SUB_BUCKETS buckets.
+    Recording is a handful of relaxed atomic operations and never blocks, so it's safe on hot paths.*/
+    class LatencyHistogram
+    {
+    public:
+        void record(std::chrono::nanoseconds latency) {
+            uint64_t value = latency.count() > 0 ? static_cast<uint64_t>(latency.count()) : 0;
+
+            buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+            count.fetch_add(1, std::memory_order_relaxed);
+            sum.fetch_add(value, std::memory_order_relaxed);
+
+            uint64_t currentMax = max.load(std::memory_order_relaxed);
+            while (value > currentMax && !max.compare_exchange_weak(currentMax, value, std::memory_order_relaxed)) {}
+
+            uint64_t currentMin = min.load(std::memory_order_relaxed);
+            while (value < currentMin && !min.compare_exchange_weak(currentMin, value, std::memory_order_relaxed)) {}
+        }
+
+        /*Percentiles are computed from the buckets, so they're the highest value each bucket can hold.
+        Not a consistent snapshot if other threads are recording.*/
+        PARLO_API LatencySnapshot snapshot() const;
+
+        /*Clears the histogram. Values recorded concurrently may be partially lost.*/
+        PARLO_API void reset();
+
+        /*The bucket a value falls into.*/
+        static size_t bucketIndex(uint64_t value) {
+            int exponent = highestBit(value | 1);
+
+            if (exponent <= HISTOGRAM_SUB_BUCKET_BITS)
+                return static_cast<size_t>(value);
+
+            if (exponent > HISTOGRAM_MAX_EXPONENT)
+                return HISTOGRAM_BUCKET_COUNT - 1;
+
+            int shift = exponent - HISTOGRAM_SUB_BUCKET_BITS;
+            size_t subBucket = static_cast<size_t>((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+
+            return static_cast<size_t>(shift + 1) * HISTOGRAM_SUB_BUCKETS + subBucket;
+        }
+
+        /*The highest value a bucket holds.*/
+        PARLO_API static uint64_t bucketUpperBound(size_t index);
+
+    private:
+        std::array<std::atomic<uint64_t>, HISTOGRAM_BUCKET_COUNT> buckets{};
+        std::atomic<uint64_t> count{ 0 };
+        std::atomic<uint64_t> sum{ 0 };
+        std::atomic<uint64_t> min{ UINT64_MAX };
+        std::atomic<uint64_t> max{ 0 };
+
+        /*The index of the highest set bit. value must not be zero.*/
+        static int highestBit(uint64_t value) {
+#ifdef _MSC_VER
+            unsigned long index;
+            _BitScanReverse64(&index, value);
+            return static_cast<int>(index);
+#else
+            return 63 - __builtin_clzll(value);
+#endif
+        }
+    };
+
+    /*The latency histograms kept for a connection.*/
+    struct LatencyHistograms
+    {
+        /*From sendAsync() until the write completed.*/
+        LatencyHistogram sendLatency;
+        /*From the socket read that completed a packet until onReceivedDataHandler is invoked.*/
+        LatencyHistogram receiveLatency;
+
+        LatencyMetrics snapshot() const {
+            return { sendLatency.snapshot(), receiveLatency.snapshot() };
+        }
+
+        void reset() {
+            sendLatency.reset();
+            receiveLatency.reset();
+        }
+
+        /*The process wide rollup that every connection also records into.*/
+        PARLO_API static LatencyHistograms& global();
+    };
+}
@@ -0,0 +1,73 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include "pch.h"
+#include "IOBackend.h"
+#include <asio.hpp>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+namespace Parlo
+{
+    IOBackend getIOBackend() {
+#if defined(ASIO_HAS_IOCP)
+        return IOBackend::IOCP;
+#elif defined(ASIO_HAS_IO_URING_AS_DEFAULT)
+        return IOBackend::IOUring;
+#elif defined(ASIO_HAS_EPOLL)
+        return IOBackend::Epoll;
+#elif defined(ASIO_HAS_KQUEUE)
+        return IOBackend::Kqueue;
+#elif defined(ASIO_HAS_DEV_POLL)
+        return IOBackend::DevPoll;
+#else
+        return IOBackend::Select;
+#endif
+    }
+
+    const char* getIOBackendName(IOBackend backend) {
+        switch (backend) {
+        case IOBackend::Epoll:
+            return "epoll";
+        case IOBackend::IOUring:
+            return "io_uring";
+        case IOBackend::Kqueue:
+            return "kqueue";
+        case IOBackend::DevPoll:
+            return "/dev/poll";
+        case IOBackend::IOCP:
+            return "iocp";
+        default:
+            return "select";
+        }
+    }
+
+    bool isIOUringAvailable() {
+#if defined(__linux__) && defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+        io_uring_params params = {};
+        long fd = syscall(__NR_io_uring_setup, 1, &params);
+        if (fd < 0)
+            return false;
+
+        close(static_cast<int>(fd));
+        return true;
+#else
+        return false;
+#endif
+    }
+}
@@ -0,0 +1,41 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#pragma once
+
+#include "Parlo.h"
+
+namespace Parlo
+{
+    /*The mechanism asio drives sockets with.*/
+    enum class IOBackend
+    {
+        Select,
+        Epoll,
+        /*Linux only, when built with PARLO_IO_URING. Reads and writes are submitted to the kernel in batches.*/
+        IOUring,
+        Kqueue,
+        DevPoll,
+        IOCP
+    };
+
+    /*The backend this build of Parlo drives sockets with. asio picks its backend at compile time,
+    so switching between epoll and io_uring means building with or without PARLO_IO_URING.*/
+    PARLO_API IOBackend getIOBackend();
+
+    PARLO_API const char* getIOBackendName(IOBackend backend);
+
+    /*Can this kernel set up an io_uring? False on kernels older than 5.1, where io_uring has been
+    disabled through sysctl or seccomp, and on other platforms. A build using io_uring can't run
+    without it, so check this before creating an io_context and fall back to an epoll build if needed.*/
+    PARLO_API bool isIOUringAvailable();
+}
@@ -0,0 +1,212 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include "pch.h"
+#include "LinkShaper.h"
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <mutex>
+#include <random>
+
+namespace Parlo
+{
+    class LinkShaper::Impl : public std::enable_shared_from_this<LinkShaper::Impl>
+    {
+    public:
+        Impl(asio::io_context& context, const LinkConditions& conditions) :
+            conditions(conditions), context(context), random(std::random_device{}()), streamTimer(context) {}
+
+        void submit(std::vector<uint8_t> data, bool stream, DeliverFunction deliver);
+
+        mutable std::mutex mutex;
+        LinkConditions conditions;
+        LinkShaperStats stats;
+
+    private:
+        /*Stream data waiting to be delivered, in order.*/
+        struct Delivery
+        {
+            std::chrono::steady_clock::time_point due;
+            std::vector<uint8_t> data;
+            DeliverFunction deliver;
+        };
+
+        asio::io_context& context;
+        std::mt19937_64 random;
+
+        /*When the link is done serializing everything submitted so far.*/
+        std::chrono::steady_clock::time_point linkFreeAt;
+
+        std::deque<Delivery> streamQueue;
+        std::chrono::steady_clock::time_point lastStreamDue;
+        asio::steady_timer streamTimer;
+        /*Set while streamTimer is armed, or its handler is delivering. Only one delivery runs at a
+        time, so stream data stays in order even if the io_context is run by several threads.*/
+        bool streamPending = false;
+
+        /*Works out when data submitted now arrives. Called with the mutex held.*/
+        std::chrono::steady_clock::time_point schedule(size_t bytes);
+
+        /*Returns true with a probability. Called with the mutex held.*/
+        bool chance(double probability);
+
+        /*Arms streamTimer for the first delivery in streamQueue. Called with the mutex held.*/
+        void armStreamTimer();
+
+        void deliverStream();
+    };
+
+    std::chrono::steady_clock::time_point LinkShaper::Impl::schedule(size_t bytes) {
+        auto now = std::chrono::steady_clock::now();
+        auto departure = now;
+
+        if (conditions.bandwidth > 0) {
+            linkFreeAt = (std::max)(linkFreeAt, now) +
+                std::chrono::nanoseconds(static_cast<int64_t>(bytes * 1000000000ull / conditions.bandwidth));
+            departure = linkFreeAt;
+        }
+
+        std::chrono::microseconds delay = conditions.latency;
+
+        if (conditions.jitter.count() > 0) {
+            std::uniform_int_distribution<int64_t> distribution(-conditions.jitter.count(), conditions.jitter.count());
+            delay = (std::max)(std::chrono::microseconds(0), delay + std::chrono::microseconds(distribution(random)));
+        }
+
+        return departure + delay;
+    }
+
+    bool LinkShaper::Impl::chance(double probability) {
+        if (probability <= 0.0)
+            return false;
+
+        return std::uniform_real_distribution<double>(0.0, 1.0)(random) < probability;
+    }
+
+    void LinkShaper::Impl::submit(std::vector<uint8_t> data, bool stream, DeliverFunction deliver) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        stats.submitted++;
+        stats.bytes += data.size();
+
+        if (!stream) {
+            if (chance(conditions.lossRate)) {
+                stats.dropped++;
+                return;
+            }
+
+            auto due = schedule(data.size());
+
+            if (chance(conditions.reorderRate)) {
+                due += conditions.reorderDelay;
+                stats.reordered++;
+            }
+
+            auto timer = std::make_shared<asio::steady_timer>(context, due);
+            timer->async_wait([self = shared_from_this(), timer, data = std::move(data), deliver = std::move(deliver)](const std::error_code& ec) mutable {
+                if (ec)
+                    return;
+
+                {
+                    std::lock_guard<std::mutex> lock(self->mutex);
+                    self->stats.delivered++;
+                }
+
+                deliver(std::move(data));
+            });
+
+            return;
+        }
+
+        auto due = schedule(data.size());
+
+        //A lost segment is resent, and nothing behind it can be delivered until it has been.
+        if (conditions.retransmitDelay.count() > 0) {
+            size_t segments = (data.size() + LINK_SEGMENT_SIZE - 1) / LINK_SEGMENT_SIZE;
+            if (chance(1.0 - std::pow(1.0 - conditions.lossRate, static_cast<double>(segments)))) {
+                due += conditions.retransmitDelay;
+                stats.retransmitted++;
+            }
+        }
+
+        //Jitter may not reorder a stream, so nothing is due before whatever was submitted earlier.
+        due = (std::max)(due, lastStreamDue);
+
+        lastStreamDue = due;
+        streamQueue.push_back({ due, std::move(data), std::move(deliver) });
+
+        if (!streamPending) {
+            streamPending = true;
+            armStreamTimer();
+        }
+    }
+
+    void LinkShaper::Impl::armStreamTimer() {
+        streamTimer.expires_at(streamQueue.front().due);
+        streamTimer.async_wait([self = shared_from_this()](const std::error_code& ec) {
+            if (!ec)
+                self->deliverStream();
+        });
+    }
+
+    void LinkShaper::Impl::deliverStream() {
+        std::vector<Delivery> due;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto now = std::chrono::steady_clock::now();
+
+            while (!streamQueue.empty() && streamQueue.front().due <= now) {
+                due.push_back(std::move(streamQueue.front()));
+                streamQueue.pop_front();
+            }
+
+            stats.delivered += due.size();
+        }
+
+        for (auto& delivery : due)
+            delivery.deliver(std::move(delivery.data));
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (!streamQueue.empty())
+            armStreamTimer();
+        else
+            streamPending = false;
+    }
+
+    LinkShaper::LinkShaper(asio::io_context& context, const LinkConditions& conditions) :
+        pImpl(std::make_shared<Impl>(context, conditions)) {}
+
+    //Pending deliveries hold on to the Impl, so they still arrive.
+    LinkShaper::~LinkShaper() = default;
+
+    void LinkShaper::setConditions(const LinkConditions& conditions) {
+        std::lock_guard<std::mutex> lock(pImpl->mutex);
+        pImpl->conditions = conditions;
+    }
+
+    LinkConditions LinkShaper::getConditions() const {
+        std::lock_guard<std::mutex> lock(pImpl->mutex);
+        return pImpl->conditions;
+    }
+
+    void LinkShaper::submit(std::vector<uint8_t> data, bool stream, DeliverFunction deliver) {
+        pImpl->submit(std::move(data), stream, std::move(deliver));
+    }
+
+    LinkShaperStats LinkShaper::getStats() const {
+        std::lock_guard<std::mutex> lock(pImpl->mutex);
+        return pImpl->stats;
+    }
+}
@@ -0,0 +1,99 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#pragma once
+
+#include <asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "Parlo.h"
+
+namespace Parlo
+{
+    /*The size of the segments stream data is lost in, I.E a TCP segment on an Ethernet link.*/
+    const size_t LINK_SEGMENT_SIZE = 1448;
+
+    /*The conditions of an emulated link.*/
+    struct LinkConditions
+    {
+        /*One way delay added to everything sent over the link.*/
+        std::chrono::microseconds latency{ 0 };
+        /*The delay varies uniformly by up to this much either way. Streams are never reordered by jitter.*/
+        std::chrono::microseconds jitter{ 0 };
+        /*The link's capacity in bytes per second, or 0 for unlimited. Data queues up behind whatever
+        is still being serialized, like it would at a bottleneck.*/
+        uint64_t bandwidth = 0;
+        /*The fraction of datagrams lost, from 0 to 1. Streams are only lost if retransmitDelay is set.*/
+        double lossRate = 0.0;
+        /*How long a stream takes to resend a lost segment, I.E TCP's retransmission timeout, or 0 if streams
+        are never lost. Each LINK_SEGMENT_SIZE of stream data is then lost with lossRate, and data that has
+        a segment lost arrives this much later, holding up everything behind it.*/
+        std::chrono::microseconds retransmitDelay{ 0 };
+        /*The fraction of datagrams held back by reorderDelay, so datagrams sent after them arrive first.*/
+        double reorderRate = 0.0;
+        std::chrono::microseconds reorderDelay{ 1000 };
+    };
+
+    /*Statistics from a LinkShaper.*/
+    struct LinkShaperStats
+    {
+        uint64_t submitted = 0;
+        uint64_t delivered = 0;
+        uint64_t dropped = 0;
+        uint64_t reordered = 0;
+        /*Stream data that had a segment lost, and was delivered late.*/
+        uint64_t retransmitted = 0;
+        uint64_t bytes = 0;
+    };
+
+    /*Emulates a slow, lossy link in process, so RTT based compression, heartbeats and congestion
+    handling can be exercised on loopback. A shaper sits on the receive path of the NetworkClients
+    and UDPNetworkClients it's set on: data read from the socket is held back until the link would
+    have delivered it. Shape both ends to get a round trip of twice the latency. Connections that
+    share a shaper share its bandwidth, like connections behind the same bottleneck.
+    Deliveries are made on the io_context's thread(s). Thread safe.*/
+    class LinkShaper
+    {
+    public:
+        using DeliverFunction = std::function<void(std::vector<uint8_t>)>;
+
+        /*Creates a LinkShaper.
+        @param context The io_context to schedule deliveries on.
+        @param conditions The conditions to emulate.*/
+        PARLO_API LinkShaper(asio::io_context& context, const LinkConditions& conditions = LinkConditions());
+        /*Anything still in flight is delivered as scheduled.*/
+        PARLO_API ~LinkShaper();
+
+        LinkShaper(const LinkShaper&) = delete;
+        LinkShaper& operator=(const LinkShaper&) = delete;
+
+        /*Changes the conditions. Applies to data submitted from now on.*/
+        PARLO_API void setConditions(const LinkConditions& conditions);
+        PARLO_API LinkConditions getConditions() const;
+
+        /*Sends data over the link.
+        @param data The data.
+        @param stream True for stream data (TCP), which is delivered in order, and late rather than lost.
+        False for datagrams, which are subject to loss and reordering.
+        @param deliver Called with the data when it arrives.*/
+        PARLO_API void submit(std::vector<uint8_t> data, bool stream, DeliverFunction deliver);
+
+        PARLO_API LinkShaperStats getStats() const;
+
+    private:
+        class Impl;
+        std::shared_ptr<Impl> pImpl;
+    };
+}
@@ -15,15 +15,22 @@ Contributor(s): ______________________________________.
 #include "Parlo.h"
 #include "Logger.h"
 #include "Socket.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Capture.h"
+#include "LinkShaper.h"
+#include "Capabilities.h"
+#include "Awaitable.h"
 #include <memory>
 
 namespace Parlo
 {
     /*The Listener is used to accept incoming connections.*/
-    class Listener::Impl : public std::enable_shared_from_this<Impl> {
+    class Listener::Impl {
         public:
             Impl(asio::io_context& context, const asio::ip::tcp::endpoint& endpoint)
-                : ioContext(context), acceptor(context, endpoint), listenerSocket(context) {
+                : ioContext(context), acceptor(context, endpoint), metricsTimer(context),
+                connectionTotals(std::make_shared<ConnectionCounters>()) {
             }
 
             /*Starts accepting new connections.*/
@@ -46,8 +53,19 @@ namespace Parlo
             BlockingQueue<std::shared_ptr<NetworkClient>> networkClients;
             std::atomic<bool> running{ false };
             std::atomic<bool> applyCompression{ false };
-            std::future<void> acceptFuture;
-            Socket listenerSocket;
+
+            /*Guards capture, linkShaper, socketOptions and capabilities, which are handed to accepted connections.*/
+            std::mutex settingsMutex;
+            std::shared_ptr<TrafficCapture> capture;
+            std::shared_ptr<LinkShaper> linkShaper;
+            SocketOptions socketOptions = defaultSocketOptions();
+            std::optional<Capabilities> capabilities;
+
+            static SocketOptions defaultSocketOptions() {
+                SocketOptions options;
+                options.linger = std::chrono::seconds(5);
+                return options;
+            }
 
             using ClientConnectedHandler = std::function<void(const std::shared_ptr<NetworkClient>& client)>;
             ClientConnectedHandler onClientConnected;
@@ -55,8 +73,10 @@ namespace Parlo
             using ClientDisconnectedHandler = std::function<void(const std::shared_ptr<NetworkClient>& client)>;
             ClientDisconnectedHandler onClientDisconnected;
 
-            /*Asynchronously accepts new connections.*/
+            /*Asynchronously accepts a new connection, and rearms itself until stopAccepting() is called.*/
             void acceptAsync();
+            /*Sets up a NetworkClient for an accepted connection.*/
+            void handleAccepted(Socket& acceptedSocket);
             void NewClient_OnClientConnected(const std::shared_ptr<NetworkClient>& client);
 
             void NewClient_OnClientDisconnected(const std::shared_ptr<NetworkClient>& client);
@@ -64,6 +84,27 @@ namespace Parlo
 
             void setApplyCompression(bool apply);
 
+            StripedCounter accepts;
+            StripedCounter disconnects;
+            asio::steady_timer metricsTimer;
+            /*Totals for every connection accepted by this Listener, counted by the connections themselves.*/
+            std::shared_ptr<ConnectionCounters> connectionTotals;
+
+            std::mutex metricsHandlerMutex;
+            std::function<void(const ListenerMetrics&)> metricsHandler;
+            std::chrono::milliseconds metricsInterval{ 0 };
+
+            ListenerMetrics getMetrics() const;
+
+            /*Calls the metrics handler, then schedules the next call.*/
+            void scheduleMetrics();
+
+#ifdef PARLO_COROUTINES
+            /*Connections waiting for accept(), once queueAccepted is set.*/
+            AwaitableQueue<std::shared_ptr<NetworkClient>> acceptedClients;
+            std::atomic<bool> queueAccepted{ false };
+#endif
+
             Listener* owner;
 
             friend class Listener;
@@ -79,80 +120,126 @@ namespace Parlo
 
     Listener::~Listener() {
         stopAccepting();
+
+        std::error_code ec;
+        pImpl->metricsTimer.cancel(ec);
     }
 
-    /*Starts accepting new connections.*/
+    /*Starts accepting new connections. The Listener must be owned by a std::shared_ptr.*/
     void Listener::Impl::startAccepting()
     {
-        running = true;
-        acceptFuture = std::async(std::launch::async, &Listener::Impl::acceptAsync, shared_from_this());
+        if (running.exchange(true))
+            return;
+
+#ifdef PARLO_COROUTINES
+        acceptedClients.reopen();
+#endif
+
+        acceptAsync();
     }
 
     /*Stops accepting new connections.*/
     void Listener::Impl::stopAccepting() {
         running = false;
 
-        if (acceptFuture.valid())
-            acceptFuture.wait();
+        std::error_code ec;
+        acceptor.cancel(ec);
 
-        //Member objects' destructors are called automatically, so no need to invoke them.
+#ifdef PARLO_COROUTINES
+        acceptedClients.close(asio::error::operation_aborted);
+#endif
     }
 
     BlockingQueue<std::shared_ptr<NetworkClient>>& Listener::Impl::clients() {
         return networkClients;
     }
 
-    /*Asynchronously accepts new connections.*/
+    /*Asynchronously accepts a new connection, and rearms itself until stopAccepting() is called.*/
     void Listener::Impl::acceptAsync() {
+        if (!running)
+            return;
+
+        //Every connection gets its own socket, which the NetworkClient takes over.
+        auto socket = std::make_shared<Socket>(ioContext);
+        std::weak_ptr<Listener> weakOwner = owner->shared_from_this();
+
+        socket->acceptAsync(acceptor, [weakOwner, socket](std::error_code ec, Socket& acceptedSocket) {
+            if (ec == asio::error::operation_aborted)
+                return;
+
+            auto listener = weakOwner.lock();
+            if (!listener)
+                return;
+
+            if (!ec)
+                listener->pImpl->handleAccepted(acceptedSocket);
+            else
+                PARLO_LOG(LogLevel::error, "Error accepting connection: {}", ec);
+
+            //Continue accepting new connections.
+            listener->pImpl->acceptAsync();
+        });
+    }
+
+    /*Sets up a NetworkClient for an accepted connection.
+    @param acceptedSocket The accepted socket, which is moved into the NetworkClient.*/
+    void Listener::Impl::handleAccepted(Socket& acceptedSocket) {
+        PARLO_TRACE_SCOPE("Listener::accept");
+        PARLO_LOG(LogLevel::info, "New client connected!");
+
         try {
-            while (running) {
-
-                listenerSocket.acceptAsync(acceptor, [this](std::error_code ec, Socket& acceptedSocket) {
-                    if (!ec) {
-                        Logger::Log("New client connected!", LogLevel::info);
-
-                        //Set socket options
-                        acceptedSocket.setLinger(true, std::chrono::seconds(5));
-
-                        //Create new client
-                        auto newClient = std::make_shared<NetworkClient>(
-                            acceptedSocket,
-                            getListenerSharedPtr()//shared_from_this()
-                        );
-
-                        //Set up event handlers
-                        newClient->setOnClientDisconnectedHandler(
-                            [this](const std::shared_ptr<NetworkClient>& client) {
-                                this->NewClient_OnClientDisconnected(client);
-                            }
-                        );
-                        newClient->setOnConnectionLostHandler(
-                            [this](const std::shared_ptr<NetworkClient>& client) {
-                                this->NewClient_OnConnectionLost(client);
-                            }
-                        );
-
-                        if (applyCompression)
-                            newClient->setApplyCompression(true);
-
-                        networkClients.add(newClient);
-
-                        if (onClientConnected)
-                            onClientConnected(newClient);
-                    }
-                    else
-                        Logger::Log("Error accepting connection: " + ec.message(), LogLevel::error);
-
-                    //Continue accepting new connections.
-                    acceptAsync();
-                });
-
-                //Sleep for a short time to avoid busy waiting
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            //Create new client
+            auto newClient = std::make_shared<NetworkClient>(std::move(acceptedSocket), getListenerSharedPtr());
+
+            //Set up event handlers. Clients don't keep the Listener alive.
+            std::weak_ptr<Listener> weakOwner = getListenerSharedPtr();
+            newClient->setOnClientDisconnectedHandler(
+                [weakOwner](const std::shared_ptr<NetworkClient>& client) {
+                    if (auto listener = weakOwner.lock())
+                        listener->pImpl->NewClient_OnClientDisconnected(client);
+                }
+            );
+            newClient->setOnConnectionLostHandler(
+                [weakOwner](const std::shared_ptr<NetworkClient>& client) {
+                    if (auto listener = weakOwner.lock())
+                        listener->pImpl->NewClient_OnConnectionLost(client);
+                }
+            );
+
+            if (applyCompression)
+                newClient->setApplyCompression(true);
+
+            {
+                std::lock_guard<std::mutex> lock(settingsMutex);
+                if (capture)
+                    newClient->setCapture(capture);
+                if (linkShaper)
+                    newClient->setLinkShaper(linkShaper);
+                newClient->setSocketOptions(socketOptions);
+                if (capabilities)
+                    newClient->setCapabilities(*capabilities);
+            }
+
+            newClient->setMetricsTotals(connectionTotals);
+            accepts.add();
+
+            networkClients.add(newClient);
+
+            if (onClientConnected)
+                onClientConnected(newClient);
+
+#ifdef PARLO_COROUTINES
+            if (queueAccepted) {
+                newClient->queueReceivedPackets();
+                acceptedClients.push(newClient);
             }
+#endif
+
+            //Only start receiving once the handlers set by onClientConnected are in place.
+            newClient->start();
         }
         catch (const std::exception& e) {
-            Logger::Log("Exception in Listener::acceptAsync(): " + std::string(e.what()), LogLevel::error);
+            PARLO_LOG(LogLevel::error, "Exception in Listener::acceptAsync(): {}", e.what());
         }
     }
 
@@ -176,24 +263,65 @@ namespace Parlo
     @param client The client that disconnected.*/
     void Listener::Impl::NewClient_OnClientDisconnected(const std::shared_ptr<NetworkClient>& client) {
         //Handle client disconnection
-        Logger::Log("Client disconnected!", LogLevel::info);
+        PARLO_LOG(LogLevel::info, "Client disconnected!");
 
         if (onClientDisconnected)
             onClientDisconnected(client);
 
-        networkClients.take(client);
+        if (networkClients.take(client))
+            disconnects.add();
     }
 
     /*A client lost its connection to this Listener instance.
     @param client The client that lost its connection.*/
     void Listener::Impl::NewClient_OnConnectionLost(const std::shared_ptr<NetworkClient>& client) {
         //Handle connection loss
-        Logger::Log("Client connection lost!", LogLevel::info);
+        PARLO_LOG(LogLevel::info, "Client connection lost!");
 
         if (onClientDisconnected)
             onClientDisconnected(client);
 
-        networkClients.take(client);
+        if (networkClients.take(client))
+            disconnects.add();
+    }
+
+    ListenerMetrics Listener::Impl::getMetrics() const {
+        ListenerMetrics metrics;
+        metrics.accepts = accepts.load();
+        metrics.disconnects = disconnects.load();
+        metrics.activeConnections = static_cast<int64_t>(networkClients.count());
+        metrics.connections = connectionTotals->snapshot();
+
+        return metrics;
+    }
+
+    /*Calls the metrics handler, then schedules the next call.*/
+    void Listener::Impl::scheduleMetrics() {
+        std::weak_ptr<Listener> weakOwner = owner->shared_from_this();
+
+        metricsTimer.expires_after(metricsInterval);
+        metricsTimer.async_wait([weakOwner](std::error_code ec) {
+            if (ec)
+                return;
+
+            if (auto listener = weakOwner.lock()) {
+                std::function<void(const ListenerMetrics&)> handler;
+
+                {
+                    std::lock_guard<std::mutex> lock(listener->pImpl->metricsHandlerMutex);
+                    handler = listener->pImpl->metricsHandler;
+                }
+
+                //Called without the lock, so the handler may replace itself.
+                if (handler)
+                    handler(listener->pImpl->getMetrics());
+
+                //Rescheduling replaces any wait started by setMetricsHandler() in the meantime.
+                std::lock_guard<std::mutex> lock(listener->pImpl->metricsHandlerMutex);
+                if (listener->pImpl->metricsHandler)
+                    listener->pImpl->scheduleMetrics();
+            }
+        });
     }
 
     void Listener::startAccepting() {
@@ -205,19 +333,102 @@ namespace Parlo
         pImpl->stopAccepting();
     }
 
+#ifdef PARLO_COROUTINES
+    /*Waits for the next connection, starting to accept them if this Listener isn't already.
+    @return The connection, whose packets are queued for NetworkClient::receive().
+    @throws std::system_error if stopAccepting() is called.*/
+    asio::awaitable<std::shared_ptr<NetworkClient>> Listener::accept() {
+        pImpl->queueAccepted = true;
+        startAccepting();
+
+        return pImpl->acceptedClients.pop();
+    }
+#endif
+
     BlockingQueue<std::shared_ptr<NetworkClient>>& Listener::clients() {
         return pImpl->clients();
     }
 
+    asio::ip::tcp::endpoint Listener::getLocalEndpoint() const {
+        return pImpl->acceptor.local_endpoint();
+    }
+
     /*Should compression be applied to packets in incoming connections? Defaults to false.
     @param apply Apply compression? Defaults to false.*/
     void Listener::setApplyCompression(bool apply) {
         pImpl->setApplyCompression(apply);
     }
 
+    /*Captures everything received by connections accepted from now on.
+    @param capture The capture to append to, or nullptr to stop.*/
+    void Listener::setCapture(std::shared_ptr<TrafficCapture> capture) {
+        std::lock_guard<std::mutex> lock(pImpl->settingsMutex);
+        pImpl->capture = std::move(capture);
+    }
+
+    /*Offers capabilities in a handshake on every connection accepted from now on.
+    @param capabilities What this end supports.*/
+    void Listener::setCapabilities(const Capabilities& capabilities) {
+        capabilities.validate();
+
+        std::lock_guard<std::mutex> lock(pImpl->settingsMutex);
+        pImpl->capabilities = capabilities;
+    }
+
+    /*Sets the TCP options applied to connections accepted from now on.
+    @param options The options.*/
+    void Listener::setSocketOptions(const SocketOptions& options) {
+        std::lock_guard<std::mutex> lock(pImpl->settingsMutex);
+        pImpl->socketOptions = options;
+
+        //Accepted sockets inherit their buffer sizes from the listening socket, and the window scale is
+        //negotiated during the handshake, so the buffers have to be set before accepting to take full effect.
+        std::error_code ec;
+        if (options.sendBufferSize) {
+            pImpl->acceptor.set_option(asio::socket_base::send_buffer_size(*options.sendBufferSize), ec);
+            if (ec)
+                PARLO_LOG(LogLevel::warn, "Failed to set the Listener's send buffer size: {}", ec.message());
+        }
+        if (options.receiveBufferSize) {
+            pImpl->acceptor.set_option(asio::socket_base::receive_buffer_size(*options.receiveBufferSize), ec);
+            if (ec)
+                PARLO_LOG(LogLevel::warn, "Failed to set the Listener's receive buffer size: {}", ec.message());
+        }
+    }
+
+    /*Shapes what connections accepted from now on receive.
+    @param shaper The shaper to emulate the link with, or nullptr to stop.*/
+    void Listener::setLinkShaper(std::shared_ptr<LinkShaper> shaper) {
+        std::lock_guard<std::mutex> lock(pImpl->settingsMutex);
+        pImpl->linkShaper = std::move(shaper);
+    }
+
     /*Set a function to be called when a client connects to this Listener instance.
     @param handler The function to be called.*/
     void Listener::setOnClientConnectedHandler(std::function<void(const std::shared_ptr<NetworkClient>&)> handler) {
         pImpl->setOnClientConnectedHandler(handler);
     }
+
+    ListenerMetrics Listener::getMetrics() const {
+        return pImpl->getMetrics();
+    }
+
+    /*Sets a handler that is periodically called with a snapshot of this Listener's counters.
+    The handler is called from the io_context. Pass an empty handler to stop.
+    @param handler The handler.
+    @param interval How often to call the handler.*/
+    void Listener::setMetricsHandler(std::function<void(const ListenerMetrics&)> handler, std::chrono::milliseconds interval) {
+        if (handler && interval.count() <= 0)
+            throw std::invalid_argument("Listener::setMetricsHandler(): Interval must be positive!");
+
+        std::lock_guard<std::mutex> lock(pImpl->metricsHandlerMutex);
+        pImpl->metricsHandler = handler;
+        pImpl->metricsInterval = interval;
+
+        std::error_code ec;
+        pImpl->metricsTimer.cancel(ec);
+
+        if (handler)
+            pImpl->scheduleMetrics();
+    }
 }
\ No newline at end of file
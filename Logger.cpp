@@ -1,8 +1,261 @@
 #include "pch.h"
 #include "Logger.h"
+#include <algorithm>
+#include <cstdio>
 
 namespace Parlo
 {
-    //Definition of the static member
+    /*How long the logging thread sleeps when every ring is empty.*/
+    const std::chrono::milliseconds LOG_DRAIN_INTERVAL(5);
+
+    //Definition of the static members
     std::function<void(const LogMessage&)> Logger::onMessageLogged = nullptr;
-}
\ No newline at end of file
+    std::atomic<int> Logger::runtimeLevel{ static_cast<int>(LogLevel::verbose) };
+
+    /*A single producer, single consumer ring of log records. The producer is the thread that owns it,
+    the consumer is the logging thread.*/
+    class LogRing
+    {
+    public:
+        bool tryPush(LogRecord&& record) {
+            size_t head = writeIndex.load(std::memory_order_relaxed);
+
+            if (head - readIndex.load(std::memory_order_acquire) >= LOG_RING_CAPACITY)
+                return false;
+
+            records[head % LOG_RING_CAPACITY] = std::move(record);
+            writeIndex.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool tryPop(LogRecord& record) {
+            size_t tail = readIndex.load(std::memory_order_relaxed);
+
+            if (tail == writeIndex.load(std::memory_order_acquire))
+                return false;
+
+            record = std::move(records[tail % LOG_RING_CAPACITY]);
+            readIndex.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        std::array<LogRecord, LOG_RING_CAPACITY> records;
+        alignas(64) std::atomic<size_t> writeIndex{ 0 };
+        alignas(64) std::atomic<size_t> readIndex{ 0 };
+    };
+
+    /*The rings of every thread that has logged, and the thread that drains them.*/
+    class LogDrain
+    {
+    public:
+        ~LogDrain() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+
+            wake.notify_all();
+            if (thread.joinable())
+                thread.join();
+        }
+
+        /*The calling thread's ring, registered on first use.*/
+        LogRing& ring() {
+            thread_local std::shared_ptr<LogRing> threadRing;
+
+            if (!threadRing) {
+                threadRing = std::make_shared<LogRing>();
+                std::lock_guard<std::mutex> lock(mutex);
+                rings.push_back(threadRing);
+
+                if (!thread.joinable())
+                    thread = std::thread(&LogDrain::run, this);
+            }
+
+            return *threadRing;
+        }
+
+        /*Blocks until every record pushed before the call has been delivered.*/
+        void flush() {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            if (!thread.joinable())
+                return;
+
+            //The pass that completes emptyPasses + 1 may have looked at a ring before this call, the one after can't have.
+            uint64_t target = emptyPasses + 2;
+            wakeRequested = true;
+            wake.notify_all();
+            idle.wait(lock, [&]() { return emptyPasses >= target || stopping; });
+        }
+
+        std::atomic<uint64_t> dropped{ 0 };
+
+    private:
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable idle;
+        std::vector<std::shared_ptr<LogRing>> rings;
+        std::thread thread;
+        bool stopping = false;
+        bool wakeRequested = false;
+        uint64_t emptyPasses = 0;
+
+        void run() {
+            std::vector<LogRecord> batch;
+
+            while (true) {
+                std::vector<std::shared_ptr<LogRing>> current;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    current = rings;
+                }
+
+                LogRecord record;
+                for (auto& threadRing : current) {
+                    while (threadRing->tryPop(record))
+                        batch.push_back(std::move(record));
+                }
+
+                if (!batch.empty()) {
+                    //Rings are drained one at a time, so restore the order across threads.
+                    std::stable_sort(batch.begin(), batch.end(), [](const LogRecord& a, const LogRecord& b) {
+                        return a.timestamp < b.timestamp;
+                    });
+
+                    deliver(batch);
+                    batch.clear();
+                    continue;
+                }
+
+                current.clear();
+
+                //Forget the rings of threads that have exited, now that they're empty.
+                std::unique_lock<std::mutex> lock(mutex);
+                rings.erase(std::remove_if(rings.begin(), rings.end(), [](const std::shared_ptr<LogRing>& threadRing) {
+                    return threadRing.use_count() == 1;
+                }), rings.end());
+
+                emptyPasses++;
+                idle.notify_all();
+
+                if (stopping)
+                    return;
+
+                wake.wait_for(lock, LOG_DRAIN_INTERVAL, [this]() { return stopping || wakeRequested; });
+                wakeRequested = false;
+            }
+        }
+
+        void deliver(const std::vector<LogRecord>& batch) {
+            for (auto& record : batch) {
+                LogMessage msg(record.formatMessage(), record.level, record.timestamp);
+
+                try {
+                    if (Logger::onMessageLogged)
+                        Logger::onMessageLogged(msg);
+                    else
+                        std::cout << msg.message << '\n'; //Equivalent to Debug.WriteLine in C#
+                }
+                catch (const std::exception&) {
+                    //A throwing handler mustn't take down the logging thread.
+                }
+            }
+
+            if (!Logger::onMessageLogged)
+                std::cout.flush();
+        }
+    };
+
+    static LogDrain& logDrain() {
+        static LogDrain drain;
+        return drain;
+    }
+
+    /*Appends this argument to a string.*/
+    void LogArgument::appendTo(std::string& output) const {
+        switch (type) {
+        case Type::Signed:
+            output += std::to_string(integer);
+            break;
+        case Type::Unsigned:
+            output += std::to_string(unsignedInteger);
+            break;
+        case Type::Floating: {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%g", floating);
+            output += buffer;
+            break;
+        }
+        case Type::String:
+            output.append(text, textLength);
+            break;
+        case Type::ErrorCode:
+            output += category->message(static_cast<int>(integer));
+            break;
+        case Type::None:
+            break;
+        }
+    }
+
+    /*Substitutes the arguments into the format string.*/
+    std::string LogRecord::formatMessage() const {
+        std::string output;
+        size_t argument = 0;
+
+        for (const char* c = format; *c; c++) {
+            if (c[0] == '{' && c[1] == '}' && argument < argumentCount) {
+                arguments[argument++].appendTo(output);
+                c++;
+            }
+            else
+                output += *c;
+        }
+
+        return output;
+    }
+
+    /*Logs a message that has already been formatted.*/
+    void Logger::Log(const std::string& message, LogLevel lvl) {
+        if (!isEnabled(lvl))
+            return;
+
+        LogRecord record;
+        record.level = lvl;
+        record.timestamp = std::chrono::system_clock::now();
+        record.format = "{}{}{}{}{}{}";
+        static_assert(MAX_LOG_ARGUMENTS == 6, "The format needs a {} per argument");
+
+        //Spread over every argument, so it's only cut short at MAX_LOG_ARGUMENTS of them.
+        const size_t chunk = LOG_ARGUMENT_TEXT_SIZE - 1;
+        for (size_t offset = 0; record.argumentCount < MAX_LOG_ARGUMENTS && (offset < message.size() || offset == 0); offset += chunk)
+            record.arguments[record.argumentCount++] = LogArgument(message.substr(offset, chunk));
+
+        enqueue(std::move(record));
+    }
+
+    void Logger::enqueue(LogRecord&& record) {
+        if (!logDrain().ring().tryPush(std::move(record)))
+            logDrain().dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /*Sets the most verbose level that is logged. Can't enable levels above PARLO_COMPILED_LOG_LEVEL.*/
+    void Logger::setLevel(LogLevel lvl) {
+        runtimeLevel.store(static_cast<int>(lvl), std::memory_order_relaxed);
+    }
+
+    LogLevel Logger::getLevel() {
+        return static_cast<LogLevel>(runtimeLevel.load(std::memory_order_relaxed));
+    }
+
+    /*Blocks until every message logged before the call has been delivered.*/
+    void Logger::flush() {
+        logDrain().flush();
+    }
+
+    /*The number of messages dropped because a ring was full.*/
+    uint64_t Logger::getDroppedCount() {
+        return logDrain().dropped.load(std::memory_order_relaxed);
+    }
+}
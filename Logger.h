@@ -12,9 +12,15 @@ Contributor(s): ______________________________________.
 
 #pragma once
 
-#include <iostream>
-#include <string>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <functional>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include "Parlo.h"
 
 //Usage example
 /*int main() {
@@ -22,11 +28,31 @@ Contributor(s): ______________________________________.
         std::cout << "Logged: " << msg.message << std::endl;
         };
 
-    Logger::Log("This is a test message", LogLevel::info);
+    PARLO_LOG(LogLevel::info, "Listening on port {}", 3077);
+    Logger::flush();
 
     return 0;
 }*/
 
+/*The most verbose level that is compiled in at all, I.E 0 for none, 1 for errors ... 4 for verbose.
+Calls to PARLO_LOG above this level compile to nothing. Defaults to verbose for DEBUG builds and none otherwise.*/
+#ifndef PARLO_COMPILED_LOG_LEVEL
+    #ifdef DEBUG
+        #define PARLO_COMPILED_LOG_LEVEL 4
+    #else
+        #define PARLO_COMPILED_LOG_LEVEL 0
+    #endif
+#endif
+
+/*Logs a message if its level is enabled. The format string must be a literal, with a {} per argument.
+Arguments are captured as they are and only formatted by the logging thread; nothing is evaluated
+if the level is disabled. Strings are copied, and cut short at LOG_ARGUMENT_TEXT_SIZE.*/
+#define PARLO_LOG(level, ...) \
+    do { \
+        if (::Parlo::Logger::isEnabled(level)) \
+            ::Parlo::Logger::LogFormat(level, __VA_ARGS__); \
+    } while (0)
+
 namespace Parlo
 {
     /// <summary>
@@ -47,28 +73,148 @@ namespace Parlo
     {
     public:
         LogMessage(const std::string& msg, LogLevel lvl) : message(msg), level(lvl) {}
+        LogMessage(const std::string& msg, LogLevel lvl, std::chrono::system_clock::time_point time) :
+            message(msg), level(lvl), timestamp(time) {}
 
         std::string message;
         LogLevel level;
+        /*When the message was logged, as opposed to when it was formatted.*/
+        std::chrono::system_clock::time_point timestamp;
+    };
+
+    /*Maximum number of arguments to a single log call.*/
+    const size_t MAX_LOG_ARGUMENTS = 6;
+
+    /*Number of records each thread's ring holds before messages are dropped.*/
+    const size_t LOG_RING_CAPACITY = 256;
+
+    /*Longest string argument kept, in bytes, including the terminator. Longer strings are cut short.*/
+    const size_t LOG_ARGUMENT_TEXT_SIZE = 64;
+
+    /*A log argument, captured by value so it can be formatted later on the logging thread.*/
+    class LogArgument
+    {
+    public:
+        enum class Type : uint8_t { None, Signed, Unsigned, Floating, String, ErrorCode };
+
+        LogArgument() : type(Type::None), integer(0) {}
+
+        template<typename T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, int>::type = 0>
+        LogArgument(T value) : type(Type::Signed), integer(static_cast<int64_t>(value)) {}
+
+        template<typename T, typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, int>::type = 0>
+        LogArgument(T value) : type(Type::Unsigned), unsignedInteger(static_cast<uint64_t>(value)) {}
+
+        LogArgument(double value) : type(Type::Floating), floating(value) {}
+
+        /*Strings are copied into the argument, since the logging thread might only get to them once they're gone.*/
+        LogArgument(const char* value) : type(Type::String) {
+            assign(value ? value : "", value ? std::char_traits<char>::length(value) : 0);
+        }
+
+        LogArgument(const std::string& value) : type(Type::String) {
+            assign(value.data(), value.size());
+        }
+
+        /*Error codes are kept as category and value, so message() is only called if the argument is formatted.*/
+        LogArgument(const std::error_code& value) : type(Type::ErrorCode), integer(value.value()), category(&value.category()) {}
+
+        /*Appends this argument to a string.*/
+        PARLO_API void appendTo(std::string& output) const;
+
+    private:
+        Type type;
+        uint8_t textLength = 0;
+        union
+        {
+            int64_t integer;
+            uint64_t unsignedInteger;
+            double floating;
+            char text[LOG_ARGUMENT_TEXT_SIZE];
+        };
+        const std::error_category* category = nullptr;
+
+        void assign(const char* value, size_t length) {
+            textLength = static_cast<uint8_t>(length < LOG_ARGUMENT_TEXT_SIZE ? length : LOG_ARGUMENT_TEXT_SIZE - 1);
+            std::char_traits<char>::copy(text, value, textLength);
+            text[textLength] = '\0';
+        }
+    };
+
+    template<typename T>
+    LogArgument makeLogArgument(T&& value) {
+        return LogArgument(std::forward<T>(value));
+    }
+
+    /*A log call, as queued for the logging thread.*/
+    struct LogRecord
+    {
+        LogLevel level = LogLevel::verbose;
+        std::chrono::system_clock::time_point timestamp;
+        const char* format = nullptr;
+        uint8_t argumentCount = 0;
+        std::array<LogArgument, MAX_LOG_ARGUMENTS> arguments;
+
+        /*Substitutes the arguments into the format string.*/
+        PARLO_API std::string formatMessage() const;
     };
 
     /// <summary>
     /// A logger for Parlo.
+    /// Log calls are queued on a lock free, per thread ring buffer and formatted and delivered by a
+    /// background thread, so logging never blocks the io_context. If a thread's ring is full, the message is dropped.
     /// </summary>
     class Logger
     {
     public:
-        static std::function<void(const LogMessage&)> onMessageLogged;
+        /*Called from the logging thread for every message. Messages are written to std::cout if it isn't set.*/
+        PARLO_API static std::function<void(const LogMessage&)> onMessageLogged;
 
-        static void Log(const std::string& message, LogLevel lvl) {
+        /*Logs a message that has already been formatted. Prefer PARLO_LOG, which doesn't format anything
+        for levels that are disabled. Cut short at MAX_LOG_ARGUMENTS times LOG_ARGUMENT_TEXT_SIZE - 1 bytes.*/
+        PARLO_API static void Log(const std::string& message, LogLevel lvl);
 
-#ifdef DEBUG
-            LogMessage msg(message, lvl);
-            if (onMessageLogged)
-                onMessageLogged(msg);
-            else
-                std::cout << msg.message << std::endl; //Equivalent to Debug.WriteLine in C#
-#endif
+        /*Logs a message. Called by PARLO_LOG once it has checked the level.
+        @param lvl The level.
+        @param format A format string literal, with a {} per argument.
+        @param args The arguments.*/
+        template<typename... Args>
+        static void LogFormat(LogLevel lvl, const char* format, Args&&... args) {
+            static_assert(sizeof...(Args) <= MAX_LOG_ARGUMENTS, "Too many log arguments!");
+
+            LogRecord record;
+            record.level = lvl;
+            record.timestamp = std::chrono::system_clock::now();
+            record.format = format;
+            record.argumentCount = static_cast<uint8_t>(sizeof...(Args));
+
+            size_t index = 0;
+            int expand[] = { 0, (record.arguments[index++] = makeLogArgument(std::forward<Args>(args)), 0)... };
+            (void)expand;
+            (void)index;
+
+            enqueue(std::move(record));
+        }
+
+        /*Is a level enabled, both at compile time and at runtime?*/
+        static bool isEnabled(LogLevel lvl) {
+            return static_cast<int>(lvl) <= PARLO_COMPILED_LOG_LEVEL &&
+                static_cast<int>(lvl) <= runtimeLevel.load(std::memory_order_relaxed);
         }
+
+        /*Sets the most verbose level that is logged. Can't enable levels above PARLO_COMPILED_LOG_LEVEL.*/
+        PARLO_API static void setLevel(LogLevel lvl);
+        PARLO_API static LogLevel getLevel();
+
+        /*Blocks until every message logged before the call has been delivered.*/
+        PARLO_API static void flush();
+
+        /*The number of messages dropped because a ring was full.*/
+        PARLO_API static uint64_t getDroppedCount();
+
+    private:
+        PARLO_API static std::atomic<int> runtimeLevel;
+
+        PARLO_API static void enqueue(LogRecord&& record);
     };
 }
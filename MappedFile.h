@@ -0,0 +1,177 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Parlo
+{
+    /*A file mapped into memory. Writable mappings can be resized, which remaps the file.*/
+    class MappedFile
+    {
+    public:
+        /*Opens or creates a file and maps it.
+        @param path The file.
+        @param writable True to create the file and map it for writing, false to map an existing file read only.
+        @param size The size to create a writable file with. Ignored for read only mappings.*/
+        MappedFile(const std::string& path, bool writable, size_t size) : writable(writable) {
+#ifdef _WIN32
+            file = CreateFileA(path.c_str(), writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+                writable ? FILE_SHARE_READ : FILE_SHARE_READ | FILE_SHARE_WRITE,
+                nullptr, writable ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE)
+                throw std::runtime_error("MappedFile: Couldn't open " + path);
+
+            if (!writable) {
+                LARGE_INTEGER fileSize;
+                GetFileSizeEx(file, &fileSize);
+                size = static_cast<size_t>(fileSize.QuadPart);
+            }
+#else
+            descriptor = open(path.c_str(), writable ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
+            if (descriptor < 0)
+                throw std::runtime_error("MappedFile: Couldn't open " + path);
+
+            if (!writable) {
+                struct stat status;
+                fstat(descriptor, &status);
+                size = static_cast<size_t>(status.st_size);
+            }
+#endif
+
+            try {
+                map(size);
+            }
+            catch (...) {
+                closeFile();
+                throw;
+            }
+        }
+
+        ~MappedFile() {
+            unmap();
+            closeFile();
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        uint8_t* data() { return address; }
+        const uint8_t* data() const { return address; }
+        size_t size() const { return mappedSize; }
+
+#ifndef _WIN32
+        /*The file's descriptor, I.E for sendfile().*/
+        int fileDescriptor() const { return descriptor; }
+#endif
+
+        /*Resizes the file and maps it again. Pointers into the old mapping are invalidated.
+        @throws std::runtime_error if the file couldn't be resized or mapped.*/
+        void resize(size_t size) {
+            unmap();
+
+#ifdef _WIN32
+            //Mapping a larger size grows the file, but shrinking it has to be done by hand.
+            LARGE_INTEGER fileSize;
+            fileSize.QuadPart = static_cast<LONGLONG>(size);
+            if (!SetFilePointerEx(file, fileSize, nullptr, FILE_BEGIN) || !SetEndOfFile(file))
+                throw std::runtime_error("MappedFile: Couldn't resize file");
+#endif
+
+            map(size);
+        }
+
+    private:
+        bool writable;
+        uint8_t* address = nullptr;
+        size_t mappedSize = 0;
+
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+#else
+        int descriptor = -1;
+#endif
+
+        void map(size_t size) {
+            mappedSize = size;
+
+            //An empty file can't be mapped, and has nothing to read anyway.
+            if (size == 0)
+                return;
+
+#ifdef _WIN32
+            LARGE_INTEGER mappingSize;
+            mappingSize.QuadPart = static_cast<LONGLONG>(size);
+            mapping = CreateFileMappingA(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY,
+                mappingSize.HighPart, mappingSize.LowPart, nullptr);
+            if (!mapping)
+                throw std::runtime_error("MappedFile: Couldn't map file");
+
+            address = static_cast<uint8_t*>(MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size));
+            if (!address)
+                throw std::runtime_error("MappedFile: Couldn't map file");
+#else
+            if (writable && ftruncate(descriptor, static_cast<off_t>(size)) != 0)
+                throw std::runtime_error("MappedFile: Couldn't resize file");
+
+            void* mapped = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, descriptor, 0);
+            if (mapped == MAP_FAILED)
+                throw std::runtime_error("MappedFile: Couldn't map file");
+
+            address = static_cast<uint8_t*>(mapped);
+#endif
+        }
+
+        void unmap() {
+#ifdef _WIN32
+            if (address)
+                UnmapViewOfFile(address);
+            if (mapping)
+                CloseHandle(mapping);
+
+            mapping = nullptr;
+#else
+            if (address)
+                munmap(address, mappedSize);
+#endif
+            address = nullptr;
+        }
+
+        void closeFile() {
+#ifdef _WIN32
+            if (file != INVALID_HANDLE_VALUE)
+                CloseHandle(file);
+
+            file = INVALID_HANDLE_VALUE;
+#else
+            if (descriptor >= 0)
+                close(descriptor);
+
+            descriptor = -1;
+#endif
+        }
+    };
+}
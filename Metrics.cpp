@@ -0,0 +1,26 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include "pch.h"
+#include "Metrics.h"
+
+namespace Parlo
+{
+    /*The stripe the calling thread writes to.*/
+    size_t metricStripeIndex()
+    {
+        static std::atomic<size_t> nextStripe{ 0 };
+        thread_local size_t stripe = nextStripe.fetch_add(1, std::memory_order_relaxed) % METRIC_STRIPES;
+
+        return stripe;
+    }
+}
@@ -0,0 +1,192 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include "Parlo.h"
+
+namespace Parlo
+{
+    /*Size of a cache line. Hot counters are padded to this so threads don't false share.*/
+    const size_t CACHE_LINE_SIZE = 64;
+
+    /*Number of stripes per counter. Threads are spread across them round robin.*/
+    const size_t METRIC_STRIPES = 16;
+
+    /*The stripe the calling thread writes to.*/
+    PARLO_API size_t metricStripeIndex();
+
+    /*A counter that is written with relaxed atomics to a per thread, cache line padded stripe,
+    and summed when read. Writes never contend unless more than METRIC_STRIPES threads write.
+    Subtracting is allowed, which makes it usable as a gauge: stripes wrap around, but the sum doesn't.*/
+    class StripedCounter
+    {
+    public:
+        void add(uint64_t value = 1) {
+            stripes[metricStripeIndex()].value.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        void subtract(uint64_t value = 1) {
+            stripes[metricStripeIndex()].value.fetch_sub(value, std::memory_order_relaxed);
+        }
+
+        /*The sum of all stripes. Not a consistent snapshot if other threads are writing.*/
+        uint64_t load() const {
+            uint64_t sum = 0;
+
+            for (auto& stripe : stripes)
+                sum += stripe.value.load(std::memory_order_relaxed);
+
+            return sum;
+        }
+
+    private:
+        struct alignas(CACHE_LINE_SIZE) Stripe
+        {
+            std::atomic<uint64_t> value{ 0 };
+        };
+
+        std::array<Stripe, METRIC_STRIPES> stripes;
+    };
+
+    /*A counter that is written with relaxed atomics, without padding. For counters that are written by one or two
+    threads at a time, such as a single connection's, where a StripedCounter would only take up memory.*/
+    class RelaxedCounter
+    {
+    public:
+        void add(uint64_t value = 1) {
+            count.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        void subtract(uint64_t value = 1) {
+            count.fetch_sub(value, std::memory_order_relaxed);
+        }
+
+        uint64_t load() const {
+            return count.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<uint64_t> count{ 0 };
+    };
+
+    /*The counters behind ConnectionMetrics.*/
+    enum class ConnectionCounter : size_t
+    {
+        BytesSent,
+        BytesReceived,
+        PacketsSent,
+        PacketsReceived,
+        Reads,
+        Writes,
+        CompressionBytesSaved,
+        SendQueueDepth,
+        SendQueueBytes,
+        ReceiveQueueBytes,
+        ReadPauses,
+        DroppedFrames,
+        OversizedFrames,
+        SupersededFrames,
+        OverflowedFrames,
+        MissedHeartbeats,
+        Count
+    };
+
+    /*A ConnectionCounter each.*/
+    template <typename Counter>
+    class BasicConnectionCounters
+    {
+    public:
+        void add(ConnectionCounter counter, uint64_t value = 1) {
+            counters[static_cast<size_t>(counter)].add(value);
+        }
+
+        void subtract(ConnectionCounter counter, uint64_t value = 1) {
+            counters[static_cast<size_t>(counter)].subtract(value);
+        }
+
+        uint64_t load(ConnectionCounter counter) const {
+            return counters[static_cast<size_t>(counter)].load();
+        }
+
+        ConnectionMetrics snapshot() const;
+
+    private:
+        std::array<Counter, static_cast<size_t>(ConnectionCounter::Count)> counters;
+    };
+
+    /*A Listener's totals, which every connection it accepted writes to, so they're striped.*/
+    struct ConnectionCounters : BasicConnectionCounters<StripedCounter> {};
+
+    /*A connection's counters and optionally the Listener wide totals it also counts towards. Only the totals are
+    striped, as a connection's own counters are mostly written by its own threads.*/
+    class ConnectionMetricsRecorder
+    {
+    public:
+        /*Sets the totals this connection also counts towards, I.E those of the Listener that accepted it.*/
+        void setTotals(std::shared_ptr<ConnectionCounters> listenerTotals) {
+            totals = std::move(listenerTotals);
+        }
+
+        void add(ConnectionCounter counter, uint64_t value = 1) {
+            counters.add(counter, value);
+            if (totals)
+                totals->add(counter, value);
+        }
+
+        void subtract(ConnectionCounter counter, uint64_t value = 1) {
+            counters.subtract(counter, value);
+            if (totals)
+                totals->subtract(counter, value);
+        }
+
+        ConnectionMetrics snapshot() const {
+            return counters.snapshot();
+        }
+
+    private:
+        BasicConnectionCounters<RelaxedCounter> counters;
+        std::shared_ptr<ConnectionCounters> totals;
+    };
+
+    template <typename Counter>
+    ConnectionMetrics BasicConnectionCounters<Counter>::snapshot() const
+    {
+        ConnectionMetrics metrics;
+        metrics.bytesSent = load(ConnectionCounter::BytesSent);
+        metrics.bytesReceived = load(ConnectionCounter::BytesReceived);
+        metrics.packetsSent = load(ConnectionCounter::PacketsSent);
+        metrics.packetsReceived = load(ConnectionCounter::PacketsReceived);
+        metrics.reads = load(ConnectionCounter::Reads);
+        metrics.framesPerRead = metrics.reads > 0 ?
+            static_cast<double>(metrics.packetsReceived) / static_cast<double>(metrics.reads) : 0.0;
+        metrics.writes = load(ConnectionCounter::Writes);
+        metrics.framesPerWrite = metrics.writes > 0 ?
+            static_cast<double>(metrics.packetsSent) / static_cast<double>(metrics.writes) : 0.0;
+        metrics.compressionBytesSaved = load(ConnectionCounter::CompressionBytesSaved);
+        metrics.sendQueueDepth = static_cast<int64_t>(load(ConnectionCounter::SendQueueDepth));
+        metrics.sendQueueBytes = static_cast<int64_t>(load(ConnectionCounter::SendQueueBytes));
+        metrics.receiveQueueBytes = static_cast<int64_t>(load(ConnectionCounter::ReceiveQueueBytes));
+        metrics.readPauses = load(ConnectionCounter::ReadPauses);
+        metrics.droppedFrames = load(ConnectionCounter::DroppedFrames);
+        metrics.oversizedFrames = load(ConnectionCounter::OversizedFrames);
+        metrics.supersededFrames = load(ConnectionCounter::SupersededFrames);
+        metrics.overflowedFrames = load(ConnectionCounter::OverflowedFrames);
+        metrics.missedHeartbeats = load(ConnectionCounter::MissedHeartbeats);
+
+        return metrics;
+    }
+}
@@ -17,17 +17,70 @@ Contributor(s): ______________________________________
 #include "Logger.h"
 #include "ParloIDs.h"
 #include "Parlo.h"
-#include <zlib.h>
+#include "Compression.h"
+#include "Capabilities.h"
+#include "RTTEstimator.h"
+#include "Metrics.h"
+#include "Histogram.h"
+#include "Trace.h"
+#include "Capture.h"
+#include "LinkShaper.h"
+#include "MappedFile.h"
+#include "Awaitable.h"
+#include <array>
+#include <cerrno>
+#include <deque>
+#include <optional>
 #include <memory>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 namespace Parlo
 {
+    /*Maximum number of queued frames written with a single gathered write.*/
+    const size_t MAX_WRITE_BATCH = 64;
+
+    /*One per SendPriority.*/
+    const size_t SEND_LANES = 4;
+
+    /*Bytes a lane may send per unit of weight, each time its turn comes around.*/
+    const int64_t LANE_QUANTUM = 4096;
+
+    /*How much of a file fits in a ParloIDs::FileChunk packet.*/
+    const size_t FILE_CHUNK_SIZE = MAX_PACKET_SIZE - PacketHeaders::STANDARD - FILE_CHUNK_HEADER_SIZE;
+
+    /*Appends a value to a file transfer header, little endian.*/
+    static void appendLittleEndian(std::vector<uint8_t>& header, uint64_t value, size_t bytes) {
+        for (size_t i = 0; i < bytes; i++)
+            header.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+
+    /*Reads a little endian value from a file transfer header.*/
+    static uint64_t readLittleEndian(const uint8_t* data, size_t bytes) {
+        uint64_t value = 0;
+        for (size_t i = 0; i < bytes; i++)
+            value |= static_cast<uint64_t>(data[i]) << (8 * i);
+
+        return value;
+    }
+
     /*The NetworkClient is used to connect to a remote endpoint and receive data.*/
-    class NetworkClient::Impl : public std::enable_shared_from_this<Impl> {
+    class NetworkClient::Impl {
     public:
         Impl(Socket& socket, std::shared_ptr<Listener> listener) :
-            socket(socket), listener(listener) {}
-        Impl(Socket& socket) : socket(socket) {}
+            socket(socket), listener(listener), heartbeatTimer(socket.native_handle().get_executor()),
+            heartbeatCheckTimer(socket.native_handle().get_executor()) {}
+        Impl(Socket& socket) : socket(socket), heartbeatTimer(socket.native_handle().get_executor()),
+            heartbeatCheckTimer(socket.native_handle().get_executor()) {
+            connected = false;
+        }
+        /*Takes ownership of an accepted socket.*/
+        Impl(Socket&& acceptedSocket, std::shared_ptr<Listener> listener) :
+            ownedSocket(std::make_unique<Socket>(std::move(acceptedSocket))), socket(*ownedSocket), listener(listener),
+            heartbeatTimer(socket.native_handle().get_executor()), heartbeatCheckTimer(socket.native_handle().get_executor()) {}
 
         Socket* getSocket();
 
@@ -49,24 +102,55 @@ namespace Parlo
         void setApplyCompression(bool apply);
 
         /*Sends data asynchronously.
-        @param data The data to send.*/
-        void sendAsync(const std::vector<uint8_t>& data);
+        @param data The data to send.
+        @param priority The lane to queue it in.
+        @param coalescingKey Replaces a queued packet with the same key, unless it's 0.*/
+        void sendAsync(const std::vector<uint8_t>& data, SendPriority priority = SendPriority::Normal, uint64_t coalescingKey = 0);
+
+        /*Throws if data can't be sent, I.E because it's too large or the socket isn't connected.*/
+        void checkSendable(const std::vector<uint8_t>& data);
+
+        /*Queues part of a file to be sent as the socket drains.
+        @return The transfer's ID.*/
+        uint32_t sendFileAsync(const std::string& path, uint64_t offset, uint64_t length, FileProgressCallback onProgress,
+            SendPriority priority);
+
+        void setLaneWeight(SendPriority lane, uint32_t weight);
+
+        void setSendWatermarks(size_t low, size_t high, OverflowPolicy policy);
+
+        void setReceiveBudget(size_t maxBytes, size_t maxPackets);
+
+        void setBatching(std::chrono::microseconds maxDelay, size_t maxBytes);
+
+        /*Writes the frames held back by setBatching().
+        @param generation The batch to write, or 0 for whichever is held.*/
+        void releaseBatch(uint64_t generation = 0);
+
+        /*Sets a handler for the event fired when the send queue drained to the low watermark after it overflowed.*/
+        void setOnWritableHandler(std::function<void(const std::shared_ptr<NetworkClient>&)> handler);
 
         /*Asynchronously connects to a remote endpoint.
-        @param endpoint The remote endpoint to connect to.*/
-        void connectAsync(const asio::ip::tcp::endpoint endpoint);
+        @param endpoint The remote endpoint to connect to.
+        @param onConnected Called once connected, or with the error if the connection failed.*/
+        void connectAsync(const asio::ip::tcp::endpoint endpoint, std::function<void(const std::error_code&)> onConnected = nullptr);
 
         /*Asynchronously disconnects from a remote endpoint.
         @param sendDisconnectMessage Whether or not to send a disconnection message to the other party. Defaults to true.*/
         void disconnectAsync(bool sendDisconnectMessage = true);
 
+        /*Starts receiving and sending heartbeats, once the connection is established and the owner is managed by a std::shared_ptr.*/
+        void start();
+
         std::shared_ptr<NetworkClient> getNetworkClientSharedPtr() {
             return owner->getSharedPtr();
         }
 
     private:
+        /*Set if this instance owns its socket, I.E it was accepted by a Listener.*/
+        std::unique_ptr<Socket> ownedSocket;
         Socket& socket;
-        std::shared_ptr<Listener> listener;
+        std::weak_ptr<Listener> listener;
 
         /*Only packets larger than this many bytes will be compressed.
         Defaults to 1024 bytes, IE Parlo's max packet size.*/
@@ -74,56 +158,298 @@ namespace Parlo
 
         /*The time in milliseconds for the RTT above which packets will be compressed.*/
         const int RTT_COMPRESSION_THRESHOLD = 100;
-        bool applyCompression = false;
+        std::atomic<bool> applyCompression{ false };
+        /*The zlib level to compress with, which a handshake may lower.*/
+        std::atomic<int> compressionLevel{ DEFAULT_COMPRESSION_LEVEL };
 
         asio::streambuf recvBuffer;
-        ProcessingBuffer processingBuffer;
         std::atomic<bool> connected{ true };
 
-        std::chrono::system_clock::time_point lastHeartbeatSent;
+        /*Everything received is appended to this, if set.*/
+        std::shared_ptr<TrafficCapture> capture;
+        uint32_t captureConnection = 0;
+
+        /*Everything received is held back by this before it's processed, if set.*/
+        std::shared_ptr<LinkShaper> linkShaper;
+
+        /*Applied when connecting, if set.*/
+        std::optional<SocketOptions> socketOptions;
+        /*TCP_QUICKACK doesn't stick, so it's set again after every read while this is true.*/
+        std::atomic<bool> quickAck{ false };
+
+        std::chrono::steady_clock::time_point lastHeartbeatSent;
 
         /*Event fired when the server notified that it's disconnecting.*/
         std::function<void(const std::shared_ptr<NetworkClient>&)> onServerDisconnectedHandler;
         std::function<void(const std::shared_ptr<NetworkClient>&)> onClientDisconnectedHandler;
         std::function<void(const std::shared_ptr<NetworkClient>&)> onConnectionLostHandler;
 
-        /*Size of compression and decompression buffer.
-        Zlib benefits from having a larger buffer than
-        MAX_PACKET_SIZE (in ProcessingBuffer)
-        to compress and decompress data.*/
-        static const int COMPRESSION_BUFFER_SIZE = 32768;
-
         /*Asynchronously receives data from this NetworkClient's connected endpoint.*/
         void receiveAsync();
 
+        std::mutex receiveMutex;
+        /*Bytes read but not yet handled, and packets waiting for receive(). Only touched with receiveMutex held.*/
+        size_t unhandledBytes = 0;
+        size_t undeliveredPackets = 0;
+        size_t maxUnhandledBytes = DEFAULT_RECEIVE_BUDGET_BYTES;
+        size_t maxUndeliveredPackets = DEFAULT_RECEIVE_BUDGET_PACKETS;
+        /*Set while no read is outstanding because the budget was spent.*/
+        bool readsPaused = false;
+
+        /*Counts bytes that were read, and pauses reading if the receive budget is spent.
+        @return Whether to keep reading.*/
+        bool countReceived(size_t bytes);
+
+        /*Counts a packet queued for receive().*/
+        void countUndelivered();
+
+        /*Counts bytes that were handled and packets that were received, and resumes reading if that brought
+        both down to half the budget.*/
+        void releaseReceived(size_t bytes, size_t packets);
+
+        /*Hands received data to the ProcessingBuffer.*/
+        void processReceivedData(const std::vector<uint8_t>& data);
+
+        /*Routes a packet from the ProcessingBuffer to the right handler, and counts it as handled.
+        The handlers may release the last reference to the owner, so nothing may be touched after this.*/
+        void handleProcessedPacket(const Packet& packet);
+
+        /*Routes a packet from the ProcessingBuffer to the right handler.*/
+        void routePacket(const std::shared_ptr<NetworkClient>& client, const Packet& packet);
+
+        /*Hands the raw body of a file segment from the ProcessingBuffer to onFileDataHandler, and counts it as handled.
+        The handler may release the last reference to the owner, so nothing may be touched after this.*/
+        void handleRawData(const std::vector<uint8_t>& data);
+
+        /*Drops the connection when the other end sends a frame that's malformed or too large.*/
+        void handleInvalidFrame();
+
+        /*The file segment whose body is being received. Only touched on the ProcessingBuffer's thread.*/
+        FileTransferProgress incomingFile;
+
+        /*Event fired when file data was received.*/
+        std::function<void(const std::shared_ptr<NetworkClient>&, const FileTransferProgress&, const std::vector<uint8_t>&)> onFileDataHandler;
+
         /*Should data be compressed based on the RTT (Round Trip Time)?
         @param data The data to consider.
         @param rtt The round trip time.*/
         bool shouldCompressData(const std::vector<uint8_t>& data, int rtt);
 
-        /*Compresses data.
-        @param data The data to compress.
-        @returns The compressed data as a std::vector<uint8_t>
-        @throws std::runtime_error if zLib couldn't be initialized or data couldn't be compressed.
-        @throws std::invalid_argument if data was null.*/
-        std::vector<uint8_t> compressData(const std::vector<uint8_t>& data);
+        /*A file being sent by sendFileAsync(). Only touched by whoever is writing.*/
+        struct OutgoingFile
+        {
+            OutgoingFile(const std::string& path) : mapping(path, false, 0) {}
+
+            MappedFile mapping;
+            uint32_t id = 0;
+            /*The range being sent, and how far along it is, as offsets into the file.*/
+            uint64_t start = 0;
+            uint64_t end = 0;
+            uint64_t position = 0;
+            /*Send segments straight from the file, rather than as packets that may be compressed.*/
+            bool zeroCopy = false;
+            SendPriority priority = SendPriority::Bulk;
+            FileProgressCallback onProgress;
+            std::chrono::steady_clock::time_point enqueuedAt;
+
+            FileTransferProgress progress() const { return { id, position - start, end - start }; }
+        };
+
+        /*A frame waiting to be written, or a file that's partly written if file is set.*/
+        struct PendingWrite
+        {
+            std::shared_ptr<std::vector<uint8_t>> data;
+            std::chrono::steady_clock::time_point enqueuedAt{};
+            uint64_t traceStart = 0;
+            std::shared_ptr<OutgoingFile> file;
+            /*Called once the frame was written, or with the error if it was dropped or replaced.*/
+            std::function<void(const std::error_code&)> onWritten;
+            /*A newer frame with the same key replaces this one while it's queued, unless it's 0.*/
+            uint64_t coalescingKey = 0;
+        };
+
+        /*A queued frame with a coalescing key, and the lane it's queued in.*/
+        struct CoalescedWrite
+        {
+            PendingWrite* pending;
+            size_t lane;
+        };
+
+        std::atomic<uint32_t> nextFileTransferID{ 1 };
 
-        /*Decompresses data.
-        @param data The data to compress.
-        @returns The decompressed data as a std::vector<uint8_t>
-        @throws std::runtime_error if zLib couldn't be initialized or data couldn't be decompressed.
-        @throws std::invalid_argument if data was null.*/
-        std::vector<uint8_t> decompressData(const std::vector<uint8_t>& data);
+        /*Frames waiting to be written with the same SendPriority.*/
+        struct SendLane
+        {
+            std::deque<PendingWrite> queue;
+            uint32_t weight = 1;
+            /*Bytes the lane may still send before the next lane's turn, I.E deficit round robin.*/
+            int64_t deficit = 0;
+        };
+
+        std::mutex sendMutex;
+        /*Frames waiting to be written, by priority. Only one write is outstanding at a time, so frames never interleave on the wire.*/
+        std::array<SendLane, SEND_LANES> lanes{ { { {}, 1 }, { {}, 4 }, { {}, 2 }, { {}, 1 } } };
+        /*The application lane whose turn it is, and whether it has been given its quantum for this turn.*/
+        size_t currentLane = static_cast<size_t>(SendPriority::High);
+        bool laneTurnStarted = false;
+        /*The queued frames that have a coalescing key. Deques don't move their elements when they grow or shrink at the ends.*/
+        std::unordered_map<uint64_t, CoalescedWrite> coalescing;
+        /*Queued by disconnectAsync(), and written once every lane has drained, since nothing is read after it.*/
+        std::optional<PendingWrite> goodbye;
+        size_t queuedWrites = 0;
+        /*Bytes of the frames that are queued or being written. Only changed with sendMutex held.*/
+        std::atomic<size_t> queuedBytes{ 0 };
+        size_t lowWatermark = DEFAULT_SEND_LOW_WATERMARK;
+        size_t highWatermark = DEFAULT_SEND_HIGH_WATERMARK;
+        OverflowPolicy overflowPolicy = OverflowPolicy::Reject;
+        /*Set when a frame didn't fit under the high watermark, until the queue drains to the low watermark.*/
+        bool overflowed = false;
+        std::function<void(const std::shared_ptr<NetworkClient>&)> onWritableHandler;
+        /*How long frames may be held back before they're written, or 0 to write them right away.*/
+        std::chrono::microseconds batchDelay{ 0 };
+        size_t batchBytes = DEFAULT_BATCH_BYTES;
+        /*Set while application frames are held back, and only control frames are written.*/
+        bool holding = false;
+        size_t heldBytes = 0;
+        /*Tells a batch's timer whether the batch it was started for is still held.*/
+        uint64_t batchGeneration = 0;
+        bool writeInProgress = false;
+        /*Close the socket once the send queue has drained, I.E after a goodbye.*/
+        bool closeWhenDrained = false;
+
+        /*How packets are framed on the wire. Packets are built with the legacy header, and reframed as they're queued.
+        Only changed with sendMutex held, so a packet is framed the way it was when it took its place in the queue.*/
+        std::atomic<HeaderFormat> headerFormat{ HeaderFormat::Legacy };
+        /*The largest packet that may be sent, which a handshake may lower.*/
+        std::atomic<size_t> maxFrameSize{ static_cast<size_t>(MAX_PACKET_SIZE) };
+
+        /*Offered in a handshake when the connection is made, if set.*/
+        std::optional<Capabilities> localCapabilities;
+        std::chrono::milliseconds handshakeTimeout = DEFAULT_HANDSHAKE_TIMEOUT;
+        /*Guards helloSent and negotiated.*/
+        mutable std::mutex handshakeMutex;
+        bool helloSent = false;
+        std::optional<Capabilities> negotiated;
+        /*Set while application frames are held back until the handshake completes. Only touched with sendMutex held.*/
+        bool handshaking = false;
+        std::function<void(const std::shared_ptr<NetworkClient>&, const Capabilities&)> onNegotiatedHandler;
+
+        /*Offers the local capabilities, and holds back application frames until the other end's arrive.*/
+        void beginHandshake();
+
+        /*Sends the local capabilities, unless they were sent already.*/
+        void sendHello();
+
+        /*Agrees on capabilities with the other end, and switches to them.*/
+        void handleHello(const Packet& packet);
+
+        /*Parses what the other end sends after its HelloAck the agreed way.*/
+        void handleHelloAck();
+
+        /*Queues the HelloAck as the last frame framed the old way, and frames everything else in the agreed format.
+        Frames queued in the application lanes are written after it, as the control lane always goes first.*/
+        void finishHandshake(const Capabilities& agreed);
+
+        /*Compresses a packet if it should be, and returns the frame to write.*/
+        std::shared_ptr<std::vector<uint8_t>> prepareFrame(const std::vector<uint8_t>& data);
+
+        /*Reframes a frame in another header format.
+        @param frame The frame, which is reframed in place.*/
+        static std::shared_ptr<std::vector<uint8_t>> reframe(std::shared_ptr<std::vector<uint8_t>> frame, HeaderFormat from, HeaderFormat to);
+
+        /*The length of a file chunk's data, so that the chunk fits in maxFrameSize.*/
+        size_t fileChunkSize() const;
+
+        /*Queues a frame that is ready for the wire.
+        @param frame The frame.
+        @param priority The lane to queue it in.
+        @param onWritten Called once the frame was written, or with the error if it was dropped. A frame that's
+        replaced by a newer one with the same coalescing key gets std::errc::operation_canceled.
+        @param coalescingKey Replaces a queued frame with the same key, unless it's 0.*/
+        void queueWrite(std::shared_ptr<std::vector<uint8_t>> frame, SendPriority priority,
+            std::function<void(const std::error_code&)> onWritten = nullptr, uint64_t coalescingKey = 0);
+
+        /*Queues a frame or file, and starts writing if nothing else is.
+        @param last Set for the goodbye, which is written once everything else has been.*/
+        void queuePending(PendingWrite pending, SendPriority priority, bool last = false);
+
+        /*Puts a frame in the place of the queued frame with the same coalescing key. Called with sendMutex held.
+        @param superseded Where the replaced frame is moved.
+        @return False if the frame must be queued like any other, which it must if nothing has its key, or if
+        the queued frame is in another lane or replacing it would grow the queue past the high watermark.*/
+        bool replaceQueued(PendingWrite& pending, SendPriority priority, std::vector<PendingWrite>& superseded);
+
+        /*Starts writing what's queued. Called with sendMutex held, and writeInProgress unset.*/
+        void startWriting();
+
+        /*Holds back an application frame that was just queued, if batching is on. Called with sendMutex held.*/
+        void holdFrame(size_t size);
+
+        /*Applies the OverflowPolicy to a frame that doesn't fit under the high watermark. Called with sendMutex held.
+        @param size The frame's size.
+        @param dropped Where the queued frames dropped to make room for it are moved.
+        @return False if the frame must be dropped instead.
+        @throws std::system_error if the policy is OverflowPolicy::Reject.*/
+        bool makeRoom(size_t size, std::vector<PendingWrite>& dropped);
+
+        /*Counts bytes that have been written or dropped out of the send queue, and calls the OnWritable handler
+        if that brought it down to the low watermark after it overflowed.*/
+        void releaseQueuedBytes(size_t bytes);
+
+        /*Picks the lane to write from next: the control lane if it has anything, otherwise the next application
+        lane in deficit round robin order that can afford its first write. Called with sendMutex held.
+        @return The lane, or SEND_LANES if every lane is empty.*/
+        size_t nextLane();
+
+        /*How many bytes the next write of a frame or file step puts on the wire.*/
+        int64_t writeCost(const PendingWrite& pending) const;
+
+        /*Writes the queued frames with a single gathered write, and keeps going until the queue is empty.
+        Only called on the socket's executor, by whoever set writeInProgress.*/
+        void writeQueued();
+
+        /*Writes the next segment of a file, or the next batch of chunks if it isn't sent zero copy.*/
+        void writeFileStep(std::shared_ptr<OutgoingFile> file, HeaderFormat format);
+
+#ifdef __linux__
+        /*Writes the body of a file segment with sendfile(), waiting for the socket whenever it's full.*/
+        void sendFileBody(std::shared_ptr<OutgoingFile> file, uint64_t remaining);
+#endif
+
+        /*Reports a file's progress, and queues it again behind whatever was sent meanwhile if it isn't done.*/
+        void finishFileStep(std::shared_ptr<OutgoingFile> file, const std::error_code& ec);
+
+        /*Drops everything queued after a failed write, and tells files being sent about it.
+        @param ec The error.
+        @param inFlight How many frames the failed write held.
+        @param file The file the failed write was part of, if any.*/
+        void handleWriteError(const std::error_code& ec, size_t inFlight, std::shared_ptr<OutgoingFile> file = nullptr);
+
+        /*Shuts down and closes the socket on its executor.*/
+        void closeSocket();
 
         /*Sends a heartbeat to the server. How often is determined by heartbeatInterval.*/
         void sendHeartbeatAsync();
-        std::thread sendHeartbeatsThread;
-        /*Should we stop sending heartbeats? */
-        std::atomic<bool> stopSendingHeartbeats = false;
+        void scheduleHeartbeat();
+        asio::steady_timer heartbeatTimer;
 
         /*Periodically checks for missed heartbeats. How often is determined by heartbeatInterval.*/
         void checkForMissedHeartbeats();
-        std::thread heartbeatCheckThread;
+        void scheduleHeartbeatCheck();
+        asio::steady_timer heartbeatCheckTimer;
+
+        ConnectionMetricsRecorder metrics;
+        LatencyHistograms latency;
+
+        /*Records a latency into this connection's histogram and the global one.*/
+        void recordLatency(LatencyHistogram LatencyHistograms::* histogram, std::chrono::steady_clock::time_point start) {
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            (latency.*histogram).record(elapsed);
+            (LatencyHistograms::global().*histogram).record(elapsed);
+        }
+
+        /*Invokes onReceivedDataHandler, recording how long the packet waited since it was read.*/
+        void dispatchReceivedData(const std::shared_ptr<NetworkClient>& client, const std::shared_ptr<Packet>& packet);
 
         std::mutex aliveMutex;
         /*Is this client's connection still alive?*/
@@ -133,15 +459,22 @@ namespace Parlo
         /*How many missed heartbeats do we have?*/
         std::atomic<int> missedHeartbeats = 0;
 
-        /*Should we stop checking for missed heartbeats?*/
-        std::atomic<bool> stopCheckMissedHeartbeats = false;
-
         /*Maximum allowed number of missed hearbeats before connection is considered dead.*/
         const int maxMissedHeartbeats = 6;
         int heartbeatInterval = 30; //In seconds.
 
-        /*The last RTT - I.E Round Trip Time, in millisecs.*/
-        int lastRTT;
+        /*Round Trip Time estimate, sampled from heartbeat echoes.*/
+        mutable std::mutex rttMutex;
+        RTTEstimator rttEstimator;
+
+        /*Sends a single heartbeat.
+        @param echo The heartbeat to echo back, if any.
+        @param echoDelay How long the echoed heartbeat was held.*/
+        void sendHeartbeat(const HeartbeatPacket* echo = nullptr, std::chrono::microseconds echoDelay = std::chrono::microseconds(0));
+
+        /*Resets the missed heartbeats, takes an RTT sample from a heartbeat that echoes one of ours,
+        and echoes heartbeats that ask for it.*/
+        void handleHeartbeat(const Packet& packet);
 
         /*Event fired when a heartbeat is received.*/
         std::function<void(const std::shared_ptr<NetworkClient>&)> onReceivedHeartbeatHandler;
@@ -151,136 +484,232 @@ namespace Parlo
 
         NetworkClient* owner;
 
+#ifdef PARLO_COROUTINES
+        /*Packets waiting for receive(), once queueReceived is set.*/
+        AwaitableQueue<std::shared_ptr<Packet>> receivedPackets;
+        std::atomic<bool> queueReceived{ false };
+        /*Where coroutines waiting in connect() and send() are stored.*/
+        HandlerMemory handlerMemory;
+#endif
+
+        /*Declared last, so its thread is stopped before anything it calls into is destroyed.*/
+        ProcessingBuffer processingBuffer;
+
         friend class NetworkClient;
     };
 
     NetworkClient::NetworkClient(Socket& socket, std::shared_ptr<Listener> listener) :
         pImpl(std::make_unique<NetworkClient::Impl>(socket, listener)) {
         pImpl->owner = this;
+        pImpl->processingBuffer.setOnPacketProcessedHandler([this](const Packet& packet) {
+            pImpl->handleProcessedPacket(packet);
+        });
+        pImpl->processingBuffer.setOnRawDataHandler([this](const std::vector<uint8_t>& data) {
+            pImpl->handleRawData(data);
+        });
+        pImpl->processingBuffer.setOnInvalidFrameHandler([this]() {
+            pImpl->handleInvalidFrame();
+        });
+    }
 
+    /*Constructs a NetworkClient for a socket accepted by a Listener, taking ownership of the socket.
+    The Listener calls start() once the NetworkClient is managed by a std::shared_ptr.*/
+    NetworkClient::NetworkClient(Socket&& socket, std::shared_ptr<Listener> listener) :
+        pImpl(std::make_unique<NetworkClient::Impl>(std::move(socket), listener)) {
+        pImpl->owner = this;
         pImpl->processingBuffer.setOnPacketProcessedHandler([this](const Packet& packet) {
-            if (packet.getID() == ParloIDs::SGoodbye) { //Server notified client of disconnection.
-                if (pImpl->onServerDisconnectedHandler)
-                    pImpl->onServerDisconnectedHandler(shared_from_this());
+            pImpl->handleProcessedPacket(packet);
+        });
+        pImpl->processingBuffer.setOnRawDataHandler([this](const std::vector<uint8_t>& data) {
+            pImpl->handleRawData(data);
+        });
+        pImpl->processingBuffer.setOnInvalidFrameHandler([this]() {
+            pImpl->handleInvalidFrame();
+        });
+    }
 
-                return;
-            }
-            if (packet.getID() == ParloIDs::CGoodbye) { //Client notified server of disconnection.
-                if (pImpl->onClientDisconnectedHandler)
-                    pImpl->onClientDisconnectedHandler(shared_from_this());
+    NetworkClient::NetworkClient(Socket& socket) : pImpl(std::make_unique<NetworkClient::Impl>(socket)) {
+        pImpl->owner = this;
+        pImpl->processingBuffer.setOnPacketProcessedHandler([this](const Packet& packet) {
+            pImpl->handleProcessedPacket(packet);
+        });
+        pImpl->processingBuffer.setOnRawDataHandler([this](const std::vector<uint8_t>& data) {
+            pImpl->handleRawData(data);
+        });
+        pImpl->processingBuffer.setOnInvalidFrameHandler([this]() {
+            pImpl->handleInvalidFrame();
+        });
+    }
 
-                return;
-            }
-            if (packet.getID() == ParloIDs::Heartbeat) {
-                std::lock_guard<std::mutex> aliveLock(pImpl->aliveMutex);
-                pImpl->isAlive = true;
+    /*Starts receiving and sending heartbeats, once the connection is established and the owner is managed by a std::shared_ptr.*/
+    void NetworkClient::Impl::start() {
+        beginHandshake();
+        receiveAsync();
+        sendHeartbeatAsync();
+        scheduleHeartbeatCheck();
+    }
 
-                //The std::lock_guard is a RAII (Resource Acquisition Is Initialization) type which 
-                //means it acquires the lock when it is created and releases it when it goes out of scope.
-                std::lock_guard<std::mutex> heartbeatsLock(pImpl->heartbeatsMutex);
-                pImpl->missedHeartbeats = 0;
+    void NetworkClient::start() {
+        pImpl->start();
+    }
 
-                auto data = std::make_shared<std::vector<uint8_t>>(packet.getData());
-                HeartbeatPacket Heartbeat = HeartbeatPacket::byteArrayToObject(data);
+    /*Routes a packet from the ProcessingBuffer to the right handler, and counts it as handled. Called on the ProcessingBuffer's thread.*/
+    void NetworkClient::Impl::handleProcessedPacket(const Packet& packet) {
+        //The owner may already be on its way out, in which case there's nobody left to tell.
+        auto client = owner->weak_from_this().lock();
+        if (!client)
+            return;
 
-                std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
-                std::chrono::system_clock::time_point sentTimestamp = Heartbeat.getSentTimestamp();
-                std::chrono::milliseconds timeSinceLast = Heartbeat.getTimeSinceLast();
+        //A handler may drop every other reference, such as the Listener's on a goodbye, so this keeps the owner alive until it's done.
+        size_t packetSize = processingBuffer.getPacketSize();
+        routePacket(client, packet);
+        releaseReceived(packetSize, 0);
+    }
 
-                auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - sentTimestamp);
-                pImpl->lastRTT = static_cast<int>(duration.count() + timeSinceLast.count());
+    /*Routes a packet from the ProcessingBuffer to the right handler. Called on the ProcessingBuffer's thread.*/
+    void NetworkClient::Impl::routePacket(const std::shared_ptr<NetworkClient>& client, const Packet& packet) {
+        metrics.add(ConnectionCounter::PacketsReceived);
 
-                if (pImpl->onReceivedHeartbeatHandler)
-                    pImpl->onReceivedHeartbeatHandler(shared_from_this());
+        if (packet.getID() == ParloIDs::SGoodbye) { //Server notified client of disconnection.
+            connected = false;
 
-                return;
-            }
+#ifdef PARLO_COROUTINES
+            //Nothing is read after a goodbye, so receive() fails once it has returned what came before it.
+            receivedPackets.close(asio::error::eof);
+#endif
 
-            if (packet.getIsCompressed()) {
-                auto decompressedData = pImpl->decompressData(packet.getData());
-                if (pImpl->onReceivedDataHandler)
-                    pImpl->onReceivedDataHandler(shared_from_this(), std::make_shared<Packet>(packet.getID(), decompressedData, false));
-            }
-            else {
-                if (pImpl->onReceivedDataHandler)
-                    pImpl->onReceivedDataHandler(shared_from_this(), std::make_shared<Packet>(packet.getID(), packet.getData(), false));
-            }
-            });
+            if (onServerDisconnectedHandler)
+                onServerDisconnectedHandler(client);
+
+            return;
+        }
+        if (packet.getID() == ParloIDs::CGoodbye) { //Client notified server of disconnection.
+            connected = false;
 
-        pImpl->heartbeatCheckThread = std::thread(&NetworkClient::Impl::checkForMissedHeartbeats, pImpl.get());
-        pImpl->sendHeartbeatsThread = std::thread(&NetworkClient::Impl::sendHeartbeatAsync, pImpl.get());
+#ifdef PARLO_COROUTINES
+            //Nothing is read after a goodbye, so receive() fails once it has returned what came before it.
+            receivedPackets.close(asio::error::eof);
+#endif
 
-        pImpl->receiveAsync();
-    }
+            if (onClientDisconnectedHandler)
+                onClientDisconnectedHandler(client);
 
-    NetworkClient::NetworkClient(Socket& socket) : pImpl(std::make_unique<NetworkClient::Impl>(socket)) {
-        pImpl->processingBuffer.setOnPacketProcessedHandler([this](const Packet& packet) {
-            pImpl->owner = this;
+            return;
+        }
+        if (packet.getID() == ParloIDs::Hello) {
+            handleHello(packet);
+            return;
+        }
+        if (packet.getID() == ParloIDs::HelloAck) {
+            handleHelloAck();
+            return;
+        }
+        if (packet.getID() == ParloIDs::Heartbeat) {
+            handleHeartbeat(packet);
+
+            if (onReceivedHeartbeatHandler)
+                onReceivedHeartbeatHandler(client);
+
+            return;
+        }
 
-            if (packet.getID() == ParloIDs::SGoodbye) { //Server notified client of disconnection.
-                if (pImpl->onServerDisconnectedHandler)
-                    pImpl->onServerDisconnectedHandler(shared_from_this());
+        if (packet.getID() == ParloIDs::FileSegment) {
+            const std::vector<uint8_t>& header = packet.getData();
+            if (header.size() < FILE_SEGMENT_HEADER_SIZE)
                 return;
-            }
-            if (packet.getID() == ParloIDs::CGoodbye) { //Client notified server of disconnection.
-                if (pImpl->onClientDisconnectedHandler)
-                    pImpl->onClientDisconnectedHandler(shared_from_this());
+
+            //The ProcessingBuffer hands over the segment's body next.
+            incomingFile.transferID = static_cast<uint32_t>(readLittleEndian(header.data(), 4));
+            incomingFile.transferred = readLittleEndian(header.data() + 4, 8);
+            incomingFile.total = readLittleEndian(header.data() + 12, 8);
+
+            //An empty file is sent as an empty segment, which still has to be reported.
+            if (readLittleEndian(header.data() + 20, 4) == 0 && onFileDataHandler)
+                onFileDataHandler(client, incomingFile, std::vector<uint8_t>());
+
+            return;
+        }
+
+        std::vector<uint8_t> data = packet.getIsCompressed() ? decompressData(packet.getData()) : packet.getData();
+
+        if (packet.getID() == ParloIDs::FileChunk) {
+            if (data.size() < FILE_CHUNK_HEADER_SIZE)
                 return;
-            }
-            if (packet.getID() == ParloIDs::Heartbeat) {
-                std::lock_guard<std::mutex> aliveLock(pImpl->aliveMutex);
-                pImpl->isAlive = true;
 
-                //The std::lock_guard is a RAII (Resource Acquisition Is Initialization) type which 
-                //means it acquires the lock when it is created and releases it when it goes out of scope.
-                std::lock_guard<std::mutex> heartbeatsLock(pImpl->heartbeatsMutex);
-                pImpl->missedHeartbeats = 0;
+            FileTransferProgress progress;
+            progress.transferID = static_cast<uint32_t>(readLittleEndian(data.data(), 4));
+            progress.transferred = readLittleEndian(data.data() + 4, 8) + (data.size() - FILE_CHUNK_HEADER_SIZE);
+            progress.total = readLittleEndian(data.data() + 12, 8);
 
-                auto data = std::make_shared<std::vector<uint8_t>>(packet.getData());
-                HeartbeatPacket Heartbeat = HeartbeatPacket::byteArrayToObject(data);
+            if (onFileDataHandler)
+                onFileDataHandler(client, progress, std::vector<uint8_t>(data.begin() + FILE_CHUNK_HEADER_SIZE, data.end()));
 
-                std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
-                std::chrono::system_clock::time_point sentTimestamp = Heartbeat.getSentTimestamp();
-                std::chrono::milliseconds timeSinceLast = Heartbeat.getTimeSinceLast();
+            return;
+        }
 
-                auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - sentTimestamp);
-                pImpl->lastRTT = static_cast<int>(duration.count() + timeSinceLast.count());
+        dispatchReceivedData(client, std::make_shared<Packet>(packet.getID(), std::move(data), false));
+    }
 
-                if (pImpl->onReceivedHeartbeatHandler)
-                    pImpl->onReceivedHeartbeatHandler(shared_from_this());
+    /*Hands the raw body of a file segment from the ProcessingBuffer to onFileDataHandler. Called on the ProcessingBuffer's thread.*/
+    void NetworkClient::Impl::handleRawData(const std::vector<uint8_t>& data) {
+        auto client = owner->weak_from_this().lock();
+        if (!client)
+            return;
 
-                return;
-            }
+        incomingFile.transferred += data.size();
 
-            if (packet.getIsCompressed()) {
-                auto decompressedData = pImpl->decompressData(packet.getData());
-                if (pImpl->onReceivedDataHandler)
-                    pImpl->onReceivedDataHandler(shared_from_this(), std::make_shared<Packet>(packet.getID(), decompressedData, false));
-            }
-            else {
-                if (pImpl->onReceivedDataHandler)
-                    pImpl->onReceivedDataHandler(shared_from_this(), std::make_shared<Packet>(packet.getID(), packet.getData(), false));
-            }
-            });
+        if (onFileDataHandler)
+            onFileDataHandler(client, incomingFile, data);
+
+        releaseReceived(data.size(), 0);
     }
 
-    Socket* NetworkClient::Impl::getSocket() {
-        return &socket;
+    /*Drops the connection when the other end sends a frame that's malformed or too large, as there's no telling
+    where the next frame starts. Called on the ProcessingBuffer's thread.*/
+    void NetworkClient::Impl::handleInvalidFrame() {
+        auto client = owner->weak_from_this().lock();
+        if (!client)
+            return;
+
+        metrics.add(ConnectionCounter::OversizedFrames);
+
+        if (connected.exchange(false)) {
+            PARLO_LOG(LogLevel::error, "Received a malformed or oversized frame, disconnecting");
+            closeSocket();
+
+            if (onConnectionLostHandler)
+                onConnectionLostHandler(client);
+        }
     }
 
-    NetworkClient::~NetworkClient() {
-        if (!pImpl->stopCheckMissedHeartbeats) {
-            pImpl->stopCheckMissedHeartbeats = true;
-            if (pImpl->heartbeatCheckThread.joinable())
-                pImpl->heartbeatCheckThread.join();
+    /*Invokes onReceivedDataHandler, recording how long the packet waited since it was read.*/
+    void NetworkClient::Impl::dispatchReceivedData(const std::shared_ptr<NetworkClient>& client, const std::shared_ptr<Packet>& packet) {
+#ifdef PARLO_COROUTINES
+        if (queueReceived) {
+            recordLatency(&LatencyHistograms::receiveLatency, processingBuffer.getReceivedTime());
+            countUndelivered();
+            receivedPackets.push(packet);
+            return;
         }
+#endif
+
+        if (!onReceivedDataHandler)
+            return;
 
-        if (!pImpl->stopSendingHeartbeats) {
-            pImpl->stopSendingHeartbeats = true;
+        recordLatency(&LatencyHistograms::receiveLatency, processingBuffer.getReceivedTime());
 
-            if (pImpl->sendHeartbeatsThread.joinable())
-                pImpl->sendHeartbeatsThread.join();
-        }
+        PARLO_TRACE_SCOPE("NetworkClient::onReceivedData");
+        onReceivedDataHandler(client, packet);
+    }
+
+    Socket* NetworkClient::Impl::getSocket() {
+        return &socket;
+    }
+
+    NetworkClient::~NetworkClient() {
+        std::error_code ec;
+        pImpl->heartbeatTimer.cancel(ec);
+        pImpl->heartbeatCheckTimer.cancel(ec);
     }
 
     /*Sets a handler for the event fired when a client disconnects from a server. This handler should be set by a Listener instance.
@@ -309,11 +738,18 @@ namespace Parlo
 
     /*Sets a handler for the event fired when data was received.
     @param handler The handler for the event.*/
-    void NetworkClient::Impl::setOnReceivedDataHandler(std::function<void(const std::shared_ptr<NetworkClient>&, 
+    void NetworkClient::Impl::setOnReceivedDataHandler(std::function<void(const std::shared_ptr<NetworkClient>&,
         const std::shared_ptr<Packet>&)> handler) {
         onReceivedDataHandler = handler;
     }
 
+    /*Sets a handler for the event fired when the send queue drained to the low watermark after it overflowed.
+    @param handler The handler for the event.*/
+    void NetworkClient::Impl::setOnWritableHandler(std::function<void(const std::shared_ptr<NetworkClient>&)> handler) {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        onWritableHandler = handler;
+    }
+
     /*Should compression be applied to network traffic? Defaults to false.*/
     void NetworkClient::Impl::setApplyCompression(bool apply) {
         applyCompression = apply;
@@ -321,286 +757,1297 @@ namespace Parlo
 
     /*Asynchronously receives data from this NetworkClient's connected endpoint.*/
     void NetworkClient::Impl::receiveAsync() {
-        if (!connected) 
+        if (!connected)
             return;
 
         //Make sure the NetworkClient instance says alive for the duration of the async operation...
-        auto self(shared_from_this());
+        auto self(owner->shared_from_this());
         asio::async_read(socket.native_handle(), recvBuffer, asio::transfer_at_least(1),
             [this, self](std::error_code ec, std::size_t bytes_transferred) {
+                PARLO_TRACE_SCOPE("NetworkClient::receive");
+
                 if (!ec) {
                     std::vector<uint8_t> data(bytes_transferred);
                     std::istream is(&recvBuffer);
                     is.read(reinterpret_cast<char*>(data.data()), bytes_transferred);
 
-                    try {
-                        processingBuffer.addData(data);
+                    metrics.add(ConnectionCounter::Reads);
+                    metrics.add(ConnectionCounter::BytesReceived, bytes_transferred);
+                    bool keepReading = countReceived(bytes_transferred);
+
+                    if (quickAck)
+                        socket.setQuickAck(true);
+
+                    if (capture) {
+                        try {
+                            capture->append(captureConnection, data.data(), data.size());
+                        }
+                        catch (const std::runtime_error& e) {
+                            PARLO_LOG(LogLevel::error, "Stopped capturing: {}", e.what());
+                            capture.reset();
+                        }
                     }
-                    catch (const std::overflow_error& e) {
-                        Logger::Log("Tried adding too much data into ProcessingBuffer!", LogLevel::warn);
+
+                    if (linkShaper) {
+                        std::weak_ptr<NetworkClient> weakSelf = self;
+                        linkShaper->submit(std::move(data), true, [weakSelf](std::vector<uint8_t> shaped) {
+                            if (auto client = weakSelf.lock())
+                                client->pImpl->processReceivedData(shaped);
+                        });
                     }
+                    else
+                        processReceivedData(data);
 
-                    receiveAsync(); //Continue receiving data
+                    if (keepReading)
+                        receiveAsync(); //Continue receiving data
+                    return;
                 }
-                else {
-                    Logger::Log("Error in receiveAsync: " + ec.message(), LogLevel::error);
-                    connected = false;
+
+#ifdef PARLO_COROUTINES
+                //Nothing more will be received, so receive() fails once it has returned what's already been read.
+                if (queueReceived) {
+                    processingBuffer.waitUntilProcessed();
+                    receivedPackets.close(ec);
+                }
+#endif
+
+                if (connected.exchange(false)) { //Otherwise we disconnected, or the other party said goodbye.
+                    PARLO_LOG(LogLevel::error, "Error in receiveAsync: {}", ec);
+                    closeSocket();
 
                     if (onConnectionLostHandler)
-                        onConnectionLostHandler(getNetworkClientSharedPtr());
+                        onConnectionLostHandler(self);
                 }
             }
         );
     }
 
-    /*Sends data asynchronously.
-    @param data The data to send.*/
-    void NetworkClient::Impl::sendAsync(const std::vector<uint8_t>& data) {
-        if (data.empty())
-            throw std::invalid_argument("Data cannot be null or empty");
-        if (data.size() > Parlo::MAX_PACKET_SIZE)
-            throw std::overflow_error("Data size exceeds maximum packet size");
+    /*Hands received data to the ProcessingBuffer.*/
+    void NetworkClient::Impl::processReceivedData(const std::vector<uint8_t>& data) {
+        try {
+            processingBuffer.addData(data);
+        }
+        catch (const std::overflow_error& e) {
+            metrics.add(ConnectionCounter::OversizedFrames);
+            PARLO_LOG(LogLevel::warn, "Tried adding too much data into ProcessingBuffer!");
+            releaseReceived(data.size(), 0);
+        }
+    }
 
-        if (!connected)
-            throw std::runtime_error("Socket is not connected");
+    /*Counts bytes that were read, and pauses reading if the receive budget is spent.
+    @return Whether to keep reading.*/
+    bool NetworkClient::Impl::countReceived(size_t bytes) {
+        std::lock_guard<std::mutex> lock(receiveMutex);
+        unhandledBytes += bytes;
+        metrics.add(ConnectionCounter::ReceiveQueueBytes, bytes);
 
-        std::vector<uint8_t> finalData;
+        if (unhandledBytes <= maxUnhandledBytes && undeliveredPackets <= maxUndeliveredPackets)
+            return true;
 
-        if (shouldCompressData(data, lastRTT)) {
-            auto compressedData = compressData(data);
-            Packet *compressedPacket = new Packet(data[0], finalData, true);
-            finalData = compressedPacket->buildPacket();
-        }
-        else
-            finalData = data;
+        //The kernel's receive buffer fills up, and TCP stops the other party from sending more.
+        readsPaused = true;
+        metrics.add(ConnectionCounter::ReadPauses);
+        return false;
+    }
 
-        //Make sure the NetworkClient instance says alive for the duration of the async operation...
-        auto self(shared_from_this());
-        asio::async_write(socket.native_handle(), asio::buffer(data),
-            [this, self](std::error_code ec, std::size_t /*bytes_transferred*/) {
-                if (ec) {
-                    Logger::Log("Error in sendAsync: " + ec.message(), LogLevel::error);
-                    connected = false;
-                    if (onConnectionLostHandler)
-                        onConnectionLostHandler(getNetworkClientSharedPtr());
-                }
-            });
+    /*Counts a packet queued for receive().*/
+    void NetworkClient::Impl::countUndelivered() {
+        std::lock_guard<std::mutex> lock(receiveMutex);
+        undeliveredPackets++;
     }
 
-    /*Should data be compressed based on the RTT (Round Trip Time)?
-    @param data The data to consider.
-    @param rtt The round trip time.*/
-    bool NetworkClient::Impl::shouldCompressData(const std::vector<uint8_t>& data, int rtt) {
-        if (data.empty())
-            throw std::invalid_argument("Data cannot be null or empty");
+    /*Counts bytes that were handled and packets that were received, and resumes reading if that brought
+    both down to half the budget.*/
+    void NetworkClient::Impl::releaseReceived(size_t bytes, size_t packets) {
+        {
+            std::lock_guard<std::mutex> lock(receiveMutex);
+            unhandledBytes -= bytes;
+            undeliveredPackets -= packets;
+            metrics.subtract(ConnectionCounter::ReceiveQueueBytes, bytes);
 
-        if (!applyCompression)
-            return false;
+            if (!readsPaused || unhandledBytes > maxUnhandledBytes / 2 || undeliveredPackets > maxUndeliveredPackets / 2)
+                return;
 
-        if (data.size() < COMPRESSION_THRESHOLD)
-            return false;
+            readsPaused = false;
+        }
 
-        if (rtt > RTT_COMPRESSION_THRESHOLD)
-            return true;
+        auto self = owner->weak_from_this().lock();
+        if (!self)
+            return;
 
-        return false;
+        asio::post(socket.native_handle().get_executor(), [this, self]() {
+            receiveAsync();
+        });
     }
 
-    /*Compresses data.
-    @param data The data to compress.
-    @returns The compressed data as a std::vector<uint8_t>
-    @throws std::runtime_error if zLib couldn't be initialized or data couldn't be compressed.
-    @throws std::invalid_argument if data was null.*/
-    std::vector<uint8_t> NetworkClient::Impl::compressData(const std::vector<uint8_t>& data) {
+    /*Sends data asynchronously.
+    @param data The data to send.
+    @param priority The lane to queue it in.
+    @param coalescingKey Replaces a queued packet with the same key, unless it's 0.*/
+    void NetworkClient::Impl::sendAsync(const std::vector<uint8_t>& data, SendPriority priority, uint64_t coalescingKey) {
+        PARLO_TRACE_SCOPE("NetworkClient::sendAsync");
+
+        checkSendable(data);
+        queueWrite(prepareFrame(data), priority, nullptr, coalescingKey);
+    }
+
+    /*Throws if data can't be sent.
+    @param data The data to send.
+    @throws std::invalid_argument if data is empty, std::overflow_error if it's too large, std::runtime_error if the socket isn't connected.*/
+    void NetworkClient::Impl::checkSendable(const std::vector<uint8_t>& data) {
         if (data.empty())
             throw std::invalid_argument("Data cannot be null or empty");
+        if (data.size() > maxFrameSize) {
+            metrics.add(ConnectionCounter::OversizedFrames);
+            throw std::overflow_error("Data size exceeds maximum packet size");
+        }
 
-        z_stream zs;
-        memset(&zs, 0, sizeof(zs));
+        if (data.size() < PacketHeaders::STANDARD && headerFormat == HeaderFormat::Compact)
+            throw std::invalid_argument("Data must be a packet built by Packet::buildPacket()");
 
-        if (deflateInit(&zs, Z_BEST_COMPRESSION) != Z_OK)
-            throw std::runtime_error("deflateInit failed");
+        if (!connected)
+            throw std::runtime_error("Socket is not connected");
+    }
 
-        zs.next_in = (Bytef*)data.data();
-        zs.avail_in = data.size();
+    /*Compresses a packet if it should be, and returns the frame to write.
+    @param data The packet.*/
+    std::shared_ptr<std::vector<uint8_t>> NetworkClient::Impl::prepareFrame(const std::vector<uint8_t>& data) {
+        //Owned by the send queue, as the caller's data may not outlive the write.
+        auto finalData = std::make_shared<std::vector<uint8_t>>();
 
-        int ret;
-        std::unique_ptr<char[]> outbuffer(new char[COMPRESSION_BUFFER_SIZE]);
-        std::vector<uint8_t> outdata;
+        int rtt;
+        {
+            std::lock_guard<std::mutex> lock(rttMutex);
+            rtt = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(rttEstimator.getSmoothedRTT()).count());
+        }
 
-        do {
-            zs.next_out = reinterpret_cast<Bytef*>(outbuffer.get());
-            zs.avail_out = COMPRESSION_BUFFER_SIZE;
+        if (shouldCompressData(data, rtt)) {
+            std::vector<uint8_t> payload(data.begin() + PacketHeaders::STANDARD, data.end());
+            Packet compressedPacket(data[0], compressData(payload, compressionLevel), true);
+            *finalData = compressedPacket.buildPacket();
 
-            ret = deflate(&zs, Z_FINISH);
+            //Data that doesn't compress is sent as is, so the frame never outgrows the maximum frame size.
+            if (finalData->size() < data.size())
+                metrics.add(ConnectionCounter::CompressionBytesSaved, data.size() - finalData->size());
+            else
+                *finalData = data;
+        }
+        else
+            *finalData = data;
 
-            if (outdata.size() < zs.total_out) {
-                outdata.insert(outdata.end(), outbuffer.get(), outbuffer.get() + zs.total_out - outdata.size());
-            }
-        } while (ret == Z_OK);
+        return finalData;
+    }
 
-        deflateEnd(&zs);
+    /*Reframes a frame in another header format. The payload's length is taken from the frame's size.
+    @param frame The frame, which is reframed in place.
+    @param from The format it's framed in.
+    @param to The format to frame it in.*/
+    std::shared_ptr<std::vector<uint8_t>> NetworkClient::Impl::reframe(std::shared_ptr<std::vector<uint8_t>> frame,
+        HeaderFormat from, HeaderFormat to) {
+        FrameHeader old;
+        if (from == to || !(from == HeaderFormat::Compact ? readCompactHeader(*frame, frame->size(), old) :
+            readLegacyHeader(*frame, frame->size(), old)))
+            return frame;
+
+        uint8_t header[MAX_COMPACT_HEADER_SIZE];
+        size_t payloadSize = frame->size() - old.headerSize;
+        size_t headerSize = to == HeaderFormat::Compact ? writeCompactHeader(header, old.id, old.compressed, payloadSize, old.channel) :
+            writeLegacyHeader(header, old.id, old.compressed, payloadSize);
+
+        //A packet of up to MAX_PACKET_SIZE never gets a longer compact header, so it's usually reframed without reallocating.
+        if (headerSize <= old.headerSize)
+            frame->erase(frame->begin(), frame->begin() + (old.headerSize - headerSize));
+        else
+            frame->insert(frame->begin(), headerSize - old.headerSize, 0);
+        std::copy(header, header + headerSize, frame->begin());
 
-        if (ret != Z_STREAM_END)
-            throw std::runtime_error("Exception during zlib compression");
+        return frame;
+    }
 
-        return outdata;
+    /*The length of a file chunk's data, so that the chunk fits in maxFrameSize.*/
+    size_t NetworkClient::Impl::fileChunkSize() const {
+        return (std::min)(FILE_CHUNK_SIZE, maxFrameSize - PacketHeaders::STANDARD - FILE_CHUNK_HEADER_SIZE);
     }
 
-    /*Decompresses data.
-    @param data The data to compress.
-    @returns The decompressed data as a std::vector<uint8_t>
-    @throws std::runtime_error if zLib couldn't be initialized or data couldn't be decompressed.
-    @throws std::invalid_argument if data was null.*/
-    std::vector<uint8_t> NetworkClient::Impl::decompressData(const std::vector<uint8_t>& data) {
-        if (data.empty())
-            throw std::invalid_argument("Data cannot be null or empty");
+    /*Queues part of a file to be sent as the socket drains.
+    @return The transfer's ID.*/
+    uint32_t NetworkClient::Impl::sendFileAsync(const std::string& path, uint64_t offset, uint64_t length, FileProgressCallback onProgress,
+        SendPriority priority) {
+        PARLO_TRACE_SCOPE("NetworkClient::sendFileAsync");
+
+        if (!connected)
+            throw std::runtime_error("Socket is not connected");
 
-        z_stream zs;
-        memset(&zs, 0, sizeof(zs));
+        auto file = std::make_shared<OutgoingFile>(path);
+        uint64_t size = file->mapping.size();
 
-        if (inflateInit(&zs) != Z_OK)
-            throw std::runtime_error("NetworkClient::decompressData: inflateInit failed.");
+        if (offset > size || length > size - offset)
+            throw std::out_of_range("NetworkClient::sendFileAsync(): Range is outside the file");
 
-        zs.next_in = (Bytef*)data.data();
-        zs.avail_in = data.size();
+        file->id = nextFileTransferID++;
+        file->start = offset;
+        file->position = offset;
+        file->end = length > 0 ? offset + length : size;
+        //Compressed data has to be framed as packets, so it can't come straight from the file.
+        file->zeroCopy = !applyCompression;
+        file->priority = priority;
+        file->onProgress = std::move(onProgress);
+        file->enqueuedAt = std::chrono::steady_clock::now();
 
-        int ret;
-        std::unique_ptr<char[]> outBuffer(new char[COMPRESSION_BUFFER_SIZE]);
-        std::vector<uint8_t> outData;
+        uint32_t id = file->id;
+        queuePending({ nullptr, file->enqueuedAt, 0, std::move(file), nullptr, 0 }, priority);
 
-        do {
-            zs.next_out = reinterpret_cast<Bytef*>(outBuffer.get());
-            zs.avail_out = COMPRESSION_BUFFER_SIZE;
+        return id;
+    }
 
-            ret = inflate(&zs, 0);
+    /*Sets how much of the connection a lane gets while other lanes are busy too.*/
+    void NetworkClient::Impl::setLaneWeight(SendPriority lane, uint32_t weight) {
+        if (lane == SendPriority::Control)
+            throw std::invalid_argument("The control lane has no weight, it always goes first");
+        if (weight == 0)
+            throw std::invalid_argument("A lane's weight must be at least 1");
 
-            if (outData.size() < zs.total_out)
-                outData.insert(outData.end(), outBuffer.get(), outBuffer.get() + zs.total_out - outData.size());
+        std::lock_guard<std::mutex> lock(sendMutex);
+        lanes[static_cast<size_t>(lane)].weight = weight;
+    }
 
-        } while (ret == Z_OK);
+    /*Bounds the bytes queued to be sent.*/
+    void NetworkClient::Impl::setSendWatermarks(size_t low, size_t high, OverflowPolicy policy) {
+        if (low > high)
+            throw std::invalid_argument("The low watermark can't be above the high watermark");
+        if (high < static_cast<size_t>(MAX_PACKET_SIZE))
+            throw std::invalid_argument("The high watermark must leave room for a packet of MAX_PACKET_SIZE");
+
+        std::lock_guard<std::mutex> lock(sendMutex);
+        lowWatermark = low;
+        highWatermark = high;
+        overflowPolicy = policy;
+    }
 
-        inflateEnd(&zs);
+    /*Bounds what is read ahead of the handlers.*/
+    void NetworkClient::Impl::setReceiveBudget(size_t maxBytes, size_t maxPackets) {
+        //Half the budget must hold a partly received packet, or reading would never resume.
+        if (maxBytes < 2 * static_cast<size_t>(MAX_PACKET_SIZE))
+            throw std::invalid_argument("The receive budget must hold two packets of MAX_PACKET_SIZE");
+        if (maxPackets == 0)
+            throw std::invalid_argument("The receive budget must allow at least one packet");
 
-        if (ret != Z_STREAM_END)
-            throw std::runtime_error("NetworkClient::decompressData: Exception during zlib decompression.");
+        {
+            std::lock_guard<std::mutex> lock(receiveMutex);
+            maxUnhandledBytes = maxBytes;
+            maxUndeliveredPackets = maxPackets;
+        }
 
-        return outData;
+        //Resumes reading if the new budget is larger.
+        releaseReceived(0, 0);
     }
 
-    /*Asynchronously connects to a remote endpoint.
-    @param endpoint The remote endpoint to connect to.*/
-    void NetworkClient::Impl::connectAsync(asio::ip::tcp::endpoint endpoint) {
-        auto self(shared_from_this());
-        socket.connectAsync(endpoint, [this, self](std::error_code ec) {
-            if (!ec) {
-                Logger::Log("Connected to server!", LogLevel::info);
-                
-                receiveAsync();
-                heartbeatCheckThread = std::thread(&NetworkClient::Impl::checkForMissedHeartbeats, self);
-                sendHeartbeatsThread = std::thread(&NetworkClient::Impl::sendHeartbeatAsync, self);
-            }
-            else {
-                Logger::Log("Error connecting to server: " + ec.message(), LogLevel::error);
-                if (onConnectionLostHandler)
-                    onConnectionLostHandler(getNetworkClientSharedPtr());
-            }
-        });
+    /*Queues a frame that is ready for the wire, and starts writing if nothing else is.*/
+    void NetworkClient::Impl::queueWrite(std::shared_ptr<std::vector<uint8_t>> frame, SendPriority priority,
+        std::function<void(const std::error_code&)> onWritten, uint64_t coalescingKey) {
+        queuePending({ std::move(frame), std::chrono::steady_clock::now(), Tracing::isEnabled() ? Tracing::now() : 0, nullptr,
+            std::move(onWritten), coalescingKey }, priority);
     }
 
-    void NetworkClient::Impl::sendHeartbeatAsync()
-    {
-        while (!stopSendingHeartbeats)
+    /*Queues a frame or file, and starts writing if nothing else is.
+    @param last Set for the goodbye, which is written once everything else has been.*/
+    void NetworkClient::Impl::queuePending(PendingWrite pending, SendPriority priority, bool last) {
+        std::vector<PendingWrite> dropped;
+        std::vector<PendingWrite> superseded;
+        bool disconnect = false;
+
         {
-            try
-            {
-                HeartbeatPacket heartbeat((std::chrono::system_clock::now() > lastHeartbeatSent) ?
-                    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - lastHeartbeatSent) :
-                    std::chrono::duration_cast<std::chrono::milliseconds>(lastHeartbeatSent - std::chrono::system_clock::now()));
-                lastHeartbeatSent = std::chrono::system_clock::now();
-                auto heartbeatData = heartbeat.toByteArray();
-                Packet pulse((uint8_t)ParloIDs::Heartbeat, *heartbeatData, false);
-                sendAsync(pulse.buildPacket());
-            }
-            catch (const std::exception& e)
-            {
-                Logger::Log("Error sending heartbeat: " + std::string(e.what()), LogLevel::error);
+            std::lock_guard<std::mutex> lock(sendMutex);
+            if (pending.data)
+                pending.data = reframe(std::move(pending.data), HeaderFormat::Legacy, headerFormat);
+            size_t size = pending.data ? pending.data->size() : 0;
+
+            bool replaced = pending.coalescingKey != 0 && replaceQueued(pending, priority, superseded);
+
+            //Control frames are few and small, and heartbeats and goodbyes must get through.
+            if (!replaced && priority != SendPriority::Control && queuedBytes + size > highWatermark && !makeRoom(size, dropped)) {
+                metrics.add(ConnectionCounter::DroppedFrames);
+                dropped.push_back(std::move(pending));
+                disconnect = overflowPolicy == OverflowPolicy::Disconnect;
             }
+            else if (!replaced) {
+                metrics.add(ConnectionCounter::SendQueueDepth);
+                metrics.add(ConnectionCounter::SendQueueBytes, size);
+                queuedBytes += size;
+
+                if (last) {
+                    goodbye = std::move(pending);
+                    closeWhenDrained = true;
+                    holding = false; //Nothing is sent after the goodbye, so everything goes now.
+                    handshaking = false;
+                }
+                else {
+                    SendLane& lane = lanes[static_cast<size_t>(priority)];
+                    lane.queue.push_back(std::move(pending));
+                    queuedWrites++;
 
-            std::this_thread::sleep_for(std::chrono::seconds(heartbeatInterval));
-        }
-    }
-
-    void NetworkClient::Impl::checkForMissedHeartbeats()
-    {
-        while (!stopCheckMissedHeartbeats)
-        {
-            std::this_thread::sleep_for(std::chrono::seconds(heartbeatInterval));
+                    if (lane.queue.back().coalescingKey != 0) {
+                        //An older frame with the same key that couldn't be replaced is still sent, but no longer replaced.
+                        auto older = coalescing.find(lane.queue.back().coalescingKey);
+                        if (older != coalescing.end())
+                            older->second.pending->coalescingKey = 0;
 
-            {
-                std::lock_guard<std::mutex> lock(heartbeatsMutex);
-                missedHeartbeats++;
-            }
+                        coalescing[lane.queue.back().coalescingKey] = { &lane.queue.back(), static_cast<size_t>(priority) };
+                    }
 
-            if (missedHeartbeats > maxMissedHeartbeats)
-            {
-                {
-                    std::lock_guard<std::mutex> lock(aliveMutex);
-                    isAlive = false;
+                    if (priority != SendPriority::Control)
+                        holdFrame(size);
                 }
 
-                if (onConnectionLostHandler)
-                    onConnectionLostHandler(getNetworkClientSharedPtr());
+                if (!writeInProgress && ((!holding && !handshaking) || priority == SendPriority::Control))
+                    startWriting();
             }
         }
-    }
 
-    /*Asynchronously disconnects from a remote endpoint.
-    @param sendDisconnectMessage Whether or not to send a disconnection message to the other party. Defaults to true.*/
-    void NetworkClient::Impl::disconnectAsync(bool sendDisconnectMessage)
-    {
-        try
-        {
-            if (connected && socket.isOpen())
-            {
-                if (sendDisconnectMessage)
-                {
-                    GoodbyePacket byePacket((int)ParloDefaultTimeouts::Client);
-                    std::vector<uint8_t> byeData = byePacket.toByteArray();
-                    Packet goodbye((uint8_t)ParloIDs::CGoodbye, byeData, false);
-                    sendAsync(goodbye.buildPacket());
-                }
+        for (auto& frame : superseded) {
+            if (frame.onWritten)
+                frame.onWritten(std::make_error_code(std::errc::operation_canceled));
+        }
 
-                if (socket.isOpen())
-                {
-                    //Shutdown both send and receive operations and close the socket
-                    socket.shutdown();
-                    socket.close();
-                }
+        for (auto& frame : dropped) {
+            if (frame.onWritten)
+                frame.onWritten(std::make_error_code(std::errc::no_buffer_space));
+        }
 
-                if (!stopCheckMissedHeartbeats) {
-                    stopCheckMissedHeartbeats = true;
-                    if (heartbeatCheckThread.joinable())
-                        heartbeatCheckThread.join();
-                }
+        if (disconnect) {
+            PARLO_LOG(LogLevel::warn, "The send queue overflowed, disconnecting");
 
-                if (!stopSendingHeartbeats) {
-                    stopSendingHeartbeats = true;
+            auto self(owner->shared_from_this());
+            asio::post(socket.native_handle().get_executor(), [this, self]() {
+                handleWriteError(std::make_error_code(std::errc::no_buffer_space), 0);
+            });
+        }
+    }
 
-                    if (sendHeartbeatsThread.joinable())
-                        sendHeartbeatsThread.join();
-                }
+    /*Puts a frame in the place of the queued frame with the same coalescing key. Called with sendMutex held.
+    @return False if the frame must be queued like any other.*/
+    bool NetworkClient::Impl::replaceQueued(PendingWrite& pending, SendPriority priority, std::vector<PendingWrite>& superseded) {
+        auto queued = coalescing.find(pending.coalescingKey);
+        if (queued == coalescing.end() || queued->second.lane != static_cast<size_t>(priority))
+            return false;
 
-                connected = false;
+        PendingWrite& older = *queued->second.pending;
+        size_t replaced = older.data->size();
+        size_t size = pending.data->size();
+
+        //Growing the queue is held to the high watermark like queueing another frame is.
+        if (priority != SendPriority::Control && size > replaced && queuedBytes - replaced + size > highWatermark)
+            return false;
+
+        queuedBytes = queuedBytes - replaced + size;
+        metrics.subtract(ConnectionCounter::SendQueueBytes, replaced);
+        metrics.add(ConnectionCounter::SendQueueBytes, size);
+        metrics.add(ConnectionCounter::SupersededFrames);
+
+        superseded.push_back(std::move(older));
+        older = std::move(pending);
+        return true;
+    }
+
+    /*Starts writing what's queued. Called with sendMutex held, and writeInProgress unset.*/
+    void NetworkClient::Impl::startWriting() {
+        writeInProgress = true;
+
+        //Make sure the NetworkClient instance says alive for the duration of the async operation...
+        auto self(owner->shared_from_this());
+        asio::post(socket.native_handle().get_executor(), [this, self]() {
+            writeQueued();
+        });
+    }
+
+    /*Holds back an application frame that was just queued, if batching is on. Called with sendMutex held.
+    @param size The frame's size.*/
+    void NetworkClient::Impl::holdFrame(size_t size) {
+        //Frames queued behind a write that's already going out are written along with it.
+        if (batchDelay.count() == 0 || (writeInProgress && !holding))
+            return;
+
+        if (!holding) {
+            holding = true;
+            heldBytes = 0;
+
+            //A timer of its own for every batch, as timers can't be cancelled from other threads.
+            uint64_t generation = ++batchGeneration;
+            auto timer = std::make_shared<asio::steady_timer>(socket.native_handle().get_executor(), batchDelay);
+            std::weak_ptr<NetworkClient> weakSelf = owner->weak_from_this();
+            timer->async_wait([this, timer, weakSelf, generation](std::error_code ec) {
+                auto self = weakSelf.lock();
+                if (!ec && self)
+                    releaseBatch(generation);
+            });
+        }
+
+        heldBytes += size;
+        if (heldBytes >= batchBytes)
+            holding = false;
+    }
+
+    /*Writes the frames held back by setBatching().
+    @param generation The batch to write, or 0 for whichever is held.*/
+    void NetworkClient::Impl::releaseBatch(uint64_t generation) {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        if (!holding || (generation != 0 && generation != batchGeneration))
+            return;
+
+        holding = false;
+        if (!writeInProgress)
+            startWriting();
+    }
+
+    /*Holds back packets while nothing is being written.*/
+    void NetworkClient::Impl::setBatching(std::chrono::microseconds maxDelay, size_t maxBytes) {
+        if (maxDelay.count() < 0)
+            throw std::invalid_argument("The batch delay can't be negative");
+        if (maxBytes == 0)
+            throw std::invalid_argument("A batch must be allowed at least one byte");
+
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            batchDelay = maxDelay;
+            batchBytes = maxBytes;
+        }
+
+        if (maxDelay.count() == 0)
+            releaseBatch();
+    }
+
+    /*Offers the local capabilities, and holds back application frames until the other end's arrive or the timeout passes.*/
+    void NetworkClient::Impl::beginHandshake() {
+        if (!localCapabilities)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            handshaking = true;
+        }
+
+        sendHello();
+
+        //Another end that's too old for a handshake passes the hello on as an ordinary packet, and never answers.
+        auto timer = std::make_shared<asio::steady_timer>(socket.native_handle().get_executor(), handshakeTimeout);
+        std::weak_ptr<NetworkClient> weakSelf = owner->weak_from_this();
+        timer->async_wait([this, timer, weakSelf](std::error_code ec) {
+            auto self = weakSelf.lock();
+            if (ec || !self)
+                return;
+
+            std::lock_guard<std::mutex> lock(sendMutex);
+            if (!handshaking)
+                return;
+
+            PARLO_LOG(LogLevel::warn, "The other end didn't answer the handshake, sending as before");
+            handshaking = false;
+            if (!writeInProgress)
+                startWriting();
+        });
+    }
+
+    /*Sends the local capabilities, or the defaults if none were set, unless they were sent already.*/
+    void NetworkClient::Impl::sendHello() {
+        std::vector<uint8_t> hello;
+
+        {
+            std::lock_guard<std::mutex> lock(handshakeMutex);
+            if (helloSent)
+                return;
+
+            helloSent = true;
+            hello = (localCapabilities ? *localCapabilities : Capabilities()).toByteArray();
+        }
+
+        sendAsync(Packet(static_cast<uint8_t>(ParloIDs::Hello), hello, false).buildPacket(), SendPriority::Control);
+    }
+
+    /*Agrees on capabilities with the other end, and switches to them. Called on the ProcessingBuffer's thread.*/
+    void NetworkClient::Impl::handleHello(const Packet& packet) {
+        Capabilities remote;
+        try {
+            remote = Capabilities::fromByteArray(packet.getData());
+            sendHello();
+        }
+        catch (const std::exception& e) {
+            PARLO_LOG(LogLevel::error, "Handshake failed, disconnecting: {}", e.what());
+            disconnectAsync(false);
+            return;
+        }
+
+        Capabilities agreed = Capabilities::negotiate(localCapabilities ? *localCapabilities : Capabilities(), remote);
+        maxFrameSize = agreed.maxFrameSize;
+        compressionLevel = agreed.compressionLevel;
+        if (agreed.codecs.empty())
+            applyCompression = false;
+
+        {
+            std::lock_guard<std::mutex> lock(handshakeMutex);
+            negotiated = agreed;
+        }
+
+        finishHandshake(agreed);
+    }
+
+    /*Queues the HelloAck as the last frame framed the old way, and frames everything else in the agreed format.*/
+    void NetworkClient::Impl::finishHandshake(const Capabilities& agreed) {
+        std::vector<PendingWrite> oversized;
+
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            HeaderFormat previous = headerFormat;
+            HeaderFormat format = agreed.headerFormats.front();
+            if (agreed.maxBatchDelay.count() > 0)
+                batchDelay = agreed.maxBatchDelay;
+
+            auto ack = reframe(std::make_shared<std::vector<uint8_t>>(
+                Packet(static_cast<uint8_t>(ParloIDs::HelloAck), { PROTOCOL_VERSION }, false).buildPacket()), HeaderFormat::Legacy, previous);
+            queuedBytes += ack->size();
+            metrics.add(ConnectionCounter::SendQueueDepth);
+            metrics.add(ConnectionCounter::SendQueueBytes, ack->size());
+            lanes[static_cast<size_t>(SendPriority::Control)].queue.push_back({ std::move(ack), std::chrono::steady_clock::now(), 0, nullptr, nullptr, 0 });
+            queuedWrites++;
+
+            headerFormat = format;
+            if (format != previous) {
+                auto reframeQueued = [&](PendingWrite& pending) {
+                    if (!pending.data)
+                        return;
+
+                    size_t before = pending.data->size();
+                    pending.data = reframe(std::move(pending.data), previous, format);
+                    queuedBytes = queuedBytes - before + pending.data->size();
+                    metrics.subtract(ConnectionCounter::SendQueueBytes, before);
+                    metrics.add(ConnectionCounter::SendQueueBytes, pending.data->size());
+                };
+
+                for (size_t i = static_cast<size_t>(SendPriority::High); i < SEND_LANES; i++) {
+                    for (PendingWrite& pending : lanes[i].queue)
+                        reframeQueued(pending);
+                }
+                if (goodbye)
+                    reframeQueued(*goodbye);
+            }
+
+            //Frames queued before the agreement are written after the ack, when the other end rejects anything larger.
+            for (size_t i = static_cast<size_t>(SendPriority::High); i < SEND_LANES; i++) {
+                std::deque<PendingWrite> kept;
+                for (PendingWrite& pending : lanes[i].queue) {
+                    if (pending.data && pending.data->size() > agreed.maxFrameSize)
+                        oversized.push_back(std::move(pending));
+                    else
+                        kept.push_back(std::move(pending));
+                }
+                lanes[i].queue.swap(kept);
+            }
+
+            //The lanes were rebuilt, so the frames that can still be replaced have moved.
+            coalescing.clear();
+            for (size_t i = static_cast<size_t>(SendPriority::High); i < SEND_LANES; i++) {
+                for (PendingWrite& pending : lanes[i].queue) {
+                    if (pending.coalescingKey != 0)
+                        coalescing[pending.coalescingKey] = { &pending, i };
+                }
+            }
+
+            if (!oversized.empty()) {
+                size_t bytes = 0;
+                for (const PendingWrite& pending : oversized)
+                    bytes += pending.data->size();
+
+                queuedBytes -= bytes;
+                queuedWrites -= oversized.size();
+                metrics.subtract(ConnectionCounter::SendQueueBytes, bytes);
+                metrics.subtract(ConnectionCounter::SendQueueDepth, oversized.size());
+                metrics.add(ConnectionCounter::OversizedFrames, oversized.size());
+                metrics.add(ConnectionCounter::DroppedFrames, oversized.size());
+            }
+
+            handshaking = false;
+            if (!writeInProgress)
+                startWriting();
+        }
+
+        for (auto& frame : oversized) {
+            if (frame.onWritten)
+                frame.onWritten(std::make_error_code(std::errc::message_size));
+        }
+    }
+
+    /*Parses what the other end sends after its HelloAck the agreed way. Called on the ProcessingBuffer's thread,
+    so the ProcessingBuffer switches before it parses the next packet.*/
+    void NetworkClient::Impl::handleHelloAck() {
+        std::optional<Capabilities> agreed;
+        {
+            std::lock_guard<std::mutex> lock(handshakeMutex);
+            agreed = negotiated;
+        }
+
+        //The other end sends its hello before its ack, so this end has agreed already.
+        if (!agreed) {
+            PARLO_LOG(LogLevel::warn, "Received a HelloAck before a Hello");
+            return;
+        }
+
+        processingBuffer.setHeaderFormat(agreed->headerFormats.front());
+        processingBuffer.setMaxFrameSize(agreed->maxFrameSize);
+
+        if (onNegotiatedHandler) {
+            if (auto client = owner->weak_from_this().lock())
+                onNegotiatedHandler(client, *agreed);
+        }
+    }
+
+    /*Applies the OverflowPolicy to a frame that doesn't fit under the high watermark. Called with sendMutex held.
+    @return False if the frame must be dropped instead.*/
+    bool NetworkClient::Impl::makeRoom(size_t size, std::vector<PendingWrite>& dropped) {
+        overflowed = true;
+        metrics.add(ConnectionCounter::OverflowedFrames);
+
+        if (overflowPolicy == OverflowPolicy::Reject)
+            throw std::system_error(std::make_error_code(std::errc::no_buffer_space), "The send queue is full");
+        if (overflowPolicy == OverflowPolicy::Disconnect)
+            return false;
+
+        while (queuedBytes + size > highWatermark) {
+            //The oldest frame at the front of an application lane. Files hold no buffers, so they're left alone.
+            SendLane* oldest = nullptr;
+            for (size_t i = static_cast<size_t>(SendPriority::High); i < SEND_LANES; i++) {
+                SendLane& lane = lanes[i];
+                if (!lane.queue.empty() && !lane.queue.front().file &&
+                    (!oldest || lane.queue.front().enqueuedAt < oldest->queue.front().enqueuedAt))
+                    oldest = &lane;
+            }
+
+            if (!oldest)
+                return false;
+
+            PendingWrite& front = oldest->queue.front();
+            if (front.coalescingKey != 0)
+                coalescing.erase(front.coalescingKey);
+
+            queuedBytes -= front.data->size();
+            metrics.subtract(ConnectionCounter::SendQueueBytes, front.data->size());
+            metrics.subtract(ConnectionCounter::SendQueueDepth);
+            metrics.add(ConnectionCounter::DroppedFrames);
+
+            dropped.push_back(std::move(front));
+            oldest->queue.pop_front();
+            queuedWrites--;
+        }
+
+        return true;
+    }
+
+    /*Counts bytes that have been written or dropped out of the send queue.*/
+    void NetworkClient::Impl::releaseQueuedBytes(size_t bytes) {
+        std::function<void(const std::shared_ptr<NetworkClient>&)> onWritable;
+
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            queuedBytes -= bytes;
+            metrics.subtract(ConnectionCounter::SendQueueBytes, bytes);
+
+            if (overflowed && queuedBytes <= lowWatermark) {
+                overflowed = false;
+                onWritable = onWritableHandler;
+            }
+        }
+
+        if (onWritable && connected)
+            onWritable(owner->shared_from_this());
+    }
+
+    /*Writes the queued frames with a single gathered write, and keeps going until the queue is empty.*/
+    void NetworkClient::Impl::writeQueued() {
+        auto batch = std::make_shared<std::vector<PendingWrite>>();
+        std::shared_ptr<OutgoingFile> file;
+        HeaderFormat format;
+
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            bool controlQueued = !lanes[static_cast<size_t>(SendPriority::Control)].queue.empty();
+            size_t laneIndex = !holding && !handshaking ? nextLane() : controlQueued ? static_cast<size_t>(SendPriority::Control) : SEND_LANES;
+            format = headerFormat;
+
+            if (laneIndex == SEND_LANES) {
+                if (!goodbye) {
+                    writeInProgress = false;
+
+                    if (closeWhenDrained)
+                        closeSocket();
+
+                    return;
+                }
+
+                batch->push_back(std::move(*goodbye));
+                goodbye.reset();
+            }
+            else {
+                SendLane& lane = lanes[laneIndex];
+                bool metered = laneIndex != static_cast<size_t>(SendPriority::Control);
+
+                //Files are written a segment at a time, on their own.
+                if (lane.queue.front().file) {
+                    lane.deficit -= writeCost(lane.queue.front());
+                    file = std::move(lane.queue.front().file);
+                    lane.queue.pop_front();
+                    queuedWrites--;
+                }
+                else {
+                    //nextLane() made sure the first frame is affordable.
+                    size_t count = 0;
+                    while (count < (std::min)(lane.queue.size(), MAX_WRITE_BATCH) && !lane.queue[count].file) {
+                        int64_t cost = writeCost(lane.queue[count]);
+                        if (metered && cost > lane.deficit)
+                            break;
+
+                        if (metered)
+                            lane.deficit -= cost;
+                        if (lane.queue[count].coalescingKey != 0)
+                            coalescing.erase(lane.queue[count].coalescingKey);
+                        count++;
+                    }
+
+                    batch->assign(std::make_move_iterator(lane.queue.begin()), std::make_move_iterator(lane.queue.begin() + count));
+                    lane.queue.erase(lane.queue.begin(), lane.queue.begin() + count);
+                    queuedWrites -= count;
+                }
+            }
+        }
+
+        if (file) {
+            writeFileStep(std::move(file), format);
+            return;
+        }
+
+        std::vector<asio::const_buffer> buffers;
+        buffers.reserve(batch->size());
+        for (auto& pending : *batch)
+            buffers.push_back(asio::buffer(*pending.data));
+
+        //Make sure the NetworkClient instance says alive for the duration of the async operation...
+        auto self(owner->shared_from_this());
+        asio::async_write(socket.native_handle(), buffers,
+            [this, self, batch](std::error_code ec, std::size_t bytes_transferred) {
+                size_t written = 0;
+                for (auto& pending : *batch) {
+                    written += pending.data->size();
+                    metrics.subtract(ConnectionCounter::SendQueueDepth);
+                    recordLatency(&LatencyHistograms::sendLatency, pending.enqueuedAt);
+
+                    //The write overlaps whatever else the io_context runs, so it's an async span.
+                    if (pending.traceStart != 0)
+                        Tracing::recordAsync("NetworkClient::write", pending.traceStart, Tracing::now());
+
+                    if (pending.onWritten)
+                        pending.onWritten(ec);
+                }
+
+                releaseQueuedBytes(written);
+
+                if (ec) {
+                    handleWriteError(ec, batch->size());
+                    return;
+                }
+
+                metrics.add(ConnectionCounter::Writes);
+                metrics.add(ConnectionCounter::PacketsSent, batch->size());
+                metrics.add(ConnectionCounter::BytesSent, bytes_transferred);
+
+                writeQueued();
+            });
+    }
+
+    /*Picks the lane to write from next. Called with sendMutex held.
+    @return The lane, or SEND_LANES if every lane is empty.*/
+    size_t NetworkClient::Impl::nextLane() {
+        if (!lanes[static_cast<size_t>(SendPriority::Control)].queue.empty())
+            return static_cast<size_t>(SendPriority::Control);
+
+        if (queuedWrites == 0)
+            return SEND_LANES;
+
+        //Terminates, since a lane with something queued is given another quantum every time around.
+        for (;;) {
+            SendLane& lane = lanes[currentLane];
+
+            if (lane.queue.empty())
+                lane.deficit = 0; //Idle lanes don't save up for later.
+            else {
+                if (!laneTurnStarted) {
+                    lane.deficit += lane.weight * LANE_QUANTUM;
+                    laneTurnStarted = true;
+                }
+
+                if (writeCost(lane.queue.front()) <= lane.deficit)
+                    return currentLane;
             }
+
+            currentLane = currentLane + 1 < SEND_LANES ? currentLane + 1 : static_cast<size_t>(SendPriority::High);
+            laneTurnStarted = false;
+        }
+    }
+
+    /*How many bytes the next write of a frame or file step puts on the wire.*/
+    int64_t NetworkClient::Impl::writeCost(const PendingWrite& pending) const {
+        if (!pending.file)
+            return static_cast<int64_t>(pending.data->size());
+
+        const OutgoingFile& file = *pending.file;
+        uint64_t step = file.zeroCopy ? FILE_SEGMENT_SIZE : fileChunkSize() * MAX_WRITE_BATCH;
+        return static_cast<int64_t>((std::min)(step, file.end - file.position));
+    }
+
+    /*Writes the next segment of a file, or the next batch of chunks if it isn't sent zero copy.
+    @param format The header format, as it was when the step was taken off the queue.*/
+    void NetworkClient::Impl::writeFileStep(std::shared_ptr<OutgoingFile> file, HeaderFormat format) {
+        PARLO_TRACE_SCOPE("NetworkClient::writeFile");
+
+        //Make sure the NetworkClient instance says alive for the duration of the async operation...
+        auto self(owner->shared_from_this());
+
+        if (!file->zeroCopy) {
+            //Whole packets, so they can be compressed like any other.
+            auto frames = std::make_shared<std::vector<std::shared_ptr<std::vector<uint8_t>>>>();
+            do {
+                size_t length = static_cast<size_t>((std::min)(static_cast<uint64_t>(fileChunkSize()), file->end - file->position));
+
+                std::vector<uint8_t> payload;
+                payload.reserve(FILE_CHUNK_HEADER_SIZE + length);
+                appendLittleEndian(payload, file->id, 4);
+                appendLittleEndian(payload, file->position - file->start, 8);
+                appendLittleEndian(payload, file->end - file->start, 8);
+                payload.insert(payload.end(), file->mapping.data() + file->position, file->mapping.data() + file->position + length);
+
+                frames->push_back(reframe(prepareFrame(Packet(ParloIDs::FileChunk, payload, false).buildPacket()), HeaderFormat::Legacy, format));
+                file->position += length;
+            } while (frames->size() < MAX_WRITE_BATCH && file->position < file->end);
+
+            std::vector<asio::const_buffer> buffers;
+            buffers.reserve(frames->size());
+            for (auto& frame : *frames)
+                buffers.push_back(asio::buffer(*frame));
+
+            asio::async_write(socket.native_handle(), buffers,
+                [this, self, file, frames](std::error_code ec, std::size_t bytes_transferred) {
+                    if (!ec) {
+                        metrics.add(ConnectionCounter::Writes);
+                        metrics.add(ConnectionCounter::PacketsSent, frames->size());
+                        metrics.add(ConnectionCounter::BytesSent, bytes_transferred);
+                    }
+
+                    finishFileStep(file, ec);
+                });
+
+            return;
+        }
+
+        uint64_t length = (std::min)(FILE_SEGMENT_SIZE, file->end - file->position);
+
+        std::vector<uint8_t> payload;
+        payload.reserve(FILE_SEGMENT_HEADER_SIZE);
+        appendLittleEndian(payload, file->id, 4);
+        appendLittleEndian(payload, file->position - file->start, 8);
+        appendLittleEndian(payload, file->end - file->start, 8);
+        appendLittleEndian(payload, length, 4);
+        auto header = reframe(std::make_shared<std::vector<uint8_t>>(Packet(ParloIDs::FileSegment, payload, false).buildPacket()),
+            HeaderFormat::Legacy, format);
+
+#ifdef __linux__
+        //The header goes through asio, and the body from the page cache to the socket without being copied in between.
+        asio::async_write(socket.native_handle(), asio::buffer(*header),
+            [this, self, file, header, length](std::error_code ec, std::size_t bytes_transferred) {
+                if (ec) {
+                    finishFileStep(file, ec);
+                    return;
+                }
+
+                metrics.add(ConnectionCounter::Writes);
+                metrics.add(ConnectionCounter::PacketsSent);
+                metrics.add(ConnectionCounter::BytesSent, bytes_transferred);
+                sendFileBody(file, length);
+            });
+#else
+        std::vector<asio::const_buffer> buffers = { asio::buffer(*header),
+            asio::buffer(file->mapping.data() + file->position, static_cast<size_t>(length)) };
+
+        asio::async_write(socket.native_handle(), buffers,
+            [this, self, file, header, length](std::error_code ec, std::size_t bytes_transferred) {
+                if (!ec) {
+                    file->position += length;
+                    metrics.add(ConnectionCounter::Writes);
+                    metrics.add(ConnectionCounter::PacketsSent);
+                    metrics.add(ConnectionCounter::BytesSent, bytes_transferred);
+                }
+
+                finishFileStep(file, ec);
+            });
+#endif
+    }
+
+#ifdef __linux__
+    /*Writes the body of a file segment with sendfile(), waiting for the socket whenever it's full.
+    @param file The file.
+    @param remaining How much of the segment is left to write.*/
+    void NetworkClient::Impl::sendFileBody(std::shared_ptr<OutgoingFile> file, uint64_t remaining) {
+        auto& native = socket.native_handle();
+        std::error_code ec;
+        native.native_non_blocking(true, ec);
+
+        while (remaining > 0 && !ec) {
+            off_t offset = static_cast<off_t>(file->position);
+            ssize_t sent = ::sendfile(native.native_handle(), file->mapping.fileDescriptor(), &offset, static_cast<size_t>(remaining));
+
+            if (sent < 0) {
+                if (errno == EINTR)
+                    continue;
+
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    auto self(owner->shared_from_this());
+                    native.async_wait(asio::ip::tcp::socket::wait_write, [this, self, file, remaining](std::error_code ec) {
+                        if (ec)
+                            finishFileStep(file, ec);
+                        else
+                            sendFileBody(file, remaining);
+                    });
+
+                    return;
+                }
+
+                ec.assign(errno, asio::error::get_system_category());
+            }
+            else if (sent == 0) //The file was truncated while it was being sent.
+                ec = asio::error::eof;
+            else {
+                file->position += static_cast<uint64_t>(sent);
+                remaining -= static_cast<uint64_t>(sent);
+                metrics.add(ConnectionCounter::BytesSent, static_cast<uint64_t>(sent));
+            }
+        }
+
+        finishFileStep(file, ec);
+    }
+#endif
+
+    /*Reports a file's progress, and queues it again behind whatever was sent meanwhile if it isn't done.*/
+    void NetworkClient::Impl::finishFileStep(std::shared_ptr<OutgoingFile> file, const std::error_code& ec) {
+        if (ec) {
+            handleWriteError(ec, 1, file);
+            return;
+        }
+
+        FileTransferProgress progress = file->progress();
+        if (file->onProgress)
+            file->onProgress(progress, ec);
+
+        if (progress.isComplete()) {
+            metrics.subtract(ConnectionCounter::SendQueueDepth);
+            recordLatency(&LatencyHistograms::sendLatency, file->enqueuedAt);
+        }
+        else {
+            //Back in its lane, behind whatever was queued in it meanwhile.
+            std::lock_guard<std::mutex> lock(sendMutex);
+            lanes[static_cast<size_t>(file->priority)].queue.push_back({ nullptr, file->enqueuedAt, 0, file, nullptr, 0 });
+            queuedWrites++;
+        }
+
+        writeQueued();
+    }
+
+    /*Drops everything queued after a failed write, and tells files being sent about it.
+    @param ec The error.
+    @param inFlight How many frames the failed write held.
+    @param file The file the failed write was part of, if any.*/
+    void NetworkClient::Impl::handleWriteError(const std::error_code& ec, size_t inFlight, std::shared_ptr<OutgoingFile> file) {
+        metrics.add(ConnectionCounter::DroppedFrames, inFlight);
+
+        std::vector<std::shared_ptr<OutgoingFile>> files;
+        if (file) {
+            metrics.subtract(ConnectionCounter::SendQueueDepth);
+            files.push_back(std::move(file));
+        }
+
+        std::vector<std::function<void(const std::error_code&)>> dropped;
+
+        {
+            //Nothing more can be written, so drop whatever is still queued.
+            std::lock_guard<std::mutex> lock(sendMutex);
+            size_t count = goodbye ? 1 : 0;
+            size_t bytes = goodbye ? goodbye->data->size() : 0;
+
+            for (auto& lane : lanes) {
+                for (auto& pending : lane.queue) {
+                    if (pending.file)
+                        files.push_back(std::move(pending.file));
+                    else {
+                        bytes += pending.data->size();
+                        if (pending.onWritten)
+                            dropped.push_back(std::move(pending.onWritten));
+                    }
+                }
+
+                count += lane.queue.size();
+                lane.queue.clear();
+                lane.deficit = 0;
+            }
+
+            metrics.add(ConnectionCounter::DroppedFrames, count);
+            metrics.subtract(ConnectionCounter::SendQueueDepth, count);
+            metrics.subtract(ConnectionCounter::SendQueueBytes, bytes);
+            queuedBytes -= bytes;
+            overflowed = false;
+            holding = false;
+            coalescing.clear();
+            goodbye.reset();
+            queuedWrites = 0;
+            writeInProgress = false;
+        }
+
+        for (auto& failed : files) {
+            if (failed->onProgress)
+                failed->onProgress(failed->progress(), ec);
+        }
+
+        for (auto& onWritten : dropped)
+            onWritten(ec);
+
+        if (connected.exchange(false)) {
+            PARLO_LOG(LogLevel::error, "Error in sendAsync: {}", ec);
+            closeSocket();
+
+            if (onConnectionLostHandler)
+                onConnectionLostHandler(owner->shared_from_this());
+        }
+    }
+
+    /*Shuts down and closes the socket on its executor, which cancels any outstanding operations.*/
+    void NetworkClient::Impl::closeSocket() {
+        std::error_code ec;
+        heartbeatTimer.cancel(ec);
+        heartbeatCheckTimer.cancel(ec);
+
+        auto self(owner->weak_from_this().lock());
+        asio::post(socket.native_handle().get_executor(), [this, self]() {
+            std::error_code ec;
+            socket.native_handle().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+            socket.native_handle().close(ec);
+        });
+    }
+
+    /*Should data be compressed based on the RTT (Round Trip Time)?
+    @param data The data to consider.
+    @param rtt The round trip time.*/
+    bool NetworkClient::Impl::shouldCompressData(const std::vector<uint8_t>& data, int rtt) {
+        if (data.empty())
+            throw std::invalid_argument("Data cannot be null or empty");
+
+        if (!applyCompression)
+            return false;
+
+        if (data.size() < COMPRESSION_THRESHOLD)
+            return false;
+
+        if (rtt > RTT_COMPRESSION_THRESHOLD)
+            return true;
+
+        return false;
+    }
+
+    /*Asynchronously connects to a remote endpoint.
+    @param endpoint The remote endpoint to connect to.*/
+    void NetworkClient::Impl::connectAsync(asio::ip::tcp::endpoint endpoint, std::function<void(const std::error_code&)> onConnected) {
+        auto self(owner->shared_from_this());
+
+        //Open the socket first, so buffer sizes are in place when the window scale is negotiated.
+        if (socketOptions) {
+            std::error_code ec;
+            if (!socket.isOpen())
+                socket.native_handle().open(endpoint.protocol(), ec);
+
+            if (!ec)
+                socket.applyOptions(*socketOptions);
+        }
+        socket.connectAsync(endpoint, [this, self, onConnected](std::error_code ec) {
+            if (!ec) {
+                PARLO_LOG(LogLevel::info, "Connected to server!");
+
+                connected = true;
+                start();
+            }
+            else {
+                PARLO_LOG(LogLevel::error, "Error connecting to server: {}", ec);
+                if (onConnectionLostHandler)
+                    onConnectionLostHandler(self);
+            }
+
+            if (onConnected)
+                onConnected(ec);
+        });
+    }
+
+    void NetworkClient::Impl::sendHeartbeatAsync()
+    {
+        if (!connected)
+            return;
+
+        sendHeartbeat();
+        scheduleHeartbeat();
+    }
+
+    void NetworkClient::Impl::scheduleHeartbeat() {
+        std::weak_ptr<NetworkClient> weakOwner = owner->shared_from_this();
+
+        heartbeatTimer.expires_after(std::chrono::seconds(heartbeatInterval));
+        heartbeatTimer.async_wait([weakOwner](std::error_code ec) {
+            if (ec)
+                return;
+
+            if (auto client = weakOwner.lock())
+                client->pImpl->sendHeartbeatAsync();
+        });
+    }
+
+    /*Sends a single heartbeat.
+    @param echo The heartbeat to echo back, if any.
+    @param echoDelay How long the echoed heartbeat was held.*/
+    void NetworkClient::Impl::sendHeartbeat(const HeartbeatPacket* echo, std::chrono::microseconds echoDelay)
+    {
+        try
+        {
+            auto now = std::chrono::steady_clock::now();
+            HeartbeatPacket heartbeat(std::chrono::duration_cast<std::chrono::milliseconds>(now - lastHeartbeatSent));
+            lastHeartbeatSent = now;
+
+            if (echo)
+                heartbeat.setEcho(echo->getSentTimestamp(), echoDelay);
+
+            auto heartbeatData = heartbeat.toByteArray();
+            Packet pulse((uint8_t)ParloIDs::Heartbeat, *heartbeatData, false);
+            sendAsync(pulse.buildPacket(), SendPriority::Control);
+        }
+        catch (const std::exception& e)
+        {
+            PARLO_LOG(LogLevel::error, "Error sending heartbeat: {}", e.what());
+        }
+    }
+
+    /*Resets the missed heartbeats, takes an RTT sample from a heartbeat that echoes one of ours,
+    and echoes heartbeats that ask for it.*/
+    void NetworkClient::Impl::handleHeartbeat(const Packet& packet)
+    {
+        auto receivedAt = HeartbeatPacket::now();
+
+        {
+            std::lock_guard<std::mutex> aliveLock(aliveMutex);
+            isAlive = true;
+        }
+
+        {
+            //The std::lock_guard is a RAII (Resource Acquisition Is Initialization) type which
+            //means it acquires the lock when it is created and releases it when it goes out of scope.
+            std::lock_guard<std::mutex> heartbeatsLock(heartbeatsMutex);
+            missedHeartbeats = 0;
+        }
+
+        auto data = std::make_shared<std::vector<uint8_t>>(packet.getData());
+        HeartbeatPacket heartbeat = HeartbeatPacket::byteArrayToObject(data);
+
+        if (heartbeat.hasEcho()) {
+            //Both timestamps are from our own steady_clock, so wall clock adjustments can't skew the sample.
+            auto sample = receivedAt - heartbeat.getEchoTimestamp() - heartbeat.getEchoDelay();
+
+            if (sample.count() > 0) {
+                std::lock_guard<std::mutex> lock(rttMutex);
+                rttEstimator.addSample(sample);
+            }
+        }
+
+        if (heartbeat.getRequestsEcho() && connected)
+            sendHeartbeat(&heartbeat, HeartbeatPacket::now() - receivedAt);
+    }
+
+    void NetworkClient::Impl::checkForMissedHeartbeats()
+    {
+        if (!connected)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(heartbeatsMutex);
+            missedHeartbeats++;
+        }
+
+        //One increment per interval is expected; anything beyond that is a heartbeat that never came.
+        if (missedHeartbeats > 1)
+            metrics.add(ConnectionCounter::MissedHeartbeats);
+
+        if (missedHeartbeats > maxMissedHeartbeats)
+        {
+            {
+                std::lock_guard<std::mutex> lock(aliveMutex);
+                isAlive = false;
+            }
+
+            if (connected.exchange(false)) {
+                closeSocket();
+
+                if (onConnectionLostHandler)
+                    onConnectionLostHandler(getNetworkClientSharedPtr());
+            }
+
+            return;
+        }
+
+        scheduleHeartbeatCheck();
+    }
+
+    void NetworkClient::Impl::scheduleHeartbeatCheck() {
+        std::weak_ptr<NetworkClient> weakOwner = owner->shared_from_this();
+
+        heartbeatCheckTimer.expires_after(std::chrono::seconds(heartbeatInterval));
+        heartbeatCheckTimer.async_wait([weakOwner](std::error_code ec) {
+            if (ec)
+                return;
+
+            if (auto client = weakOwner.lock())
+                client->pImpl->checkForMissedHeartbeats();
+        });
+    }
+
+    /*Asynchronously disconnects from a remote endpoint. A disconnection message is sent before
+    the socket is closed; anything sent before it is still delivered.
+    @param sendDisconnectMessage Whether or not to send a disconnection message to the other party. Defaults to true.*/
+    void NetworkClient::Impl::disconnectAsync(bool sendDisconnectMessage)
+    {
+        try
+        {
+            if (!socket.isOpen() || !connected.exchange(false))
+                return;
+
+            std::error_code ec;
+            heartbeatTimer.cancel(ec);
+            heartbeatCheckTimer.cancel(ec);
+
+            if (sendDisconnectMessage)
+            {
+                GoodbyePacket byePacket((int)ParloDefaultTimeouts::Client);
+                std::vector<uint8_t> byeData = byePacket.toByteArray();
+                Packet goodbye((uint8_t)ParloIDs::CGoodbye, byeData, false);
+
+                queuePending({ std::make_shared<std::vector<uint8_t>>(goodbye.buildPacket()), std::chrono::steady_clock::now(), 0, nullptr, nullptr, 0 },
+                    SendPriority::Control, true);
+            }
+            else
+                closeSocket();
         }
         catch (const asio::system_error& e)
         {
-            Logger::Log("Exception during NetworkClient::disconnectAsync(): " + std::string(e.what()), LogLevel::error);
+            PARLO_LOG(LogLevel::error, "Exception during NetworkClient::disconnectAsync(): {}", e.what());
         }
         catch (const std::exception& e)
         {
-            Logger::Log("Exception during NetworkClient::disconnectAsync(): " + std::string(e.what()), LogLevel::error);
+            PARLO_LOG(LogLevel::error, "Exception during NetworkClient::disconnectAsync(): {}", e.what());
         }
     }
 
@@ -628,19 +2075,205 @@ namespace Parlo
         pImpl->setOnReceivedDataHandler(handler);
     }
 
+    void NetworkClient::setOnWritableHandler(std::function<void(const std::shared_ptr<NetworkClient>&)> handler) {
+        pImpl->setOnWritableHandler(handler);
+    }
+
+    /*Sets a handler for file data sent with sendFileAsync().
+    @param handler The handler for the event.*/
+    void NetworkClient::setOnFileDataHandler(std::function<void(const std::shared_ptr<NetworkClient>&, const FileTransferProgress&,
+        const std::vector<uint8_t>&)> handler) {
+        pImpl->onFileDataHandler = handler;
+    }
+
     void NetworkClient::setApplyCompression(bool apply) {
         pImpl->setApplyCompression(apply);
     }
 
+    /*Appends everything this NetworkClient receives to a capture. Set it before connecting.
+    @param capture The capture to append to, or nullptr to stop capturing.*/
+    void NetworkClient::setCapture(std::shared_ptr<TrafficCapture> capture) {
+        if (capture)
+            pImpl->captureConnection = capture->addConnection();
+
+        pImpl->capture = std::move(capture);
+    }
+
+    /*Sets the TCP options to apply when connecting, or right away if already connected.
+    @param options The options. Options that aren't set are left as they are.*/
+    void NetworkClient::setSocketOptions(const SocketOptions& options) {
+        pImpl->socketOptions = options;
+        pImpl->quickAck = options.quickAck.value_or(false);
+
+        if (pImpl->socket.isOpen())
+            pImpl->socket.applyOptions(options);
+    }
+
+    /*Reads back the effective TCP options of this NetworkClient's socket.
+    @throws std::runtime_error if the socket isn't open.*/
+    SocketOptions NetworkClient::getSocketOptions() {
+        return pImpl->socket.getOptions();
+    }
+
+    /*Holds back everything this NetworkClient receives the way a slower link would. Set it before connecting.
+    @param shaper The shaper to hold received data back with, or nullptr to receive it as soon as it's read.*/
+    void NetworkClient::setLinkShaper(std::shared_ptr<LinkShaper> shaper) {
+        pImpl->linkShaper = std::move(shaper);
+    }
+
+    bool NetworkClient::isConnected() const {
+        return pImpl->connected;
+    }
+
+    RTTStats NetworkClient::getRTTStats() const {
+        std::lock_guard<std::mutex> lock(pImpl->rttMutex);
+        return pImpl->rttEstimator.getStats();
+    }
+
+    ConnectionMetrics NetworkClient::getMetrics() const {
+        return pImpl->metrics.snapshot();
+    }
+
+    LatencyMetrics NetworkClient::getLatencyMetrics() const {
+        return pImpl->latency.snapshot();
+    }
+
+    void NetworkClient::resetLatencyMetrics() {
+        pImpl->latency.reset();
+    }
+
+    /*Sets the Listener wide totals this connection's counters also count towards.*/
+    void NetworkClient::setMetricsTotals(std::shared_ptr<ConnectionCounters> totals) {
+        pImpl->metrics.setTotals(std::move(totals));
+    }
+
+    void NetworkClient::measureRTTAsync() {
+        if (!pImpl->connected)
+            throw std::runtime_error("Socket is not connected");
+
+        pImpl->sendHeartbeat();
+    }
+
     void NetworkClient::connectAsync(const asio::ip::tcp::endpoint endpoint) {
         pImpl->connectAsync(endpoint);
     }
 
-    void NetworkClient::sendAsync(const std::vector<uint8_t>& data) {
-        pImpl->sendAsync(data);
+    void NetworkClient::sendAsync(const std::vector<uint8_t>& data, SendPriority priority, uint64_t coalescingKey) {
+        pImpl->sendAsync(data, priority, coalescingKey);
+    }
+
+    uint32_t NetworkClient::sendFileAsync(const std::string& path, uint64_t offset, uint64_t length, FileProgressCallback onProgress,
+        SendPriority priority) {
+        return pImpl->sendFileAsync(path, offset, length, std::move(onProgress), priority);
+    }
+
+    void NetworkClient::setLaneWeight(SendPriority lane, uint32_t weight) {
+        pImpl->setLaneWeight(lane, weight);
+    }
+
+    void NetworkClient::setSendWatermarks(size_t low, size_t high, OverflowPolicy policy) {
+        pImpl->setSendWatermarks(low, high, policy);
+    }
+
+    size_t NetworkClient::getQueuedBytes() const {
+        return pImpl->queuedBytes;
+    }
+
+    void NetworkClient::setReceiveBudget(size_t maxBytes, size_t maxPackets) {
+        pImpl->setReceiveBudget(maxBytes, maxPackets);
+    }
+
+    void NetworkClient::setBatching(std::chrono::microseconds maxDelay, size_t maxBytes) {
+        pImpl->setBatching(maxDelay, maxBytes);
+    }
+
+    void NetworkClient::flush() {
+        pImpl->releaseBatch();
+    }
+
+    /*Sets how packets are framed on this connection, from the next packet sent or processed on.
+    Packets that were queued before are sent in the format they were queued in.
+    @param format The format.*/
+    void NetworkClient::setHeaderFormat(HeaderFormat format) {
+        {
+            std::lock_guard<std::mutex> lock(pImpl->sendMutex);
+            pImpl->headerFormat = format;
+        }
+
+        pImpl->processingBuffer.setHeaderFormat(format);
+    }
+
+    /*Offers capabilities in a handshake when the connection is made. Set it before connecting.
+    @param capabilities What this end supports.
+    @param timeout How long to wait for the other end.*/
+    void NetworkClient::setCapabilities(const Capabilities& capabilities, std::chrono::milliseconds timeout) {
+        capabilities.validate();
+        if (timeout.count() <= 0)
+            throw std::invalid_argument("The handshake timeout must be positive");
+
+        pImpl->localCapabilities = capabilities;
+        pImpl->handshakeTimeout = timeout;
+    }
+
+    /*What both ends agreed on in the handshake, or nothing if there hasn't been one yet.*/
+    std::optional<Capabilities> NetworkClient::getNegotiatedCapabilities() const {
+        std::lock_guard<std::mutex> lock(pImpl->handshakeMutex);
+        return pImpl->negotiated;
+    }
+
+    void NetworkClient::setOnNegotiatedHandler(std::function<void(const std::shared_ptr<NetworkClient>&, const Capabilities&)> handler) {
+        pImpl->onNegotiatedHandler = std::move(handler);
     }
 
     void NetworkClient::disconnectAsync(bool sendDisconnectMessage) {
         pImpl->disconnectAsync(sendDisconnectMessage);
     }
-}
\ No newline at end of file
+
+#ifdef PARLO_COROUTINES
+    /*Queues received packets for receive(), instead of handing them to the OnReceivedData handler.*/
+    void NetworkClient::queueReceivedPackets() {
+        pImpl->queueReceived = true;
+    }
+
+    /*Connects to a remote endpoint.
+    @param endpoint The remote endpoint to connect to.
+    @throws std::system_error if the connection failed.*/
+    asio::awaitable<void> NetworkClient::connect(const asio::ip::tcp::endpoint endpoint) {
+        //Something like a RPCChannel may have taken over the received packets already.
+        if (!pImpl->onReceivedDataHandler)
+            pImpl->queueReceived = true;
+
+        return suspendCoroutine(pImpl->handlerMemory, [this, endpoint](SuspendedCoroutine<>* suspended) {
+            pImpl->connectAsync(endpoint, [suspended](const std::error_code& ec) { suspended->complete(ec); });
+        });
+    }
+
+    /*Waits for the next packet, decompressed.
+    @return The packet.
+    @throws std::system_error once the connection is lost and every packet received before that has been returned.*/
+    asio::awaitable<std::shared_ptr<Packet>> NetworkClient::receive() {
+        pImpl->queueReceived = true;
+
+        std::shared_ptr<Packet> packet = co_await pImpl->receivedPackets.pop();
+        pImpl->releaseReceived(0, 1);
+        co_return packet;
+    }
+
+    /*Sends a packet through the same queue as sendAsync(), and waits until it was written to the socket.
+    The packet is checked and compressed right away, so errors are thrown before anything is awaited.
+    @param packet The packet to send.*/
+    asio::awaitable<void> NetworkClient::send(const Packet& packet, SendPriority priority) {
+        std::vector<uint8_t> data = packet.buildPacket();
+        pImpl->checkSendable(data);
+
+        return suspendCoroutine(pImpl->handlerMemory, [this, frame = pImpl->prepareFrame(data), priority](SuspendedCoroutine<>* suspended) mutable {
+            try {
+                pImpl->queueWrite(std::move(frame), priority, [suspended](const std::error_code& ec) { suspended->complete(ec); });
+            }
+            catch (const std::system_error& e) {
+                suspended->fail(e.code());
+            }
+        });
+    }
+#endif
+}
@@ -41,6 +41,7 @@ namespace Parlo
 
         uint8_t getID() const { return id; }
         uint8_t getIsCompressed() const { return isCompressed; }
+        uint8_t getIsReliable() const { return isReliable; }
         uint16_t getLength() const { return length; }
         const std::vector<uint8_t>& getData() const { return data; }
 
@@ -110,6 +111,12 @@ namespace Parlo
         return pImpl->getIsCompressed();
     }
 
+    /*Is this packet supposed to be transferred reliably? Always 0 for TCP packets.*/
+    uint8_t Packet::getIsReliable() const
+    {
+        return pImpl->getIsReliable();
+    }
+
     uint16_t Packet::getLength() const
     {
         return pImpl->getLength();
@@ -21,9 +21,12 @@ Contributor(s): ______________________________________.
 #include <atomic>
 #include <chrono>
 #include <iostream>
+#include <string>
 #include <stdexcept>
 #include <functional>
+#include <optional>
 #include "PacketHeaders.h"
+#include "FrameHeader.h"
 #include "BlockingQueue.h"
 #include <asio.hpp>
 
@@ -47,9 +50,200 @@ namespace Parlo
 {
     class Listener; //Forward declaration
     class Socket;
+    struct SocketOptions;
+    class UDPListener;
+    class UDPSocket;
+    struct ConnectionCounters;
+    class TrafficCapture;
+    class LinkShaper;
+    struct Capabilities;
 
     const int MAX_PACKET_SIZE = 1024;
 
+    /*The order in which reliable UDP packets on a channel are delivered.*/
+    enum class DeliveryOrder
+    {
+        Ordered,
+        Unordered
+    };
+
+    /*The lane a packet is queued in by NetworkClient. Control packets are written before anything else,
+    and the other lanes share the connection by weight, so bulk data can't hold up smaller, more urgent packets.*/
+    enum class SendPriority : uint8_t
+    {
+        /*Heartbeats, and anything else that mustn't wait behind data.*/
+        Control,
+        High,
+        Normal,
+        /*The default for files.*/
+        Bulk
+    };
+
+    /*What NetworkClient::sendAsync() does with a packet that would take the bytes queued to be sent past the high watermark.
+    Control packets are always queued.*/
+    enum class OverflowPolicy : uint8_t
+    {
+        /*Throws a std::system_error with std::errc::no_buffer_space. The packet isn't sent.*/
+        Reject,
+        /*Drops the oldest queued packets until the packet fits, or the packet itself if they aren't enough.*/
+        DropOldest,
+        /*Drops the packet and everything queued, and closes the connection as if it was lost.*/
+        Disconnect
+    };
+
+    /*How many bytes a NetworkClient queues to be sent before its OverflowPolicy kicks in,
+    and how few it must be down to before its OnWritable handler is called.*/
+    const size_t DEFAULT_SEND_HIGH_WATERMARK = 4 * 1024 * 1024;
+    const size_t DEFAULT_SEND_LOW_WATERMARK = 1024 * 1024;
+
+    /*How many bytes a NetworkClient reads ahead of its handlers, and how many packets it queues for receive(),
+    before it stops reading from the socket.*/
+    const size_t DEFAULT_RECEIVE_BUDGET_BYTES = 1024 * 1024;
+    const size_t DEFAULT_RECEIVE_BUDGET_PACKETS = 4096;
+
+    /*How many bytes NetworkClient::setBatching() holds back before they're written regardless of the delay.*/
+    const size_t DEFAULT_BATCH_BYTES = 16 * 1024;
+
+    /*How long a NetworkClient waits for the other end's capabilities before it gives up on the handshake.*/
+    const std::chrono::milliseconds DEFAULT_HANDSHAKE_TIMEOUT(2000);
+
+    /*Makes a key for NetworkClient::sendAsync() that coalesces packets with the same ID about the same thing,
+    I.E the position updates of one entity.
+    @param packetID The packet's ID.
+    @param subject What the packet is about. Only the lower 56 bits are used.*/
+    inline uint64_t makeCoalescingKey(uint8_t packetID, uint64_t subject) {
+        return static_cast<uint64_t>(packetID) << 56 | (subject & 0x00FFFFFFFFFFFFFFull);
+    }
+
+    /*Statistics for the reliability layer of a UDP connection.*/
+    struct ReliabilityStats
+    {
+        uint64_t packetsSent = 0;
+        uint64_t retransmissions = 0;
+        uint64_t packetsLost = 0;
+        uint64_t duplicatesReceived = 0;
+        size_t congestionWindow = 0;
+        size_t bytesInFlight = 0;
+        std::chrono::microseconds smoothedRTT{ 0 };
+    };
+
+    /*Round trip time statistics for a connection, measured on steady_clock.
+    All values are zero until the first sample has been taken.*/
+    struct RTTStats
+    {
+        std::chrono::microseconds latestRTT{ 0 };
+        std::chrono::microseconds smoothedRTT{ 0 };
+        /*RTTVAR, I.E the jitter.*/
+        std::chrono::microseconds rttVariance{ 0 };
+        std::chrono::microseconds minRTT{ 0 };
+        uint64_t sampleCount = 0;
+    };
+
+    /*Files are sent in segments of this many bytes, so other packets can go out between them.*/
+    const uint64_t FILE_SEGMENT_SIZE = 256 * 1024;
+
+    /*Payload sizes of ParloIDs::FileSegment packets: [uint32_t transfer][uint64_t offset][uint64_t total][uint32_t length],
+    and of the header of ParloIDs::FileChunk packets: [uint32_t transfer][uint64_t offset][uint64_t total]. Little endian.*/
+    const size_t FILE_SEGMENT_HEADER_SIZE = 24;
+    const size_t FILE_CHUNK_HEADER_SIZE = 20;
+
+    /*How far along a file sent with NetworkClient::sendFileAsync() is.*/
+    struct FileTransferProgress
+    {
+        uint32_t transferID = 0;
+        uint64_t transferred = 0;
+        uint64_t total = 0;
+
+        bool isComplete() const { return transferred == total; }
+    };
+
+    /*A snapshot of a connection's counters.*/
+    struct ConnectionMetrics
+    {
+        uint64_t bytesSent = 0;
+        uint64_t bytesReceived = 0;
+        uint64_t packetsSent = 0;
+        uint64_t packetsReceived = 0;
+        /*Completed socket reads.*/
+        uint64_t reads = 0;
+        /*packetsReceived / reads.*/
+        double framesPerRead = 0.0;
+        /*Completed socket writes of packets.*/
+        uint64_t writes = 0;
+        /*packetsSent / writes.*/
+        double framesPerWrite = 0.0;
+        /*Bytes not sent thanks to compression.*/
+        uint64_t compressionBytesSaved = 0;
+        /*Writes that have been started but not completed.*/
+        int64_t sendQueueDepth = 0;
+        /*Bytes of those writes.*/
+        int64_t sendQueueBytes = 0;
+        /*Bytes read from the socket that haven't been handled yet.*/
+        int64_t receiveQueueBytes = 0;
+        /*How many times reading was paused because the receive budget was spent.*/
+        uint64_t readPauses = 0;
+        /*Frames that failed to send or couldn't be decoded.*/
+        uint64_t droppedFrames = 0;
+        /*Frames rejected for exceeding MAX_PACKET_SIZE.*/
+        uint64_t oversizedFrames = 0;
+        /*Frames replaced by a newer one with the same coalescing key before they were sent.*/
+        uint64_t supersededFrames = 0;
+        /*Packets that would have taken the send queue past its high watermark.*/
+        uint64_t overflowedFrames = 0;
+        uint64_t missedHeartbeats = 0;
+    };
+
+    /*A snapshot of a latency histogram. Percentiles are accurate to within 6.25%.*/
+    struct LatencySnapshot
+    {
+        uint64_t count = 0;
+        std::chrono::nanoseconds min{ 0 };
+        std::chrono::nanoseconds max{ 0 };
+        std::chrono::nanoseconds mean{ 0 };
+        std::chrono::nanoseconds p50{ 0 };
+        std::chrono::nanoseconds p90{ 0 };
+        std::chrono::nanoseconds p99{ 0 };
+        std::chrono::nanoseconds p999{ 0 };
+    };
+
+    /*Latency histograms for a connection, or for all connections.*/
+    struct LatencyMetrics
+    {
+        /*From sendAsync() until the write completed.*/
+        LatencySnapshot sendLatency;
+        /*From the socket read that completed a packet until onReceivedDataHandler is invoked.*/
+        LatencySnapshot receiveLatency;
+    };
+
+    /*Latency histograms for all connections in this process.*/
+    PARLO_API LatencyMetrics getGlobalLatencyMetrics();
+    PARLO_API void resetGlobalLatencyMetrics();
+
+    /*Turns recording of trace events on or off. Tracing is off by default, and costs next to nothing while it is.*/
+    PARLO_API void setTracingEnabled(bool enabled);
+    PARLO_API bool isTracingEnabled();
+
+    /*Writes the recorded trace events to a file in the Chrome trace event format, which can be loaded into
+    chrome://tracing or https://ui.perfetto.dev. The events of threads that have exited are only written once,
+    and only those of the last TRACE_MAX_EXITED_BUFFERS of them are kept until then.
+    @param path The file to write.
+    @throws std::runtime_error if the file couldn't be written.*/
+    PARLO_API void writeTrace(const std::string& path);
+
+    /*Discards every recorded trace event.*/
+    PARLO_API void clearTrace();
+
+    /*A snapshot of a Listener's counters.*/
+    struct ListenerMetrics
+    {
+        uint64_t accepts = 0;
+        /*Connections that disconnected or were lost. accepts and disconnects together are the churn.*/
+        uint64_t disconnects = 0;
+        int64_t activeConnections = 0;
+        /*Totals for every connection this Listener has accepted, including closed ones.*/
+        ConnectionMetrics connections;
+    };
+
     /*A packet is used to send data across a network.*/
     class Packet
     {
@@ -60,6 +254,7 @@ namespace Parlo
 
         PARLO_API uint8_t getID() const;
         PARLO_API uint8_t getIsCompressed() const;
+        PARLO_API uint8_t getIsReliable() const;
         PARLO_API uint16_t getLength() const;
         PARLO_API const std::vector<uint8_t>& getData() const;
 
@@ -83,15 +278,45 @@ namespace Parlo
         using PacketProcessedCallback = std::function<void(const Packet&)>;
         PARLO_API void setOnPacketProcessedHandler(PacketProcessedCallback callback);
 
+        /*Sets a handler for the raw bytes that follow a ParloIDs::FileSegment packet. They're handed over
+        as they arrive instead of being parsed as packets. Called on the processing thread, after the
+        OnPacketProcessed handler was called with the segment's header.*/
+        using RawDataCallback = std::function<void(const std::vector<uint8_t>&)>;
+        PARLO_API void setOnRawDataHandler(RawDataCallback callback);
+
+        /*Sets a handler for a frame whose header is malformed, or that's larger than the maximum frame size.
+        There's no telling where the next frame starts, so everything after it is dropped. Called once, on the
+        processing thread.*/
+        using InvalidFrameCallback = std::function<void()>;
+        PARLO_API void setOnInvalidFrameHandler(InvalidFrameCallback callback);
+
         PARLO_API void addData(const std::vector<uint8_t>& data);
 
         PARLO_API uint8_t operator[](size_t index) const;
 
         PARLO_API size_t bufferCount() const;
 
+        /*Blocks until every byte added so far has been processed, and every complete packet handed to the OnPacketProcessed handler.*/
+        PARLO_API void waitUntilProcessed();
+
+        /*When the last byte of the packet being processed was added. Only valid inside the OnPacketProcessed handler.*/
+        PARLO_API std::chrono::steady_clock::time_point getReceivedTime() const;
+
+        /*The length of the packet being processed as it was received, header included. Only valid inside the OnPacketProcessed handler.*/
+        PARLO_API size_t getPacketSize() const;
+
+        /*Sets how the packets that haven't been processed yet are framed. Legacy by default.
+        Takes effect from the next packet on, so it can be called from the OnPacketProcessed handler.*/
+        PARLO_API void setHeaderFormat(HeaderFormat format);
+
+        /*Sets the largest frame accepted, header included. MAX_PACKET_SIZE by default.
+        Takes effect from the next packet on, so it can be called from the OnPacketProcessed handler.*/
+        PARLO_API void setMaxFrameSize(size_t size);
+
     private:
         class Impl;
-        std::unique_ptr<Impl> pImpl;
+        //Shared with the processing thread, which may outlive this instance if it's destroyed from a handler.
+        std::shared_ptr<Impl> pImpl;
     };
 
     /*The NetworkClient class represents a NetworkClient that can connect to a remote endpoint and receive data.*/
@@ -101,15 +326,124 @@ namespace Parlo
         class Impl;
         std::unique_ptr<Impl> pImpl;
 
+        /*Sets the Listener wide totals this connection's counters also count towards.*/
+        void setMetricsTotals(std::shared_ptr<ConnectionCounters> totals);
+
+        /*Starts receiving and sending heartbeats on an accepted connection.*/
+        void start();
+
+#ifdef PARLO_COROUTINES
+        /*Queues received packets for receive(), instead of handing them to the OnReceivedData handler.*/
+        void queueReceivedPackets();
+#endif
+
+        friend class Listener;
+
     public:
         PARLO_API NetworkClient(Socket& socket, std::shared_ptr<Listener> listener);
+        /*Constructs a NetworkClient for a socket accepted by a Listener, taking ownership of the socket.*/
+        PARLO_API NetworkClient(Socket&& socket, std::shared_ptr<Listener> listener);
         PARLO_API NetworkClient(Socket& socket);
         PARLO_API ~NetworkClient();
 
         PARLO_API Socket* getSocket();
 
         PARLO_API void connectAsync(const asio::ip::tcp::endpoint endpoint);
-        PARLO_API void sendAsync(const std::vector<uint8_t>& data);
+        /*Sends a packet.
+        @param data The packet.
+        @param priority The lane to queue it in. Packets in the same lane are sent in order.
+        @param coalescingKey If a packet with the same key is still queued, it's replaced by this one in its place
+        in the queue, so only the latest value is sent. Use makeCoalescingKey(), or 0 to always send the packet.
+        A packet in another lane isn't replaced, and neither is one if replacing it would take the send queue past
+        its high watermark. This one is then queued as usual, the OverflowPolicy applies to it, and both are sent.
+        @throws std::system_error with std::errc::no_buffer_space if the send queue is full and the OverflowPolicy is Reject.*/
+        PARLO_API void sendAsync(const std::vector<uint8_t>& data, SendPriority priority = SendPriority::Normal,
+            uint64_t coalescingKey = 0);
+
+        using FileProgressCallback = std::function<void(const FileTransferProgress&, const std::error_code&)>;
+
+        /*Sends part of a file, which the other party receives through its OnFileData handler.
+        On Linux the file is sent with sendfile() straight from the page cache, unless compression is applied,
+        in which case it's sent from a memory mapping as ordinary, compressible packets. The file is sent in
+        segments as the socket drains, so packets sent meanwhile aren't held up for long and memory use stays flat.
+        @param path The file to send.
+        @param offset Where in the file to start.
+        @param length How many bytes to send, or 0 for the rest of the file.
+        @param onProgress Called on the io_context after every segment, and with an error if the connection was lost.
+        @param priority The lane to queue the segments in.
+        @return The transfer's ID, which the receiver's handler is called with.
+        @throws std::runtime_error if the socket isn't connected or the file couldn't be opened.
+        @throws std::out_of_range if the range is outside the file.*/
+        PARLO_API uint32_t sendFileAsync(const std::string& path, uint64_t offset = 0, uint64_t length = 0,
+            FileProgressCallback onProgress = nullptr, SendPriority priority = SendPriority::Bulk);
+
+        /*Sets how much of the connection a lane gets while other lanes are busy too. A lane with twice the
+        weight of another sends twice as many bytes. Defaults to 4 for High, 2 for Normal and 1 for Bulk.
+        @param lane The lane.
+        @param weight Its weight.
+        @throws std::invalid_argument for SendPriority::Control, which always goes first, or a weight of 0.*/
+        PARLO_API void setLaneWeight(SendPriority lane, uint32_t weight);
+
+        /*Bounds the bytes queued to be sent, so a slow peer can't make them grow without limit.
+        Defaults to DEFAULT_SEND_LOW_WATERMARK, DEFAULT_SEND_HIGH_WATERMARK and OverflowPolicy::Reject.
+        @param low Once the queue overflowed, the OnWritable handler is called when it has drained down to this many bytes.
+        @param high Packets that would take the queue past this many bytes are handled by the policy.
+        @param policy What to do with them.
+        @throws std::invalid_argument if low is above high, or high can't hold a packet of MAX_PACKET_SIZE.*/
+        PARLO_API void setSendWatermarks(size_t low, size_t high, OverflowPolicy policy = OverflowPolicy::Reject);
+
+        /*How many bytes are queued to be sent, including those being written. Thread safe.*/
+        PARLO_API size_t getQueuedBytes() const;
+
+        /*Stops reading from the socket while the bytes read but not yet handled, or the packets waiting for receive(),
+        are over budget, so TCP's flow control slows the other party down instead of memory growing.
+        Reading resumes once both are down to half. Defaults to DEFAULT_RECEIVE_BUDGET_BYTES and DEFAULT_RECEIVE_BUDGET_PACKETS.
+        @param maxBytes The bytes that may be read ahead of the handlers.
+        @param maxPackets The packets that may wait for receive().
+        @throws std::invalid_argument if maxBytes can't hold two packets of MAX_PACKET_SIZE, or maxPackets is 0.*/
+        PARLO_API void setReceiveBudget(size_t maxBytes, size_t maxPackets = DEFAULT_RECEIVE_BUDGET_PACKETS);
+
+        /*Holds back packets while nothing is being written, and writes them all at once when flush() is called,
+        maxDelay has passed since the first of them was sent, or maxBytes are held, whichever comes first.
+        Many small packets then go out in full segments rather than a write each. Control packets aren't held,
+        and a disconnect writes whatever is.
+        @param maxDelay How long a packet may be held, or 0 to write packets right away, which is the default.
+        @param maxBytes How many bytes may be held.
+        @throws std::invalid_argument if maxBytes is 0.*/
+        PARLO_API void setBatching(std::chrono::microseconds maxDelay, size_t maxBytes = DEFAULT_BATCH_BYTES);
+
+        /*Writes the packets held back by setBatching() right away, I.E at the end of a tick.*/
+        PARLO_API void flush();
+
+        /*Sets how packets are framed on this connection, from the next packet sent or processed on.
+        Both ends must use the same format. HeaderFormat::Compact shrinks the header of small packets to 2 bytes,
+        and requires sendAsync() to be passed packets built by Packet::buildPacket().
+        @param format The format, HeaderFormat::Legacy by default.*/
+        PARLO_API void setHeaderFormat(HeaderFormat format);
+
+#ifdef PARLO_COROUTINES
+        //The coroutine interface, built with PARLO_COROUTINES. Once receive() is called, connect() is called without
+        //an OnReceivedData handler set, or the NetworkClient came from Listener::accept(), packets are queued for
+        //receive() instead of going to the OnReceivedData handler.
+        //Like an asio socket, the NetworkClient must outlive the co_await.
+
+        /*Connects to a remote endpoint.
+        @param endpoint The remote endpoint to connect to.
+        @throws std::system_error if the connection failed.*/
+        PARLO_API asio::awaitable<void> connect(const asio::ip::tcp::endpoint endpoint);
+
+        /*Waits for the next packet, decompressed. Only one coroutine can wait at a time.
+        @return The packet.
+        @throws std::system_error once the connection is lost and every packet received before that has been returned.*/
+        PARLO_API asio::awaitable<std::shared_ptr<Packet>> receive();
+
+        /*Sends a packet, and waits until it was written to the socket.
+        @param packet The packet to send.
+        @param priority The lane to queue it in.
+        @throws std::overflow_error and std::runtime_error like sendAsync(), and std::system_error if the send queue was full
+        or the write failed.*/
+        PARLO_API asio::awaitable<void> send(const Packet& packet, SendPriority priority = SendPriority::Normal);
+#endif
         
         /*Asynchronously disconnects from a remote endpoint.
         @param sendDisconnectMessage Whether or not to send a disconnection message to the other party. Defaults to true.*/
@@ -117,15 +451,76 @@ namespace Parlo
 
         PARLO_API void setApplyCompression(bool apply);
 
+        /*Appends everything this NetworkClient receives to a capture, which can be replayed with TrafficReplay.
+        Set it before connecting. Pass nullptr to stop capturing.
+        @param capture The capture to append to. Can be shared by many connections.*/
+        PARLO_API void setCapture(std::shared_ptr<TrafficCapture> capture);
+
+        /*Sets the TCP options to apply when connecting, or right away if already connected.
+        Start from SocketOptions::lowLatency() or SocketOptions::bulkThroughput() and override what's needed.
+        @param options The options. Options that aren't set are left as they are.*/
+        PARLO_API void setSocketOptions(const SocketOptions& options);
+
+        /*Reads back the effective TCP options of this NetworkClient's socket.
+        @throws std::runtime_error if the socket isn't open.*/
+        PARLO_API SocketOptions getSocketOptions();
+
+        /*Offers capabilities in a handshake when the connection is made, and uses what both ends support from then on:
+        the header format, compression, batching and the largest packet. Set it before connecting.
+        Packets sent meanwhile are held back until the other end's capabilities arrive, or the timeout passes,
+        after which they're sent as before. A NetworkClient that wasn't set up for a handshake still answers one,
+        offering a default Capabilities. Include Capabilities.h.
+        @param capabilities What this end supports.
+        @param timeout How long to wait for the other end, I.E if it's too old for a handshake.
+        @throws std::invalid_argument if the capabilities can't be offered, or the timeout isn't positive.*/
+        PARLO_API void setCapabilities(const Capabilities& capabilities, std::chrono::milliseconds timeout = DEFAULT_HANDSHAKE_TIMEOUT);
+
+        /*What both ends agreed on in the handshake, or nothing if there hasn't been one yet. Thread safe.*/
+        PARLO_API std::optional<Capabilities> getNegotiatedCapabilities() const;
+
+        /*Sets a handler for the event fired when both ends have agreed on their capabilities.
+        Called on the processing thread, before any packet that was framed the agreed way is handled.*/
+        PARLO_API void setOnNegotiatedHandler(std::function<void(const std::shared_ptr<NetworkClient>&, const Capabilities&)> handler);
+
+        /*Holds back everything this NetworkClient receives the way a slower link would, to test on loopback
+        under WAN conditions. Set it before connecting.
+        @param shaper The shaper to emulate the link with. Can be shared by many connections.*/
+        PARLO_API void setLinkShaper(std::shared_ptr<LinkShaper> shaper);
+
+        /*Is this NetworkClient connected? False until connectAsync() succeeds, and after a disconnection.*/
+        PARLO_API bool isConnected() const;
+
+        /*Round trip time statistics, sampled from heartbeats. Thread safe.*/
+        PARLO_API RTTStats getRTTStats() const;
+
+        /*Sends a heartbeat right away to take an RTT sample, instead of waiting for the next one.*/
+        PARLO_API void measureRTTAsync();
+
+        /*A snapshot of this connection's counters. Thread safe and cheap enough to poll.*/
+        PARLO_API ConnectionMetrics getMetrics() const;
+
+        /*Snapshots of this connection's latency histograms. Thread safe.*/
+        PARLO_API LatencyMetrics getLatencyMetrics() const;
+        PARLO_API void resetLatencyMetrics();
+
         PARLO_API std::shared_ptr<NetworkClient> getSharedPtr() {
             return shared_from_this();
         }
 
-        void setOnClientDisconnectedHandler(std::function<void(const std::shared_ptr<NetworkClient>&)> handler);
-        void setOnConnectionLostHandler(std::function<void(const std::shared_ptr<NetworkClient>&)> handler);
-        void setOnServerDisconnectedHandler(std::function<void(const std::shared_ptr<NetworkClient>&)> handler);
-        void setOnReceivedHeartbeatHandler(std::function<void(const std::shared_ptr<NetworkClient>&)> handler);
-        void setOnReceivedDataHandler(std::function<void(const std::shared_ptr<NetworkClient>&, const std::shared_ptr<Packet>&)> handler);
+        PARLO_API void setOnClientDisconnectedHandler(std::function<void(const std::shared_ptr<NetworkClient>&)> handler);
+        PARLO_API void setOnConnectionLostHandler(std::function<void(const std::shared_ptr<NetworkClient>&)> handler);
+        PARLO_API void setOnServerDisconnectedHandler(std::function<void(const std::shared_ptr<NetworkClient>&)> handler);
+        PARLO_API void setOnReceivedHeartbeatHandler(std::function<void(const std::shared_ptr<NetworkClient>&)> handler);
+        PARLO_API void setOnReceivedDataHandler(std::function<void(const std::shared_ptr<NetworkClient>&, const std::shared_ptr<Packet>&)> handler);
+
+        /*Sets a handler for when the send queue has drained down to the low watermark after it overflowed,
+        I.E it's time to resume sending. Called on the io_context.*/
+        PARLO_API void setOnWritableHandler(std::function<void(const std::shared_ptr<NetworkClient>&)> handler);
+
+        /*Sets a handler for file data sent with sendFileAsync(). Called in order for each piece that arrives,
+        with the progress including that piece. The transfer is done once progress.isComplete().*/
+        PARLO_API void setOnFileDataHandler(std::function<void(const std::shared_ptr<NetworkClient>&, const FileTransferProgress&,
+            const std::vector<uint8_t>&)> handler);
     };
 
     /*A Listener is used to listen for incoming connections.*/
@@ -139,9 +534,48 @@ namespace Parlo
         PARLO_API void stopAccepting();
         PARLO_API BlockingQueue<std::shared_ptr<NetworkClient>>& clients();
 
-        void setApplyCompression(bool apply);
+#ifdef PARLO_COROUTINES
+        /*Waits for the next connection, starting to accept them if this Listener isn't already. Built with PARLO_COROUTINES.
+        Once this is called, connections are queued for it, and their packets are queued for NetworkClient::receive().
+        The OnClientConnected handler is still called. Only one coroutine can wait at a time, and the Listener must outlive the co_await.
+        @return The connection.
+        @throws std::system_error if stopAccepting() is called.*/
+        PARLO_API asio::awaitable<std::shared_ptr<NetworkClient>> accept();
+#endif
+
+        /*The endpoint this Listener is bound to, I.E to find the port picked when binding to port 0.*/
+        PARLO_API asio::ip::tcp::endpoint getLocalEndpoint() const;
+
+        PARLO_API void setApplyCompression(bool apply);
+
+        /*Captures everything received by connections accepted from now on. Pass nullptr to stop.
+        @param capture The capture to append to.*/
+        PARLO_API void setCapture(std::shared_ptr<TrafficCapture> capture);
+
+        /*Shapes what connections accepted from now on receive. Pass nullptr to stop.
+        @param shaper The shaper to emulate the link with, shared by the connections.*/
+        PARLO_API void setLinkShaper(std::shared_ptr<LinkShaper> shaper);
+
+        /*Sets the TCP options applied to connections accepted from now on. Defaults to a 5 second linger.
+        Buffer sizes are set on the listening socket as well, so accepted connections start out with them.
+        @param options The options.*/
+        PARLO_API void setSocketOptions(const SocketOptions& options);
+
+        /*Offers capabilities in a handshake on every connection accepted from now on. See NetworkClient::setCapabilities().
+        @param capabilities What this end supports.
+        @throws std::invalid_argument if the capabilities can't be offered.*/
+        PARLO_API void setCapabilities(const Capabilities& capabilities);
+
+        PARLO_API void setOnClientConnectedHandler(std::function<void(const std::shared_ptr<NetworkClient>&)> handler);
 
-        void setOnClientConnectedHandler(std::function<void(const std::shared_ptr<NetworkClient>&)> handler);
+        /*A snapshot of this Listener's counters. Thread safe and cheap enough to poll.*/
+        PARLO_API ListenerMetrics getMetrics() const;
+
+        /*Sets a handler that is periodically called with a snapshot of this Listener's counters,
+        I.E to push them to an exporter. Pass an empty handler to stop.
+        @param handler The handler.
+        @param interval How often to call the handler.*/
+        PARLO_API void setMetricsHandler(std::function<void(const ListenerMetrics&)> handler, std::chrono::milliseconds interval);
 
         PARLO_API std::shared_ptr<Listener> getSharedPtr() {
             return shared_from_this();
@@ -150,4 +584,109 @@ namespace Parlo
         class Impl;
         std::unique_ptr<Impl> pImpl;
     };
+
+    /*The UDPNetworkClient class represents a connection over UDP.
+    Instances created with connectAsync() own their socket, while instances created by a UDPListener
+    share the listener's socket and are identified by their remote endpoint.
+    Instances must be owned by a std::shared_ptr before they start receiving data.*/
+    class UDPNetworkClient : public std::enable_shared_from_this<UDPNetworkClient>
+    {
+    private:
+        class Impl;
+        std::unique_ptr<Impl> pImpl;
+
+    public:
+        PARLO_API UDPNetworkClient(asio::io_context& context);
+        PARLO_API UDPNetworkClient(std::shared_ptr<UDPSocket> socket, const asio::ip::udp::endpoint& remoteEndpoint,
+            std::shared_ptr<UDPListener> listener);
+        PARLO_API ~UDPNetworkClient();
+
+        PARLO_API void connectAsync(const asio::ip::udp::endpoint& endpoint);
+
+        /*Sends a packet built with Packet(id, data, compressed, reliable).buildPacket() as a single datagram.
+        Reliable packets are acknowledged and retransmitted until they arrive.
+        @param data The packet to send.
+        @param channel The channel reliable packets are ordered within. Defaults to 0.*/
+        PARLO_API void sendAsync(const std::vector<uint8_t>& data, uint8_t channel = 0);
+
+        /*Sets whether reliable packets on a channel are delivered in the order they were sent. Channels are ordered by default.
+        @param channel The channel.
+        @param order The delivery order.*/
+        PARLO_API void setChannelOrder(uint8_t channel, DeliveryOrder order);
+
+        PARLO_API ReliabilityStats getReliabilityStats() const;
+
+        /*Round trip time statistics, sampled from heartbeats and from acknowledgements of reliable packets. Thread safe.*/
+        PARLO_API RTTStats getRTTStats() const;
+
+        /*Sends a heartbeat right away to take an RTT sample, instead of waiting for the next one.*/
+        PARLO_API void measureRTTAsync();
+
+        /*Asynchronously disconnects from a remote endpoint.
+        @param sendDisconnectMessage Whether or not to send a disconnection message to the other party. Defaults to true.*/
+        PARLO_API void disconnectAsync(bool sendDisconnectMessage = true);
+
+        PARLO_API asio::ip::udp::endpoint getRemoteEndpoint() const;
+        PARLO_API bool isConnected() const;
+
+        /*The time elapsed since a datagram was last received from the remote endpoint.*/
+        PARLO_API std::chrono::milliseconds getTimeSinceLastReceived() const;
+
+        /*Processes a datagram received from the remote endpoint. Called by UDPListener for shared sockets.
+        @param data The datagram.
+        @param length The length of the datagram.*/
+        PARLO_API void processDatagram(const uint8_t* data, size_t length);
+
+        /*Holds back, drops and reorders the datagrams this UDPNetworkClient receives the way a worse link would,
+        to test on loopback under WAN conditions. Set it before connecting.
+        @param shaper The shaper to emulate the link with. Can be shared by many connections.*/
+        PARLO_API void setLinkShaper(std::shared_ptr<LinkShaper> shaper);
+
+        PARLO_API std::shared_ptr<UDPNetworkClient> getSharedPtr() {
+            return shared_from_this();
+        }
+
+        PARLO_API void setOnClientDisconnectedHandler(std::function<void(const std::shared_ptr<UDPNetworkClient>&)> handler);
+        PARLO_API void setOnConnectionLostHandler(std::function<void(const std::shared_ptr<UDPNetworkClient>&)> handler);
+        PARLO_API void setOnServerDisconnectedHandler(std::function<void(const std::shared_ptr<UDPNetworkClient>&)> handler);
+        PARLO_API void setOnReceivedHeartbeatHandler(std::function<void(const std::shared_ptr<UDPNetworkClient>&)> handler);
+        PARLO_API void setOnReceivedDataHandler(std::function<void(const std::shared_ptr<UDPNetworkClient>&, const std::shared_ptr<Packet>&)> handler);
+    };
+
+    /*A UDPListener multiplexes connections from many remote endpoints over a single UDP socket.
+    A connection is created when the first valid datagram arrives from a new endpoint.*/
+    class UDPListener : public std::enable_shared_from_this<UDPListener>
+    {
+    public:
+        PARLO_API UDPListener(asio::io_context& context, const asio::ip::udp::endpoint& endpoint);
+        PARLO_API ~UDPListener();
+
+        PARLO_API void startAccepting();
+        PARLO_API void stopAccepting();
+        PARLO_API BlockingQueue<std::shared_ptr<UDPNetworkClient>>& clients();
+
+        PARLO_API asio::ip::udp::endpoint getLocalEndpoint() const;
+
+        /*Sets the time without traffic after which a connection is considered lost. Defaults to ParloDefaultTimeouts::Server.*/
+        PARLO_API void setIdleTimeout(std::chrono::seconds timeout);
+
+        /*Shapes what connections created from now on receive. Pass nullptr to stop.
+        @param shaper The shaper to emulate the link with, shared by the connections.*/
+        PARLO_API void setLinkShaper(std::shared_ptr<LinkShaper> shaper);
+
+        PARLO_API void setOnClientConnectedHandler(std::function<void(const std::shared_ptr<UDPNetworkClient>&)> handler);
+        PARLO_API void setOnClientDisconnectedHandler(std::function<void(const std::shared_ptr<UDPNetworkClient>&)> handler);
+
+        PARLO_API std::shared_ptr<UDPListener> getSharedPtr() {
+            return shared_from_this();
+        }
+    private:
+        class Impl;
+        std::unique_ptr<Impl> pImpl;
+
+        /*Forgets a connection. Called by server side UDPNetworkClient instances that disconnect.*/
+        void removeClient(const asio::ip::udp::endpoint& endpoint);
+
+        friend class UDPNetworkClient;
+    };
 }
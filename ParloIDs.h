@@ -5,6 +5,28 @@ These IDs are reserved, I.E
 should not be used by a protocol.*/
 enum ParloIDs
 {
+    /*The ID for the capabilities an end offers in a handshake. See Capabilities.*/
+    Hello = 0xF6,
+
+    /*The ID for the last packet an end frames the old way, once it has both ends' capabilities.*/
+    HelloAck = 0xF7,
+
+    /*The ID for a request sent by RPCChannel.*/
+    RPCRequest = 0xF8,
+
+    /*The ID for a response sent by RPCChannel.*/
+    RPCResponse = 0xF9,
+
+    /*The ID for the header of a file segment sent by NetworkClient::sendFileAsync().
+    The payload's last 4 bytes hold how many bytes of raw file data follow the packet on the stream.*/
+    FileSegment = 0xFA,
+
+    /*The ID for a piece of a file sent by NetworkClient::sendFileAsync() as an ordinary packet.*/
+    FileChunk = 0xFB,
+
+    /*The ID for an acknowledgement of reliable UDP packets.*/
+    Ack = 0xFC,
+
     /*The ID for a Heartbeat packet.*/
     Heartbeat = 0xFD,
 
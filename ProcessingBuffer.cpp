@@ -12,6 +12,10 @@ Contributor(s): ______________________________________.
 
 #include "pch.h"
 #include "Parlo.h"
+#include "ParloIDs.h"
+#include "Trace.h"
+#include <algorithm>
+#include <deque>
 #include <memory>
 
 namespace Parlo
@@ -25,40 +29,68 @@ namespace Parlo
         using PacketProcessedCallback = std::function<void(const Packet&)>;
         void setOnPacketProcessedHandler(PacketProcessedCallback callback);
 
+        using RawDataCallback = std::function<void(const std::vector<uint8_t>&)>;
+        void setOnRawDataHandler(RawDataCallback callback);
+
+        using InvalidFrameCallback = std::function<void()>;
+        void setOnInvalidFrameHandler(InvalidFrameCallback callback);
+
         void addData(const std::vector<uint8_t>& data);
 
         uint8_t operator[](size_t index) const;
 
         size_t bufferCount() const;
+
+        void waitUntilProcessed();
+
+        std::chrono::steady_clock::time_point getReceivedTime() const;
+
+        size_t getPacketSize() const;
+
+        void setHeaderFormat(HeaderFormat format);
+
+        void setMaxFrameSize(size_t size);
     private:
-        std::queue<uint8_t> internalBuffer;
+        std::deque<uint8_t> internalBuffer;
         mutable std::mutex mutex;
         std::condition_variable cv;
+        /*Notified whenever the processing thread has caught up with the data added.*/
+        std::condition_variable processedCv;
         std::thread processingThread;
         std::atomic<bool> stopProcessing{ false };
 
-        bool hasReadHeader = false;
-        uint8_t currentID = 0;
-        bool isCompressed = false;
-        uint16_t currentLength = 0;
+        HeaderFormat headerFormat = HeaderFormat::Legacy;
+        FrameHeader currentHeader;
+        size_t maxFrameSize = MAX_PACKET_SIZE;
+        /*Set once a frame was rejected. Nothing after it can be framed, so everything is dropped from then on.*/
+        bool invalid = false;
+
+        /*How many raw bytes are still to come after a ParloIDs::FileSegment packet, before the next packet.*/
+        uint64_t rawRemaining = 0;
+
+        /*The total number of bytes added at the end of each addData() call, and when it was called.
+        Used to find out which read completed a packet.*/
+        std::deque<std::pair<uint64_t, std::chrono::steady_clock::time_point>> readMarks;
+        uint64_t bytesAdded = 0;
+        uint64_t bytesConsumed = 0;
+        uint64_t bytesProcessed = 0;
+        std::chrono::steady_clock::time_point receivedTime;
 
         PacketProcessedCallback onPacketProcessedHandler;
+        RawDataCallback onRawDataHandler;
+        InvalidFrameCallback onInvalidFrameHandler;
 
         void processPackets();
-        void readHeader();
+        bool readHeader();
 
         friend class ProcessingBuffer;
     };
 
     ProcessingBuffer::Impl::Impl() : stopProcessing(false) {
-        processingThread = std::thread(&Impl::processPackets, this);
     }
 
+    /*The processing thread has been joined or detached by ~ProcessingBuffer() at this point.*/
     ProcessingBuffer::Impl::~Impl() {
-        stopProcessing.store(true, std::memory_order_relaxed);
-        cv.notify_all();
-        if (processingThread.joinable())
-            processingThread.join();
     }
 
     /*Sets a handler for the OnPacketProcessed event.
@@ -67,6 +99,18 @@ namespace Parlo
         onPacketProcessedHandler = callback;
     }
 
+    /*Sets a handler for the raw bytes that follow a ParloIDs::FileSegment packet.
+    @param RawDataCallback A callback function with the signature: void(const std::vector<uint8_t>&)*/
+    void ProcessingBuffer::Impl::setOnRawDataHandler(RawDataCallback callback) {
+        onRawDataHandler = callback;
+    }
+
+    /*Sets a handler for a frame that's malformed or larger than the maximum frame size.
+    @param InvalidFrameCallback A callback function with the signature: void()*/
+    void ProcessingBuffer::Impl::setOnInvalidFrameHandler(InvalidFrameCallback callback) {
+        onInvalidFrameHandler = callback;
+    }
+
     /*
     * Shovels shit (data) into the buffer.
     * @param The data to add. Needs to be no bigger than MAX_PACKET_SIZE!
@@ -78,8 +122,15 @@ namespace Parlo
 
         {
             std::lock_guard<std::mutex> lock(mutex);
-            for (auto byte : data)
-                internalBuffer.push(byte);
+            //Nothing can be framed after an invalid frame, but it's still counted so waitUntilProcessed() returns.
+            if (!invalid) {
+                for (auto byte : data)
+                    internalBuffer.push_back(byte);
+            }
+
+            bytesAdded += data.size();
+            if (!invalid)
+                readMarks.emplace_back(bytesAdded, std::chrono::steady_clock::now());
         }
 
         cv.notify_one();
@@ -90,84 +141,177 @@ namespace Parlo
         if (index >= internalBuffer.size())
             throw std::out_of_range("ProcessingBuffer: Index out of range!");
 
-        auto tempQueue = internalBuffer;
-        for (size_t i = 0; i < index; ++i)
-            tempQueue.pop();
-
-        return tempQueue.front();
+        return internalBuffer[index];
     }
 
     /*The length of the internal buffer.*/
     size_t ProcessingBuffer::Impl::bufferCount() const {
+        std::lock_guard<std::mutex> lock(mutex);
         return internalBuffer.size();
     }
 
+    /*Blocks until every byte added so far has been processed, and every complete packet handed to the OnPacketProcessed handler.*/
+    void ProcessingBuffer::Impl::waitUntilProcessed() {
+        std::unique_lock<std::mutex> lock(mutex);
+        processedCv.wait(lock, [this] { return bytesProcessed == bytesAdded || stopProcessing; });
+    }
+
+    /*When the last byte of the packet being processed was added. Only valid inside the OnPacketProcessed handler,
+    which is called on the processing thread that sets it, so this doesn't lock.*/
+    std::chrono::steady_clock::time_point ProcessingBuffer::Impl::getReceivedTime() const {
+        return receivedTime;
+    }
+
+    /*The length of the packet being processed as it was received, header included. Only valid inside the
+    OnPacketProcessed handler, so this doesn't lock either.*/
+    size_t ProcessingBuffer::Impl::getPacketSize() const {
+        return currentHeader.headerSize + currentHeader.payloadSize;
+    }
+
+    /*Sets how the packets that haven't been processed yet are framed.
+    Packets are parsed one at a time with the lock held, so this always takes effect at a packet boundary.*/
+    void ProcessingBuffer::Impl::setHeaderFormat(HeaderFormat format) {
+        std::lock_guard<std::mutex> lock(mutex);
+        headerFormat = format;
+    }
+
+    void ProcessingBuffer::Impl::setMaxFrameSize(size_t size) {
+        std::lock_guard<std::mutex> lock(mutex);
+        maxFrameSize = size;
+    }
+
     /*Processes packets.*/
 	void ProcessingBuffer::Impl::processPackets() {
+        uint64_t bytesSeen = 0;
+
         while (!stopProcessing)
         {
             std::unique_lock<std::mutex> lock(mutex);
-            cv.wait(lock, [this] { return !internalBuffer.empty() || stopProcessing; });
+            //Only wake up for new data, so a partial packet doesn't keep this thread spinning.
+            cv.wait(lock, [&] { return bytesAdded != bytesSeen || stopProcessing; });
 
             if (stopProcessing) break;
 
-            if (internalBuffer.size() >= static_cast<size_t>(PacketHeaders::STANDARD)) {
-                if (!hasReadHeader)
-                    readHeader();
-            }
+            bytesSeen = bytesAdded;
 
-            if (hasReadHeader) {
-                if (internalBuffer.size() >= static_cast<size_t>(currentLength - PacketHeaders::STANDARD)) {
-                    std::vector<uint8_t> packetData(currentLength - PacketHeaders::STANDARD);
-                    for (uint16_t i = 0; i < packetData.size(); ++i) {
-                        packetData[i] = internalBuffer.front();
-                        internalBuffer.pop();
+            //A single read can complete many packets, so keep going until the buffer runs dry.
+            while (!stopProcessing) {
+                //The body of a file segment isn't framed, so hand it over as is.
+                if (rawRemaining > 0) {
+                    if (internalBuffer.empty())
+                        break;
+
+                    size_t count = static_cast<size_t>((std::min)(rawRemaining, static_cast<uint64_t>(internalBuffer.size())));
+                    std::vector<uint8_t> raw(internalBuffer.begin(), internalBuffer.begin() + count);
+                    internalBuffer.erase(internalBuffer.begin(), internalBuffer.begin() + count);
+
+                    rawRemaining -= count;
+                    bytesConsumed += count;
+
+                    if (onRawDataHandler) {
+                        lock.unlock();
+                        onRawDataHandler(raw);
+                        lock.lock();
                     }
 
-                    hasReadHeader = false;
-                    Packet packet(currentID, packetData, isCompressed);
-                    
-                    if (onPacketProcessedHandler)
-                        onPacketProcessedHandler(packet);
+                    continue;
+                }
+
+                //The header stays in the buffer until the whole packet has arrived.
+                if (!readHeader())
+                    break;
+
+                //Waiting for the rest of a frame that's too large would never end, so give up on the stream instead.
+                size_t packetLength = currentHeader.headerSize + currentHeader.payloadSize;
+                if (currentHeader.malformed || packetLength > maxFrameSize) {
+                    invalid = true;
+                    bytesConsumed += internalBuffer.size();
+                    internalBuffer.clear();
+                    readMarks.clear();
+
+                    if (onInvalidFrameHandler) {
+                        lock.unlock();
+                        onInvalidFrameHandler();
+                        lock.lock();
+                    }
+
+                    break;
+                }
+
+                if (internalBuffer.size() < packetLength)
+                    break;
+
+                PARLO_TRACE_SCOPE("ProcessingBuffer::processPacket");
+
+                std::vector<uint8_t> packetData(internalBuffer.begin() + currentHeader.headerSize, internalBuffer.begin() + packetLength);
+                internalBuffer.erase(internalBuffer.begin(), internalBuffer.begin() + packetLength);
+
+                bytesConsumed += packetLength;
+
+                //The first read that ends at or after the packet's last byte is the one that completed it.
+                while (!readMarks.empty() && readMarks.front().first < bytesConsumed)
+                    readMarks.pop_front();
+                receivedTime = readMarks.empty() ? std::chrono::steady_clock::now() : readMarks.front().second;
+
+                //The last four bytes of a segment's header are the length of the raw bytes that follow it.
+                if (currentHeader.id == ParloIDs::FileSegment && packetData.size() >= FILE_SEGMENT_HEADER_SIZE) {
+                    size_t end = packetData.size();
+                    rawRemaining = static_cast<uint64_t>(packetData[end - 4]) | static_cast<uint64_t>(packetData[end - 3]) << 8 |
+                        static_cast<uint64_t>(packetData[end - 2]) << 16 | static_cast<uint64_t>(packetData[end - 1]) << 24;
+                }
+
+                Packet packet(currentHeader.id, packetData, currentHeader.compressed);
+
+                //Handlers run without the lock, so a slow one doesn't block whoever is adding data.
+                if (onPacketProcessedHandler) {
+                    lock.unlock();
+                    onPacketProcessedHandler(packet);
+                    lock.lock();
                 }
             }
 
-            std::this_thread::sleep_for(std::chrono::milliseconds(10)); //To prevent hogging the processor
+            bytesProcessed = bytesSeen;
+            processedCv.notify_all();
         }
 	}
 
-    /*Reads a packet's header.*/
-    void ProcessingBuffer::Impl::readHeader() {
-        if (internalBuffer.size() < 4) 
-            return; //Not enough data to read the header
+    /*Reads the header of the packet at the front of the buffer, without removing it.
+    @return False if the whole header hasn't arrived yet.*/
+    bool ProcessingBuffer::Impl::readHeader() {
+        if (headerFormat == HeaderFormat::Compact)
+            return readCompactHeader(internalBuffer, internalBuffer.size(), currentHeader);
 
-        currentID = internalBuffer.front();
-        internalBuffer.pop();
-        isCompressed = internalBuffer.front();
-        internalBuffer.pop();
-
-        //Read two bytes for the length and combine them
-        uint8_t lengthLow = internalBuffer.front();
-        internalBuffer.pop();
-        uint8_t lengthHigh = internalBuffer.front();
-        internalBuffer.pop();
-
-        currentLength = static_cast<uint16_t>(lengthHigh << 8 | lengthLow);
-        std::cout << "lengthLow: " << static_cast<int>(lengthLow) << ", lengthHigh: " << static_cast<int>(lengthHigh) << ", currentLength: " << currentLength << std::endl;
-        hasReadHeader = true;
+        return readLegacyHeader(internalBuffer, internalBuffer.size(), currentHeader);
     }
 
     ProcessingBuffer::ProcessingBuffer()
-        : pImpl(std::make_unique<Impl>())
-    {}
+        : pImpl(std::make_shared<Impl>())
+    {
+        //The thread keeps its own reference, so the Impl outlives it even if it's detached.
+        auto impl = pImpl;
+        pImpl->processingThread = std::thread([impl]() { impl->processPackets(); });
+    }
 
     ProcessingBuffer::~ProcessingBuffer() {
-        if (pImpl) {
-            pImpl->stopProcessing.store(true, std::memory_order_relaxed);
-            pImpl->cv.notify_all();
-            if (pImpl->processingThread.joinable())
-                pImpl->processingThread.join();
+        if (!pImpl)
+            return;
+
+        //Destroyed from the OnPacketProcessed handler, which runs on the processing thread.
+        //The thread sees the flag once the handler returns, and releases the Impl on its way out.
+        if (std::this_thread::get_id() == pImpl->processingThread.get_id()) {
+            pImpl->stopProcessing = true;
+            pImpl->processingThread.detach();
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(pImpl->mutex);
+            pImpl->stopProcessing = true;
         }
+
+        pImpl->cv.notify_all();
+        if (pImpl->processingThread.joinable())
+            pImpl->processingThread.join();
     }
 
     /*Sets a handler for the OnPacketProcessed event.
@@ -176,6 +320,18 @@ namespace Parlo
         pImpl->setOnPacketProcessedHandler(callback);
     }
 
+    /*Sets a handler for the raw bytes that follow a ParloIDs::FileSegment packet.
+    @param RawDataCallback A callback function with the signature: void(const std::vector<uint8_t>&)*/
+    void ProcessingBuffer::setOnRawDataHandler(RawDataCallback callback) {
+        pImpl->setOnRawDataHandler(callback);
+    }
+
+    /*Sets a handler for a frame that's malformed or larger than the maximum frame size.
+    @param InvalidFrameCallback A callback function with the signature: void()*/
+    void ProcessingBuffer::setOnInvalidFrameHandler(InvalidFrameCallback callback) {
+        pImpl->setOnInvalidFrameHandler(callback);
+    }
+
     /*
     * Shovels shit (data) into the buffer.
     * @param The data to add. Needs to be no bigger than MAX_PACKET_SIZE!
@@ -193,4 +349,31 @@ namespace Parlo
     size_t ProcessingBuffer::bufferCount() const {
         return pImpl->bufferCount();
     }
+
+    /*Blocks until every byte added so far has been processed, and every complete packet handed to the OnPacketProcessed handler.*/
+    void ProcessingBuffer::waitUntilProcessed() {
+        pImpl->waitUntilProcessed();
+    }
+
+    /*When the last byte of the packet being processed was added. Only valid inside the OnPacketProcessed handler.*/
+    std::chrono::steady_clock::time_point ProcessingBuffer::getReceivedTime() const {
+        return pImpl->getReceivedTime();
+    }
+
+    /*The length of the packet being processed as it was received, header included. Only valid inside the OnPacketProcessed handler.*/
+    size_t ProcessingBuffer::getPacketSize() const {
+        return pImpl->getPacketSize();
+    }
+
+    /*Sets how the packets that haven't been processed yet are framed. Takes effect from the next packet on.
+    @param format The format.*/
+    void ProcessingBuffer::setHeaderFormat(HeaderFormat format) {
+        pImpl->setHeaderFormat(format);
+    }
+
+    /*Sets the largest frame the processing buffer accepts, header included. Takes effect from the next packet on.
+    @param size The size in bytes.*/
+    void ProcessingBuffer::setMaxFrameSize(size_t size) {
+        pImpl->setMaxFrameSize(size);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,604 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include "pch.h"
+#include "RPCChannel.h"
+#include "Awaitable.h"
+#include "Logger.h"
+#include "ParloIDs.h"
+#include "Socket.h"
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+namespace Parlo
+{
+    namespace
+    {
+        /*How often the deadlines of outstanding calls are checked, while there are any.*/
+        const std::chrono::milliseconds DEADLINE_RESOLUTION(5);
+
+        /*Size of [uint32_t call ID][uint8_t method or status].*/
+        const size_t RPC_HEADER_SIZE = 5;
+
+        const uint32_t NO_SLOT = 0xFFFFFFFF;
+
+        enum RPCStatus : uint8_t
+        {
+            Success = 0,
+            Failure = 1,
+            NoHandler = 2
+        };
+
+        class RPCCategory : public std::error_category
+        {
+        public:
+            const char* name() const noexcept override {
+                return "Parlo.RPC";
+            }
+
+            std::string message(int error) const override {
+                switch (static_cast<RPCError>(error)) {
+                case RPCError::RemoteError:
+                    return "The remote handler failed";
+                case RPCError::UnknownMethod:
+                    return "No handler is registered for the method";
+                default:
+                    return "Unknown RPC error";
+                }
+            }
+        };
+
+        void writeUInt32(uint8_t* destination, uint32_t value) {
+            for (int i = 0; i < 4; i++)
+                destination[i] = static_cast<uint8_t>(value >> (i * 8));
+        }
+
+        uint32_t readUInt32(const uint8_t* source) {
+            uint32_t value = 0;
+            for (int i = 0; i < 4; i++)
+                value |= static_cast<uint32_t>(source[i]) << (i * 8);
+
+            return value;
+        }
+
+        /*Builds the payload of a request or response, leaving the call ID to be filled in.*/
+        std::vector<uint8_t> buildPayload(uint8_t methodOrStatus, const std::vector<uint8_t>& data) {
+            std::vector<uint8_t> payload;
+            payload.reserve(RPC_HEADER_SIZE + data.size());
+            payload.resize(RPC_HEADER_SIZE);
+            payload[4] = methodOrStatus;
+            payload.insert(payload.end(), data.begin(), data.end());
+            return payload;
+        }
+    }
+
+    const std::error_category& rpcCategory() {
+        static RPCCategory category;
+        return category;
+    }
+
+    class RPCChannel::Impl : public std::enable_shared_from_this<RPCChannel::Impl>
+    {
+    public:
+        /*Whatever is waiting for a call to complete.*/
+        struct Completion
+        {
+            RPCCallback callback;
+            std::optional<std::promise<std::vector<uint8_t>>> promise;
+#ifdef PARLO_COROUTINES
+            SuspendedCoroutine<std::vector<uint8_t>>* coroutine = nullptr;
+#endif
+
+            void operator()(const std::error_code& ec, std::vector<uint8_t> response);
+        };
+
+        Impl(std::shared_ptr<NetworkClient> client, size_t maxCalls);
+
+        /*Installs the NetworkClient's handlers. Called once the Impl is owned by a std::shared_ptr.*/
+        void attach();
+
+        /*Builds the payload of a request.
+        @throws std::overflow_error if the request is too large.*/
+        std::vector<uint8_t> buildRequest(uint8_t method, const std::vector<uint8_t>& request);
+
+        /*Sends a request built by buildRequest().
+        @return The call's ID.
+        @throws std::runtime_error if the table of pending calls is full.*/
+        uint32_t start(std::vector<uint8_t> payload, Completion completion, std::chrono::milliseconds timeout);
+
+        /*Completes a call, unless something else completed it first.
+        @return True if this completed it.*/
+        bool finish(uint32_t callID, const std::error_code& ec, std::vector<uint8_t> response = std::vector<uint8_t>());
+
+        /*Fails every outstanding call.
+        @param ec The error to fail them with.
+        @param permanently Whether calls started from now on fail too.*/
+        void failAll(const std::error_code& ec, bool permanently);
+
+        void stopSweeping();
+
+        RPCStats getStats() const;
+
+        std::mutex handlersMutex;
+        std::array<std::shared_ptr<RPCHandler>, 256> handlers;
+        std::shared_ptr<std::function<void(const std::shared_ptr<NetworkClient>&, const std::shared_ptr<Packet>&)>> onReceivedDataHandler;
+        std::shared_ptr<std::function<void(const std::shared_ptr<NetworkClient>&)>> onDisconnectedHandler;
+
+#ifdef PARLO_COROUTINES
+        HandlerMemory handlerMemory;
+#endif
+
+    private:
+        /*A slot in the table of pending calls. Whoever swaps callID from the call's ID to 0 owns the
+        completion, so a response, a deadline and a cancellation can race without a lock.*/
+        struct PendingCall
+        {
+            std::atomic<uint32_t> callID{ 0 };
+            /*steady_clock ticks, or 0 if the call has no deadline.*/
+            std::atomic<int64_t> deadline{ 0 };
+            /*The next slot on the free list.*/
+            std::atomic<uint32_t> nextFree{ NO_SLOT };
+            /*Bumped every time the slot is reused, so late responses don't complete a newer call.*/
+            uint32_t generation = 0;
+            Completion completion;
+        };
+
+        std::shared_ptr<NetworkClient> client;
+
+        std::unique_ptr<PendingCall[]> calls;
+        size_t capacity;
+        uint32_t indexBits = 0;
+        uint32_t indexMask;
+        /*Head of the free list of slots: a tag in the upper 32 bits, to rule out ABA, and the slot in the lower 32.*/
+        std::atomic<uint64_t> freeHead{ NO_SLOT };
+        std::atomic<bool> closed{ false };
+
+        std::mutex timerMutex;
+        asio::steady_timer sweepTimer;
+        /*Set while sweepTimer is armed or sweeping. Only whoever sets it touches the timer.*/
+        std::atomic<bool> sweeping{ false };
+        std::atomic<size_t> deadlineCalls{ 0 };
+
+        std::atomic<uint64_t> callCount{ 0 };
+        std::atomic<uint64_t> completedCount{ 0 };
+        std::atomic<uint64_t> failedCount{ 0 };
+        std::atomic<uint64_t> timedOutCount{ 0 };
+        std::atomic<uint64_t> cancelledCount{ 0 };
+        std::atomic<uint64_t> lateResponseCount{ 0 };
+        std::atomic<uint64_t> servedCount{ 0 };
+        std::atomic<size_t> inFlight{ 0 };
+
+        uint32_t popFree();
+        void pushFree(uint32_t index);
+
+        /*Arms sweepTimer, unless it already is.*/
+        void armSweep();
+        /*Fails the calls whose deadline has passed.*/
+        void sweep();
+
+        void handlePacket(const std::shared_ptr<NetworkClient>& sender, const std::shared_ptr<Packet>& packet);
+        void serve(const std::shared_ptr<NetworkClient>& sender, const std::vector<uint8_t>& payload);
+        void handleResponse(const std::vector<uint8_t>& payload);
+        void handleDisconnected(const std::shared_ptr<NetworkClient>& sender);
+    };
+
+    void RPCChannel::Impl::Completion::operator()(const std::error_code& ec, std::vector<uint8_t> response) {
+        if (callback) {
+            callback(ec, std::move(response));
+            return;
+        }
+
+        if (promise) {
+            if (ec) {
+                std::string message = ec == RPCError::RemoteError ? std::string(response.begin(), response.end()) : std::string();
+                promise->set_exception(std::make_exception_ptr(std::system_error(ec, message)));
+            }
+            else
+                promise->set_value(std::move(response));
+
+            return;
+        }
+
+#ifdef PARLO_COROUTINES
+        if (coroutine)
+            coroutine->complete(ec, std::move(response));
+#endif
+    }
+
+    RPCChannel::Impl::Impl(std::shared_ptr<NetworkClient> client, size_t maxCalls) :
+        client(std::move(client)), sweepTimer(this->client->getSocket()->native_handle().get_executor()) {
+        if (maxCalls == 0 || maxCalls > 65536)
+            throw std::invalid_argument("maxCalls must be between 1 and 65536");
+
+        while ((size_t(1) << indexBits) < maxCalls)
+            indexBits++;
+
+        capacity = size_t(1) << indexBits;
+        indexMask = static_cast<uint32_t>(capacity - 1);
+        calls = std::make_unique<PendingCall[]>(capacity);
+
+        //Pushed in reverse, so the first slots are handed out first.
+        for (size_t i = capacity; i > 0; i--)
+            pushFree(static_cast<uint32_t>(i - 1));
+    }
+
+    void RPCChannel::Impl::attach() {
+        std::weak_ptr<Impl> weakSelf = shared_from_this();
+
+        client->setOnReceivedDataHandler([weakSelf](const std::shared_ptr<NetworkClient>& sender, const std::shared_ptr<Packet>& packet) {
+            if (auto self = weakSelf.lock())
+                self->handlePacket(sender, packet);
+        });
+
+        auto onDisconnected = [weakSelf](const std::shared_ptr<NetworkClient>& sender) {
+            if (auto self = weakSelf.lock())
+                self->handleDisconnected(sender);
+        };
+
+        client->setOnConnectionLostHandler(onDisconnected);
+        client->setOnServerDisconnectedHandler(onDisconnected);
+        client->setOnClientDisconnectedHandler(onDisconnected);
+    }
+
+    uint32_t RPCChannel::Impl::popFree() {
+        uint64_t head = freeHead.load(std::memory_order_acquire);
+
+        for (;;) {
+            uint32_t index = static_cast<uint32_t>(head);
+            if (index == NO_SLOT)
+                return NO_SLOT;
+
+            uint64_t next = ((head >> 32) + 1) << 32 | calls[index].nextFree.load(std::memory_order_relaxed);
+            if (freeHead.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire))
+                return index;
+        }
+    }
+
+    void RPCChannel::Impl::pushFree(uint32_t index) {
+        uint64_t head = freeHead.load(std::memory_order_relaxed);
+
+        for (;;) {
+            calls[index].nextFree.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+
+            uint64_t next = ((head >> 32) + 1) << 32 | index;
+            if (freeHead.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed))
+                return;
+        }
+    }
+
+    std::vector<uint8_t> RPCChannel::Impl::buildRequest(uint8_t method, const std::vector<uint8_t>& request) {
+        if (request.size() > MAX_PAYLOAD_SIZE)
+            throw std::overflow_error("Request exceeds RPCChannel::MAX_PAYLOAD_SIZE");
+
+        return buildPayload(method, request);
+    }
+
+    uint32_t RPCChannel::Impl::start(std::vector<uint8_t> payload, Completion completion, std::chrono::milliseconds timeout) {
+        uint32_t index = popFree();
+        if (index == NO_SLOT)
+            throw std::runtime_error("Too many RPCs in flight");
+
+        PendingCall& call = calls[index];
+
+        //The ID is never 0, which marks a free slot.
+        call.generation = (call.generation + 1) & (0xFFFFFFFF >> indexBits);
+        if (call.generation == 0)
+            call.generation = 1;
+
+        uint32_t callID = call.generation << indexBits | index;
+        call.completion = std::move(completion);
+
+        if (timeout.count() > 0) {
+            call.deadline.store((std::chrono::steady_clock::now() + timeout).time_since_epoch().count(), std::memory_order_relaxed);
+            deadlineCalls++;
+        }
+        else
+            call.deadline.store(0, std::memory_order_relaxed);
+
+        callCount++;
+        inFlight++;
+        writeUInt32(payload.data(), callID);
+        call.callID.store(callID);
+
+        if (timeout.count() > 0)
+            armSweep();
+
+        //failAll() may have swept the table before the call was in it.
+        if (closed) {
+            finish(callID, std::make_error_code(std::errc::connection_aborted));
+            return callID;
+        }
+
+        try {
+            client->sendAsync(Packet((uint8_t)ParloIDs::RPCRequest, payload, false).buildPacket());
+        }
+        catch (const std::system_error& e) {
+            finish(callID, e.code());
+        }
+        catch (const std::exception&) {
+            finish(callID, std::make_error_code(std::errc::not_connected));
+        }
+
+        return callID;
+    }
+
+    bool RPCChannel::Impl::finish(uint32_t callID, const std::error_code& ec, std::vector<uint8_t> response) {
+        uint32_t index = callID & indexMask;
+        PendingCall& call = calls[index];
+
+        uint32_t expected = callID;
+        if (!call.callID.compare_exchange_strong(expected, 0, std::memory_order_acq_rel))
+            return false;
+
+        Completion completion = std::exchange(call.completion, Completion());
+        if (call.deadline.load(std::memory_order_relaxed) != 0)
+            deadlineCalls--;
+
+        pushFree(index);
+        inFlight--;
+
+        if (!ec)
+            completedCount++;
+        else if (ec == std::errc::timed_out)
+            timedOutCount++;
+        else if (ec == std::errc::operation_canceled)
+            cancelledCount++;
+        else
+            failedCount++;
+
+        completion(ec, std::move(response));
+        return true;
+    }
+
+    void RPCChannel::Impl::failAll(const std::error_code& ec, bool permanently) {
+        if (permanently)
+            closed = true;
+
+        for (size_t i = 0; i < capacity; i++) {
+            uint32_t callID = calls[i].callID.load();
+            if (callID != 0)
+                finish(callID, ec);
+        }
+    }
+
+    void RPCChannel::Impl::armSweep() {
+        if (sweeping.exchange(true))
+            return;
+
+        std::lock_guard<std::mutex> lock(timerMutex);
+        if (closed)
+            return;
+
+        std::weak_ptr<Impl> weakSelf = shared_from_this();
+        sweepTimer.expires_after(DEADLINE_RESOLUTION);
+        sweepTimer.async_wait([weakSelf](const std::error_code& ec) {
+            if (ec)
+                return;
+
+            if (auto self = weakSelf.lock())
+                self->sweep();
+        });
+    }
+
+    void RPCChannel::Impl::sweep() {
+        int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+
+        for (size_t i = 0; i < capacity; i++) {
+            uint32_t callID = calls[i].callID.load(std::memory_order_acquire);
+            if (callID == 0)
+                continue;
+
+            int64_t deadline = calls[i].deadline.load(std::memory_order_relaxed);
+            if (deadline != 0 && deadline <= now)
+                finish(callID, std::make_error_code(std::errc::timed_out));
+        }
+
+        //A call with a deadline that starts now either sees sweeping cleared, or is seen here.
+        sweeping = false;
+        if (deadlineCalls > 0)
+            armSweep();
+    }
+
+    void RPCChannel::Impl::stopSweeping() {
+        std::lock_guard<std::mutex> lock(timerMutex);
+        closed = true;
+        sweepTimer.cancel();
+    }
+
+    /*Routes a packet from the NetworkClient. Called on its processing thread.*/
+    void RPCChannel::Impl::handlePacket(const std::shared_ptr<NetworkClient>& sender, const std::shared_ptr<Packet>& packet) {
+        if (packet->getID() == ParloIDs::RPCRequest) {
+            serve(sender, packet->getData());
+            return;
+        }
+        if (packet->getID() == ParloIDs::RPCResponse) {
+            handleResponse(packet->getData());
+            return;
+        }
+
+        std::shared_ptr<std::function<void(const std::shared_ptr<NetworkClient>&, const std::shared_ptr<Packet>&)>> handler;
+        {
+            std::lock_guard<std::mutex> lock(handlersMutex);
+            handler = onReceivedDataHandler;
+        }
+
+        if (handler)
+            (*handler)(sender, packet);
+    }
+
+    void RPCChannel::Impl::serve(const std::shared_ptr<NetworkClient>& sender, const std::vector<uint8_t>& payload) {
+        if (payload.size() < RPC_HEADER_SIZE)
+            return;
+
+        uint32_t callID = readUInt32(payload.data());
+        uint8_t method = payload[4];
+
+        std::shared_ptr<RPCHandler> handler;
+        {
+            std::lock_guard<std::mutex> lock(handlersMutex);
+            handler = handlers[method];
+        }
+
+        std::vector<uint8_t> response;
+
+        if (!handler)
+            response = buildPayload(RPCStatus::NoHandler, std::vector<uint8_t>());
+        else {
+            try {
+                std::vector<uint8_t> result = (*handler)(std::vector<uint8_t>(payload.begin() + RPC_HEADER_SIZE, payload.end()));
+                if (result.size() > MAX_PAYLOAD_SIZE)
+                    throw std::overflow_error("Response exceeds RPCChannel::MAX_PAYLOAD_SIZE");
+
+                response = buildPayload(RPCStatus::Success, result);
+            }
+            catch (const std::exception& e) {
+                std::string message = e.what();
+                if (message.size() > MAX_PAYLOAD_SIZE)
+                    message.resize(MAX_PAYLOAD_SIZE);
+                response = buildPayload(RPCStatus::Failure, std::vector<uint8_t>(message.begin(), message.end()));
+            }
+        }
+
+        servedCount++;
+        writeUInt32(response.data(), callID);
+
+        try {
+            sender->sendAsync(Packet((uint8_t)ParloIDs::RPCResponse, response, false).buildPacket());
+        }
+        catch (const std::exception& e) {
+            PARLO_LOG(LogLevel::warn, "RPCChannel: Couldn't send response: {}", e.what());
+        }
+    }
+
+    void RPCChannel::Impl::handleResponse(const std::vector<uint8_t>& payload) {
+        if (payload.size() < RPC_HEADER_SIZE)
+            return;
+
+        uint32_t callID = readUInt32(payload.data());
+        std::error_code error;
+
+        if (payload[4] == RPCStatus::Failure)
+            error = RPCError::RemoteError;
+        else if (payload[4] == RPCStatus::NoHandler)
+            error = RPCError::UnknownMethod;
+
+        if (!finish(callID, error, std::vector<uint8_t>(payload.begin() + RPC_HEADER_SIZE, payload.end())))
+            lateResponseCount++;
+    }
+
+    void RPCChannel::Impl::handleDisconnected(const std::shared_ptr<NetworkClient>& sender) {
+        failAll(std::make_error_code(std::errc::connection_aborted), true);
+
+        std::shared_ptr<std::function<void(const std::shared_ptr<NetworkClient>&)>> handler;
+        {
+            std::lock_guard<std::mutex> lock(handlersMutex);
+            handler = onDisconnectedHandler;
+        }
+
+        if (handler)
+            (*handler)(sender);
+    }
+
+    RPCStats RPCChannel::Impl::getStats() const {
+        RPCStats stats;
+        stats.calls = callCount;
+        stats.completed = completedCount;
+        stats.failed = failedCount;
+        stats.timedOut = timedOutCount;
+        stats.cancelled = cancelledCount;
+        stats.lateResponses = lateResponseCount;
+        stats.served = servedCount;
+        stats.inFlight = inFlight;
+        return stats;
+    }
+
+    RPCChannel::RPCChannel(std::shared_ptr<NetworkClient> client, size_t maxCalls) :
+        pImpl(std::make_shared<Impl>(std::move(client), maxCalls)) {
+        pImpl->attach();
+    }
+
+    RPCChannel::~RPCChannel() {
+        pImpl->stopSweeping();
+        pImpl->failAll(std::make_error_code(std::errc::operation_canceled), true);
+    }
+
+    void RPCChannel::setHandler(uint8_t method, RPCHandler handler) {
+        std::lock_guard<std::mutex> lock(pImpl->handlersMutex);
+        pImpl->handlers[method] = handler ? std::make_shared<RPCHandler>(std::move(handler)) : nullptr;
+    }
+
+    uint32_t RPCChannel::callAsync(uint8_t method, const std::vector<uint8_t>& request, RPCCallback callback,
+        std::chrono::milliseconds timeout) {
+        Impl::Completion completion;
+        completion.callback = std::move(callback);
+
+        return pImpl->start(pImpl->buildRequest(method, request), std::move(completion), timeout);
+    }
+
+    std::future<std::vector<uint8_t>> RPCChannel::callFuture(uint8_t method, const std::vector<uint8_t>& request,
+        std::chrono::milliseconds timeout) {
+        Impl::Completion completion;
+        completion.promise.emplace();
+        std::future<std::vector<uint8_t>> response = completion.promise->get_future();
+
+        pImpl->start(pImpl->buildRequest(method, request), std::move(completion), timeout);
+        return response;
+    }
+
+#ifdef PARLO_COROUTINES
+    asio::awaitable<std::vector<uint8_t>> RPCChannel::call(uint8_t method, const std::vector<uint8_t>& request,
+        std::chrono::milliseconds timeout) {
+        std::vector<uint8_t> payload = pImpl->buildRequest(method, request);
+
+        return suspendCoroutine<std::vector<uint8_t>>(pImpl->handlerMemory,
+            [this, payload = std::move(payload), timeout](SuspendedCoroutine<std::vector<uint8_t>>* suspended) mutable {
+            Impl::Completion completion;
+            completion.coroutine = suspended;
+
+            try {
+                pImpl->start(std::move(payload), std::move(completion), timeout);
+            }
+            catch (const std::runtime_error&) {
+                suspended->fail(std::make_error_code(std::errc::resource_unavailable_try_again));
+            }
+        });
+    }
+#endif
+
+    bool RPCChannel::cancel(uint32_t callID) {
+        return callID != 0 && pImpl->finish(callID, std::make_error_code(std::errc::operation_canceled));
+    }
+
+    void RPCChannel::cancelAll() {
+        pImpl->failAll(std::make_error_code(std::errc::operation_canceled), false);
+    }
+
+    void RPCChannel::setOnReceivedDataHandler(std::function<void(const std::shared_ptr<NetworkClient>&, const std::shared_ptr<Packet>&)> handler) {
+        std::lock_guard<std::mutex> lock(pImpl->handlersMutex);
+        pImpl->onReceivedDataHandler = handler ?
+            std::make_shared<std::function<void(const std::shared_ptr<NetworkClient>&, const std::shared_ptr<Packet>&)>>(std::move(handler)) : nullptr;
+    }
+
+    void RPCChannel::setOnDisconnectedHandler(std::function<void(const std::shared_ptr<NetworkClient>&)> handler) {
+        std::lock_guard<std::mutex> lock(pImpl->handlersMutex);
+        pImpl->onDisconnectedHandler = handler ?
+            std::make_shared<std::function<void(const std::shared_ptr<NetworkClient>&)>>(std::move(handler)) : nullptr;
+    }
+
+    RPCStats RPCChannel::getStats() const {
+        return pImpl->getStats();
+    }
+}
@@ -0,0 +1,147 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <system_error>
+#include <vector>
+#include "Parlo.h"
+#include "PacketHeaders.h"
+
+namespace Parlo
+{
+    /*Errors a remote procedure call can fail with, besides the std::errc ones:
+    std::errc::timed_out when its deadline passed, std::errc::operation_canceled when it was cancelled,
+    std::errc::not_connected when the request couldn't be sent, std::errc::no_buffer_space when the NetworkClient's
+    send queue was full, and std::errc::connection_aborted when the connection was lost before the response arrived.*/
+    enum class RPCError
+    {
+        /*The remote handler threw. The response holds its message.*/
+        RemoteError = 1,
+        /*No handler is registered for the method at the other end.*/
+        UnknownMethod
+    };
+
+    PARLO_API const std::error_category& rpcCategory();
+
+    inline std::error_code make_error_code(RPCError error) {
+        return std::error_code(static_cast<int>(error), rpcCategory());
+    }
+
+    /*Statistics for an RPCChannel.*/
+    struct RPCStats
+    {
+        uint64_t calls = 0;
+        uint64_t completed = 0;
+        uint64_t failed = 0;
+        uint64_t timedOut = 0;
+        uint64_t cancelled = 0;
+        /*Responses that arrived after their call had timed out or been cancelled.*/
+        uint64_t lateResponses = 0;
+        /*Requests this end has served.*/
+        uint64_t served = 0;
+        size_t inFlight = 0;
+    };
+
+    /*Sends requests over a NetworkClient and matches up the responses, so any number of calls can be
+    outstanding on a connection at once. Each call gets a correlation ID that its response carries back,
+    so responses may arrive in any order. Pending calls are kept in a fixed size lock free table,
+    and calls can be started and completed from any thread.
+    Both ends of a connection can make and serve calls. Requests are ParloIDs::RPCRequest packets
+    holding [uint32_t call ID][uint8_t method][request], and responses are ParloIDs::RPCResponse packets
+    holding [uint32_t call ID][uint8_t status][response]. Little endian.
+    The RPCChannel takes over the NetworkClient's received data and disconnection handlers: packets that
+    aren't RPCs are passed on to the handler set with setOnReceivedDataHandler().*/
+    class RPCChannel
+    {
+    public:
+        /*Called with the response to a call, or the error it failed with. A RPCError::RemoteError
+        comes with the remote handler's message as the response.*/
+        using RPCCallback = std::function<void(const std::error_code&, std::vector<uint8_t>)>;
+        /*Serves a call, returning the response. Whatever it throws is sent back as a RPCError::RemoteError.*/
+        using RPCHandler = std::function<std::vector<uint8_t>(const std::vector<uint8_t>&)>;
+
+        /*The largest request or response, after the packet header and the RPC header.*/
+        static const size_t MAX_PAYLOAD_SIZE = MAX_PACKET_SIZE - PacketHeaders::STANDARD - 5;
+
+        /*Creates a RPCChannel.
+        @param client The connection to make and serve calls on.
+        @param maxCalls How many calls can be outstanding at once. Rounded up to a power of two, at most 65536.*/
+        PARLO_API RPCChannel(std::shared_ptr<NetworkClient> client, size_t maxCalls = 4096);
+        /*Fails every outstanding call with std::errc::operation_canceled. The NetworkClient drops RPCs from then on.*/
+        PARLO_API ~RPCChannel();
+
+        RPCChannel(const RPCChannel&) = delete;
+        RPCChannel& operator=(const RPCChannel&) = delete;
+
+        /*Registers the handler for a method. Handlers run on the NetworkClient's processing thread,
+        one request at a time, in the order they arrived.
+        @param method The method.
+        @param handler The handler, or nullptr to unregister it.*/
+        PARLO_API void setHandler(uint8_t method, RPCHandler handler);
+
+        /*Calls a method at the other end.
+        @param method The method.
+        @param request The request, at most MAX_PAYLOAD_SIZE bytes.
+        @param callback Called once with the response or error, on whichever thread completed the call.
+        @param timeout How long to wait for the response, or 0 to wait until the connection is lost.
+        Deadlines are checked every few milliseconds.
+        @return The call's ID, which can be passed to cancel().
+        @throws std::overflow_error if the request is too large, std::runtime_error if maxCalls calls are outstanding.*/
+        PARLO_API uint32_t callAsync(uint8_t method, const std::vector<uint8_t>& request, RPCCallback callback,
+            std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+        /*Calls a method at the other end.
+        @return The response. The future throws a std::system_error if the call failed.
+        @throws std::overflow_error if the request is too large, std::runtime_error if maxCalls calls are outstanding.*/
+        PARLO_API std::future<std::vector<uint8_t>> callFuture(uint8_t method, const std::vector<uint8_t>& request,
+            std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+#ifdef PARLO_COROUTINES
+        /*Calls a method at the other end. The RPCChannel must outlive the co_await.
+        @return The response.
+        @throws std::system_error if the call failed.*/
+        PARLO_API asio::awaitable<std::vector<uint8_t>> call(uint8_t method, const std::vector<uint8_t>& request,
+            std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+#endif
+
+        /*Fails a call with std::errc::operation_canceled. Its response is dropped if it still arrives.
+        @param callID The ID callAsync() returned.
+        @return False if the call had already completed.*/
+        PARLO_API bool cancel(uint32_t callID);
+
+        /*Cancels every outstanding call.*/
+        PARLO_API void cancelAll();
+
+        /*Sets the handler for packets that aren't RPCs.*/
+        PARLO_API void setOnReceivedDataHandler(std::function<void(const std::shared_ptr<NetworkClient>&, const std::shared_ptr<Packet>&)> handler);
+        /*Sets the handler for when the connection is lost, or either end disconnects.*/
+        PARLO_API void setOnDisconnectedHandler(std::function<void(const std::shared_ptr<NetworkClient>&)> handler);
+
+        PARLO_API RPCStats getStats() const;
+
+    private:
+        class Impl;
+        std::shared_ptr<Impl> pImpl;
+    };
+}
+
+namespace std
+{
+    template <>
+    struct is_error_code_enum<Parlo::RPCError> : true_type {};
+}
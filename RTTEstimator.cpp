@@ -0,0 +1,86 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include "pch.h"
+#include "RTTEstimator.h"
+#include <algorithm>
+
+namespace Parlo
+{
+    /*Initial retransmission timeout, used until the first sample arrives.*/
+    const std::chrono::microseconds INITIAL_RETRANSMISSION_TIMEOUT = std::chrono::milliseconds(500);
+
+    RTTEstimator::RTTEstimator() :
+        smoothedRTT(0), rttVariance(0), minRTT(Duration::max()), latestRTT(0),
+        minTimeout(std::chrono::milliseconds(50)), maxTimeout(std::chrono::seconds(10))
+    {
+    }
+
+    /*Adds an RTT sample.
+    @param sample The measured round trip time.*/
+    void RTTEstimator::addSample(Duration sample)
+    {
+        if (sample < Duration::zero())
+            sample = Duration::zero();
+
+        latestRTT = sample;
+        minRTT = (std::min)(minRTT, sample);
+
+        if (sampleCount == 0) {
+            smoothedRTT = sample;
+            rttVariance = sample / 2;
+        }
+        else {
+            //RTTVAR <- 3/4 * RTTVAR + 1/4 * |SRTT - R'|, then SRTT <- 7/8 * SRTT + 1/8 * R'
+            Duration delta = smoothedRTT > sample ? smoothedRTT - sample : sample - smoothedRTT;
+            rttVariance = (rttVariance * 3 + delta) / 4;
+            smoothedRTT = (smoothedRTT * 7 + sample) / 8;
+        }
+
+        sampleCount++;
+    }
+
+    /*The retransmission timeout: SRTT + 4 * RTTVAR, clamped to [minTimeout, maxTimeout].*/
+    RTTEstimator::Duration RTTEstimator::getRetransmissionTimeout() const
+    {
+        if (sampleCount == 0)
+            return INITIAL_RETRANSMISSION_TIMEOUT;
+
+        Duration timeout = smoothedRTT + rttVariance * 4;
+        return (std::max)(minTimeout, (std::min)(timeout, maxTimeout));
+    }
+
+    /*Sets the bounds for the retransmission timeout.
+    @param minimum The lowest timeout.
+    @param maximum The highest timeout.*/
+    void RTTEstimator::setTimeoutBounds(Duration minimum, Duration maximum)
+    {
+        minTimeout = minimum;
+        maxTimeout = maximum;
+    }
+
+    /*The estimator's state as an RTTStats snapshot.*/
+    RTTStats RTTEstimator::getStats() const
+    {
+        RTTStats stats;
+
+        if (sampleCount > 0) {
+            stats.latestRTT = latestRTT;
+            stats.smoothedRTT = smoothedRTT;
+            stats.rttVariance = rttVariance;
+            stats.minRTT = minRTT;
+            stats.sampleCount = sampleCount;
+        }
+
+        return stats;
+    }
+}
@@ -0,0 +1,62 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include "Parlo.h"
+
+namespace Parlo
+{
+    /*Estimates the round trip time of a connection from RTT samples, as described in RFC 6298.*/
+    class RTTEstimator
+    {
+    public:
+        using Duration = std::chrono::microseconds;
+
+        RTTEstimator();
+
+        /*Adds an RTT sample.
+        @param sample The measured round trip time.*/
+        void addSample(Duration sample);
+
+        /*Has at least one sample been added?*/
+        bool hasSamples() const { return sampleCount > 0; }
+
+        Duration getSmoothedRTT() const { return smoothedRTT; }
+        Duration getRTTVariance() const { return rttVariance; }
+        Duration getMinRTT() const { return minRTT; }
+        Duration getLatestRTT() const { return latestRTT; }
+        uint64_t getSampleCount() const { return sampleCount; }
+
+        /*The estimator's state as an RTTStats snapshot.*/
+        RTTStats getStats() const;
+
+        /*The retransmission timeout: SRTT + 4 * RTTVAR, clamped to [minTimeout, maxTimeout].*/
+        Duration getRetransmissionTimeout() const;
+
+        /*Sets the bounds for the retransmission timeout. RFC 6298 suggests a minimum of a second,
+        which is far too conservative for interactive traffic, so the default is lower.*/
+        void setTimeoutBounds(Duration minimum, Duration maximum);
+
+    private:
+        Duration smoothedRTT;
+        Duration rttVariance;
+        Duration minRTT;
+        Duration latestRTT;
+        uint64_t sampleCount = 0;
+
+        Duration minTimeout;
+        Duration maxTimeout;
+    };
+}
@@ -0,0 +1,502 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include "pch.h"
+#include "ReliabilityLayer.h"
+#include "ParloIDs.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace Parlo
+{
+    /*Size of the sequence number window that's tracked on both sides.*/
+    const uint16_t SEQUENCE_WINDOW = 1024;
+
+    /*Maximum number of unacknowledged packets. Kept well below SEQUENCE_WINDOW so
+    old sequence numbers can't be mistaken for new ones.*/
+    const size_t MAX_PACKETS_IN_FLIGHT = 512;
+
+    /*Number of sequence numbers below the largest one that an ack covers.*/
+    const int ACK_BITS = 32;
+
+    /*Size of a ParloIDs::Ack payload: largest sequence, SACK bits and ack delay.*/
+    const size_t ACK_PAYLOAD_SIZE = 2 + 4 + 4;
+
+    /*How long an acknowledgement may be held back, waiting for a datagram to piggyback on.*/
+    const std::chrono::milliseconds MAX_ACK_DELAY(5);
+
+    /*How many newer packets must be acked before an unacked one is declared lost.*/
+    const uint16_t PACKET_REORDER_THRESHOLD = 3;
+
+    const uint8_t ORDERED_CHANNEL_FLAG = 0x80;
+
+    /*Maximum number of late arrivals (older than the SACK bits reach) that are acked individually.*/
+    const size_t MAX_LATE_ACKS = 32;
+
+    /*Is sequence number a newer than b, taking wraparound into account?*/
+    static bool sequenceGreaterThan(uint16_t a, uint16_t b)
+    {
+        return static_cast<int16_t>(static_cast<uint16_t>(a - b)) > 0;
+    }
+
+    static void writeUInt16(std::vector<uint8_t>& buffer, uint16_t value)
+    {
+        buffer.push_back(static_cast<uint8_t>(value & 0xFF));
+        buffer.push_back(static_cast<uint8_t>((value >> 8) & 0xFF));
+    }
+
+    static void writeUInt32(std::vector<uint8_t>& buffer, uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+            buffer.push_back(static_cast<uint8_t>((value >> (i * 8)) & 0xFF));
+    }
+
+    static uint16_t readUInt16(const uint8_t* data)
+    {
+        return static_cast<uint16_t>(data[1] << 8 | data[0]);
+    }
+
+    static uint32_t readUInt32(const uint8_t* data)
+    {
+        return static_cast<uint32_t>(data[0]) | static_cast<uint32_t>(data[1]) << 8 |
+            static_cast<uint32_t>(data[2]) << 16 | static_cast<uint32_t>(data[3]) << 24;
+    }
+
+    ReliabilityLayer::ReliabilityLayer() :
+        congestionControl(RELIABLE_MAX_DATAGRAM_SIZE),
+        channels(RELIABLE_CHANNEL_COUNT),
+        sentPackets(SEQUENCE_WINDOW),
+        receivedSequences(SEQUENCE_WINDOW, false)
+    {
+    }
+
+    /*Sets whether packets on a channel are delivered in the order they were sent. Channels are ordered by default.
+    @param channel The channel, below RELIABLE_CHANNEL_COUNT.
+    @param order The delivery order.*/
+    void ReliabilityLayer::setChannelOrder(uint8_t channel, DeliveryOrder order)
+    {
+        if (channel >= RELIABLE_CHANNEL_COUNT)
+            throw std::out_of_range("ReliabilityLayer: Invalid channel!");
+
+        channels[channel].order = order;
+    }
+
+    /*Queues a reliable packet. It is sent by poll() once the congestion window and pacer allow it.
+    @param id The packet's ID.
+    @param isCompressed Is the payload compressed?
+    @param channel The channel to send on.
+    @param payload The packet's payload.
+    @param length The length of the payload.*/
+    void ReliabilityLayer::send(uint8_t id, bool isCompressed, uint8_t channel, const uint8_t* payload, size_t length)
+    {
+        if (channel >= RELIABLE_CHANNEL_COUNT)
+            throw std::out_of_range("ReliabilityLayer: Invalid channel!");
+        if (length == 0)
+            throw std::invalid_argument("ReliabilityLayer: Payload cannot be null or empty!");
+
+        Channel& state = channels[channel];
+        bool ordered = state.order == DeliveryOrder::Ordered;
+        uint16_t orderIndex = ordered ? state.nextSendIndex++ : 0;
+
+        pendingPackets.push_back({ id, isCompressed, channel, ordered, orderIndex, std::vector<uint8_t>(payload, payload + length) });
+    }
+
+    /*The retransmission timeout, including exponential backoff.*/
+    ReliabilityLayer::Clock::duration ReliabilityLayer::retransmissionTimeout() const
+    {
+        return rttEstimator.getRetransmissionTimeout() * (1 << (std::min)(timeoutBackoff, 6));
+    }
+
+    /*Declares an in-flight packet lost and queues it for retransmission.*/
+    void ReliabilityLayer::markLost(SentPacket& packet)
+    {
+        packet.lost = true;
+        bytesInFlight -= packet.datagram.size();
+        stats.packetsLost++;
+        retransmissionQueue.push_back(packet.sequence);
+    }
+
+    /*Can a datagram of the given size be sent under the congestion window and pacer?*/
+    bool ReliabilityLayer::canSend(size_t bytes, Clock::time_point now)
+    {
+        //Always allow one packet when nothing is in flight, or the connection could stall for good.
+        if (bytesInFlight > 0 && bytesInFlight + bytes > congestionControl.getCongestionWindow())
+            return false;
+
+        return congestionControl.canSend(bytes, now, rttEstimator.getSmoothedRTT());
+    }
+
+    /*Records a datagram as sent.*/
+    void ReliabilityLayer::onSent(SentPacket& packet, Clock::time_point now)
+    {
+        packet.lost = false;
+        packet.sentTime = now;
+        packet.transmissions++;
+        bytesInFlight += packet.datagram.size();
+        congestionControl.onPacketSent(packet.datagram.size());
+    }
+
+    /*Returns the datagrams that should be sent now: retransmissions, new packets and due acknowledgements.
+    @param now The current time.*/
+    std::vector<std::vector<uint8_t>> ReliabilityLayer::poll(Clock::time_point now)
+    {
+        std::vector<std::vector<uint8_t>> datagrams;
+
+        //Retransmission timeout: everything that has been in flight for too long is presumed lost.
+        bool timedOut = false;
+        Clock::duration timeout = retransmissionTimeout();
+
+        for (uint16_t sequence = oldestUnacked; sequence != nextSequence; sequence++) {
+            SentPacket& packet = sentPackets[sequence % SEQUENCE_WINDOW];
+
+            if (packet.inFlight && !packet.lost && packet.sentTime + timeout <= now) {
+                markLost(packet);
+                timedOut = true;
+            }
+        }
+
+        if (timedOut) {
+            congestionControl.onRetransmissionTimeout(now);
+            timeoutBackoff++;
+        }
+
+        while (!retransmissionQueue.empty()) {
+            SentPacket& packet = sentPackets[retransmissionQueue.front() % SEQUENCE_WINDOW];
+
+            if (!packet.inFlight || !packet.lost || packet.sequence != retransmissionQueue.front()) {
+                retransmissionQueue.pop_front(); //Acked in the meantime.
+                continue;
+            }
+
+            if (!canSend(packet.datagram.size(), now))
+                break;
+
+            onSent(packet, now);
+            stats.retransmissions++;
+            datagrams.push_back(packet.datagram);
+            retransmissionQueue.pop_front();
+        }
+
+        while (retransmissionQueue.empty() && !pendingPackets.empty() && packetsInFlight < MAX_PACKETS_IN_FLIGHT) {
+            PendingPacket& pending = pendingPackets.front();
+            bool ordered = pending.ordered;
+
+            std::vector<uint8_t> payload;
+            payload.reserve(pending.payload.size() + 5);
+            payload.push_back(static_cast<uint8_t>(pending.channel | (ordered ? ORDERED_CHANNEL_FLAG : 0)));
+            writeUInt16(payload, nextSequence);
+            if (ordered)
+                writeUInt16(payload, pending.orderIndex);
+            payload.insert(payload.end(), pending.payload.begin(), pending.payload.end());
+
+            Packet packet(pending.id, payload, pending.isCompressed, true);
+            std::vector<uint8_t> datagram = packet.buildPacket();
+
+            if (!canSend(datagram.size(), now))
+                break;
+
+            SentPacket& sent = sentPackets[nextSequence % SEQUENCE_WINDOW];
+            sent.inFlight = true;
+            sent.sequence = nextSequence;
+            sent.transmissions = 0;
+            sent.datagram = std::move(datagram);
+            onSent(sent, now);
+
+            packetsInFlight++;
+            nextSequence++;
+            stats.packetsSent++;
+            datagrams.push_back(sent.datagram);
+            pendingPackets.pop_front();
+        }
+
+        if (ackPending && (ackImmediately || now >= ackDeadline)) {
+            if (!datagrams.empty())
+                piggybackAck(datagrams.front(), now);
+
+            if (ackPending)
+                datagrams.push_back(buildAck(now));
+        }
+
+        return datagrams;
+    }
+
+    /*The time at which poll() should next be called, or Clock::time_point::max() if nothing is pending.
+    @param now The current time.*/
+    ReliabilityLayer::Clock::time_point ReliabilityLayer::nextTimeout(Clock::time_point now) const
+    {
+        Clock::time_point next = Clock::time_point::max();
+        Clock::duration timeout = retransmissionTimeout();
+
+        for (uint16_t sequence = oldestUnacked; sequence != nextSequence; sequence++) {
+            const SentPacket& packet = sentPackets[sequence % SEQUENCE_WINDOW];
+
+            if (packet.inFlight && !packet.lost)
+                next = (std::min)(next, packet.sentTime + timeout);
+        }
+
+        //Work held back only by the pacer (not the window, which opens on an ack) needs a wakeup.
+        if (!retransmissionQueue.empty() || (!pendingPackets.empty() && packetsInFlight < MAX_PACKETS_IN_FLIGHT)) {
+            if (bytesInFlight == 0 || bytesInFlight + RELIABLE_MAX_DATAGRAM_SIZE <= congestionControl.getCongestionWindow())
+                next = (std::min)(next, congestionControl.nextSendTime(RELIABLE_MAX_DATAGRAM_SIZE, now, rttEstimator.getSmoothedRTT()));
+        }
+
+        if (ackPending)
+            next = (std::min)(next, ackImmediately ? now : ackDeadline);
+
+        return next;
+    }
+
+    /*Processes a received reliable packet.
+    @param id The packet's ID.
+    @param isCompressed Is the payload compressed?
+    @param payload The packet's payload, including the reliability header.
+    @param now The current time.
+    @returns The packets that are now ready for delivery, in order.*/
+    std::vector<ReliablePacket> ReliabilityLayer::onPacketReceived(uint8_t id, bool isCompressed,
+        const std::vector<uint8_t>& payload, Clock::time_point now)
+    {
+        std::vector<ReliablePacket> delivered;
+
+        if (payload.size() < 3)
+            return delivered;
+
+        uint8_t channel = payload[0] & ~ORDERED_CHANNEL_FLAG;
+        bool ordered = (payload[0] & ORDERED_CHANNEL_FLAG) != 0;
+        uint16_t sequence = readUInt16(&payload[1]);
+        size_t headerSize = ordered ? 5 : 3;
+
+        if (payload.size() <= headerSize)
+            return delivered;
+
+        bool duplicate = false;
+
+        if (!hasReceived) {
+            hasReceived = true;
+            largestReceived = sequence;
+            largestReceivedTime = now;
+            receivedSequences[sequence % SEQUENCE_WINDOW] = true;
+        }
+        else if (sequenceGreaterThan(sequence, largestReceived)) {
+            //Forget the slots that are being reused for the new sequence numbers.
+            for (uint16_t skipped = largestReceived + 1; skipped != sequence; skipped++)
+                receivedSequences[skipped % SEQUENCE_WINDOW] = false;
+
+            if (static_cast<uint16_t>(sequence - largestReceived) > 1)
+                ackImmediately = true; //A gap; tell the sender as soon as possible.
+
+            largestReceived = sequence;
+            largestReceivedTime = now;
+            receivedSequences[sequence % SEQUENCE_WINDOW] = true;
+        }
+        else {
+            uint16_t distance = static_cast<uint16_t>(largestReceived - sequence);
+
+            if (distance >= SEQUENCE_WINDOW || receivedSequences[sequence % SEQUENCE_WINDOW])
+                duplicate = true;
+            else
+                receivedSequences[sequence % SEQUENCE_WINDOW] = true;
+
+            //Too old for the SACK bits to cover, so it gets an ack of its own.
+            if (distance > ACK_BITS && distance < SEQUENCE_WINDOW && lateAcks.size() < MAX_LATE_ACKS)
+                lateAcks.push_back(sequence);
+
+            ackImmediately = true; //Filled a gap, or the sender is retransmitting.
+        }
+
+        if (!ackPending) {
+            ackPending = true;
+            ackDeadline = now + MAX_ACK_DELAY;
+        }
+
+        if (++unackedPackets >= 2)
+            ackImmediately = true;
+
+        if (duplicate) {
+            stats.duplicatesReceived++;
+            return delivered;
+        }
+
+        ReliablePacket packet{ id, isCompressed, std::vector<uint8_t>(payload.begin() + headerSize, payload.end()) };
+
+        if (!ordered || channel >= RELIABLE_CHANNEL_COUNT) {
+            delivered.push_back(std::move(packet));
+            return delivered;
+        }
+
+        Channel& state = channels[channel];
+        uint16_t orderIndex = readUInt16(&payload[3]);
+
+        if (orderIndex == state.nextDeliveryIndex) {
+            delivered.push_back(std::move(packet));
+            state.nextDeliveryIndex++;
+
+            //Release whatever was waiting for this packet.
+            auto it = state.heldBack.find(state.nextDeliveryIndex);
+            while (it != state.heldBack.end()) {
+                delivered.push_back(std::move(it->second));
+                state.heldBack.erase(it);
+                state.nextDeliveryIndex++;
+                it = state.heldBack.find(state.nextDeliveryIndex);
+            }
+        }
+        else if (sequenceGreaterThan(orderIndex, state.nextDeliveryIndex))
+            state.heldBack.emplace(orderIndex, std::move(packet));
+
+        return delivered;
+    }
+
+    /*Processes the payload of a received ParloIDs::Ack packet.
+    @param payload The acknowledgement.
+    @param now The current time.*/
+    void ReliabilityLayer::onAckReceived(const std::vector<uint8_t>& payload, Clock::time_point now)
+    {
+        if (payload.size() < ACK_PAYLOAD_SIZE)
+            return;
+
+        uint16_t largest = readUInt16(&payload[0]);
+        uint32_t ackBits = readUInt32(&payload[2]);
+        std::chrono::microseconds ackDelay(readUInt32(&payload[6]));
+
+        size_t ackedBytes = 0;
+
+        auto acknowledge = [&](uint16_t sequence, bool isLargest) {
+            SentPacket& packet = sentPackets[sequence % SEQUENCE_WINDOW];
+
+            if (!packet.inFlight || packet.sequence != sequence)
+                return;
+
+            //Karn's algorithm: retransmitted packets give ambiguous RTT samples.
+            if (isLargest && packet.transmissions == 1 && !packet.lost) {
+                auto sample = std::chrono::duration_cast<std::chrono::microseconds>(now - packet.sentTime);
+                rttEstimator.addSample(sample > ackDelay ? sample - ackDelay : sample);
+            }
+
+            if (isLargest && (!hasLargestAcked || sequenceGreaterThan(sequence, largestAcked) || sequence == largestAcked)) {
+                largestAcked = sequence;
+                largestAckedSentTime = packet.sentTime;
+                hasLargestAcked = true;
+            }
+
+            if (!packet.lost) {
+                bytesInFlight -= packet.datagram.size();
+                ackedBytes += packet.datagram.size();
+            }
+
+            packet.inFlight = false;
+            packet.lost = false;
+            packet.datagram.clear();
+            packet.datagram.shrink_to_fit();
+            packetsInFlight--;
+        };
+
+        acknowledge(largest, true);
+
+        for (int i = 0; i < ACK_BITS; i++) {
+            if (ackBits & (1u << i))
+                acknowledge(static_cast<uint16_t>(largest - 1 - i), false);
+        }
+
+        if (ackedBytes > 0) {
+            timeoutBackoff = 0;
+            congestionControl.onAck(ackedBytes, now, rttEstimator.getSmoothedRTT());
+        }
+
+        while (oldestUnacked != nextSequence && !sentPackets[oldestUnacked % SEQUENCE_WINDOW].inFlight)
+            oldestUnacked++;
+
+        if (!hasLargestAcked)
+            return;
+
+        //Packet threshold loss detection: anything sent before the largest acked packet and
+        //at least PACKET_REORDER_THRESHOLD sequence numbers older than it is presumed lost.
+        for (uint16_t sequence = oldestUnacked; sequence != nextSequence; sequence++) {
+            if (static_cast<uint16_t>(largestAcked - sequence) < PACKET_REORDER_THRESHOLD || !sequenceGreaterThan(largestAcked, sequence))
+                break;
+
+            SentPacket& packet = sentPackets[sequence % SEQUENCE_WINDOW];
+
+            if (packet.inFlight && !packet.lost && packet.sentTime < largestAckedSentTime) {
+                congestionControl.onLoss(packet.sentTime, now);
+                markLost(packet);
+            }
+        }
+    }
+
+    /*Appends a ParloIDs::Ack packet for a sequence number and the ACK_BITS before it.*/
+    void ReliabilityLayer::appendAck(std::vector<uint8_t>& datagram, uint16_t largest, std::chrono::microseconds ackDelay) const
+    {
+        uint32_t ackBits = 0;
+
+        for (int i = 0; i < ACK_BITS; i++) {
+            if (receivedSequences[static_cast<uint16_t>(largest - 1 - i) % SEQUENCE_WINDOW])
+                ackBits |= 1u << i;
+        }
+
+        long long delay = ackDelay.count();
+
+        std::vector<uint8_t> payload;
+        payload.reserve(ACK_PAYLOAD_SIZE);
+        writeUInt16(payload, largest);
+        writeUInt32(payload, ackBits);
+        writeUInt32(payload, static_cast<uint32_t>((std::min)(delay, static_cast<long long>(UINT32_MAX))));
+
+        std::vector<uint8_t> ack = Packet((uint8_t)ParloIDs::Ack, payload, false, false).buildPacket();
+        datagram.insert(datagram.end(), ack.begin(), ack.end());
+    }
+
+    /*Builds the ParloIDs::Ack packets for what has been received so far: one for the largest
+    sequence number, plus one for each late arrival the SACK bits couldn't cover.*/
+    std::vector<uint8_t> ReliabilityLayer::buildAck(Clock::time_point now)
+    {
+        std::vector<uint8_t> datagram;
+        appendAck(datagram, largestReceived, std::chrono::duration_cast<std::chrono::microseconds>(now - largestReceivedTime));
+
+        for (uint16_t sequence : lateAcks)
+            appendAck(datagram, sequence, std::chrono::microseconds(0));
+
+        lateAcks.clear();
+        ackPending = false;
+        ackImmediately = false;
+        unackedPackets = 0;
+
+        return datagram;
+    }
+
+    /*Appends a pending acknowledgement to an outgoing datagram, if there is one and it fits.
+    @param datagram The outgoing datagram.*/
+    void ReliabilityLayer::piggybackAck(std::vector<uint8_t>& datagram, Clock::time_point now)
+    {
+        size_t ackSize = (1 + lateAcks.size()) * (PacketHeaders::UDP + ACK_PAYLOAD_SIZE);
+
+        if (!ackPending || datagram.size() + ackSize > RELIABLE_MAX_DATAGRAM_SIZE)
+            return;
+
+        std::vector<uint8_t> ack = buildAck(now);
+        datagram.insert(datagram.end(), ack.begin(), ack.end());
+    }
+
+    /*Are any reliable packets queued or unacknowledged?*/
+    bool ReliabilityLayer::hasUnackedData() const
+    {
+        return packetsInFlight > 0 || !pendingPackets.empty();
+    }
+
+    ReliabilityStats ReliabilityLayer::getStats() const
+    {
+        ReliabilityStats current = stats;
+        current.congestionWindow = congestionControl.getCongestionWindow();
+        current.bytesInFlight = bytesInFlight;
+        current.smoothedRTT = rttEstimator.getSmoothedRTT();
+
+        return current;
+    }
+}
@@ -0,0 +1,189 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+#include "Parlo.h"
+#include "RTTEstimator.h"
+#include "CongestionControl.h"
+
+namespace Parlo
+{
+    /*Number of reliable channels. Ordering is only enforced within a channel,
+    so a lost packet on one channel never holds up another.*/
+    const int RELIABLE_CHANNEL_COUNT = 128;
+
+    /*Largest datagram the reliability layer produces, used as the congestion controller's MSS.*/
+    const size_t RELIABLE_MAX_DATAGRAM_SIZE = 1200;
+
+    /*A reliable packet that is ready to be delivered to the application.*/
+    struct ReliablePacket
+    {
+        uint8_t id;
+        bool isCompressed;
+        std::vector<uint8_t> payload;
+    };
+
+    /*Selective acknowledgement based reliability for UDP packets that have isReliable set.
+
+    Every reliable packet gets a connection wide 16 bit sequence number, used for acknowledgements,
+    retransmission and duplicate suppression. Packets on ordered channels also carry a per channel
+    order index, so they can be held back until the gap in front of them is filled.
+    The reliable packet's payload is prefixed with:
+        [channel (bit 7 set if ordered)][sequence, 16 bit LE][order index, 16 bit LE, ordered channels only]
+
+    Acknowledgements are ParloIDs::Ack packets holding the largest sequence number received,
+    a 32 bit SACK field for the 32 sequence numbers before it, and the time the ack was held back.
+    They are piggybacked onto outgoing datagrams whenever possible.
+
+    Reliable sends are limited by a CUBIC congestion window and paced across the RTT.
+    The class does no I/O and takes the current time as a parameter, so it's not thread safe
+    and callers must serialize access.*/
+    class PARLO_API ReliabilityLayer
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        ReliabilityLayer();
+
+        /*Sets whether packets on a channel are delivered in the order they were sent. Channels are ordered by default.
+        @param channel The channel, below RELIABLE_CHANNEL_COUNT.
+        @param order The delivery order.*/
+        void setChannelOrder(uint8_t channel, DeliveryOrder order);
+
+        /*Queues a reliable packet. It is sent by poll() once the congestion window and pacer allow it.
+        @param id The packet's ID.
+        @param isCompressed Is the payload compressed?
+        @param channel The channel to send on.
+        @param payload The packet's payload.
+        @param length The length of the payload.*/
+        void send(uint8_t id, bool isCompressed, uint8_t channel, const uint8_t* payload, size_t length);
+
+        /*Returns the datagrams that should be sent now: retransmissions, new packets and due acknowledgements.
+        @param now The current time.*/
+        std::vector<std::vector<uint8_t>> poll(Clock::time_point now);
+
+        /*The time at which poll() should next be called, or Clock::time_point::max() if nothing is pending.
+        @param now The current time.*/
+        Clock::time_point nextTimeout(Clock::time_point now) const;
+
+        /*Processes a received reliable packet.
+        @param id The packet's ID.
+        @param isCompressed Is the payload compressed?
+        @param payload The packet's payload, including the reliability header.
+        @param now The current time.
+        @returns The packets that are now ready for delivery, in order.*/
+        std::vector<ReliablePacket> onPacketReceived(uint8_t id, bool isCompressed, const std::vector<uint8_t>& payload, Clock::time_point now);
+
+        /*Processes the payload of a received ParloIDs::Ack packet.
+        @param payload The acknowledgement.
+        @param now The current time.*/
+        void onAckReceived(const std::vector<uint8_t>& payload, Clock::time_point now);
+
+        /*Appends a pending acknowledgement to an outgoing datagram, if there is one and it fits.
+        @param datagram The outgoing datagram.*/
+        void piggybackAck(std::vector<uint8_t>& datagram, Clock::time_point now);
+
+        /*Are any reliable packets queued or unacknowledged?*/
+        bool hasUnackedData() const;
+
+        ReliabilityStats getStats() const;
+        const RTTEstimator& getRTTEstimator() const { return rttEstimator; }
+
+        /*Adds an RTT sample taken outside of the reliability layer, I.E from a heartbeat.
+        @param sample The measured round trip time.*/
+        void addRTTSample(std::chrono::microseconds sample) { rttEstimator.addSample(sample); }
+
+    private:
+        struct SentPacket
+        {
+            bool inFlight = false;
+            /*Declared lost and waiting for retransmission. Lost packets don't count towards bytesInFlight.*/
+            bool lost = false;
+            uint16_t sequence = 0;
+            int transmissions = 0;
+            Clock::time_point sentTime;
+            std::vector<uint8_t> datagram;
+        };
+
+        struct PendingPacket
+        {
+            uint8_t id;
+            bool isCompressed;
+            uint8_t channel;
+            bool ordered;
+            uint16_t orderIndex;
+            std::vector<uint8_t> payload;
+        };
+
+        struct Channel
+        {
+            DeliveryOrder order = DeliveryOrder::Ordered;
+            uint16_t nextSendIndex = 0;
+            uint16_t nextDeliveryIndex = 0;
+            std::unordered_map<uint16_t, ReliablePacket> heldBack;
+        };
+
+        RTTEstimator rttEstimator;
+        CubicCongestionControl congestionControl;
+        std::vector<Channel> channels;
+
+        //Sending side.
+        std::vector<SentPacket> sentPackets;
+        std::deque<PendingPacket> pendingPackets;
+        std::deque<uint16_t> retransmissionQueue;
+        uint16_t nextSequence = 0;
+        uint16_t oldestUnacked = 0;
+        uint16_t largestAcked = 0;
+        bool hasLargestAcked = false;
+        Clock::time_point largestAckedSentTime;
+        size_t packetsInFlight = 0;
+        size_t bytesInFlight = 0;
+        int timeoutBackoff = 0;
+
+        //Receiving side.
+        std::vector<bool> receivedSequences;
+        uint16_t largestReceived = 0;
+        bool hasReceived = false;
+        Clock::time_point largestReceivedTime;
+        bool ackPending = false;
+        bool ackImmediately = false;
+        int unackedPackets = 0;
+        Clock::time_point ackDeadline;
+        std::vector<uint16_t> lateAcks;
+
+        ReliabilityStats stats;
+
+        /*The retransmission timeout, including exponential backoff.*/
+        Clock::duration retransmissionTimeout() const;
+
+        /*Declares an in-flight packet lost and queues it for retransmission.*/
+        void markLost(SentPacket& packet);
+
+        /*Can a datagram of the given size be sent under the congestion window and pacer?*/
+        bool canSend(size_t bytes, Clock::time_point now);
+
+        /*Records a datagram as sent.*/
+        void onSent(SentPacket& packet, Clock::time_point now);
+
+        /*Appends a ParloIDs::Ack packet for a sequence number and the ACK_BITS before it.*/
+        void appendAck(std::vector<uint8_t>& datagram, uint16_t largest, std::chrono::microseconds ackDelay) const;
+
+        /*Builds the ParloIDs::Ack packets for what has been received so far.*/
+        std::vector<uint8_t> buildAck(Clock::time_point now);
+    };
+}
@@ -0,0 +1,170 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Parlo.h"
+
+namespace Parlo
+{
+    /*How many bytes each direction of a shared memory connection holds before packets have to wait.*/
+    const size_t DEFAULT_SHARED_MEMORY_RING_SIZE = 256 * 1024;
+
+    /*How long a shared memory connection spins on an empty ring, at most, before it sleeps until the other end wakes it.*/
+    const std::chrono::microseconds DEFAULT_SHARED_MEMORY_SPIN_TIME(50);
+
+    /*How a SharedMemoryClient has been waiting.*/
+    struct SharedMemoryStats
+    {
+        /*Times this end slept on an empty ring.*/
+        uint64_t sleeps = 0;
+        /*Times a packet arrived while this end was spinning, saving a sleep.*/
+        uint64_t spinHits = 0;
+        /*Times this end woke the other end, at a system call each.*/
+        uint64_t wakeupsSent = 0;
+        /*Times the ring to the other end was full, so packets had to wait for it.*/
+        uint64_t ringFull = 0;
+    };
+
+    struct SharedMemoryChannel;
+
+    /*Can this platform make shared memory connections? Only Linux can.*/
+    PARLO_API bool isSharedMemoryAvailable();
+
+    /*A connection to a process on the same host through shared memory, instead of through the TCP loopback.
+    Packets are built by Packet::buildPacket() and framed the same way as on a NetworkClient, but are copied into
+    a single producer, single consumer ring in a memfd shared by both processes, one ring per direction. An end
+    that runs out of packets spins for a while before it sleeps on an eventfd, and the other end only writes the
+    eventfd if it does, so a busy connection doesn't make any system calls.
+    The connection is set up over a Unix domain socket in the abstract namespace, which stays open so either end
+    can tell when the other process is gone. There are no heartbeats. Linux only.
+    Instances must be owned by a std::shared_ptr before they connect.*/
+    class SharedMemoryClient : public std::enable_shared_from_this<SharedMemoryClient>
+    {
+    private:
+        class Impl;
+        std::unique_ptr<Impl> pImpl;
+
+        /*Takes over a connection accepted by a SharedMemoryListener.*/
+        void accept(std::unique_ptr<SharedMemoryChannel> channel);
+
+        /*Starts receiving on a connection accepted by a SharedMemoryListener.*/
+        void start();
+
+        friend class SharedMemoryListener;
+
+    public:
+        PARLO_API SharedMemoryClient(asio::io_context& context);
+        PARLO_API ~SharedMemoryClient();
+
+        /*Connects to a SharedMemoryListener on this host.
+        @param name The name the SharedMemoryListener was created with.
+        @throws std::runtime_error if shared memory connections aren't available.*/
+        PARLO_API void connectAsync(const std::string& name);
+
+        /*Connects to the SharedMemoryListener created for a TCP endpoint on this host. See SharedMemoryListener::nameFor().
+        @param endpoint The endpoint.
+        @throws std::invalid_argument if the endpoint isn't a loopback address.*/
+        PARLO_API void connectAsync(const asio::ip::tcp::endpoint& endpoint);
+
+        /*Is there a SharedMemoryListener for a TCP endpoint, so a connection to it can skip the TCP stack?
+        Only loopback endpoints qualify. Use it to pick between a SharedMemoryClient and a NetworkClient.
+        @param endpoint The endpoint.*/
+        PARLO_API static bool isReachable(const asio::ip::tcp::endpoint& endpoint);
+
+        /*Sends a packet. Written straight into the ring if there's room, otherwise queued until there is.
+        @param data A packet built by Packet::buildPacket().
+        @throws std::invalid_argument if data isn't a packet, std::overflow_error if it exceeds MAX_PACKET_SIZE,
+        and std::runtime_error if this isn't connected.*/
+        PARLO_API void sendAsync(const std::vector<uint8_t>& data);
+
+        /*Asynchronously disconnects. Anything sent before is still delivered.
+        @param sendDisconnectMessage Whether or not to send a disconnection message to the other party. Defaults to true.*/
+        PARLO_API void disconnectAsync(bool sendDisconnectMessage = true);
+
+        /*Sets how long to spin on an empty ring before sleeping. Spinning keeps an io_context thread busy, but
+        a packet that arrives meanwhile is picked up without being woken. How long is adapted to the traffic:
+        it's halved every time spinning comes up empty, down to not spinning at all, and back to the maximum once
+        it catches a packet or a sleep turns out shorter than the maximum. Hosts with a single CPU never spin.
+        Defaults to DEFAULT_SHARED_MEMORY_SPIN_TIME.
+        @param maxSpinTime The longest to spin, or 0 to always sleep right away.*/
+        PARLO_API void setSpinTime(std::chrono::microseconds maxSpinTime);
+
+        /*Is this SharedMemoryClient connected? False until connectAsync() succeeds, and after a disconnection.*/
+        PARLO_API bool isConnected() const;
+
+        /*A snapshot of this connection's counters. Reads count the passes that found packets in the ring,
+        and writes the packets written to it. Thread safe.*/
+        PARLO_API ConnectionMetrics getMetrics() const;
+
+        /*How this connection has been waiting. Thread safe.*/
+        PARLO_API SharedMemoryStats getSharedMemoryStats() const;
+
+        PARLO_API std::shared_ptr<SharedMemoryClient> getSharedPtr() {
+            return shared_from_this();
+        }
+
+        PARLO_API void setOnClientDisconnectedHandler(std::function<void(const std::shared_ptr<SharedMemoryClient>&)> handler);
+        PARLO_API void setOnConnectionLostHandler(std::function<void(const std::shared_ptr<SharedMemoryClient>&)> handler);
+        PARLO_API void setOnServerDisconnectedHandler(std::function<void(const std::shared_ptr<SharedMemoryClient>&)> handler);
+        /*Sets the handler for received packets, decompressed. Called on the io_context, in the order the packets were sent.*/
+        PARLO_API void setOnReceivedDataHandler(std::function<void(const std::shared_ptr<SharedMemoryClient>&, const std::shared_ptr<Packet>&)> handler);
+    };
+
+    /*A SharedMemoryListener accepts shared memory connections from processes on the same host. See SharedMemoryClient.
+    Accepted connections keep themselves alive until they're disconnected.*/
+    class SharedMemoryListener : public std::enable_shared_from_this<SharedMemoryListener>
+    {
+    public:
+        /*Creates a SharedMemoryListener.
+        @param context An asio::io_context instance.
+        @param name What SharedMemoryClient::connectAsync() is passed to connect. Must be unique on the host.
+        @throws std::runtime_error if shared memory connections aren't available, or the name is taken.*/
+        PARLO_API SharedMemoryListener(asio::io_context& context, const std::string& name);
+        /*Creates a SharedMemoryListener for a TCP endpoint, I.E to serve the same port as a Listener does, so that
+        local processes can connect to it with SharedMemoryClient::connectAsync(endpoint) instead.
+        @param endpoint The TCP endpoint. The name is nameFor(endpoint).*/
+        PARLO_API SharedMemoryListener(asio::io_context& context, const asio::ip::tcp::endpoint& endpoint);
+        PARLO_API ~SharedMemoryListener();
+
+        PARLO_API void startAccepting();
+        PARLO_API void stopAccepting();
+
+        PARLO_API const std::string& getName() const;
+
+        /*The name of the SharedMemoryListener for a TCP endpoint, which is the same for every loopback address.*/
+        PARLO_API static std::string nameFor(const asio::ip::tcp::endpoint& endpoint);
+
+        /*Sets the size of both rings of connections accepted from now on. Defaults to DEFAULT_SHARED_MEMORY_RING_SIZE.
+        @param size The size in bytes.
+        @throws std::invalid_argument if the size isn't a power of two, or can't hold a packet of MAX_PACKET_SIZE.*/
+        PARLO_API void setRingSize(size_t size);
+
+        /*Sets how long connections accepted from now on spin. See SharedMemoryClient::setSpinTime().*/
+        PARLO_API void setSpinTime(std::chrono::microseconds maxSpinTime);
+
+        PARLO_API void setOnClientConnectedHandler(std::function<void(const std::shared_ptr<SharedMemoryClient>&)> handler);
+
+        PARLO_API std::shared_ptr<SharedMemoryListener> getSharedPtr() {
+            return shared_from_this();
+        }
+    private:
+        class Impl;
+        std::unique_ptr<Impl> pImpl;
+    };
+}
@@ -0,0 +1,700 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include "pch.h"
+#include "SharedMemory.h"
+#include "SharedMemoryRing.h"
+#include "GoodbyePacket.h"
+#include "Compression.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "ParloIDs.h"
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+
+namespace Parlo
+{
+    bool isSharedMemoryAvailable() {
+#ifdef __linux__
+        return true;
+#else
+        return false;
+#endif
+    }
+
+#ifdef __linux__
+    /*How many packets a pass of the receive loop hands over before it lets other handlers on the io_context run.*/
+    const size_t MAX_PACKETS_PER_PASS = 256;
+
+    /*Wakes whoever sleeps on an eventfd.*/
+    static void signalEvent(int descriptor) {
+        uint64_t one = 1;
+        ssize_t written = ::write(descriptor, &one, sizeof(one));
+        (void)written;
+    }
+
+    /*The SharedMemoryClient exchanges packets with another process through a pair of rings in shared memory.*/
+    class SharedMemoryClient::Impl {
+    public:
+        Impl(asio::io_context& context) : controlSocket(context), wakeEvent(context) {}
+        ~Impl() {
+            if (peerWakeEvent >= 0)
+                ::close(peerWakeEvent);
+        }
+
+        /*Connects to a SharedMemoryListener and maps the segment it sends back.
+        @param name The name the SharedMemoryListener was created with.*/
+        void connectAsync(const std::string& name);
+
+        /*Sends a packet built by Packet::buildPacket().*/
+        void sendAsync(const std::vector<uint8_t>& data);
+
+        /*Asynchronously disconnects.
+        @param sendDisconnectMessage Whether or not to send a disconnection message to the other party.*/
+        void disconnectAsync(bool sendDisconnectMessage);
+
+        /*Takes over a connection accepted by a SharedMemoryListener.*/
+        void accept(std::unique_ptr<SharedMemoryChannel> channel);
+
+        /*Starts receiving, and watching for the other end to go away.*/
+        void start();
+
+        std::atomic<bool> connected{ false };
+
+        /*The longest the receive loop spins, in microseconds.*/
+        std::atomic<int64_t> maxSpinTime{ DEFAULT_SHARED_MEMORY_SPIN_TIME.count() };
+
+        ConnectionMetricsRecorder metrics;
+        std::atomic<uint64_t> sleeps{ 0 };
+        std::atomic<uint64_t> spinHits{ 0 };
+        std::atomic<uint64_t> wakeupsSent{ 0 };
+        std::atomic<uint64_t> ringFull{ 0 };
+
+        std::function<void(const std::shared_ptr<SharedMemoryClient>&)> onServerDisconnectedHandler;
+        std::function<void(const std::shared_ptr<SharedMemoryClient>&)> onClientDisconnectedHandler;
+        std::function<void(const std::shared_ptr<SharedMemoryClient>&)> onConnectionLostHandler;
+        std::function<void(const std::shared_ptr<SharedMemoryClient>&, const std::shared_ptr<Packet>&)> onReceivedDataHandler;
+
+        SharedMemoryClient* owner;
+
+    private:
+        /*Stays open for as long as the connection does. Nothing is sent on it after the hello.*/
+        asio::local::stream_protocol::socket controlSocket;
+        uint8_t controlByte = 0;
+        /*The eventfd this end sleeps on, and the one the other end sleeps on. Both are closed on destruction,
+        so they can still be written to after the connection was closed.*/
+        asio::posix::stream_descriptor wakeEvent;
+        int ownWakeEvent = -1;
+        int peerWakeEvent = -1;
+
+        std::unique_ptr<SharedMemorySegment> segment;
+        std::optional<SharedMemoryRing> inbound;
+        /*Guarded by sendMutex, which makes this end a single producer.*/
+        std::optional<SharedMemoryRing> outbound;
+        bool isServer = false;
+
+        /*Set once the other end has closed the control socket. What it wrote before that is still in the ring.*/
+        std::atomic<bool> peerClosed{ false };
+        /*Set once this end is done. The receive loop tears the connection down the next time it runs.*/
+        std::atomic<bool> closed{ false };
+
+        /*Guards outbound, pending and closeWhenSent.*/
+        std::mutex sendMutex;
+        /*Packets that didn't fit in the ring, in the order they were sent.*/
+        std::deque<std::vector<uint8_t>> pending;
+        std::atomic<bool> hasPending{ false };
+        /*Close once pending has been written, I.E after a goodbye.*/
+        bool closeWhenSent = false;
+
+        /*How long the receive loop spins next time. Only touched by the receive loop.*/
+        std::chrono::nanoseconds spinTime{ DEFAULT_SHARED_MEMORY_SPIN_TIME };
+
+        /*Maps a segment and takes over its eventfds.*/
+        void attach(std::unique_ptr<SharedMemorySegment> connectionSegment, int wakeDescriptor, int peerWakeDescriptor);
+
+        /*Hands over the packets in the ring, writes whatever waits for room, then spins or sleeps until there's more.
+        Runs on the io_context, and only one pass runs at a time.*/
+        void receive();
+
+        /*Hands over up to MAX_PACKETS_PER_PASS packets from the ring.
+        @return How many there were.*/
+        size_t drain();
+
+        /*Dispatches a packet to the handlers.*/
+        void handlePacket(uint8_t id, bool isCompressed, std::vector<uint8_t> payload);
+
+        /*Writes a frame into the ring, or queues it behind those waiting for room.*/
+        void queueFrame(const std::vector<uint8_t>& frame);
+
+        /*Writes as many waiting frames as fit. Called with sendMutex held.
+        @return True if the other end has to be woken.*/
+        bool writePending();
+
+        /*Writes the frames waiting for room, and wakes the other end if it needs to be.*/
+        void flushPending();
+
+        void countSent(size_t size) {
+            metrics.add(ConnectionCounter::BytesSent, size);
+            metrics.add(ConnectionCounter::PacketsSent);
+            metrics.add(ConnectionCounter::Writes);
+        }
+
+        void wakePeer() {
+            signalEvent(peerWakeEvent);
+            wakeupsSent++;
+        }
+
+        /*Reports that the other end went away without saying goodbye.*/
+        void connectionLost();
+
+        /*Marks the connection as done, and wakes the receive loop to tear it down.*/
+        void close();
+
+        /*Tells the other end this one is gone.*/
+        void closeControlSocket() {
+            std::error_code ec;
+            controlSocket.close(ec);
+        }
+    };
+
+    /*Connects to a SharedMemoryListener and maps the segment it sends back.
+    @param name The name the SharedMemoryListener was created with.*/
+    void SharedMemoryClient::Impl::connectAsync(const std::string& name) {
+        auto self(owner->shared_from_this());
+
+        controlSocket.async_connect(sharedMemoryEndpoint(name), [this, self, name](std::error_code ec) {
+            if (ec) {
+                PARLO_LOG(LogLevel::error, "Error connecting to shared memory listener {}: {}", name, ec);
+                if (onConnectionLostHandler)
+                    onConnectionLostHandler(self);
+
+                return;
+            }
+
+            //The listener sends the segment and the eventfds as soon as it has accepted the connection.
+            controlSocket.async_wait(asio::socket_base::wait_read, [this, self, name](std::error_code ec) {
+                if (!ec) {
+                    int descriptors[SHARED_MEMORY_DESCRIPTORS];
+                    uint32_t ringSize = receiveDescriptors(controlSocket.native_handle(), descriptors);
+
+                    try {
+                        if (ringSize == 0)
+                            throw std::runtime_error("Invalid hello");
+
+                        //The server sends the client's eventfd first.
+                        std::unique_ptr<SharedMemorySegment> connectionSegment;
+                        try {
+                            connectionSegment = std::make_unique<SharedMemorySegment>(descriptors[0], ringSize);
+                        }
+                        catch (...) {
+                            ::close(descriptors[1]);
+                            ::close(descriptors[2]);
+                            throw;
+                        }
+
+                        attach(std::move(connectionSegment), descriptors[1], descriptors[2]);
+                    }
+                    catch (const std::exception& e) {
+                        PARLO_LOG(LogLevel::error, "Error connecting to shared memory listener {}: {}", name, e.what());
+                        ec = std::make_error_code(std::errc::protocol_error);
+                    }
+                }
+
+                if (ec) {
+                    if (ec != std::errc::protocol_error)
+                        PARLO_LOG(LogLevel::error, "Error connecting to shared memory listener {}: {}", name, ec);
+
+                    closeControlSocket();
+                    if (onConnectionLostHandler)
+                        onConnectionLostHandler(self);
+
+                    return;
+                }
+
+                PARLO_LOG(LogLevel::info, "Connected to shared memory listener {}!", name);
+                connected = true;
+                start();
+            });
+        });
+    }
+
+    /*Takes over a connection accepted by a SharedMemoryListener.*/
+    void SharedMemoryClient::Impl::accept(std::unique_ptr<SharedMemoryChannel> channel) {
+        isServer = true;
+        controlSocket = std::move(channel->socket);
+        attach(std::move(channel->segment), std::exchange(channel->wakeEvent, -1), std::exchange(channel->peerWakeEvent, -1));
+        connected = true;
+    }
+
+    /*Maps a segment and takes over its eventfds.*/
+    void SharedMemoryClient::Impl::attach(std::unique_ptr<SharedMemorySegment> connectionSegment, int wakeDescriptor, int peerWakeDescriptor) {
+        segment = std::move(connectionSegment);
+        inbound.emplace(segment->ring(isServer ? 0 : 1));
+        outbound.emplace(segment->ring(isServer ? 1 : 0));
+
+        wakeEvent.assign(wakeDescriptor);
+        ownWakeEvent = wakeDescriptor;
+        peerWakeEvent = peerWakeDescriptor;
+    }
+
+    /*Starts receiving, and watching for the other end to go away.*/
+    void SharedMemoryClient::Impl::start() {
+        auto self(owner->shared_from_this());
+
+        //Nothing is sent on the control socket after the hello, so this only completes once the other end closes it.
+        controlSocket.async_read_some(asio::buffer(&controlByte, 1), [this, self](std::error_code, size_t) {
+            peerClosed = true;
+            signalEvent(ownWakeEvent);
+        });
+
+        asio::post(controlSocket.get_executor(), [this, self]() {
+            receive();
+        });
+    }
+
+    /*Hands over the packets in the ring, writes whatever waits for room, then spins or sleeps until there's more.*/
+    void SharedMemoryClient::Impl::receive() {
+        auto self(owner->shared_from_this());
+
+        if (closed) {
+            closeControlSocket();
+            return;
+        }
+
+        size_t received = drain();
+        if (hasPending)
+            flushPending();
+
+        if (closed) {
+            closeControlSocket();
+            return;
+        }
+
+        if (peerClosed && inbound->isEmpty()) {
+            connectionLost();
+            return;
+        }
+
+        //With a single CPU, the other end can't make progress while this one spins.
+        static const bool canSpin = std::thread::hardware_concurrency() > 1;
+        auto limit = canSpin ? std::chrono::nanoseconds(std::chrono::microseconds(maxSpinTime.load(std::memory_order_relaxed))) :
+            std::chrono::nanoseconds(0);
+        auto more = [this]() {
+            return !inbound->isEmpty() || peerClosed || closed || (hasPending && outbound->hasRoom(MAX_PACKET_SIZE));
+        };
+
+        //Packets are coming in, so there's no point waiting for them.
+        if (received > 0) {
+            asio::post(controlSocket.get_executor(), [this, self]() { receive(); });
+            return;
+        }
+
+        //Spin for the next packet, for a while. A spin that catches one is worth repeating, and one that
+        //comes up empty is halved next time, until it's not worth starting.
+        auto now = std::chrono::steady_clock::now();
+        if (spinTime > std::chrono::nanoseconds(0)) {
+            auto deadline = now + (std::min)(spinTime, limit);
+
+            do {
+                for (int i = 0; i < 64; i++) {
+                    if (more()) {
+                        spinHits++;
+                        spinTime = limit;
+                        asio::post(controlSocket.get_executor(), [this, self]() { receive(); });
+                        return;
+                    }
+
+                    cpuRelax();
+                }
+            } while ((now = std::chrono::steady_clock::now()) < deadline);
+        }
+        spinTime = spinTime / 2 < limit / 16 ? std::chrono::nanoseconds(0) : spinTime / 2;
+
+        if (!inbound->prepareToSleep() || more()) {
+            asio::post(controlSocket.get_executor(), [this, self]() { receive(); });
+            return;
+        }
+
+        sleeps++;
+        wakeEvent.async_wait(asio::posix::stream_descriptor::wait_read, [this, self, now, limit](std::error_code ec) {
+            if (ec)
+                return;
+
+            uint64_t count;
+            ssize_t read = ::read(ownWakeEvent, &count, sizeof(count));
+            (void)read;
+
+            //Woken sooner than a spin would have given up, so spinning would have saved the wakeup.
+            if (std::chrono::steady_clock::now() - now < limit)
+                spinTime = limit;
+
+            receive();
+        });
+    }
+
+    /*Hands over up to MAX_PACKETS_PER_PASS packets from the ring.
+    @return How many there were.*/
+    size_t SharedMemoryClient::Impl::drain() {
+        FrameHeader header;
+        std::vector<uint8_t> payload;
+        size_t count = 0;
+
+        while (count < MAX_PACKETS_PER_PASS && inbound->peek(header)) {
+            size_t size = header.headerSize + header.payloadSize;
+
+            //Only a corrupted ring could hold this, and there's no telling where the next frame starts.
+            if (size > static_cast<size_t>(MAX_PACKET_SIZE)) {
+                PARLO_LOG(LogLevel::error, "SharedMemoryClient: Frame of {} bytes in the ring, dropping the connection.", size);
+                metrics.add(ConnectionCounter::OversizedFrames);
+                connectionLost();
+                break;
+            }
+
+            inbound->consume(header, payload);
+            count++;
+            metrics.add(ConnectionCounter::BytesReceived, size);
+            metrics.add(ConnectionCounter::PacketsReceived);
+
+            //Whatever arrives after this end disconnected is dropped, but still consumed to make room.
+            if (!connected)
+                continue;
+
+            try {
+                handlePacket(header.id, header.compressed, std::move(payload));
+            }
+            catch (const std::exception& e) {
+                PARLO_LOG(LogLevel::error, "SharedMemoryClient: Failed to process packet: {}", e.what());
+                metrics.add(ConnectionCounter::DroppedFrames);
+            }
+        }
+
+        if (count > 0) {
+            metrics.add(ConnectionCounter::Reads);
+            if (inbound->wakeProducer())
+                wakePeer();
+        }
+
+        return count;
+    }
+
+    /*Dispatches a packet to the handlers.*/
+    void SharedMemoryClient::Impl::handlePacket(uint8_t id, bool isCompressed, std::vector<uint8_t> payload) {
+        auto client = owner->shared_from_this();
+
+        if (id == ParloIDs::SGoodbye) { //Server notified client of disconnection.
+            connected = false;
+            close();
+
+            if (onServerDisconnectedHandler)
+                onServerDisconnectedHandler(client);
+
+            return;
+        }
+        if (id == ParloIDs::CGoodbye) { //Client notified server of disconnection.
+            connected = false;
+            close();
+
+            if (onClientDisconnectedHandler)
+                onClientDisconnectedHandler(client);
+
+            return;
+        }
+
+        if (isCompressed)
+            payload = decompressData(payload);
+
+        if (onReceivedDataHandler)
+            onReceivedDataHandler(client, std::make_shared<Packet>(id, payload, false));
+    }
+
+    /*Sends a packet built by Packet::buildPacket().*/
+    void SharedMemoryClient::Impl::sendAsync(const std::vector<uint8_t>& data) {
+        if (data.empty())
+            throw std::invalid_argument("Data cannot be null or empty");
+        if (data.size() > static_cast<size_t>(MAX_PACKET_SIZE)) {
+            metrics.add(ConnectionCounter::OversizedFrames);
+            throw std::overflow_error("Data size exceeds maximum packet size");
+        }
+
+        FrameHeader header;
+        if (!readLegacyHeader(data.data(), data.size(), header) || header.headerSize + header.payloadSize != data.size())
+            throw std::invalid_argument("Data is not a packet built by Packet::buildPacket()");
+
+        if (!connected)
+            throw std::runtime_error("Socket is not connected");
+
+        queueFrame(data);
+    }
+
+    /*Writes a frame into the ring, or queues it behind those waiting for room.*/
+    void SharedMemoryClient::Impl::queueFrame(const std::vector<uint8_t>& frame) {
+        bool wake;
+
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+
+            if (pending.empty() && outbound->write(frame.data(), frame.size())) {
+                countSent(frame.size());
+                wake = outbound->wakeConsumer();
+            }
+            else {
+                if (pending.empty())
+                    ringFull++;
+
+                pending.push_back(frame);
+                metrics.add(ConnectionCounter::SendQueueDepth);
+                metrics.add(ConnectionCounter::SendQueueBytes, frame.size());
+                wake = writePending();
+            }
+        }
+
+        if (wake)
+            wakePeer();
+    }
+
+    /*Writes as many waiting frames as fit. Called with sendMutex held.
+    @return True if the other end has to be woken.*/
+    bool SharedMemoryClient::Impl::writePending() {
+        bool wrote = false;
+
+        while (!pending.empty()) {
+            const std::vector<uint8_t>& frame = pending.front();
+
+            if (!outbound->write(frame.data(), frame.size())) {
+                //The receive loop is woken once the other end makes room, unless it already has.
+                if (outbound->prepareToBlock(frame.size()))
+                    break;
+
+                continue;
+            }
+
+            countSent(frame.size());
+            metrics.subtract(ConnectionCounter::SendQueueDepth);
+            metrics.subtract(ConnectionCounter::SendQueueBytes, frame.size());
+            pending.pop_front();
+            wrote = true;
+        }
+
+        hasPending = !pending.empty();
+        if (!hasPending && closeWhenSent)
+            close();
+
+        return wrote && outbound->wakeConsumer();
+    }
+
+    /*Writes the frames waiting for room, and wakes the other end if it needs to be.*/
+    void SharedMemoryClient::Impl::flushPending() {
+        bool wake;
+
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            wake = writePending();
+        }
+
+        if (wake)
+            wakePeer();
+    }
+
+    /*Reports that the other end went away without saying goodbye.*/
+    void SharedMemoryClient::Impl::connectionLost() {
+        close();
+
+        if (!connected.exchange(false))
+            return;
+
+        PARLO_LOG(LogLevel::info, "SharedMemoryClient: The other end is gone.");
+        if (onConnectionLostHandler)
+            onConnectionLostHandler(owner->shared_from_this());
+    }
+
+    /*Marks the connection as done, and wakes the receive loop to tear it down.*/
+    void SharedMemoryClient::Impl::close() {
+        if (closed.exchange(true) || ownWakeEvent < 0)
+            return;
+
+        signalEvent(ownWakeEvent);
+    }
+
+    /*Asynchronously disconnects. A disconnection message is written after anything sent before it,
+    and the connection is closed once it has been.
+    @param sendDisconnectMessage Whether or not to send a disconnection message to the other party.*/
+    void SharedMemoryClient::Impl::disconnectAsync(bool sendDisconnectMessage) {
+        if (!connected.exchange(false))
+            return;
+
+        if (!sendDisconnectMessage) {
+            close();
+            return;
+        }
+
+        try {
+            GoodbyePacket byePacket(isServer ? (int)ParloDefaultTimeouts::Server : (int)ParloDefaultTimeouts::Client);
+            Packet goodbye(isServer ? (uint8_t)ParloIDs::SGoodbye : (uint8_t)ParloIDs::CGoodbye, byePacket.toByteArray(), false);
+            std::vector<uint8_t> frame = goodbye.buildPacket();
+            bool wake;
+
+            {
+                std::lock_guard<std::mutex> lock(sendMutex);
+                pending.push_back(std::move(frame));
+                metrics.add(ConnectionCounter::SendQueueDepth);
+                metrics.add(ConnectionCounter::SendQueueBytes, pending.back().size());
+                closeWhenSent = true;
+                wake = writePending();
+            }
+
+            if (wake)
+                wakePeer();
+        }
+        catch (const std::exception& e) {
+            PARLO_LOG(LogLevel::error, "Exception during SharedMemoryClient::disconnectAsync(): {}", e.what());
+            close();
+        }
+    }
+#else
+    class SharedMemoryClient::Impl {
+    public:
+        Impl(asio::io_context&) {}
+
+        void connectAsync(const std::string&) {
+            throw std::runtime_error("Shared memory connections are only available on Linux");
+        }
+        void sendAsync(const std::vector<uint8_t>&) {
+            throw std::runtime_error("Socket is not connected");
+        }
+        void disconnectAsync(bool) {}
+        void accept(std::unique_ptr<SharedMemoryChannel>) {}
+        void start() {}
+
+        std::atomic<bool> connected{ false };
+        std::atomic<int64_t> maxSpinTime{ 0 };
+        ConnectionMetricsRecorder metrics;
+        std::atomic<uint64_t> sleeps{ 0 };
+        std::atomic<uint64_t> spinHits{ 0 };
+        std::atomic<uint64_t> wakeupsSent{ 0 };
+        std::atomic<uint64_t> ringFull{ 0 };
+
+        std::function<void(const std::shared_ptr<SharedMemoryClient>&)> onServerDisconnectedHandler;
+        std::function<void(const std::shared_ptr<SharedMemoryClient>&)> onClientDisconnectedHandler;
+        std::function<void(const std::shared_ptr<SharedMemoryClient>&)> onConnectionLostHandler;
+        std::function<void(const std::shared_ptr<SharedMemoryClient>&, const std::shared_ptr<Packet>&)> onReceivedDataHandler;
+
+        SharedMemoryClient* owner;
+    };
+#endif
+
+    /*Constructs a new SharedMemoryClient instance. Call connectAsync() to start using it.
+    @param context An asio::io_context instance.*/
+    SharedMemoryClient::SharedMemoryClient(asio::io_context& context) :
+        pImpl(std::make_unique<SharedMemoryClient::Impl>(context)) {
+        pImpl->owner = this;
+    }
+
+    SharedMemoryClient::~SharedMemoryClient() {}
+
+    void SharedMemoryClient::connectAsync(const std::string& name) {
+        pImpl->connectAsync(name);
+    }
+
+    /*Connects to the SharedMemoryListener created for a TCP endpoint on this host.
+    @param endpoint The endpoint, which must be a loopback address.*/
+    void SharedMemoryClient::connectAsync(const asio::ip::tcp::endpoint& endpoint) {
+        if (!endpoint.address().is_loopback())
+            throw std::invalid_argument("Only loopback endpoints can be reached through shared memory");
+
+        pImpl->connectAsync(SharedMemoryListener::nameFor(endpoint));
+    }
+
+    /*Is there a SharedMemoryListener for a TCP endpoint? Looks for its socket in /proc/net/unix,
+    so finding out doesn't make a connection.
+    @param endpoint The endpoint.*/
+    bool SharedMemoryClient::isReachable(const asio::ip::tcp::endpoint& endpoint) {
+        if (!isSharedMemoryAvailable() || !endpoint.address().is_loopback())
+            return false;
+
+        //Abstract sockets are listed with an @ in place of the leading null byte.
+        std::string path = " @parlo." + SharedMemoryListener::nameFor(endpoint);
+        std::ifstream sockets("/proc/net/unix");
+        std::string line;
+
+        while (std::getline(sockets, line)) {
+            if (line.size() >= path.size() && line.compare(line.size() - path.size(), path.size(), path) == 0)
+                return true;
+        }
+
+        return false;
+    }
+
+    void SharedMemoryClient::sendAsync(const std::vector<uint8_t>& data) {
+        pImpl->sendAsync(data);
+    }
+
+    void SharedMemoryClient::disconnectAsync(bool sendDisconnectMessage) {
+        pImpl->disconnectAsync(sendDisconnectMessage);
+    }
+
+    void SharedMemoryClient::accept(std::unique_ptr<SharedMemoryChannel> channel) {
+        pImpl->accept(std::move(channel));
+    }
+
+    void SharedMemoryClient::start() {
+        pImpl->start();
+    }
+
+    /*Sets how long to spin on an empty ring before sleeping.
+    @param maxSpinTime The longest to spin, or 0 to always sleep right away.
+    @throws std::invalid_argument if maxSpinTime is negative.*/
+    void SharedMemoryClient::setSpinTime(std::chrono::microseconds maxSpinTime) {
+        if (maxSpinTime.count() < 0)
+            throw std::invalid_argument("The spin time can't be negative");
+
+        pImpl->maxSpinTime = maxSpinTime.count();
+    }
+
+    bool SharedMemoryClient::isConnected() const {
+        return pImpl->connected;
+    }
+
+    ConnectionMetrics SharedMemoryClient::getMetrics() const {
+        return pImpl->metrics.snapshot();
+    }
+
+    SharedMemoryStats SharedMemoryClient::getSharedMemoryStats() const {
+        SharedMemoryStats stats;
+        stats.sleeps = pImpl->sleeps;
+        stats.spinHits = pImpl->spinHits;
+        stats.wakeupsSent = pImpl->wakeupsSent;
+        stats.ringFull = pImpl->ringFull;
+        return stats;
+    }
+
+    void SharedMemoryClient::setOnClientDisconnectedHandler(std::function<void(const std::shared_ptr<SharedMemoryClient>&)> handler) {
+        pImpl->onClientDisconnectedHandler = handler;
+    }
+
+    void SharedMemoryClient::setOnConnectionLostHandler(std::function<void(const std::shared_ptr<SharedMemoryClient>&)> handler) {
+        pImpl->onConnectionLostHandler = handler;
+    }
+
+    void SharedMemoryClient::setOnServerDisconnectedHandler(std::function<void(const std::shared_ptr<SharedMemoryClient>&)> handler) {
+        pImpl->onServerDisconnectedHandler = handler;
+    }
+
+    void SharedMemoryClient::setOnReceivedDataHandler(std::function<void(const std::shared_ptr<SharedMemoryClient>&,
+        const std::shared_ptr<Packet>&)> handler) {
+        pImpl->onReceivedDataHandler = handler;
+    }
+}
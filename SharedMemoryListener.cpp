@@ -0,0 +1,216 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include "pch.h"
+#include "SharedMemory.h"
+#include "SharedMemoryRing.h"
+#include "Logger.h"
+#include <mutex>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+namespace Parlo
+{
+#ifdef __linux__
+    class SharedMemoryListener::Impl {
+    public:
+        Impl(asio::io_context& context, const std::string& name) : name(name), context(context), acceptor(context) {
+            std::error_code ec;
+
+            acceptor.open(asio::local::stream_protocol(), ec);
+            if (!ec)
+                acceptor.bind(sharedMemoryEndpoint(name), ec);
+            if (!ec)
+                acceptor.listen(asio::socket_base::max_listen_connections, ec);
+
+            if (ec)
+                throw std::runtime_error("Couldn't create shared memory listener " + name + ": " + ec.message());
+        }
+
+        void startAccepting();
+        void stopAccepting();
+
+        std::string name;
+
+        /*Guards ringSize, spinTime and the handler.*/
+        std::mutex settingsMutex;
+        size_t ringSize = DEFAULT_SHARED_MEMORY_RING_SIZE;
+        std::chrono::microseconds spinTime = DEFAULT_SHARED_MEMORY_SPIN_TIME;
+        std::function<void(const std::shared_ptr<SharedMemoryClient>&)> onClientConnectedHandler;
+
+        SharedMemoryListener* owner;
+
+    private:
+        asio::io_context& context;
+        asio::local::stream_protocol::acceptor acceptor;
+        std::atomic<bool> running{ false };
+
+        void acceptNext();
+
+        /*Sets up the segment and the eventfds for a connection, and sends them to the client.*/
+        void handleAccepted(asio::local::stream_protocol::socket socket);
+    };
+
+    void SharedMemoryListener::Impl::startAccepting() {
+        if (running.exchange(true))
+            return;
+
+        acceptNext();
+    }
+
+    void SharedMemoryListener::Impl::stopAccepting() {
+        running = false;
+
+        std::error_code ec;
+        acceptor.cancel(ec);
+    }
+
+    void SharedMemoryListener::Impl::acceptNext() {
+        auto self(owner->shared_from_this());
+
+        acceptor.async_accept([this, self](std::error_code ec, asio::local::stream_protocol::socket socket) {
+            if (!running)
+                return;
+
+            if (!ec)
+                handleAccepted(std::move(socket));
+            else
+                PARLO_LOG(LogLevel::error, "Error accepting shared memory connection on {}: {}", name, ec);
+
+            acceptNext();
+        });
+    }
+
+    /*Sets up the segment and the eventfds for a connection, and sends them to the client.*/
+    void SharedMemoryListener::Impl::handleAccepted(asio::local::stream_protocol::socket socket) {
+        size_t connectionRingSize;
+        std::chrono::microseconds connectionSpinTime;
+        std::function<void(const std::shared_ptr<SharedMemoryClient>&)> handler;
+
+        {
+            std::lock_guard<std::mutex> lock(settingsMutex);
+            connectionRingSize = ringSize;
+            connectionSpinTime = spinTime;
+            handler = onClientConnectedHandler;
+        }
+
+        auto channel = std::make_unique<SharedMemoryChannel>(std::move(socket));
+
+        try {
+            channel->segment = std::make_unique<SharedMemorySegment>(connectionRingSize);
+        }
+        catch (const std::exception& e) {
+            PARLO_LOG(LogLevel::error, "Error setting up shared memory connection on {}: {}", name, e.what());
+            return;
+        }
+
+        channel->wakeEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        channel->peerWakeEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (channel->wakeEvent < 0 || channel->peerWakeEvent < 0) {
+            PARLO_LOG(LogLevel::error, "Error setting up shared memory connection on {}: Couldn't create eventfd", name);
+            return;
+        }
+
+        //The client's eventfd goes first. The client gets duplicates, so this end keeps its own.
+        const int descriptors[SHARED_MEMORY_DESCRIPTORS] = {
+            channel->segment->fileDescriptor(), channel->peerWakeEvent, channel->wakeEvent };
+        if (!sendDescriptors(channel->socket.native_handle(), static_cast<uint32_t>(connectionRingSize), descriptors)) {
+            PARLO_LOG(LogLevel::error, "Error setting up shared memory connection on {}: Couldn't send the segment", name);
+            return;
+        }
+
+        auto client = std::make_shared<SharedMemoryClient>(context);
+        client->setSpinTime(connectionSpinTime);
+        client->accept(std::move(channel));
+
+        if (handler)
+            handler(client);
+
+        client->start();
+    }
+#else
+    class SharedMemoryListener::Impl {
+    public:
+        Impl(asio::io_context&, const std::string& name) : name(name) {
+            throw std::runtime_error("Shared memory connections are only available on Linux");
+        }
+
+        void startAccepting() {}
+        void stopAccepting() {}
+
+        std::string name;
+        std::mutex settingsMutex;
+        size_t ringSize = DEFAULT_SHARED_MEMORY_RING_SIZE;
+        std::chrono::microseconds spinTime = DEFAULT_SHARED_MEMORY_SPIN_TIME;
+        std::function<void(const std::shared_ptr<SharedMemoryClient>&)> onClientConnectedHandler;
+
+        SharedMemoryListener* owner;
+    };
+#endif
+
+    /*Creates a SharedMemoryListener.
+    @param context An asio::io_context instance.
+    @param name What SharedMemoryClient::connectAsync() is passed to connect.*/
+    SharedMemoryListener::SharedMemoryListener(asio::io_context& context, const std::string& name) :
+        pImpl(std::make_unique<SharedMemoryListener::Impl>(context, name)) {
+        pImpl->owner = this;
+    }
+
+    SharedMemoryListener::SharedMemoryListener(asio::io_context& context, const asio::ip::tcp::endpoint& endpoint) :
+        SharedMemoryListener(context, nameFor(endpoint)) {}
+
+    SharedMemoryListener::~SharedMemoryListener() {}
+
+    void SharedMemoryListener::startAccepting() {
+        pImpl->startAccepting();
+    }
+
+    void SharedMemoryListener::stopAccepting() {
+        pImpl->stopAccepting();
+    }
+
+    const std::string& SharedMemoryListener::getName() const {
+        return pImpl->name;
+    }
+
+    std::string SharedMemoryListener::nameFor(const asio::ip::tcp::endpoint& endpoint) {
+        return "port." + std::to_string(endpoint.port());
+    }
+
+    /*Sets the size of both rings of connections accepted from now on.
+    @param size The size in bytes.
+    @throws std::invalid_argument if the size isn't a power of two, or can't hold a packet of MAX_PACKET_SIZE.*/
+    void SharedMemoryListener::setRingSize(size_t size) {
+        if (!isValidRingSize(size))
+            throw std::invalid_argument("The ring size must be a power of two between " +
+                std::to_string(MIN_SHARED_MEMORY_RING_SIZE) + " and " + std::to_string(MAX_SHARED_MEMORY_RING_SIZE) + " bytes");
+
+        std::lock_guard<std::mutex> lock(pImpl->settingsMutex);
+        pImpl->ringSize = size;
+    }
+
+    /*Sets how long connections accepted from now on spin.
+    @throws std::invalid_argument if maxSpinTime is negative.*/
+    void SharedMemoryListener::setSpinTime(std::chrono::microseconds maxSpinTime) {
+        if (maxSpinTime.count() < 0)
+            throw std::invalid_argument("The spin time can't be negative");
+
+        std::lock_guard<std::mutex> lock(pImpl->settingsMutex);
+        pImpl->spinTime = maxSpinTime;
+    }
+
+    void SharedMemoryListener::setOnClientConnectedHandler(std::function<void(const std::shared_ptr<SharedMemoryClient>&)> handler) {
+        std::lock_guard<std::mutex> lock(pImpl->settingsMutex);
+        pImpl->onClientConnectedHandler = handler;
+    }
+}
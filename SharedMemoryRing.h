@@ -0,0 +1,363 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <asio.hpp>
+#include "FrameHeader.h"
+#include "Parlo.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Parlo
+{
+    /*The smallest ring a shared memory connection can have, so a packet of MAX_PACKET_SIZE always fits with room to spare.*/
+    const size_t MIN_SHARED_MEMORY_RING_SIZE = 4 * MAX_PACKET_SIZE;
+    const size_t MAX_SHARED_MEMORY_RING_SIZE = 1 << 30;
+
+    inline bool isValidRingSize(size_t size) {
+        return size >= MIN_SHARED_MEMORY_RING_SIZE && size <= MAX_SHARED_MEMORY_RING_SIZE && (size & (size - 1)) == 0;
+    }
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+        "Shared memory rings need lock free atomics, since they're shared between processes");
+
+    /*The indices of a ring, at the start of the ring in the shared memory segment. Each index is on its own
+    cache line, so the producer and the consumer don't keep taking the line from each other.*/
+    struct SharedMemoryRingControl
+    {
+        /*How many bytes the producer has written, ever. Only the producer writes it.*/
+        alignas(64) std::atomic<uint64_t> head{ 0 };
+        /*How many bytes the consumer has read, ever. Only the consumer writes it.*/
+        alignas(64) std::atomic<uint64_t> tail{ 0 };
+        /*Set by the consumer before it sleeps, and by the producer when a frame didn't fit, so the other
+        end only wakes them when they're actually waiting.*/
+        alignas(64) std::atomic<uint32_t> consumerSleeping{ 0 };
+        std::atomic<uint32_t> producerBlocked{ 0 };
+    };
+
+    /*Bytes of a ring, starting at an index that may wrap around, I.E to read a frame header with readLegacyHeader().*/
+    struct RingBytes
+    {
+        const uint8_t* data;
+        uint64_t mask;
+        uint64_t start;
+
+        uint8_t operator[](size_t index) const { return data[(start + index) & mask]; }
+    };
+
+    /*Tells the CPU it's in a spin loop, so it doesn't speculate ahead and can give a hyperthread the core.*/
+    inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    /*A single producer, single consumer ring of packets in shared memory. Packets are framed like they are on
+    a socket, with a legacy header, and are always written whole, so the consumer never sees part of one.*/
+    class SharedMemoryRing
+    {
+    public:
+        /*@param base Where the ring starts, footprint(capacity) bytes.
+        @param capacity The ring's size in bytes. A power of two.*/
+        SharedMemoryRing(uint8_t* base, size_t capacity) :
+            control(reinterpret_cast<SharedMemoryRingControl*>(base)), data(base + sizeof(SharedMemoryRingControl)),
+            capacity(capacity), mask(capacity - 1) {}
+
+        /*The bytes a ring of a capacity takes up, its indices included.*/
+        static size_t footprint(size_t capacity) {
+            return sizeof(SharedMemoryRingControl) + capacity;
+        }
+
+        /*Writes a frame if there's room for it. Only called by the producer.
+        @return False if the ring is too full.*/
+        bool write(const uint8_t* frame, size_t size) {
+            uint64_t head = control->head.load(std::memory_order_relaxed);
+            if (capacity - (head - control->tail.load(std::memory_order_acquire)) < size)
+                return false;
+
+            size_t offset = static_cast<size_t>(head & mask);
+            size_t first = (std::min)(size, capacity - offset);
+            std::copy(frame, frame + first, data + offset);
+            std::copy(frame + first, frame + size, data);
+
+            //Sequentially consistent, so it can't be reordered with the load in wakeConsumer().
+            control->head.store(head + size);
+            return true;
+        }
+
+        /*Reads the header of the next frame. Only called by the consumer.
+        @return False if the ring is empty.*/
+        bool peek(FrameHeader& header) const {
+            uint64_t tail = control->tail.load(std::memory_order_relaxed);
+            size_t available = static_cast<size_t>(control->head.load(std::memory_order_acquire) - tail);
+            return readLegacyHeader(RingBytes{ data, mask, tail }, available, header);
+        }
+
+        /*Copies out the payload of the frame peek() returned, and frees the room it took up. Only called by the consumer.
+        @param header The header peek() returned.
+        @param payload Set to the payload.*/
+        void consume(const FrameHeader& header, std::vector<uint8_t>& payload) {
+            uint64_t tail = control->tail.load(std::memory_order_relaxed);
+            size_t offset = static_cast<size_t>((tail + header.headerSize) & mask);
+            size_t first = (std::min)(header.payloadSize, capacity - offset);
+
+            payload.resize(header.payloadSize);
+            std::copy(data + offset, data + offset + first, payload.begin());
+            std::copy(data, data + (header.payloadSize - first), payload.begin() + first);
+
+            //Sequentially consistent, so it can't be reordered with the load in wakeProducer().
+            control->tail.store(tail + header.headerSize + header.payloadSize);
+        }
+
+        bool isEmpty() const {
+            return control->head.load(std::memory_order_acquire) == control->tail.load(std::memory_order_relaxed);
+        }
+
+        /*Is there room for a frame? Only meaningful to the producer.*/
+        bool hasRoom(size_t size) const {
+            return capacity - (control->head.load(std::memory_order_relaxed) - control->tail.load(std::memory_order_acquire)) >= size;
+        }
+
+        /*Announces that the consumer is about to sleep. Paired with wakeConsumer(): either the producer sees
+        the flag and wakes the consumer, or the consumer sees the frame and doesn't sleep.
+        @return False if it mustn't sleep, since a frame arrived meanwhile.*/
+        bool prepareToSleep() {
+            control->consumerSleeping.store(1);
+            if (control->head.load() != control->tail.load(std::memory_order_relaxed)) {
+                control->consumerSleeping.store(0);
+                return false;
+            }
+
+            return true;
+        }
+
+        /*Called by the producer after writing.
+        @return True if the consumer was asleep and has to be woken.*/
+        bool wakeConsumer() {
+            return control->consumerSleeping.load() != 0 && control->consumerSleeping.exchange(0) != 0;
+        }
+
+        /*Announces that the producer is waiting for room for a frame. Paired with wakeProducer().
+        @return False if it mustn't wait, since the room was made meanwhile.*/
+        bool prepareToBlock(size_t size) {
+            control->producerBlocked.store(1);
+            if (capacity - (control->head.load(std::memory_order_relaxed) - control->tail.load()) >= size) {
+                control->producerBlocked.store(0);
+                return false;
+            }
+
+            return true;
+        }
+
+        /*Called by the consumer after consuming.
+        @return True if the producer was waiting for room and has to be woken.*/
+        bool wakeProducer() {
+            return control->producerBlocked.load() != 0 && control->producerBlocked.exchange(0) != 0;
+        }
+
+    private:
+        SharedMemoryRingControl* control;
+        uint8_t* data;
+        size_t capacity;
+        uint64_t mask;
+    };
+
+#ifdef __linux__
+    /*A memfd holding the two rings of a shared memory connection, mapped into this process.
+    The ring at index 0 carries what the client sends, and the one at index 1 what the server sends.*/
+    class SharedMemorySegment
+    {
+    public:
+        /*Creates a segment, with empty rings.
+        @param ringSize The size of each ring. A power of two.
+        @throws std::runtime_error if the memfd couldn't be created or mapped.*/
+        explicit SharedMemorySegment(size_t ringSize) : ringSize(ringSize) {
+            descriptor = memfd_create("parlo", MFD_CLOEXEC);
+            if (descriptor < 0)
+                throw std::runtime_error("SharedMemorySegment: Couldn't create memfd");
+
+            if (ftruncate(descriptor, static_cast<off_t>(size())) != 0) {
+                close(descriptor);
+                throw std::runtime_error("SharedMemorySegment: Couldn't resize memfd");
+            }
+
+            map();
+            for (size_t i = 0; i < 2; i++)
+                new (address + i * SharedMemoryRing::footprint(ringSize)) SharedMemoryRingControl();
+        }
+
+        /*Maps a segment created by another process, taking ownership of its descriptor.
+        @param descriptor The memfd.
+        @param ringSize The size of each ring, as the other process created it.
+        @throws std::runtime_error if the memfd is too small, or couldn't be mapped.*/
+        SharedMemorySegment(int descriptor, size_t ringSize) : descriptor(descriptor), ringSize(ringSize) {
+            struct stat status;
+            if (fstat(descriptor, &status) != 0 || static_cast<size_t>(status.st_size) < size()) {
+                close(descriptor);
+                throw std::runtime_error("SharedMemorySegment: memfd is too small for its rings");
+            }
+
+            map();
+        }
+
+        ~SharedMemorySegment() {
+            munmap(address, size());
+            close(descriptor);
+        }
+
+        SharedMemorySegment(const SharedMemorySegment&) = delete;
+        SharedMemorySegment& operator=(const SharedMemorySegment&) = delete;
+
+        int fileDescriptor() const { return descriptor; }
+
+        SharedMemoryRing ring(size_t index) {
+            return SharedMemoryRing(address + index * SharedMemoryRing::footprint(ringSize), ringSize);
+        }
+
+    private:
+        int descriptor;
+        size_t ringSize;
+        uint8_t* address = nullptr;
+
+        size_t size() const {
+            return 2 * SharedMemoryRing::footprint(ringSize);
+        }
+
+        void map() {
+            void* mapped = mmap(nullptr, size(), PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+            if (mapped == MAP_FAILED) {
+                close(descriptor);
+                throw std::runtime_error("SharedMemorySegment: Couldn't map memfd");
+            }
+
+            address = static_cast<uint8_t*>(mapped);
+        }
+    };
+
+    /*What a SharedMemoryListener sends a SharedMemoryClient that connects: [uint32_t SHARED_MEMORY_MAGIC][uint32_t ring size],
+    with the memfd, the client's eventfd and the server's eventfd attached, in that order.*/
+    const uint32_t SHARED_MEMORY_MAGIC = 0x534D5250;
+    const size_t SHARED_MEMORY_DESCRIPTORS = 3;
+
+    /*The Unix domain socket a SharedMemoryListener listens on. It's in the abstract namespace, so nothing is left on disk.*/
+    inline asio::local::stream_protocol::endpoint sharedMemoryEndpoint(const std::string& name) {
+        return asio::local::stream_protocol::endpoint(std::string(1, '\0') + "parlo." + name);
+    }
+
+    /*A connection a SharedMemoryListener accepted, handed over to the SharedMemoryClient that serves it.
+    Closes the eventfds unless they were taken.*/
+    struct SharedMemoryChannel
+    {
+        explicit SharedMemoryChannel(asio::local::stream_protocol::socket socket) : socket(std::move(socket)) {}
+        ~SharedMemoryChannel() {
+            if (wakeEvent >= 0)
+                ::close(wakeEvent);
+            if (peerWakeEvent >= 0)
+                ::close(peerWakeEvent);
+        }
+
+        asio::local::stream_protocol::socket socket;
+        std::unique_ptr<SharedMemorySegment> segment;
+        /*The eventfd this end sleeps on, and the one the other end sleeps on.*/
+        int wakeEvent = -1;
+        int peerWakeEvent = -1;
+    };
+
+    /*Sends the hello with a connection's descriptors over a Unix domain socket.
+    @return False if it couldn't be sent.*/
+    inline bool sendDescriptors(int socket, uint32_t ringSize, const int (&descriptors)[SHARED_MEMORY_DESCRIPTORS]) {
+        uint32_t hello[2] = { SHARED_MEMORY_MAGIC, ringSize };
+        iovec data{ hello, sizeof(hello) };
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(descriptors))] = {};
+
+        msghdr message{};
+        message.msg_iov = &data;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(descriptors));
+        std::memcpy(CMSG_DATA(header), descriptors, sizeof(descriptors));
+
+        return sendmsg(socket, &message, MSG_NOSIGNAL) == static_cast<ssize_t>(sizeof(hello));
+    }
+
+    /*Receives the hello sent by sendDescriptors(), without blocking.
+    @param descriptors Set to the descriptors, which the caller then owns.
+    @return The size of the rings, or 0 if what arrived wasn't a valid hello, in which case no descriptors are left open.*/
+    inline uint32_t receiveDescriptors(int socket, int (&descriptors)[SHARED_MEMORY_DESCRIPTORS]) {
+        uint32_t hello[2] = {};
+        iovec data{ hello, sizeof(hello) };
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(descriptors))] = {};
+
+        msghdr message{};
+        message.msg_iov = &data;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        ssize_t received = recvmsg(socket, &message, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+        size_t count = 0;
+
+        if (received >= 0) {
+            for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+                if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+                    continue;
+
+                size_t attached = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (size_t i = 0; i < attached; i++) {
+                    int descriptor;
+                    std::memcpy(&descriptor, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+
+                    if (count < SHARED_MEMORY_DESCRIPTORS)
+                        descriptors[count++] = descriptor;
+                    else
+                        ::close(descriptor);
+                }
+            }
+        }
+
+        if (received != static_cast<ssize_t>(sizeof(hello)) || hello[0] != SHARED_MEMORY_MAGIC || !isValidRingSize(hello[1]) ||
+            count != SHARED_MEMORY_DESCRIPTORS || (message.msg_flags & MSG_CTRUNC)) {
+            for (size_t i = 0; i < count; i++)
+                ::close(descriptors[i]);
+
+            return 0;
+        }
+
+        return hello[1];
+    }
+#else
+    struct SharedMemoryChannel {};
+#endif
+}
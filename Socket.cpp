@@ -1,9 +1,33 @@
 #include "pch.h"
 #include "Socket.h"
+#include "Logger.h"
 
+#ifndef _WIN32
+#include <netinet/tcp.h>
+#endif
 
 namespace Parlo
 {
+    //Options asio doesn't have types for. Each is only defined where the platform has it.
+#ifdef TCP_QUICKACK
+    using QuickAckOption = asio::detail::socket_option::boolean<IPPROTO_TCP, TCP_QUICKACK>;
+#endif
+#ifdef SO_BUSY_POLL
+    using BusyPollOption = asio::detail::socket_option::integer<SOL_SOCKET, SO_BUSY_POLL>;
+#endif
+#ifdef TCP_NOTSENT_LOWAT
+    using NotSentLowWatermarkOption = asio::detail::socket_option::integer<IPPROTO_TCP, TCP_NOTSENT_LOWAT>;
+#endif
+#ifdef TCP_KEEPIDLE
+    using KeepAliveIdleOption = asio::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPIDLE>;
+#endif
+#ifdef TCP_KEEPINTVL
+    using KeepAliveIntervalOption = asio::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPINTVL>;
+#endif
+#ifdef TCP_KEEPCNT
+    using KeepAliveCountOption = asio::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPCNT>;
+#endif
+
     /*Asynchronously accepts new connection(s).
     @param acceptor An asio::ip::tcp::acceptor instance for accepting connections.
     @param callback A callback function to be called when a new socket was accepted.*/
@@ -28,6 +52,138 @@ namespace Parlo
             throw std::runtime_error("Failed to set linger option: " + ec.message());
     }
     
+    /*Applies every option that's set. Options that fail to apply are logged and skipped.
+    @param options The options to apply.*/
+    void Socket::applyOptions(const SocketOptions& options)
+    {
+        auto set = [this](const char* name, const auto& option) {
+            std::error_code ec;
+            socket.set_option(option, ec);
+
+            if (ec)
+                PARLO_LOG(LogLevel::warn, "Failed to set socket option {}: {}", name, ec.message());
+        };
+
+        if (options.noDelay)
+            set("TCP_NODELAY", asio::ip::tcp::no_delay(*options.noDelay));
+        if (options.sendBufferSize)
+            set("SO_SNDBUF", asio::socket_base::send_buffer_size(*options.sendBufferSize));
+        if (options.receiveBufferSize)
+            set("SO_RCVBUF", asio::socket_base::receive_buffer_size(*options.receiveBufferSize));
+        if (options.keepAlive)
+            set("SO_KEEPALIVE", asio::socket_base::keep_alive(*options.keepAlive));
+#ifdef TCP_KEEPIDLE
+        if (options.keepAliveIdle)
+            set("TCP_KEEPIDLE", KeepAliveIdleOption(static_cast<int>(options.keepAliveIdle->count())));
+#endif
+#ifdef TCP_KEEPINTVL
+        if (options.keepAliveInterval)
+            set("TCP_KEEPINTVL", KeepAliveIntervalOption(static_cast<int>(options.keepAliveInterval->count())));
+#endif
+#ifdef TCP_KEEPCNT
+        if (options.keepAliveCount)
+            set("TCP_KEEPCNT", KeepAliveCountOption(*options.keepAliveCount));
+#endif
+#ifdef TCP_QUICKACK
+        if (options.quickAck)
+            set("TCP_QUICKACK", QuickAckOption(*options.quickAck));
+#endif
+#ifdef SO_BUSY_POLL
+        if (options.busyPoll)
+            set("SO_BUSY_POLL", BusyPollOption(static_cast<int>(options.busyPoll->count())));
+#endif
+#ifdef TCP_NOTSENT_LOWAT
+        if (options.notSentLowWatermark)
+            set("TCP_NOTSENT_LOWAT", NotSentLowWatermarkOption(*options.notSentLowWatermark));
+#endif
+        if (options.linger)
+            set("SO_LINGER", asio::socket_base::linger(true, static_cast<int>(options.linger->count())));
+    }
+
+    /*Turns TCP_QUICKACK on or off, where the platform has it. Errors are ignored.*/
+    void Socket::setQuickAck(bool enable)
+    {
+#ifdef TCP_QUICKACK
+        std::error_code ec;
+        socket.set_option(QuickAckOption(enable), ec);
+#else
+        (void)enable;
+#endif
+    }
+
+    /*Reads back the effective value of every option the platform has.
+    @throws std::runtime_error if the socket isn't open.*/
+    SocketOptions Socket::getOptions()
+    {
+        if (!socket.is_open())
+            throw std::runtime_error("Failed to read socket options: the socket isn't open");
+
+        SocketOptions options;
+        std::error_code ec;
+
+        asio::ip::tcp::no_delay noDelay;
+        socket.get_option(noDelay, ec);
+        if (!ec)
+            options.noDelay = noDelay.value();
+
+        asio::socket_base::send_buffer_size sendBufferSize;
+        socket.get_option(sendBufferSize, ec);
+        if (!ec)
+            options.sendBufferSize = sendBufferSize.value();
+
+        asio::socket_base::receive_buffer_size receiveBufferSize;
+        socket.get_option(receiveBufferSize, ec);
+        if (!ec)
+            options.receiveBufferSize = receiveBufferSize.value();
+
+        asio::socket_base::keep_alive keepAlive;
+        socket.get_option(keepAlive, ec);
+        if (!ec)
+            options.keepAlive = keepAlive.value();
+#ifdef TCP_KEEPIDLE
+        KeepAliveIdleOption keepAliveIdle;
+        socket.get_option(keepAliveIdle, ec);
+        if (!ec)
+            options.keepAliveIdle = std::chrono::seconds(keepAliveIdle.value());
+#endif
+#ifdef TCP_KEEPINTVL
+        KeepAliveIntervalOption keepAliveInterval;
+        socket.get_option(keepAliveInterval, ec);
+        if (!ec)
+            options.keepAliveInterval = std::chrono::seconds(keepAliveInterval.value());
+#endif
+#ifdef TCP_KEEPCNT
+        KeepAliveCountOption keepAliveCount;
+        socket.get_option(keepAliveCount, ec);
+        if (!ec)
+            options.keepAliveCount = keepAliveCount.value();
+#endif
+#ifdef TCP_QUICKACK
+        QuickAckOption quickAck;
+        socket.get_option(quickAck, ec);
+        if (!ec)
+            options.quickAck = quickAck.value();
+#endif
+#ifdef SO_BUSY_POLL
+        BusyPollOption busyPoll;
+        socket.get_option(busyPoll, ec);
+        if (!ec)
+            options.busyPoll = std::chrono::microseconds(busyPoll.value());
+#endif
+#ifdef TCP_NOTSENT_LOWAT
+        NotSentLowWatermarkOption notSentLowWatermark;
+        socket.get_option(notSentLowWatermark, ec);
+        if (!ec)
+            options.notSentLowWatermark = notSentLowWatermark.value();
+#endif
+        asio::socket_base::linger linger;
+        socket.get_option(linger, ec);
+        if (!ec && linger.enabled())
+            options.linger = std::chrono::seconds(linger.timeout());
+
+        return options;
+    }
+
     /*Asynchronously connects to a remote endpoint.
     @param endpoint The remote endpoint to connect to.
     @param callback A callback function to be called when the connection attempt completes.*/
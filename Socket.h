@@ -1,11 +1,83 @@
 #pragma once
 
 #include <asio.hpp>
+#include <chrono>
 #include <functional>
+#include <optional>
 #include <utility>
 
 namespace Parlo
 {
+    /*TCP options applied to a Socket when it's accepted or connected. Options that aren't set are left
+    at the OS' defaults. Options the platform doesn't have are skipped.*/
+    struct SocketOptions
+    {
+        /*TCP_NODELAY: send small writes right away instead of coalescing them (Nagle's algorithm).*/
+        std::optional<bool> noDelay;
+        /*SO_SNDBUF and SO_RCVBUF in bytes. Linux reports back double the size that was set.*/
+        std::optional<int> sendBufferSize;
+        std::optional<int> receiveBufferSize;
+        /*SO_KEEPALIVE, and on Linux when to start probing, how often and how many probes to send.*/
+        std::optional<bool> keepAlive;
+        std::optional<std::chrono::seconds> keepAliveIdle;
+        std::optional<std::chrono::seconds> keepAliveInterval;
+        std::optional<int> keepAliveCount;
+        /*TCP_QUICKACK, Linux only: acknowledge right away instead of delaying ACKs. The kernel turns
+        it off again by itself, so NetworkClient sets it again after every read, at one system call per read.*/
+        std::optional<bool> quickAck;
+        /*SO_BUSY_POLL, Linux only: how long a blocking read busy polls the NIC. Raising it above
+        net.core.busy_read needs CAP_NET_ADMIN.*/
+        std::optional<std::chrono::microseconds> busyPoll;
+        /*TCP_NOTSENT_LOWAT, Linux and macOS: how many unsent bytes may sit in the send buffer before the
+        socket stops being writable. Keeps queued data in the application where it can still be reordered.*/
+        std::optional<int> notSentLowWatermark;
+        /*SO_LINGER: how long closing waits for unsent data. Zero resets the connection on close.*/
+        std::optional<std::chrono::seconds> linger;
+
+        /*Small messages, sent as soon as possible: Nagle's algorithm and delayed ACKs are turned off,
+        and little unsent data is queued in the kernel. Busy polling isn't included, since it burns
+        CPU and only helps with NICs that support it.*/
+        static SocketOptions lowLatency() {
+            SocketOptions options;
+            options.noDelay = true;
+            options.quickAck = true;
+            options.notSentLowWatermark = 16 * 1024;
+            return options;
+        }
+
+        /*Large transfers: big buffers so the window can open up on long, fast links, and small writes
+        are coalesced.*/
+        static SocketOptions bulkThroughput() {
+            SocketOptions options;
+            options.noDelay = false;
+            options.sendBufferSize = 4 * 1024 * 1024;
+            options.receiveBufferSize = 4 * 1024 * 1024;
+            return options;
+        }
+
+        /*Sets every option that's set in another SocketOptions, I.E to override parts of a preset.
+        @param overrides The options to set.*/
+        SocketOptions& merge(const SocketOptions& overrides) {
+            auto take = [](auto& option, const auto& override) {
+                if (override)
+                    option = override;
+            };
+
+            take(noDelay, overrides.noDelay);
+            take(sendBufferSize, overrides.sendBufferSize);
+            take(receiveBufferSize, overrides.receiveBufferSize);
+            take(keepAlive, overrides.keepAlive);
+            take(keepAliveIdle, overrides.keepAliveIdle);
+            take(keepAliveInterval, overrides.keepAliveInterval);
+            take(keepAliveCount, overrides.keepAliveCount);
+            take(quickAck, overrides.quickAck);
+            take(busyPoll, overrides.busyPoll);
+            take(notSentLowWatermark, overrides.notSentLowWatermark);
+            take(linger, overrides.linger);
+            return *this;
+        }
+    };
+
     class Socket {
     public:
         Socket(asio::io_context& io_context) : socket(io_context) {}
@@ -26,6 +98,19 @@ namespace Parlo
         void acceptAsync(asio::ip::tcp::acceptor& acceptor, std::function<void(std::error_code, Socket&)> callback);
         void setLinger(bool enable, std::chrono::seconds timeout);
 
+        /*Applies every option that's set. Options that fail to apply, I.E busy polling without the
+        privileges for it, are logged and skipped, so one option doesn't keep a connection from working.
+        @param options The options to apply.*/
+        void applyOptions(const SocketOptions& options);
+
+        /*Turns TCP_QUICKACK on or off, where the platform has it. Errors are ignored, since the kernel
+        resets the option by itself anyway and this is called after every read.*/
+        void setQuickAck(bool enable);
+
+        /*Reads back the effective value of every option the platform has.
+        @throws std::runtime_error if the socket isn't open.*/
+        SocketOptions getOptions();
+
         /*Returns the native ASIO socket for use with ASIO operations. */
         asio::ip::tcp::socket& native_handle() { return socket; }
 
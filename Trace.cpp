@@ -0,0 +1,211 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include "pch.h"
+#include "Trace.h"
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Parlo
+{
+    std::atomic<bool> Tracing::enabled{ false };
+
+    /*The events recorded by one thread. The mutex is only ever contended while the trace is written out.*/
+    struct TraceBuffer
+    {
+        std::mutex mutex;
+        std::array<TraceEvent, TRACE_BUFFER_CAPACITY> events;
+        uint64_t written = 0;
+        uint32_t threadID = 0;
+
+        void add(const TraceEvent& event) {
+            std::lock_guard<std::mutex> lock(mutex);
+            events[written % TRACE_BUFFER_CAPACITY] = event;
+            written++;
+        }
+    };
+
+    /*Every thread's buffer. Buffers are kept after their thread exits so its events can still be written,
+    but only until they have been, and only the last TRACE_MAX_EXITED_BUFFERS of them.*/
+    class TraceRegistry
+    {
+    public:
+        TraceBuffer& buffer();
+
+        /*Moves the buffer of a thread that is exiting to those that are only kept to be written.*/
+        void release(const std::shared_ptr<TraceBuffer>& buffer) {
+            bool empty;
+            {
+                std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+                empty = buffer->written == 0;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            buffers.erase(std::remove(buffers.begin(), buffers.end(), buffer), buffers.end());
+
+            if (empty)
+                return;
+
+            exitedBuffers.push_back(buffer);
+            if (exitedBuffers.size() > TRACE_MAX_EXITED_BUFFERS)
+                exitedBuffers.pop_front();
+        }
+
+        /*Every buffer with events to write. Those of exited threads are handed over, as nothing more is added to them.*/
+        std::vector<std::shared_ptr<TraceBuffer>> collect() {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<std::shared_ptr<TraceBuffer>> all(buffers);
+            all.insert(all.end(), exitedBuffers.begin(), exitedBuffers.end());
+            exitedBuffers.clear();
+
+            return all;
+        }
+
+        std::atomic<uint64_t> nextAsyncID{ 1 };
+
+    private:
+        std::mutex mutex;
+        std::vector<std::shared_ptr<TraceBuffer>> buffers;
+        std::deque<std::shared_ptr<TraceBuffer>> exitedBuffers;
+        uint32_t nextThreadID = 1;
+    };
+
+    static TraceRegistry& traceRegistry() {
+        //Never destroyed, as threads that are still running at exit release their buffers to it.
+        static TraceRegistry* registry = new TraceRegistry();
+        return *registry;
+    }
+
+    /*A thread's buffer, which is released to the registry when the thread exits.*/
+    struct ThreadTraceBuffer
+    {
+        std::shared_ptr<TraceBuffer> buffer;
+
+        ~ThreadTraceBuffer() {
+            if (buffer)
+                traceRegistry().release(buffer);
+        }
+    };
+
+    TraceBuffer& TraceRegistry::buffer() {
+        thread_local ThreadTraceBuffer threadBuffer;
+
+        if (!threadBuffer.buffer) {
+            threadBuffer.buffer = std::make_shared<TraceBuffer>();
+            std::lock_guard<std::mutex> lock(mutex);
+            threadBuffer.buffer->threadID = nextThreadID++;
+            buffers.push_back(threadBuffer.buffer);
+        }
+
+        return *threadBuffer.buffer;
+    }
+
+    /*Records a span on the calling thread. Spans on a thread must nest.*/
+    void Tracing::recordComplete(const char* name, uint64_t start, uint64_t end) {
+        TraceEvent event;
+        event.name = name;
+        event.start = start;
+        event.end = end;
+        traceRegistry().buffer().add(event);
+    }
+
+    /*Records a span that may overlap others, such as an asynchronous write.*/
+    void Tracing::recordAsync(const char* name, uint64_t start, uint64_t end) {
+        TraceEvent event;
+        event.name = name;
+        event.start = start;
+        event.end = end;
+        event.id = traceRegistry().nextAsyncID.fetch_add(1, std::memory_order_relaxed);
+        event.kind = TraceEvent::Kind::Async;
+        traceRegistry().buffer().add(event);
+    }
+
+    /*Turns recording of trace events on or off.*/
+    void setTracingEnabled(bool enabled) {
+        Tracing::enabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool isTracingEnabled() {
+        return Tracing::isEnabled();
+    }
+
+    /*Discards every recorded event.*/
+    void clearTrace() {
+        for (auto& buffer : traceRegistry().collect()) {
+            std::lock_guard<std::mutex> lock(buffer->mutex);
+            buffer->written = 0;
+        }
+    }
+
+    /*Appends a Chrome trace event. Timestamps are in microseconds.*/
+    static void appendTraceEvent(std::string& output, const char* phase, const char* name, uint32_t threadID,
+        double timestamp, const char* extra) {
+        char buffer[256];
+        std::snprintf(buffer, sizeof(buffer), "%s\n{\"name\":\"%s\",\"cat\":\"parlo\",\"ph\":\"%s\",\"pid\":1,\"tid\":%u,\"ts\":%.3f%s}",
+            output.empty() ? "" : ",", name, phase, threadID, timestamp, extra);
+        output += buffer;
+    }
+
+    /*Writes every recorded event to a file in the Chrome trace event format, which can be loaded into
+    chrome://tracing or https://ui.perfetto.dev.
+    @param path The file to write.
+    The buffers of threads that have exited are discarded once they've been written.
+    @throws std::runtime_error if the file couldn't be written.*/
+    void writeTrace(const std::string& path) {
+        std::string events;
+        uint64_t epoch = UINT64_MAX;
+        std::vector<std::pair<uint32_t, TraceEvent>> recorded;
+
+        for (auto& buffer : traceRegistry().collect()) {
+            std::lock_guard<std::mutex> lock(buffer->mutex);
+            uint64_t count = (std::min)(buffer->written, static_cast<uint64_t>(TRACE_BUFFER_CAPACITY));
+
+            for (uint64_t i = buffer->written - count; i < buffer->written; i++) {
+                const TraceEvent& event = buffer->events[i % TRACE_BUFFER_CAPACITY];
+                recorded.emplace_back(buffer->threadID, event);
+                epoch = (std::min)(epoch, event.start);
+            }
+        }
+
+        for (auto& entry : recorded) {
+            const TraceEvent& event = entry.second;
+            double start = static_cast<double>(event.start - epoch) / 1000.0;
+            double end = static_cast<double>(event.end - epoch) / 1000.0;
+            char extra[64];
+
+            if (event.kind == TraceEvent::Kind::Complete) {
+                std::snprintf(extra, sizeof(extra), ",\"dur\":%.3f", end - start);
+                appendTraceEvent(events, "X", event.name, entry.first, start, extra);
+            }
+            else {
+                std::snprintf(extra, sizeof(extra), ",\"id\":\"0x%llx\"", static_cast<unsigned long long>(event.id));
+                appendTraceEvent(events, "b", event.name, entry.first, start, extra);
+                appendTraceEvent(events, "e", event.name, entry.first, end, extra);
+            }
+        }
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file)
+            throw std::runtime_error("writeTrace(): Couldn't open " + path);
+
+        file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" << events << "\n]}\n";
+
+        if (!file)
+            throw std::runtime_error("writeTrace(): Couldn't write " + path);
+    }
+}
@@ -0,0 +1,98 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "Parlo.h"
+
+/*Set to 0 to compile out every trace point.*/
+#ifndef PARLO_ENABLE_TRACING
+    #define PARLO_ENABLE_TRACING 1
+#endif
+
+#define PARLO_TRACE_CONCAT_IMPL(a, b) a##b
+#define PARLO_TRACE_CONCAT(a, b) PARLO_TRACE_CONCAT_IMPL(a, b)
+
+/*Records the time from here to the end of the enclosing scope. name must be a string literal.*/
+#if PARLO_ENABLE_TRACING
+    #define PARLO_TRACE_SCOPE(name) ::Parlo::TraceScope PARLO_TRACE_CONCAT(parloTraceScope, __LINE__)(name)
+#else
+    #define PARLO_TRACE_SCOPE(name) do {} while (0)
+#endif
+
+namespace Parlo
+{
+    /*Number of events each thread keeps. Once full, the oldest events are overwritten.*/
+    const size_t TRACE_BUFFER_CAPACITY = 16384;
+
+    /*Number of buffers kept for threads that have exited, until writeTrace() or clearTrace() is called. Beyond
+    that the oldest are discarded, so threads that come and go, such as those of connections, don't pile up.*/
+    const size_t TRACE_MAX_EXITED_BUFFERS = 16;
+
+    /*A recorded trace event. Times are steady_clock nanoseconds.*/
+    struct TraceEvent
+    {
+        enum class Kind : uint8_t { Complete, Async };
+
+        const char* name = nullptr;
+        uint64_t start = 0;
+        uint64_t end = 0;
+        /*Identifies an async event, which may start and end on different threads.*/
+        uint64_t id = 0;
+        Kind kind = Kind::Complete;
+    };
+
+    /*Records trace events into per thread buffers, which are written out as Chrome trace JSON.*/
+    class Tracing
+    {
+    public:
+        /*A single relaxed load, so trace points cost next to nothing while tracing is off.*/
+        static bool isEnabled() {
+            return enabled.load(std::memory_order_relaxed);
+        }
+
+        static uint64_t now() {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+
+        /*Records a span on the calling thread. Spans on a thread must nest.*/
+        PARLO_API static void recordComplete(const char* name, uint64_t start, uint64_t end);
+
+        /*Records a span that may overlap others, such as an asynchronous write.*/
+        PARLO_API static void recordAsync(const char* name, uint64_t start, uint64_t end);
+
+        PARLO_API static std::atomic<bool> enabled;
+    };
+
+    /*Records the lifetime of a scope. Use PARLO_TRACE_SCOPE rather than this.*/
+    class TraceScope
+    {
+    public:
+        explicit TraceScope(const char* name) : name(name), start(Tracing::isEnabled() ? Tracing::now() : 0) {}
+
+        ~TraceScope() {
+            if (start != 0)
+                Tracing::recordComplete(name, start, Tracing::now());
+        }
+
+        TraceScope(const TraceScope&) = delete;
+        TraceScope& operator=(const TraceScope&) = delete;
+
+    private:
+        const char* name;
+        uint64_t start;
+    };
+}
@@ -0,0 +1,273 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include "pch.h"
+#include "BlockingQueue.h"
+#include "GoodbyePacket.h"
+#include "Parlo.h"
+#include "Logger.h"
+#include "LinkShaper.h"
+#include "UDPSocket.h"
+#include <map>
+#include <memory>
+
+namespace Parlo
+{
+    /*How often idle connections are looked for, in seconds.*/
+    const int UDP_IDLE_SWEEP_INTERVAL = 5;
+
+    /*The UDPListener is used to accept datagrams from many remote endpoints on one socket.*/
+    class UDPListener::Impl {
+        public:
+            Impl(asio::io_context& context, const asio::ip::udp::endpoint& endpoint)
+                : socket(std::make_shared<UDPSocket>(context)), sweepTimer(context) {
+                socket->bind(endpoint);
+            }
+
+            /*Starts accepting new connections.*/
+            void startAccepting();
+            /*Stops accepting new connections. Existing connections keep working.*/
+            void stopAccepting();
+
+        private:
+            std::shared_ptr<UDPSocket> socket;
+            asio::steady_timer sweepTimer;
+            bool receiving = false;
+            std::atomic<bool> running{ false };
+            std::chrono::seconds idleTimeout{ ParloDefaultTimeouts::Server };
+
+            std::mutex connectionsMutex;
+            /*Connections, identified by their remote endpoint.*/
+            std::map<asio::ip::udp::endpoint, std::shared_ptr<UDPNetworkClient>> connections;
+            /*Handed to new connections. Guarded by connectionsMutex.*/
+            std::shared_ptr<LinkShaper> linkShaper;
+            BlockingQueue<std::shared_ptr<UDPNetworkClient>> networkClients;
+
+            using ClientConnectedHandler = std::function<void(const std::shared_ptr<UDPNetworkClient>& client)>;
+            ClientConnectedHandler onClientConnected;
+
+            using ClientDisconnectedHandler = std::function<void(const std::shared_ptr<UDPNetworkClient>& client)>;
+            ClientDisconnectedHandler onClientDisconnected;
+
+            /*Routes a datagram to the connection for its endpoint, creating the connection if needed.*/
+            void onDatagramReceived(const asio::ip::udp::endpoint& endpoint, const uint8_t* data, size_t length);
+
+            /*Forgets a connection.*/
+            void removeClient(const asio::ip::udp::endpoint& endpoint);
+
+            /*Disconnects connections that haven't received anything for idleTimeout.*/
+            void sweepIdleClients();
+            void scheduleSweep();
+
+            UDPListener* owner;
+
+            friend class UDPListener;
+    };
+
+    /*Constructs a new UDPListener instance bound to a local endpoint.
+    @param context An asio::io_context instance.
+    @param endpoint The local endpoint to listen on.
+    @throws std::runtime_error if the socket couldn't be bound.*/
+    UDPListener::UDPListener(asio::io_context& context, const asio::ip::udp::endpoint& endpoint) :
+        pImpl(std::make_unique<UDPListener::Impl>(context, endpoint)) {
+        pImpl->owner = this;
+    }
+
+    UDPListener::~UDPListener() {
+        stopAccepting();
+
+        std::error_code ec;
+        pImpl->sweepTimer.cancel(ec);
+        pImpl->socket->close();
+    }
+
+    /*Starts accepting new connections.*/
+    void UDPListener::Impl::startAccepting() {
+        running = true;
+
+        if (receiving)
+            return;
+
+        receiving = true;
+        std::weak_ptr<UDPListener> weakOwner = owner->shared_from_this();
+
+        socket->startReceiving(
+            [weakOwner](const asio::ip::udp::endpoint& endpoint, const uint8_t* data, size_t length) {
+                if (auto listener = weakOwner.lock())
+                    listener->pImpl->onDatagramReceived(endpoint, data, length);
+            },
+            [](const std::error_code& ec) {
+                //An unconnected socket reports ICMP errors for whichever peer caused them; the idle sweep cleans up.
+                PARLO_LOG(LogLevel::warn, "Error in UDPListener receive: {}", ec);
+            });
+
+        scheduleSweep();
+    }
+
+    /*Stops accepting new connections. Existing connections keep working.*/
+    void UDPListener::Impl::stopAccepting() {
+        running = false;
+    }
+
+    /*Routes a datagram to the connection for its endpoint, creating the connection if needed.*/
+    void UDPListener::Impl::onDatagramReceived(const asio::ip::udp::endpoint& endpoint, const uint8_t* data, size_t length) {
+        std::shared_ptr<UDPNetworkClient> client;
+        bool isNewClient = false;
+
+        {
+            std::lock_guard<std::mutex> lock(connectionsMutex);
+            auto it = connections.find(endpoint);
+
+            if (it != connections.end())
+                client = it->second;
+            else {
+                if (!running)
+                    return;
+
+                //Don't create connections for stray datagrams that don't even hold a packet header.
+                if (length <= static_cast<size_t>(PacketHeaders::UDP))
+                    return;
+
+                client = std::make_shared<UDPNetworkClient>(socket, endpoint, owner->shared_from_this());
+
+                //The application may hold on to the connection after this UDPListener is gone.
+                std::weak_ptr<UDPListener> weakOwner = owner->shared_from_this();
+                client->setOnClientDisconnectedHandler([weakOwner](const std::shared_ptr<UDPNetworkClient>& disconnected) {
+                    if (auto listener = weakOwner.lock())
+                        listener->pImpl->removeClient(disconnected->getRemoteEndpoint());
+                });
+                client->setOnConnectionLostHandler([weakOwner](const std::shared_ptr<UDPNetworkClient>& lost) {
+                    if (auto listener = weakOwner.lock())
+                        listener->pImpl->removeClient(lost->getRemoteEndpoint());
+                });
+
+                if (linkShaper)
+                    client->setLinkShaper(linkShaper);
+
+                connections[endpoint] = client;
+                isNewClient = true;
+            }
+        }
+
+        if (isNewClient) {
+            PARLO_LOG(LogLevel::info, "New client connected!");
+            networkClients.add(client);
+
+            if (onClientConnected)
+                onClientConnected(client);
+        }
+
+        client->processDatagram(data, length);
+    }
+
+    /*Forgets a connection.*/
+    void UDPListener::Impl::removeClient(const asio::ip::udp::endpoint& endpoint) {
+        std::shared_ptr<UDPNetworkClient> client;
+
+        {
+            std::lock_guard<std::mutex> lock(connectionsMutex);
+            auto it = connections.find(endpoint);
+
+            if (it == connections.end())
+                return;
+
+            client = it->second;
+            connections.erase(it);
+        }
+
+        PARLO_LOG(LogLevel::info, "Client disconnected!");
+        networkClients.take(client);
+
+        if (onClientDisconnected)
+            onClientDisconnected(client);
+    }
+
+    /*Disconnects connections that haven't received anything for idleTimeout.*/
+    void UDPListener::Impl::sweepIdleClients() {
+        std::vector<std::shared_ptr<UDPNetworkClient>> idleClients;
+
+        {
+            std::lock_guard<std::mutex> lock(connectionsMutex);
+
+            for (auto& connection : connections) {
+                if (connection.second->getTimeSinceLastReceived() > idleTimeout)
+                    idleClients.push_back(connection.second);
+            }
+        }
+
+        for (auto& client : idleClients) {
+            PARLO_LOG(LogLevel::info, "Client connection lost!");
+            client->disconnectAsync(false);
+        }
+    }
+
+    void UDPListener::Impl::scheduleSweep() {
+        std::weak_ptr<UDPListener> weakOwner = owner->shared_from_this();
+
+        sweepTimer.expires_after(std::chrono::seconds(UDP_IDLE_SWEEP_INTERVAL));
+        sweepTimer.async_wait([weakOwner](std::error_code ec) {
+            if (ec)
+                return;
+
+            if (auto listener = weakOwner.lock()) {
+                listener->pImpl->sweepIdleClients();
+                listener->pImpl->scheduleSweep();
+            }
+        });
+    }
+
+    void UDPListener::startAccepting() {
+        pImpl->startAccepting();
+    }
+
+    /*Stops accepting new connections.*/
+    void UDPListener::stopAccepting() {
+        pImpl->stopAccepting();
+    }
+
+    BlockingQueue<std::shared_ptr<UDPNetworkClient>>& UDPListener::clients() {
+        return pImpl->networkClients;
+    }
+
+    asio::ip::udp::endpoint UDPListener::getLocalEndpoint() const {
+        return pImpl->socket->localEndpoint();
+    }
+
+    /*Sets the time without traffic after which a connection is considered lost.
+    @param timeout The timeout. Defaults to ParloDefaultTimeouts::Server.*/
+    void UDPListener::setIdleTimeout(std::chrono::seconds timeout) {
+        pImpl->idleTimeout = timeout;
+    }
+
+    /*Shapes what connections created from now on receive.
+    @param shaper The shaper to emulate the link with, or nullptr to stop.*/
+    void UDPListener::setLinkShaper(std::shared_ptr<LinkShaper> shaper) {
+        std::lock_guard<std::mutex> lock(pImpl->connectionsMutex);
+        pImpl->linkShaper = std::move(shaper);
+    }
+
+    /*Set a function to be called when a client connects to this UDPListener instance.
+    @param handler The function to be called.*/
+    void UDPListener::setOnClientConnectedHandler(std::function<void(const std::shared_ptr<UDPNetworkClient>&)> handler) {
+        pImpl->onClientConnected = handler;
+    }
+
+    /*Set a function to be called when a client disconnects from, or times out on, this UDPListener instance.
+    @param handler The function to be called.*/
+    void UDPListener::setOnClientDisconnectedHandler(std::function<void(const std::shared_ptr<UDPNetworkClient>&)> handler) {
+        pImpl->onClientDisconnected = handler;
+    }
+
+    void UDPListener::removeClient(const asio::ip::udp::endpoint& endpoint) {
+        pImpl->removeClient(endpoint);
+    }
+}
@@ -0,0 +1,562 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include "pch.h"
+#include "HeartbeatPacket.h"
+#include "GoodbyePacket.h"
+#include "UDPSocket.h"
+#include "Logger.h"
+#include "ParloIDs.h"
+#include "Parlo.h"
+#include "Compression.h"
+#include "ReliabilityLayer.h"
+#include "LinkShaper.h"
+#include <memory>
+
+namespace Parlo
+{
+    /*The UDPNetworkClient is used to exchange datagrams with a remote endpoint.*/
+    class UDPNetworkClient::Impl {
+    public:
+        Impl(asio::io_context& context) :
+            socket(std::make_shared<UDPSocket>(context)), ownsSocket(true), heartbeatTimer(context), reliabilityTimer(context) {}
+        Impl(std::shared_ptr<UDPSocket> sharedSocket, const asio::ip::udp::endpoint& endpoint, std::shared_ptr<UDPListener> udpListener) :
+            socket(sharedSocket), remoteEndpoint(endpoint), listener(udpListener), ownsSocket(false),
+            heartbeatTimer(sharedSocket->native_handle().get_executor()),
+            reliabilityTimer(sharedSocket->native_handle().get_executor()) {
+            connected = true;
+            touch();
+        }
+
+        /*Connects the socket to a remote endpoint and starts receiving datagrams.
+        @param endpoint The remote endpoint to connect to.*/
+        void connectAsync(const asio::ip::udp::endpoint& endpoint);
+
+        /*Sends a UDP packet as a single datagram.
+        @param data The packet to send.
+        @param channel The channel reliable packets are ordered within.*/
+        void sendAsync(const std::vector<uint8_t>& data, uint8_t channel);
+
+        /*Asynchronously disconnects from a remote endpoint.
+        @param sendDisconnectMessage Whether or not to send a disconnection message to the other party.*/
+        void disconnectAsync(bool sendDisconnectMessage);
+
+        /*Hands a received datagram to the link shaper if one is set, otherwise splits it right away.*/
+        void processDatagram(const uint8_t* data, size_t length);
+
+        /*Splits a datagram into packets and dispatches them.*/
+        void splitDatagram(const uint8_t* data, size_t length);
+
+        /*Received datagrams are held back, dropped or reordered by this before they're processed, if set.*/
+        std::shared_ptr<LinkShaper> linkShaper;
+
+    private:
+        std::shared_ptr<UDPSocket> socket;
+        asio::ip::udp::endpoint remoteEndpoint;
+        std::weak_ptr<UDPListener> listener;
+
+        /*Does this instance own its socket, I.E was it created by connectAsync() rather than a UDPListener?*/
+        bool ownsSocket;
+        std::atomic<bool> connected{ false };
+
+        /*steady_clock ticks at which a datagram was last received.*/
+        std::atomic<int64_t> lastReceived{ 0 };
+
+        asio::steady_timer heartbeatTimer;
+        int heartbeatInterval = 30; //In seconds.
+        std::chrono::steady_clock::time_point lastHeartbeatSent;
+
+        /*Guards reliability and reliabilityTimer, which are driven from the io_context and from sendAsync().*/
+        mutable std::mutex reliabilityMutex;
+        ReliabilityLayer reliability;
+        asio::steady_timer reliabilityTimer;
+        /*When reliabilityTimer is due to fire, or time_point::max() if it isn't armed.*/
+        std::chrono::steady_clock::time_point reliabilityDeadline = std::chrono::steady_clock::time_point::max();
+
+        std::function<void(const std::shared_ptr<UDPNetworkClient>&)> onServerDisconnectedHandler;
+        std::function<void(const std::shared_ptr<UDPNetworkClient>&)> onClientDisconnectedHandler;
+        std::function<void(const std::shared_ptr<UDPNetworkClient>&)> onConnectionLostHandler;
+        std::function<void(const std::shared_ptr<UDPNetworkClient>&)> onReceivedHeartbeatHandler;
+        std::function<void(const std::shared_ptr<UDPNetworkClient>&, const std::shared_ptr<Packet>&)> onReceivedDataHandler;
+
+        UDPNetworkClient* owner;
+
+        void touch() {
+            lastReceived = std::chrono::steady_clock::now().time_since_epoch().count();
+        }
+
+        /*Runs a single packet read from a datagram through the reliability layer, then dispatches it.*/
+        void handlePacket(uint8_t id, bool isCompressed, bool isReliable, std::vector<uint8_t> payload);
+
+        /*Dispatches a packet to the handlers.*/
+        void dispatchPacket(uint8_t id, bool isCompressed, bool isReliable, std::vector<uint8_t> payload);
+
+        /*Sends a datagram, piggybacking a pending acknowledgement on it.*/
+        void sendDatagram(std::vector<uint8_t> datagram);
+
+        /*Sends whatever the reliability layer has due and arms the timer for its next deadline.*/
+        void serviceReliability();
+
+        /*The connection was lost, I.E because the remote endpoint is unreachable.*/
+        void connectionLost();
+
+        /*Sends a heartbeat, then schedules the next one. How often is determined by heartbeatInterval.*/
+        void sendHeartbeatAsync();
+        void scheduleHeartbeat();
+
+        /*Sends a single heartbeat.
+        @param echo The heartbeat to echo back, if any.
+        @param echoDelay How long the echoed heartbeat was held.*/
+        void sendHeartbeat(const HeartbeatPacket* echo = nullptr, std::chrono::microseconds echoDelay = std::chrono::microseconds(0));
+
+        /*Takes an RTT sample from a heartbeat that echoes one of ours, and echoes heartbeats that ask for it.*/
+        void handleHeartbeat(const std::vector<uint8_t>& payload);
+
+        friend class UDPNetworkClient;
+    };
+
+    /*Constructs a new client side UDPNetworkClient instance. Call connectAsync() to start using it.
+    @param context An asio::io_context instance.*/
+    UDPNetworkClient::UDPNetworkClient(asio::io_context& context) :
+        pImpl(std::make_unique<UDPNetworkClient::Impl>(context)) {
+        pImpl->owner = this;
+    }
+
+    /*Constructs a new server side UDPNetworkClient instance that shares a UDPListener's socket.
+    @param socket The listener's socket.
+    @param remoteEndpoint The remote endpoint this connection is identified by.
+    @param listener The UDPListener that owns this connection.*/
+    UDPNetworkClient::UDPNetworkClient(std::shared_ptr<UDPSocket> socket, const asio::ip::udp::endpoint& remoteEndpoint,
+        std::shared_ptr<UDPListener> listener) :
+        pImpl(std::make_unique<UDPNetworkClient::Impl>(socket, remoteEndpoint, listener)) {
+        pImpl->owner = this;
+    }
+
+    UDPNetworkClient::~UDPNetworkClient() {
+        std::error_code ec;
+        pImpl->heartbeatTimer.cancel(ec);
+        pImpl->reliabilityTimer.cancel(ec);
+
+        if (pImpl->ownsSocket)
+            pImpl->socket->close();
+    }
+
+    /*Connects the socket to a remote endpoint and starts receiving datagrams.
+    @param endpoint The remote endpoint to connect to.
+    @throws std::runtime_error if the socket couldn't be connected.*/
+    void UDPNetworkClient::Impl::connectAsync(const asio::ip::udp::endpoint& endpoint) {
+        if (!ownsSocket)
+            throw std::runtime_error("UDPNetworkClient::connectAsync(): Instance belongs to a UDPListener!");
+
+        remoteEndpoint = endpoint;
+        socket->connect(endpoint);
+        connected = true;
+        touch();
+
+        std::weak_ptr<UDPNetworkClient> weakOwner = owner->shared_from_this();
+        socket->startReceiving(
+            [weakOwner](const asio::ip::udp::endpoint&, const uint8_t* data, size_t length) {
+                if (auto client = weakOwner.lock())
+                    client->pImpl->processDatagram(data, length);
+            },
+            [weakOwner](const std::error_code& ec) {
+                PARLO_LOG(LogLevel::error, "Error in UDPNetworkClient receive: {}", ec);
+                if (auto client = weakOwner.lock())
+                    client->pImpl->connectionLost();
+            });
+
+        PARLO_LOG(LogLevel::info, "Connected to server!");
+
+        //The first heartbeat announces this connection to the UDPListener.
+        sendHeartbeatAsync();
+    }
+
+    /*Sends a UDP packet as a single datagram.
+    @param data The packet to send.
+    @param channel The channel reliable packets are ordered within.*/
+    void UDPNetworkClient::Impl::sendAsync(const std::vector<uint8_t>& data, uint8_t channel) {
+        if (data.empty())
+            throw std::invalid_argument("Data cannot be null or empty");
+        if (data.size() > Parlo::MAX_PACKET_SIZE)
+            throw std::overflow_error("Data size exceeds maximum packet size");
+        if (data.size() <= static_cast<size_t>(PacketHeaders::UDP))
+            throw std::invalid_argument("Data is not a UDP packet");
+
+        if (!connected)
+            throw std::runtime_error("Socket is not connected");
+
+        if (data[2] != 0) { //isReliable
+            {
+                std::lock_guard<std::mutex> lock(reliabilityMutex);
+                reliability.send(data[0], data[1] != 0, channel, data.data() + PacketHeaders::UDP, data.size() - PacketHeaders::UDP);
+            }
+
+            serviceReliability();
+        }
+        else
+            sendDatagram(data);
+    }
+
+    /*Sends a datagram, piggybacking a pending acknowledgement on it.*/
+    void UDPNetworkClient::Impl::sendDatagram(std::vector<uint8_t> datagram) {
+        {
+            std::lock_guard<std::mutex> lock(reliabilityMutex);
+            reliability.piggybackAck(datagram, std::chrono::steady_clock::now());
+        }
+
+        socket->sendAsync(remoteEndpoint, std::move(datagram));
+    }
+
+    /*Sends whatever the reliability layer has due and arms the timer for its next deadline.*/
+    void UDPNetworkClient::Impl::serviceReliability() {
+        std::vector<std::vector<uint8_t>> datagrams;
+
+        {
+            std::lock_guard<std::mutex> lock(reliabilityMutex);
+            auto now = std::chrono::steady_clock::now();
+            datagrams = reliability.poll(now);
+
+            auto next = reliability.nextTimeout(now);
+
+            //Only re-arm if the deadline moved closer; a timer that fires early just polls again.
+            if (next < reliabilityDeadline && connected) {
+                reliabilityDeadline = next;
+                std::weak_ptr<UDPNetworkClient> weakOwner = owner->shared_from_this();
+
+                reliabilityTimer.expires_at(next);
+                reliabilityTimer.async_wait([weakOwner](std::error_code ec) {
+                    if (ec)
+                        return;
+
+                    if (auto client = weakOwner.lock()) {
+                        {
+                            std::lock_guard<std::mutex> lock(client->pImpl->reliabilityMutex);
+                            client->pImpl->reliabilityDeadline = std::chrono::steady_clock::time_point::max();
+                        }
+
+                        client->pImpl->serviceReliability();
+                    }
+                });
+            }
+        }
+
+        for (auto& datagram : datagrams)
+            socket->sendAsync(remoteEndpoint, std::move(datagram));
+    }
+
+    /*Hands a received datagram to the link shaper if one is set, otherwise splits it right away.*/
+    void UDPNetworkClient::Impl::processDatagram(const uint8_t* data, size_t length) {
+        if (!linkShaper) {
+            splitDatagram(data, length);
+            return;
+        }
+
+        std::weak_ptr<UDPNetworkClient> weakOwner = owner->weak_from_this();
+        linkShaper->submit(std::vector<uint8_t>(data, data + length), false, [weakOwner](std::vector<uint8_t> shaped) {
+            if (auto client = weakOwner.lock())
+                client->pImpl->splitDatagram(shaped.data(), shaped.size());
+        });
+    }
+
+    /*Splits a datagram into packets and dispatches them.
+    A datagram holds one or more packets, each with a PacketHeaders::UDP sized header:
+    ID, compressed flag, reliable flag and a little-endian 16 bit length that includes the header.*/
+    void UDPNetworkClient::Impl::splitDatagram(const uint8_t* data, size_t length) {
+        touch();
+
+        size_t offset = 0;
+
+        while (length - offset >= static_cast<size_t>(PacketHeaders::UDP)) {
+            const uint8_t* header = data + offset;
+            uint16_t packetLength = static_cast<uint16_t>(header[4] << 8 | header[3]);
+
+            if (packetLength <= static_cast<uint16_t>(PacketHeaders::UDP) || packetLength > length - offset) {
+                PARLO_LOG(LogLevel::warn, "UDPNetworkClient: Dropped malformed datagram.");
+                return;
+            }
+
+            std::vector<uint8_t> payload(header + PacketHeaders::UDP, header + packetLength);
+            offset += packetLength;
+
+            try {
+                handlePacket(header[0], header[1] != 0, header[2] != 0, std::move(payload));
+            }
+            catch (const std::exception& e) {
+                PARLO_LOG(LogLevel::error, "UDPNetworkClient: Failed to process packet: {}", e.what());
+            }
+        }
+    }
+
+    /*Runs a single packet read from a datagram through the reliability layer, then dispatches it.*/
+    void UDPNetworkClient::Impl::handlePacket(uint8_t id, bool isCompressed, bool isReliable, std::vector<uint8_t> payload) {
+        if (id == ParloIDs::Ack) {
+            {
+                std::lock_guard<std::mutex> lock(reliabilityMutex);
+                reliability.onAckReceived(payload, std::chrono::steady_clock::now());
+            }
+
+            serviceReliability(); //The window may have opened, or packets may have been declared lost.
+            return;
+        }
+
+        if (!isReliable) {
+            dispatchPacket(id, isCompressed, false, std::move(payload));
+            return;
+        }
+
+        std::vector<ReliablePacket> delivered;
+
+        {
+            std::lock_guard<std::mutex> lock(reliabilityMutex);
+            delivered = reliability.onPacketReceived(id, isCompressed, payload, std::chrono::steady_clock::now());
+        }
+
+        serviceReliability(); //Schedules the acknowledgement.
+
+        for (auto& packet : delivered)
+            dispatchPacket(packet.id, packet.isCompressed, true, std::move(packet.payload));
+    }
+
+    /*Dispatches a packet to the handlers.*/
+    void UDPNetworkClient::Impl::dispatchPacket(uint8_t id, bool isCompressed, bool isReliable, std::vector<uint8_t> payload) {
+        if (id == ParloIDs::SGoodbye) { //Server notified client of disconnection.
+            if (onServerDisconnectedHandler)
+                onServerDisconnectedHandler(owner->shared_from_this());
+
+            return;
+        }
+        if (id == ParloIDs::CGoodbye) { //Client notified server of disconnection.
+            connected = false;
+
+            if (onClientDisconnectedHandler)
+                onClientDisconnectedHandler(owner->shared_from_this());
+
+            return;
+        }
+        if (id == ParloIDs::Heartbeat) {
+            handleHeartbeat(payload);
+
+            if (onReceivedHeartbeatHandler)
+                onReceivedHeartbeatHandler(owner->shared_from_this());
+
+            return;
+        }
+
+        if (isCompressed)
+            payload = decompressData(payload);
+
+        if (onReceivedDataHandler)
+            onReceivedDataHandler(owner->shared_from_this(), std::make_shared<Packet>(id, payload, false, isReliable));
+    }
+
+    /*The connection was lost, I.E because the remote endpoint is unreachable.*/
+    void UDPNetworkClient::Impl::connectionLost() {
+        if (!connected.exchange(false))
+            return;
+
+        std::error_code ec;
+        heartbeatTimer.cancel(ec);
+
+        {
+            std::lock_guard<std::mutex> lock(reliabilityMutex);
+            reliabilityTimer.cancel(ec);
+        }
+
+        if (ownsSocket)
+            socket->close();
+
+        if (onConnectionLostHandler)
+            onConnectionLostHandler(owner->shared_from_this());
+    }
+
+    void UDPNetworkClient::Impl::sendHeartbeatAsync() {
+        if (!connected)
+            return;
+
+        sendHeartbeat();
+        scheduleHeartbeat();
+    }
+
+    /*Sends a single heartbeat.
+    @param echo The heartbeat to echo back, if any.
+    @param echoDelay How long the echoed heartbeat was held.*/
+    void UDPNetworkClient::Impl::sendHeartbeat(const HeartbeatPacket* echo, std::chrono::microseconds echoDelay) {
+        try {
+            auto now = std::chrono::steady_clock::now();
+            HeartbeatPacket heartbeat(std::chrono::duration_cast<std::chrono::milliseconds>(now - lastHeartbeatSent));
+            lastHeartbeatSent = now;
+
+            if (echo)
+                heartbeat.setEcho(echo->getSentTimestamp(), echoDelay);
+
+            auto heartbeatData = heartbeat.toByteArray();
+            Packet pulse((uint8_t)ParloIDs::Heartbeat, *heartbeatData, false, false);
+            sendDatagram(pulse.buildPacket());
+        }
+        catch (const std::exception& e) {
+            PARLO_LOG(LogLevel::error, "Error sending heartbeat: {}", e.what());
+        }
+    }
+
+    /*Takes an RTT sample from a heartbeat that echoes one of ours, and echoes heartbeats that ask for it.*/
+    void UDPNetworkClient::Impl::handleHeartbeat(const std::vector<uint8_t>& payload) {
+        auto receivedAt = HeartbeatPacket::now();
+        HeartbeatPacket heartbeat = HeartbeatPacket::byteArrayToObject(std::make_shared<std::vector<uint8_t>>(payload));
+
+        if (heartbeat.hasEcho()) {
+            auto sample = receivedAt - heartbeat.getEchoTimestamp() - heartbeat.getEchoDelay();
+
+            if (sample.count() > 0) {
+                std::lock_guard<std::mutex> lock(reliabilityMutex);
+                reliability.addRTTSample(sample);
+            }
+        }
+
+        if (heartbeat.getRequestsEcho() && connected)
+            sendHeartbeat(&heartbeat, HeartbeatPacket::now() - receivedAt);
+    }
+
+    void UDPNetworkClient::Impl::scheduleHeartbeat() {
+        std::weak_ptr<UDPNetworkClient> weakOwner = owner->shared_from_this();
+
+        heartbeatTimer.expires_after(std::chrono::seconds(heartbeatInterval));
+        heartbeatTimer.async_wait([weakOwner](std::error_code ec) {
+            if (ec)
+                return;
+
+            if (auto client = weakOwner.lock())
+                client->pImpl->sendHeartbeatAsync();
+        });
+    }
+
+    /*Asynchronously disconnects from a remote endpoint.
+    @param sendDisconnectMessage Whether or not to send a disconnection message to the other party.*/
+    void UDPNetworkClient::Impl::disconnectAsync(bool sendDisconnectMessage) {
+        if (!connected.exchange(false))
+            return;
+
+        std::error_code ec;
+        heartbeatTimer.cancel(ec);
+
+        {
+            std::lock_guard<std::mutex> lock(reliabilityMutex);
+            reliabilityTimer.cancel(ec);
+        }
+
+        try {
+            if (sendDisconnectMessage) {
+                GoodbyePacket byePacket(ownsSocket ? (int)ParloDefaultTimeouts::Client : (int)ParloDefaultTimeouts::Server);
+                Packet goodbye(ownsSocket ? (uint8_t)ParloIDs::CGoodbye : (uint8_t)ParloIDs::SGoodbye,
+                    byePacket.toByteArray(), false, false);
+                socket->sendAsync(remoteEndpoint, goodbye.buildPacket());
+            }
+        }
+        catch (const std::exception& e) {
+            PARLO_LOG(LogLevel::error, "Exception during UDPNetworkClient::disconnectAsync(): {}", e.what());
+        }
+
+        if (ownsSocket) {
+            //Close after the queued goodbye has been flushed.
+            auto udpSocket = socket;
+            asio::post(socket->native_handle().get_executor(), [udpSocket]() { udpSocket->close(); });
+        }
+        else if (auto udpListener = listener.lock())
+            udpListener->removeClient(remoteEndpoint);
+    }
+
+    void UDPNetworkClient::connectAsync(const asio::ip::udp::endpoint& endpoint) {
+        pImpl->connectAsync(endpoint);
+    }
+
+    void UDPNetworkClient::sendAsync(const std::vector<uint8_t>& data, uint8_t channel) {
+        pImpl->sendAsync(data, channel);
+    }
+
+    /*Sets whether reliable packets on a channel are delivered in the order they were sent. Channels are ordered by default.
+    @param channel The channel, below RELIABLE_CHANNEL_COUNT.
+    @param order The delivery order.*/
+    void UDPNetworkClient::setChannelOrder(uint8_t channel, DeliveryOrder order) {
+        std::lock_guard<std::mutex> lock(pImpl->reliabilityMutex);
+        pImpl->reliability.setChannelOrder(channel, order);
+    }
+
+    ReliabilityStats UDPNetworkClient::getReliabilityStats() const {
+        std::lock_guard<std::mutex> lock(pImpl->reliabilityMutex);
+        return pImpl->reliability.getStats();
+    }
+
+    RTTStats UDPNetworkClient::getRTTStats() const {
+        std::lock_guard<std::mutex> lock(pImpl->reliabilityMutex);
+        return pImpl->reliability.getRTTEstimator().getStats();
+    }
+
+    void UDPNetworkClient::measureRTTAsync() {
+        if (!pImpl->connected)
+            throw std::runtime_error("Socket is not connected");
+
+        //Heartbeats are otherwise only sent from the io_context.
+        std::weak_ptr<UDPNetworkClient> weakOwner = shared_from_this();
+        asio::post(pImpl->socket->native_handle().get_executor(), [weakOwner]() {
+            if (auto client = weakOwner.lock())
+                client->pImpl->sendHeartbeat();
+        });
+    }
+
+    void UDPNetworkClient::disconnectAsync(bool sendDisconnectMessage) {
+        pImpl->disconnectAsync(sendDisconnectMessage);
+    }
+
+    asio::ip::udp::endpoint UDPNetworkClient::getRemoteEndpoint() const {
+        return pImpl->remoteEndpoint;
+    }
+
+    bool UDPNetworkClient::isConnected() const {
+        return pImpl->connected;
+    }
+
+    /*The time elapsed since a datagram was last received from the remote endpoint.*/
+    std::chrono::milliseconds UDPNetworkClient::getTimeSinceLastReceived() const {
+        std::chrono::steady_clock::time_point last{ std::chrono::steady_clock::duration(pImpl->lastReceived.load()) };
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - last);
+    }
+
+    void UDPNetworkClient::processDatagram(const uint8_t* data, size_t length) {
+        pImpl->processDatagram(data, length);
+    }
+
+    /*Holds back, drops and reorders received datagrams the way a worse link would. Set it before connecting.
+    @param shaper The shaper to emulate the link with, or nullptr to process datagrams as soon as they're received.*/
+    void UDPNetworkClient::setLinkShaper(std::shared_ptr<LinkShaper> shaper) {
+        pImpl->linkShaper = std::move(shaper);
+    }
+
+    void UDPNetworkClient::setOnClientDisconnectedHandler(std::function<void(const std::shared_ptr<UDPNetworkClient>&)> handler) {
+        pImpl->onClientDisconnectedHandler = handler;
+    }
+
+    void UDPNetworkClient::setOnConnectionLostHandler(std::function<void(const std::shared_ptr<UDPNetworkClient>&)> handler) {
+        pImpl->onConnectionLostHandler = handler;
+    }
+
+    void UDPNetworkClient::setOnServerDisconnectedHandler(std::function<void(const std::shared_ptr<UDPNetworkClient>&)> handler) {
+        pImpl->onServerDisconnectedHandler = handler;
+    }
+
+    void UDPNetworkClient::setOnReceivedHeartbeatHandler(std::function<void(const std::shared_ptr<UDPNetworkClient>&)> handler) {
+        pImpl->onReceivedHeartbeatHandler = handler;
+    }
+
+    void UDPNetworkClient::setOnReceivedDataHandler(std::function<void(const std::shared_ptr<UDPNetworkClient>&,
+        const std::shared_ptr<Packet>&)> handler) {
+        pImpl->onReceivedDataHandler = handler;
+    }
+}
@@ -0,0 +1,434 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include "pch.h"
+#include "UDPSocket.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <cerrno>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103 //From linux/udp.h, for older libc headers.
+#endif
+#endif
+
+namespace Parlo
+{
+#ifdef __linux__
+    /*Maximum number of segments the kernel accepts in one GSO send (UDP_MAX_SEGMENTS).*/
+    const size_t UDP_MAX_GSO_SEGMENTS = 64;
+
+    /*Maximum number of payload bytes in one GSO send. Stays clear of the 64 KB IP datagram limit.*/
+    const size_t UDP_MAX_GSO_BYTES = 60000;
+
+    /*Control message buffer carrying the UDP_SEGMENT size of a GSO send.*/
+    union GSOControl
+    {
+        char buffer[CMSG_SPACE(sizeof(uint16_t))];
+        cmsghdr align;
+    };
+#endif
+
+    UDPSocket::UDPSocket(asio::io_context& context) : socket(context) {}
+
+    UDPSocket::~UDPSocket()
+    {
+        std::error_code ec;
+        socket.close(ec);
+    }
+
+    /*Opens this UDPSocket instance and binds it to a local endpoint.
+    @param endpoint The local endpoint to bind to.
+    @throws std::runtime_error if the socket couldn't be opened or bound.*/
+    void UDPSocket::bind(const asio::ip::udp::endpoint& endpoint)
+    {
+        std::error_code ec;
+
+        if (!socket.is_open()) {
+            socket.open(endpoint.protocol(), ec);
+            if (ec)
+                throw std::runtime_error("Failed to open UDP socket: " + ec.message());
+        }
+
+        socket.bind(endpoint, ec);
+        if (ec)
+            throw std::runtime_error("Failed to bind UDP socket: " + ec.message());
+
+        configure();
+    }
+
+    /*Opens this UDPSocket instance (if needed) and connects it to a remote endpoint,
+    so that only datagrams from that endpoint are received.
+    @param endpoint The remote endpoint to connect to.
+    @throws std::runtime_error if the socket couldn't be opened or connected.*/
+    void UDPSocket::connect(const asio::ip::udp::endpoint& endpoint)
+    {
+        std::error_code ec;
+        bool wasOpen = socket.is_open();
+
+        if (!wasOpen) {
+            socket.open(endpoint.protocol(), ec);
+            if (ec)
+                throw std::runtime_error("Failed to open UDP socket: " + ec.message());
+        }
+
+        socket.connect(endpoint, ec);
+        if (ec)
+            throw std::runtime_error("Failed to connect UDP socket: " + ec.message());
+
+        connected = true;
+
+        if (!wasOpen)
+            configure();
+    }
+
+    /*Sets up non-blocking mode and probes for GSO support once the socket is open.*/
+    void UDPSocket::configure()
+    {
+        receiveBuffers.assign(static_cast<size_t>(UDP_BATCH_SIZE) * UDP_RECEIVE_BUFFER_SIZE, 0);
+        receiveEndpoints.assign(UDP_BATCH_SIZE, asio::ip::udp::endpoint());
+
+#ifdef __linux__
+        //Batched sends and receives are done directly on the descriptor and must never block the io_context.
+        socket.non_blocking(true);
+
+        int segmentSize = 0;
+        socklen_t optionLength = sizeof(segmentSize);
+        gsoSupported = ::getsockopt(socket.native_handle(), SOL_UDP, UDP_SEGMENT, &segmentSize, &optionLength) == 0;
+        gsoEnabled = gsoSupported;
+#endif
+    }
+
+    /*Starts receiving datagrams. Callbacks are invoked on the io_context's thread(s).
+    @param onDatagram Called once for every datagram received.
+    @param onError Called when receiving failed, I.E because of an ICMP error on a connected socket.*/
+    void UDPSocket::startReceiving(DatagramReceivedCallback onDatagram, ReceiveErrorCallback onError)
+    {
+        onDatagramReceived = onDatagram;
+        onReceiveError = onError;
+
+        receiveAsync();
+    }
+
+    /*Asynchronously receives datagrams.*/
+    void UDPSocket::receiveAsync()
+    {
+        if (!socket.is_open())
+            return;
+
+        //Make sure the UDPSocket instance stays alive for the duration of the async operation...
+        auto self(shared_from_this());
+
+#ifdef __linux__
+        socket.async_wait(asio::ip::udp::socket::wait_read, [this, self](std::error_code ec) {
+            if (ec) {
+                if (ec != asio::error::operation_aborted && onReceiveError)
+                    onReceiveError(ec);
+
+                return;
+            }
+
+            mmsghdr messages[UDP_BATCH_SIZE];
+            iovec iovecs[UDP_BATCH_SIZE];
+
+            //Drain what's readable, but hand the thread back to the io_context
+            //after a few batches so one busy socket can't starve the others.
+            for (int round = 0; round < 4; round++) {
+                std::memset(messages, 0, sizeof(messages));
+
+                for (int i = 0; i < UDP_BATCH_SIZE; i++) {
+                    iovecs[i].iov_base = receiveBuffers.data() + static_cast<size_t>(i) * UDP_RECEIVE_BUFFER_SIZE;
+                    iovecs[i].iov_len = UDP_RECEIVE_BUFFER_SIZE;
+                    messages[i].msg_hdr.msg_iov = &iovecs[i];
+                    messages[i].msg_hdr.msg_iovlen = 1;
+                    messages[i].msg_hdr.msg_name = receiveEndpoints[i].data();
+                    messages[i].msg_hdr.msg_namelen = static_cast<socklen_t>(receiveEndpoints[i].capacity());
+                }
+
+                int received = ::recvmmsg(socket.native_handle(), messages, UDP_BATCH_SIZE, MSG_DONTWAIT, nullptr);
+
+                if (received < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    if (errno != EAGAIN && errno != EWOULDBLOCK && onReceiveError)
+                        onReceiveError(std::error_code(errno, std::system_category()));
+
+                    break;
+                }
+
+                for (int i = 0; i < received; i++) {
+                    if (messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                        PARLO_LOG(LogLevel::warn, "UDPSocket: Dropped oversized datagram.");
+                        continue;
+                    }
+
+                    receiveEndpoints[i].resize(messages[i].msg_hdr.msg_namelen);
+
+                    if (onDatagramReceived)
+                        onDatagramReceived(receiveEndpoints[i], static_cast<const uint8_t*>(iovecs[i].iov_base), messages[i].msg_len);
+                }
+
+                if (received < UDP_BATCH_SIZE)
+                    break;
+            }
+
+            receiveAsync(); //Continue receiving data
+        });
+#else
+        socket.async_receive_from(asio::buffer(receiveBuffers.data(), UDP_RECEIVE_BUFFER_SIZE), receiveEndpoints[0],
+            [this, self](std::error_code ec, std::size_t bytesTransferred) {
+                if (ec == asio::error::operation_aborted)
+                    return;
+
+                if (!ec) {
+                    if (onDatagramReceived)
+                        onDatagramReceived(receiveEndpoints[0], receiveBuffers.data(), bytesTransferred);
+                }
+                else if (ec != asio::error::message_size && onReceiveError)
+                    onReceiveError(ec);
+
+                receiveAsync(); //Continue receiving data
+            });
+#endif
+    }
+
+    /*Queues a datagram for sending. Queued datagrams are flushed in batches on the io_context.
+    @param endpoint The endpoint to send to. Ignored if this socket is connected.
+    @param datagram The datagram to send.*/
+    void UDPSocket::sendAsync(const asio::ip::udp::endpoint& endpoint, std::vector<uint8_t> datagram)
+    {
+        bool postFlush = false;
+
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            sendQueue.push_back({ endpoint, std::move(datagram) });
+
+            if (!flushScheduled) {
+                flushScheduled = true;
+                postFlush = true;
+            }
+        }
+
+        if (postFlush) {
+            auto self(shared_from_this());
+            asio::post(socket.get_executor(), [this, self]() { flush(); });
+        }
+    }
+
+    /*Sends everything in the send queue.*/
+    void UDPSocket::flush()
+    {
+        std::vector<OutgoingDatagram> batch;
+
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            batch.swap(sendQueue);
+        }
+
+        size_t sent = batch.empty() ? 0 : sendBatch(batch);
+
+        if (sent < batch.size()) {
+            //The socket buffer is full, so wait until the kernel can take more.
+            requeue(batch, sent);
+
+            auto self(shared_from_this());
+            socket.async_wait(asio::ip::udp::socket::wait_write, [this, self](std::error_code ec) {
+                if (ec) {
+                    std::lock_guard<std::mutex> lock(sendMutex);
+                    sendQueue.clear();
+                    flushScheduled = false;
+                    return;
+                }
+
+                flush();
+            });
+
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(sendMutex);
+
+        if (sendQueue.empty())
+            flushScheduled = false;
+        else {
+            auto self(shared_from_this());
+            asio::post(socket.get_executor(), [this, self]() { flush(); });
+        }
+    }
+
+    /*Sends a batch of datagrams.
+    @returns The index of the first datagram that couldn't be sent because the socket would block,
+    or batch.size() if everything was sent.*/
+    size_t UDPSocket::sendBatch(std::vector<OutgoingDatagram>& batch)
+    {
+        if (!socket.is_open())
+            return batch.size();
+
+#ifdef __linux__
+        const size_t count = batch.size();
+        const bool useGSO = gsoEnabled;
+
+        std::vector<mmsghdr> messages;
+        std::vector<iovec> iovecs(count);
+        std::vector<GSOControl> controls(count);
+        std::vector<size_t> firstDatagram;
+        messages.reserve(count);
+        firstDatagram.reserve(count);
+
+        size_t index = 0;
+
+        while (index < count) {
+            const size_t segmentSize = batch[index].data.size();
+            size_t segments = 1;
+            size_t totalSize = segmentSize;
+
+            iovecs[index].iov_base = batch[index].data.data();
+            iovecs[index].iov_len = segmentSize;
+
+            if (useGSO) {
+                //Only the last segment of a GSO send may be shorter than the others.
+                while (index + segments < count && segments < UDP_MAX_GSO_SEGMENTS) {
+                    OutgoingDatagram& next = batch[index + segments];
+
+                    if ((!connected && next.endpoint != batch[index].endpoint) || next.data.size() > segmentSize ||
+                        totalSize + next.data.size() > UDP_MAX_GSO_BYTES)
+                        break;
+
+                    iovecs[index + segments].iov_base = next.data.data();
+                    iovecs[index + segments].iov_len = next.data.size();
+                    totalSize += next.data.size();
+                    segments++;
+
+                    if (next.data.size() < segmentSize)
+                        break;
+                }
+            }
+
+            mmsghdr message;
+            std::memset(&message, 0, sizeof(message));
+            message.msg_hdr.msg_iov = &iovecs[index];
+            message.msg_hdr.msg_iovlen = segments;
+
+            if (!connected) {
+                message.msg_hdr.msg_name = batch[index].endpoint.data();
+                message.msg_hdr.msg_namelen = static_cast<socklen_t>(batch[index].endpoint.size());
+            }
+
+            if (segments > 1) {
+                GSOControl& control = controls[messages.size()];
+                std::memset(&control, 0, sizeof(control));
+                message.msg_hdr.msg_control = control.buffer;
+                message.msg_hdr.msg_controllen = sizeof(control.buffer);
+
+                cmsghdr* cmsg = CMSG_FIRSTHDR(&message.msg_hdr);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+
+                uint16_t gsoSize = static_cast<uint16_t>(segmentSize);
+                std::memcpy(CMSG_DATA(cmsg), &gsoSize, sizeof(gsoSize));
+            }
+
+            messages.push_back(message);
+            firstDatagram.push_back(index);
+            index += segments;
+        }
+
+        size_t sent = 0;
+
+        while (sent < messages.size()) {
+            unsigned int chunk = static_cast<unsigned int>((std::min)(messages.size() - sent, static_cast<size_t>(UDP_BATCH_SIZE)));
+            int result = ::sendmmsg(socket.native_handle(), &messages[sent], chunk, 0);
+
+            if (result < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return firstDatagram[sent];
+
+                if (useGSO && messages[sent].msg_hdr.msg_controllen != 0 && (errno == EIO || errno == EINVAL)) {
+                    //The device can't segment (I.E no checksum offload). Retry the rest without GSO.
+                    PARLO_LOG(LogLevel::warn, "UDPSocket: GSO send failed, falling back to sendmmsg().");
+                    gsoEnabled = false;
+                    return firstDatagram[sent];
+                }
+
+                //UDP is unreliable anyway, so drop the datagram(s) that failed and carry on.
+                PARLO_LOG(LogLevel::warn, "UDPSocket: Failed to send datagram: {}", std::strerror(errno));
+                sent++;
+                continue;
+            }
+
+            sent += static_cast<size_t>(result);
+        }
+#else
+        for (auto& datagram : batch) {
+            std::error_code ec;
+
+            if (connected)
+                socket.send(asio::buffer(datagram.data), 0, ec);
+            else
+                socket.send_to(asio::buffer(datagram.data), datagram.endpoint, 0, ec);
+
+            if (ec)
+                PARLO_LOG(LogLevel::warn, "UDPSocket: Failed to send datagram: {}", ec);
+        }
+#endif
+
+        return batch.size();
+    }
+
+    /*Puts unsent datagrams back at the front of the send queue.*/
+    void UDPSocket::requeue(std::vector<OutgoingDatagram>& batch, size_t first)
+    {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        sendQueue.insert(sendQueue.begin(), std::make_move_iterator(batch.begin() + first), std::make_move_iterator(batch.end()));
+    }
+
+    /*Closes this UDPSocket instance.*/
+    void UDPSocket::close()
+    {
+        std::error_code ec;
+        socket.close(ec);
+    }
+
+    /*Is this socket still open?*/
+    bool UDPSocket::isOpen() const
+    {
+        return socket.is_open();
+    }
+
+    /*Is UDP generic segmentation offload used for sends?*/
+    bool UDPSocket::isGSOEnabled() const
+    {
+        return gsoEnabled;
+    }
+
+    /*Enables or disables UDP generic segmentation offload. Has no effect if the kernel doesn't support it.*/
+    void UDPSocket::setGSOEnabled(bool enable)
+    {
+        gsoEnabled = enable && gsoSupported;
+    }
+
+    asio::ip::udp::endpoint UDPSocket::localEndpoint() const
+    {
+        std::error_code ec;
+        return socket.local_endpoint(ec);
+    }
+}
@@ -0,0 +1,126 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#pragma once
+
+#include <asio.hpp>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Parlo
+{
+    /*Maximum number of datagrams moved per recvmmsg() or sendmmsg() call.*/
+    const int UDP_BATCH_SIZE = 32;
+
+    /*Size of each receive slot. Datagrams larger than this are truncated by the kernel and dropped.*/
+    const int UDP_RECEIVE_BUFFER_SIZE = 2048;
+
+    /*A UDP socket that batches datagrams.
+    On Linux, datagrams are received with recvmmsg() and sent with sendmmsg(). Runs of equally sized
+    datagrams to the same endpoint are handed to the kernel as one GSO (UDP_SEGMENT) send when the
+    kernel supports it. Other platforms fall back to one datagram per system call.*/
+    class UDPSocket : public std::enable_shared_from_this<UDPSocket>
+    {
+    public:
+        using DatagramReceivedCallback = std::function<void(const asio::ip::udp::endpoint&, const uint8_t*, size_t)>;
+        using ReceiveErrorCallback = std::function<void(const std::error_code&)>;
+
+        UDPSocket(asio::io_context& context);
+        ~UDPSocket();
+
+        //Delete copy constructor and copy assignment operator
+        UDPSocket(const UDPSocket&) = delete;
+        UDPSocket& operator=(const UDPSocket&) = delete;
+
+        /*Opens this UDPSocket instance and binds it to a local endpoint.
+        @param endpoint The local endpoint to bind to.
+        @throws std::runtime_error if the socket couldn't be opened or bound.*/
+        void bind(const asio::ip::udp::endpoint& endpoint);
+
+        /*Opens this UDPSocket instance (if needed) and connects it to a remote endpoint,
+        so that only datagrams from that endpoint are received.
+        @param endpoint The remote endpoint to connect to.
+        @throws std::runtime_error if the socket couldn't be opened or connected.*/
+        void connect(const asio::ip::udp::endpoint& endpoint);
+
+        /*Starts receiving datagrams. Callbacks are invoked on the io_context's thread(s).
+        @param onDatagram Called once for every datagram received.
+        @param onError Called when receiving failed, I.E because of an ICMP error on a connected socket.*/
+        void startReceiving(DatagramReceivedCallback onDatagram, ReceiveErrorCallback onError);
+
+        /*Queues a datagram for sending. Queued datagrams are flushed in batches on the io_context.
+        @param endpoint The endpoint to send to. Ignored if this socket is connected.
+        @param datagram The datagram to send.*/
+        void sendAsync(const asio::ip::udp::endpoint& endpoint, std::vector<uint8_t> datagram);
+
+        /*Closes this UDPSocket instance.*/
+        void close();
+
+        /*Is this socket still open?*/
+        bool isOpen() const;
+
+        /*Is UDP generic segmentation offload used for sends?*/
+        bool isGSOEnabled() const;
+
+        /*Enables or disables UDP generic segmentation offload. Has no effect if the kernel doesn't support it.*/
+        void setGSOEnabled(bool enable);
+
+        asio::ip::udp::endpoint localEndpoint() const;
+
+        /*Returns the native ASIO socket for use with ASIO operations. */
+        asio::ip::udp::socket& native_handle() { return socket; }
+
+    private:
+        struct OutgoingDatagram
+        {
+            asio::ip::udp::endpoint endpoint;
+            std::vector<uint8_t> data;
+        };
+
+        asio::ip::udp::socket socket;
+        bool connected = false;
+        bool gsoSupported = false;
+        std::atomic<bool> gsoEnabled{ false };
+
+        std::mutex sendMutex;
+        std::vector<OutgoingDatagram> sendQueue;
+        /*Is a flush posted to, or waiting on, the io_context?*/
+        bool flushScheduled = false;
+
+        DatagramReceivedCallback onDatagramReceived;
+        ReceiveErrorCallback onReceiveError;
+
+        std::vector<uint8_t> receiveBuffers;
+        std::vector<asio::ip::udp::endpoint> receiveEndpoints;
+
+        /*Sets up non-blocking mode and probes for GSO support once the socket is open.*/
+        void configure();
+
+        /*Asynchronously receives datagrams.*/
+        void receiveAsync();
+
+        /*Sends everything in the send queue.*/
+        void flush();
+
+        /*Sends a batch of datagrams.
+        @returns The index of the first datagram that couldn't be sent because the socket would block,
+        or batch.size() if everything was sent.*/
+        size_t sendBatch(std::vector<OutgoingDatagram>& batch);
+
+        /*Puts unsent datagrams back at the front of the send queue.*/
+        void requeue(std::vector<OutgoingDatagram>& batch, size_t first);
+    };
+}
@@ -0,0 +1,58 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include <benchmark/benchmark.h>
+#include <random>
+#include <vector>
+#include "Compression.h"
+
+/*Compressible data resembling serialized game state: runs of repeated fields with some noise.*/
+static std::vector<uint8_t> makePayload(size_t size) {
+    std::mt19937 random(42);
+    std::vector<uint8_t> payload(size);
+
+    for (size_t i = 0; i < size; i++)
+        payload[i] = (i % 16 < 12) ? static_cast<uint8_t>(i % 16) : static_cast<uint8_t>(random() & 0xFF);
+
+    return payload;
+}
+
+/*compressData() for range(0) bytes at zlib level range(1).*/
+static void BM_Compress(benchmark::State& state) {
+    std::vector<uint8_t> payload = makePayload(static_cast<size_t>(state.range(0)));
+    int level = static_cast<int>(state.range(1));
+    size_t compressedSize = 0;
+
+    for (auto _ : state) {
+        std::vector<uint8_t> compressed = Parlo::compressData(payload, level);
+        compressedSize = compressed.size();
+        benchmark::DoNotOptimize(compressed.data());
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * payload.size()));
+    state.counters["ratio"] = static_cast<double>(payload.size()) / static_cast<double>(compressedSize);
+}
+BENCHMARK(BM_Compress)->ArgsProduct({ { 256, 1024, 16384 }, { 1, 6, Parlo::DEFAULT_COMPRESSION_LEVEL } });
+
+/*decompressData() of range(0) bytes compressed at the default level.*/
+static void BM_Decompress(benchmark::State& state) {
+    std::vector<uint8_t> payload = makePayload(static_cast<size_t>(state.range(0)));
+    std::vector<uint8_t> compressed = Parlo::compressData(payload);
+
+    for (auto _ : state) {
+        std::vector<uint8_t> decompressed = Parlo::decompressData(compressed);
+        benchmark::DoNotOptimize(decompressed.data());
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * payload.size()));
+}
+BENCHMARK(BM_Decompress)->Arg(256)->Arg(1024)->Arg(16384);
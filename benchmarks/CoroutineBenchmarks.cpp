@@ -0,0 +1,171 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+#include "Parlo.h"
+#include "Socket.h"
+
+/*Every allocation in the process, by any thread. Built as its own executable, so this doesn't skew other benchmarks.*/
+static std::atomic<uint64_t> allocations{ 0 };
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* block = std::malloc(size ? size : 1))
+        return block;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* block) noexcept {
+    std::free(block);
+}
+
+void operator delete(void* block, std::size_t) noexcept {
+    std::free(block);
+}
+
+/*Round trips per benchmark iteration, so starting one costs little next to them.*/
+static const int ROUND_TRIPS = 100;
+
+/*An io_context running on its own thread, and a Listener on an ephemeral loopback port.*/
+struct Loopback
+{
+    asio::io_context context;
+    std::unique_ptr<asio::executor_work_guard<asio::io_context::executor_type>> workGuard;
+    std::thread ioThread;
+    std::shared_ptr<Parlo::Listener> listener;
+    Parlo::Socket socket{ context };
+    std::shared_ptr<Parlo::NetworkClient> client;
+
+    Loopback() : workGuard(std::make_unique<asio::executor_work_guard<asio::io_context::executor_type>>(context.get_executor())) {
+        listener = std::make_shared<Parlo::Listener>(context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+        client = std::make_shared<Parlo::NetworkClient>(socket);
+        ioThread = std::thread([this]() { context.run(); });
+    }
+
+    ~Loopback() {
+        client->disconnectAsync(false);
+        listener->stopAccepting();
+        workGuard.reset();
+        context.stop();
+        ioThread.join();
+    }
+};
+
+/*Reports allocations and latency per round trip.*/
+static void reportRoundTrips(benchmark::State& state, uint64_t allocated) {
+    double roundTrips = static_cast<double>(state.iterations()) * ROUND_TRIPS;
+
+    state.SetItemsProcessed(static_cast<int64_t>(roundTrips));
+    state.counters["allocs/roundtrip"] = benchmark::Counter(static_cast<double>(allocated) / roundTrips);
+    state.counters["latency"] = benchmark::Counter(roundTrips, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+/*Echoing packets with the callback interface: each handler sends the next packet.*/
+static void BM_CallbackRoundTrip(benchmark::State& state) {
+    Loopback loopback;
+    std::atomic<int> remaining{ 0 };
+    const std::vector<uint8_t> packet = Parlo::Packet(1, std::vector<uint8_t>(64, 0xAB), false).buildPacket();
+
+    loopback.listener->setOnClientConnectedHandler([](const std::shared_ptr<Parlo::NetworkClient>& client) {
+        client->setOnReceivedDataHandler([](const std::shared_ptr<Parlo::NetworkClient>& sender,
+            const std::shared_ptr<Parlo::Packet>& received) {
+            sender->sendAsync(Parlo::Packet(received->getID(), received->getData(), false).buildPacket());
+        });
+    });
+    loopback.listener->startAccepting();
+
+    loopback.client->setOnReceivedDataHandler([&](const std::shared_ptr<Parlo::NetworkClient>& client,
+        const std::shared_ptr<Parlo::Packet>&) {
+        if (remaining.fetch_sub(1) > 1)
+            client->sendAsync(packet);
+    });
+    loopback.client->connectAsync(loopback.listener->getLocalEndpoint());
+    while (!loopback.client->isConnected())
+        std::this_thread::yield();
+
+    uint64_t allocated = 0;
+    for (auto _ : state) {
+        uint64_t before = allocations.load();
+        remaining = ROUND_TRIPS;
+        loopback.client->sendAsync(packet);
+
+        while (remaining.load() > 0)
+            std::this_thread::yield();
+
+        allocated += allocations.load() - before;
+    }
+
+    reportRoundTrips(state, allocated);
+}
+BENCHMARK(BM_CallbackRoundTrip)->UseRealTime();
+
+/*Echoes every packet a connection sends, until it's lost.*/
+static asio::awaitable<void> echo(std::shared_ptr<Parlo::Listener> listener) {
+    auto client = co_await listener->accept();
+
+    try {
+        for (;;) {
+            auto packet = co_await client->receive();
+            co_await client->send(Parlo::Packet(packet->getID(), packet->getData(), false));
+        }
+    }
+    catch (const std::system_error&) {
+    }
+}
+
+/*Sends a packet and waits for it to be echoed, ROUND_TRIPS times.*/
+static asio::awaitable<void> roundTrips(std::shared_ptr<Parlo::NetworkClient> client, std::atomic<bool>* done) {
+    const Parlo::Packet packet(1, std::vector<uint8_t>(64, 0xAB), false);
+
+    for (int i = 0; i < ROUND_TRIPS; i++) {
+        co_await client->send(packet);
+        co_await client->receive();
+    }
+
+    *done = true;
+}
+
+static asio::awaitable<void> connect(std::shared_ptr<Parlo::NetworkClient> client, asio::ip::tcp::endpoint endpoint) {
+    co_await client->connect(endpoint);
+}
+
+/*Echoing packets with the coroutine interface on both ends.*/
+static void BM_CoroutineRoundTrip(benchmark::State& state) {
+    Loopback loopback;
+    asio::co_spawn(loopback.context, echo(loopback.listener), asio::detached);
+    asio::co_spawn(loopback.context, connect(loopback.client, loopback.listener->getLocalEndpoint()), asio::detached);
+    while (!loopback.client->isConnected())
+        std::this_thread::yield();
+
+    uint64_t allocated = 0;
+    std::atomic<bool> done{ false };
+    for (auto _ : state) {
+        uint64_t before = allocations.load();
+        done = false;
+        asio::co_spawn(loopback.context, roundTrips(loopback.client, &done), asio::detached);
+
+        while (!done.load())
+            std::this_thread::yield();
+
+        allocated += allocations.load() - before;
+    }
+
+    reportRoundTrips(state, allocated);
+}
+BENCHMARK(BM_CoroutineRoundTrip)->UseRealTime();
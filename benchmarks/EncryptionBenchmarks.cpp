@@ -0,0 +1,54 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <vector>
+#include "EncryptedPacket.h"
+
+static std::shared_ptr<Parlo::EncryptionArgs> makeArgs(Parlo::EncryptionMode mode) {
+    auto args = std::make_shared<Parlo::EncryptionArgs>();
+    args->Mode = mode;
+    args->Key = "benchmark key";
+    args->Salt = "benchmark salt";
+    return args;
+}
+
+/*Building an encrypted packet with a payload of range(0) bytes, in mode range(1).
+Includes deriving the key, which happens on every packet.*/
+static void BM_EncryptPacket(benchmark::State& state) {
+    std::vector<uint8_t> payload(static_cast<size_t>(state.range(0)), 0xAB);
+    Parlo::EncryptedPacket packet(makeArgs(static_cast<Parlo::EncryptionMode>(state.range(1))), 1, payload);
+
+    for (auto _ : state) {
+        std::vector<uint8_t> built = packet.buildPacket();
+        benchmark::DoNotOptimize(built.data());
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * payload.size()));
+}
+BENCHMARK(BM_EncryptPacket)->ArgsProduct({ { 64, 1000 }, { Parlo::EncryptionMode::AES, Parlo::EncryptionMode::Twofish } });
+
+static void BM_DecryptPacket(benchmark::State& state) {
+    std::vector<uint8_t> payload(static_cast<size_t>(state.range(0)), 0xAB);
+    auto args = makeArgs(static_cast<Parlo::EncryptionMode>(state.range(1)));
+    std::vector<uint8_t> built = Parlo::EncryptedPacket(args, 1, payload).buildPacket();
+    Parlo::EncryptedPacket received(args, 1, std::vector<uint8_t>(built.begin() + Parlo::PacketHeaders::STANDARD, built.end()));
+
+    for (auto _ : state) {
+        std::vector<uint8_t> decrypted = received.decryptPacket();
+        benchmark::DoNotOptimize(decrypted.data());
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * payload.size()));
+}
+BENCHMARK(BM_DecryptPacket)->ArgsProduct({ { 64, 1000 }, { Parlo::EncryptionMode::AES, Parlo::EncryptionMode::Twofish } });
@@ -0,0 +1,53 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include <benchmark/benchmark.h>
+#include <string>
+#include <system_error>
+#include "Logger.h"
+
+/*The cost of a log call whose level is disabled at runtime, which should be a single load.*/
+static void BM_LogDisabled(benchmark::State& state) {
+    Parlo::LogLevel previous = Parlo::Logger::getLevel();
+    Parlo::Logger::setLevel(Parlo::LogLevel::error);
+
+    for (auto _ : state)
+        PARLO_LOG(Parlo::LogLevel::verbose, "Received {} bytes from {}", 1024, "client");
+
+    Parlo::Logger::setLevel(previous);
+}
+BENCHMARK(BM_LogDisabled);
+
+/*The cost of enqueueing an enabled log call on the calling thread. Formatting happens on the logging thread.*/
+static void BM_LogEnqueue(benchmark::State& state) {
+    Parlo::Logger::onMessageLogged = [](const Parlo::LogMessage& msg) { benchmark::DoNotOptimize(msg.message.size()); };
+    std::error_code ec = std::make_error_code(std::errc::connection_reset);
+
+    for (auto _ : state)
+        Parlo::Logger::LogFormat(Parlo::LogLevel::error, "Error in receiveAsync: {} after {} bytes", ec, state.iterations());
+
+    Parlo::Logger::flush();
+    state.counters["dropped"] = static_cast<double>(Parlo::Logger::getDroppedCount());
+    Parlo::Logger::onMessageLogged = nullptr;
+}
+BENCHMARK(BM_LogEnqueue)->Threads(1)->Threads(4);
+
+/*The previous, synchronous cost of a log call: building the string on the calling thread.*/
+static void BM_LogFormatInline(benchmark::State& state) {
+    std::error_code ec = std::make_error_code(std::errc::connection_reset);
+
+    for (auto _ : state) {
+        std::string message = "Error in receiveAsync: " + ec.message() + " after " + std::to_string(state.iterations()) + " bytes";
+        benchmark::DoNotOptimize(message);
+    }
+}
+BENCHMARK(BM_LogFormatInline);
@@ -0,0 +1,166 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "Parlo.h"
+#include "HeartbeatPacket.h"
+#include "GoodbyePacket.h"
+
+/*Frames a packet with a payload of payloadSize bytes in the given format.*/
+static std::vector<uint8_t> frame(Parlo::HeaderFormat format, uint8_t id, size_t payloadSize) {
+    std::vector<uint8_t> packet = Parlo::Packet(id, std::vector<uint8_t>(payloadSize, id), false).buildPacket();
+    if (format == Parlo::HeaderFormat::Legacy)
+        return packet;
+
+    uint8_t header[Parlo::MAX_COMPACT_HEADER_SIZE];
+    size_t headerSize = Parlo::writeCompactHeader(header, id, false, payloadSize);
+    packet.erase(packet.begin(), packet.begin() + Parlo::PacketHeaders::STANDARD);
+    packet.insert(packet.begin(), header, header + headerSize);
+    return packet;
+}
+
+/*Ingestion of a stream of packets into a ProcessingBuffer, fed in chunks of range(0) bytes as if
+that was what each socket read returned, framed in the HeaderFormat range(1). Measured until every packet has been processed.*/
+static void BM_ProcessingBufferIngest(benchmark::State& state) {
+    const size_t chunkSize = static_cast<size_t>(state.range(0));
+    const Parlo::HeaderFormat format = static_cast<Parlo::HeaderFormat>(state.range(1));
+    const int packetCount = 64;
+
+    std::vector<uint8_t> stream;
+    for (int i = 0; i < packetCount; i++) {
+        std::vector<uint8_t> packet = frame(format, static_cast<uint8_t>(i), 100);
+        stream.insert(stream.end(), packet.begin(), packet.end());
+    }
+
+    std::vector<std::vector<uint8_t>> chunks;
+    for (size_t offset = 0; offset < stream.size(); offset += chunkSize)
+        chunks.emplace_back(stream.begin() + offset, stream.begin() + (std::min)(offset + chunkSize, stream.size()));
+
+    Parlo::ProcessingBuffer buffer;
+    buffer.setHeaderFormat(format);
+    std::atomic<int> processed{ 0 };
+    buffer.setOnPacketProcessedHandler([&processed](const Parlo::Packet&) {
+        processed.fetch_add(1, std::memory_order_release);
+    });
+
+    for (auto _ : state) {
+        processed.store(0, std::memory_order_relaxed);
+
+        for (auto& chunk : chunks)
+            buffer.addData(chunk);
+
+        while (processed.load(std::memory_order_acquire) < packetCount)
+            std::this_thread::yield();
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * stream.size()));
+    state.SetItemsProcessed(state.iterations() * packetCount);
+}
+BENCHMARK(BM_ProcessingBufferIngest)->ArgsProduct({ { 1, 16, 104, 512, Parlo::MAX_PACKET_SIZE }, { 0, 1 } });
+
+/*Parsing the header of a packet with a payload of range(1) bytes, framed in the HeaderFormat range(0),
+from the front of a std::deque like the ProcessingBuffer's. Reports the header's bytes on the wire.*/
+static void BM_HeaderParse(benchmark::State& state) {
+    const Parlo::HeaderFormat format = static_cast<Parlo::HeaderFormat>(state.range(0));
+    std::vector<uint8_t> packet = frame(format, 1, static_cast<size_t>(state.range(1)));
+    std::deque<uint8_t> buffer(packet.begin(), packet.end());
+
+    Parlo::FrameHeader header;
+    for (auto _ : state) {
+        bool complete = format == Parlo::HeaderFormat::Compact ? Parlo::readCompactHeader(buffer, buffer.size(), header) :
+            Parlo::readLegacyHeader(buffer, buffer.size(), header);
+        benchmark::DoNotOptimize(complete);
+        benchmark::DoNotOptimize(header);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.counters["headerBytes"] = benchmark::Counter(static_cast<double>(header.headerSize));
+    state.counters["overhead%"] = benchmark::Counter(100.0 * header.headerSize / packet.size());
+}
+BENCHMARK(BM_HeaderParse)->ArgsProduct({ { 0, 1 }, { 8, 62, 100, 500, Parlo::MAX_PACKET_SIZE - 4 } });
+
+/*Writing a compact header for a payload of range(0) bytes.*/
+static void BM_CompactHeaderWrite(benchmark::State& state) {
+    const size_t payloadSize = static_cast<size_t>(state.range(0));
+    uint8_t header[Parlo::MAX_COMPACT_HEADER_SIZE];
+
+    for (auto _ : state) {
+        size_t headerSize = Parlo::writeCompactHeader(header, 1, false, payloadSize);
+        benchmark::DoNotOptimize(headerSize);
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CompactHeaderWrite)->Arg(8)->Arg(500);
+
+/*Packet::buildPacket() for a TCP packet with a payload of range(0) bytes.*/
+static void BM_PacketBuild(benchmark::State& state) {
+    std::vector<uint8_t> payload(static_cast<size_t>(state.range(0)), 0xAB);
+    Parlo::Packet packet(1, payload, false);
+
+    for (auto _ : state) {
+        std::vector<uint8_t> built = packet.buildPacket();
+        benchmark::DoNotOptimize(built.data());
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * payload.size()));
+}
+BENCHMARK(BM_PacketBuild)->Arg(16)->Arg(256)->Arg(Parlo::MAX_PACKET_SIZE - 4);
+
+/*Serializing a heartbeat, including the echo.*/
+static void BM_HeartbeatSerialize(benchmark::State& state) {
+    Parlo::HeartbeatPacket heartbeat(std::chrono::milliseconds(30));
+    heartbeat.setEcho(std::chrono::microseconds(123456), std::chrono::microseconds(42));
+
+    for (auto _ : state) {
+        auto bytes = heartbeat.toByteArray();
+        benchmark::DoNotOptimize(bytes->data());
+    }
+}
+BENCHMARK(BM_HeartbeatSerialize);
+
+static void BM_HeartbeatDeserialize(benchmark::State& state) {
+    Parlo::HeartbeatPacket heartbeat(std::chrono::milliseconds(30));
+    auto bytes = heartbeat.toByteArray();
+
+    for (auto _ : state) {
+        Parlo::HeartbeatPacket parsed = Parlo::HeartbeatPacket::byteArrayToObject(bytes);
+        benchmark::DoNotOptimize(parsed);
+    }
+}
+BENCHMARK(BM_HeartbeatDeserialize);
+
+static void BM_GoodbyeSerialize(benchmark::State& state) {
+    GoodbyePacket goodbye(ParloDefaultTimeouts::Server);
+
+    for (auto _ : state) {
+        std::vector<uint8_t> bytes = goodbye.toByteArray();
+        benchmark::DoNotOptimize(bytes.data());
+    }
+}
+BENCHMARK(BM_GoodbyeSerialize);
+
+static void BM_GoodbyeDeserialize(benchmark::State& state) {
+    std::vector<uint8_t> bytes = GoodbyePacket(ParloDefaultTimeouts::Server).toByteArray();
+
+    for (auto _ : state) {
+        GoodbyePacket parsed = GoodbyePacket::fromByteArray(bytes);
+        benchmark::DoNotOptimize(parsed);
+    }
+}
+BENCHMARK(BM_GoodbyeDeserialize);
@@ -0,0 +1,80 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "Parlo.h"
+#include "Capture.h"
+
+/*The capture replayed by BM_ReplayCapture. Set PARLO_CAPTURE to replay a capture of real traffic,
+otherwise a synthetic one is written: 8 connections sending 100 byte packets in 512 byte reads.*/
+static std::string replayCapturePath() {
+    if (const char* path = std::getenv("PARLO_CAPTURE"))
+        return path;
+
+    const std::string path = "ReplayBenchmarks.bin";
+    static bool written = false;
+
+    if (!written) {
+        Parlo::TrafficCapture capture(path);
+
+        std::vector<uint8_t> stream;
+        for (int i = 0; i < 1000; i++) {
+            std::vector<uint8_t> packet = Parlo::Packet(1, std::vector<uint8_t>(100, static_cast<uint8_t>(i)), false).buildPacket();
+            stream.insert(stream.end(), packet.begin(), packet.end());
+        }
+
+        for (uint32_t connection = 0; connection < 8; connection++) {
+            capture.addConnection();
+            for (size_t offset = 0; offset < stream.size(); offset += 512)
+                capture.append(connection, stream.data() + offset, (std::min)(static_cast<size_t>(512), stream.size() - offset));
+        }
+
+        written = true;
+    }
+
+    return path;
+}
+
+/*Replaying a capture through the dispatch path as fast as possible.*/
+static void BM_ReplayCapture(benchmark::State& state) {
+    Parlo::TrafficReplay replay(replayCapturePath());
+    Parlo::ReplayStats stats;
+
+    for (auto _ : state)
+        stats = replay.replay([](uint32_t, const Parlo::Packet& packet) { benchmark::DoNotOptimize(packet.getID()); });
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * stats.bytes));
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * stats.packets));
+}
+BENCHMARK(BM_ReplayCapture)->Unit(benchmark::kMillisecond);
+
+/*Appending a read of range(0) bytes to a capture.*/
+static void BM_CaptureAppend(benchmark::State& state) {
+    std::vector<uint8_t> data(static_cast<size_t>(state.range(0)), 0xAB);
+
+    {
+        Parlo::TrafficCapture capture("CaptureBenchmarks.bin");
+        uint32_t connection = capture.addConnection();
+
+        for (auto _ : state)
+            capture.append(connection, data.data(), data.size());
+    }
+
+    std::remove("CaptureBenchmarks.bin");
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * data.size()));
+}
+BENCHMARK(BM_CaptureAppend)->Arg(64)->Arg(512);
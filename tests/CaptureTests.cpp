@@ -0,0 +1,142 @@
+#include "pch.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Parlo.h"
+#include "Capture.h"
+#include "Compression.h"
+#include "Socket.h"
+
+/*Test for reading back the records of a capture, in order.*/
+TEST(CaptureTests, TestRecords) {
+    {
+        Parlo::TrafficCapture capture("CaptureTestsRecords.bin");
+        uint32_t first = capture.addConnection();
+        uint32_t second = capture.addConnection();
+        EXPECT_NE(first, second);
+
+        std::vector<uint8_t> small = { 1, 2, 3 };
+        std::vector<uint8_t> large(3 * Parlo::CAPTURE_INITIAL_SIZE / 2, 0xCD); //Forces the file to grow.
+
+        capture.append(first, small.data(), small.size());
+        capture.append(second, large.data(), large.size());
+        capture.append(first, small.data(), 1);
+    }
+
+    Parlo::TrafficReplay replay("CaptureTestsRecords.bin");
+    std::vector<Parlo::CaptureRecord> records;
+    replay.forEachRecord([&](const Parlo::CaptureRecord& record) { records.push_back(record); });
+
+    ASSERT_EQ(records.size(), 3u);
+    EXPECT_EQ(records[0].length, 3u);
+    EXPECT_EQ(records[0].data[2], 3);
+    EXPECT_EQ(records[1].length, 3 * Parlo::CAPTURE_INITIAL_SIZE / 2);
+    EXPECT_EQ(records[1].data[records[1].length - 1], 0xCD);
+    EXPECT_EQ(records[2].connection, records[0].connection);
+    EXPECT_LE(records[0].timestamp, records[2].timestamp);
+
+    std::remove("CaptureTestsRecords.bin");
+}
+
+/*Test for replaying packets that were split across reads, and compressed packets.*/
+TEST(CaptureTests, TestReplay) {
+    {
+        Parlo::TrafficCapture capture("CaptureTestsReplay.bin");
+        uint32_t connection = capture.addConnection();
+
+        std::vector<uint8_t> stream;
+        for (uint8_t i = 0; i < 10; i++) {
+            auto packet = Parlo::Packet(i, std::vector<uint8_t>(100, i), false).buildPacket();
+            stream.insert(stream.end(), packet.begin(), packet.end());
+        }
+
+        auto compressed = Parlo::Packet(10, Parlo::compressData(std::vector<uint8_t>(500, 7)), true).buildPacket();
+        stream.insert(stream.end(), compressed.begin(), compressed.end());
+
+        //Reads that don't line up with packets.
+        for (size_t offset = 0; offset < stream.size(); offset += 77)
+            capture.append(connection, stream.data() + offset, (std::min)(static_cast<size_t>(77), stream.size() - offset));
+    }
+
+    Parlo::TrafficReplay replay("CaptureTestsReplay.bin");
+    std::mutex mutex;
+    std::vector<uint8_t> ids;
+    std::vector<uint8_t> lastPayload;
+
+    Parlo::ReplayStats stats = replay.replay([&](uint32_t, const Parlo::Packet& packet) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ids.push_back(packet.getID());
+        lastPayload = packet.getData();
+    });
+
+    EXPECT_EQ(stats.packets, 11u);
+    ASSERT_EQ(ids.size(), 11u);
+    for (uint8_t i = 0; i < ids.size(); i++)
+        EXPECT_EQ(ids[i], i);
+    EXPECT_EQ(lastPayload, std::vector<uint8_t>(500, 7));
+
+    std::remove("CaptureTestsReplay.bin");
+}
+
+/*Test for capturing the traffic received by a Listener's connections, and replaying it.*/
+TEST(CaptureTests, TestCaptureConnection) {
+    asio::io_context context;
+    auto workGuard = asio::make_work_guard(context);
+    std::thread ioThread([&context]() { context.run(); });
+
+    std::atomic<int> received{ 0 };
+    Parlo::Socket socket(context);
+
+    {
+        auto capture = std::make_shared<Parlo::TrafficCapture>("CaptureTestsConnection.bin");
+        auto listener = std::make_shared<Parlo::Listener>(context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+        listener->setCapture(capture);
+        listener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::NetworkClient>& client) {
+            client->setOnReceivedDataHandler([&](const std::shared_ptr<Parlo::NetworkClient>&,
+                const std::shared_ptr<Parlo::Packet>&) {
+                received++;
+            });
+        });
+        listener->startAccepting();
+
+        auto client = std::make_shared<Parlo::NetworkClient>(socket);
+        client->connectAsync(listener->getLocalEndpoint());
+
+        auto start = std::chrono::steady_clock::now();
+        while (!client->isConnected() && std::chrono::steady_clock::now() - start < std::chrono::seconds(1))
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        EXPECT_TRUE(client->isConnected());
+
+        for (uint8_t i = 0; i < 20; i++)
+            client->sendAsync(Parlo::Packet(1, { i, i, i }, false).buildPacket());
+
+        start = std::chrono::steady_clock::now();
+        while (received.load() < 20 && std::chrono::steady_clock::now() - start < std::chrono::seconds(1))
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        EXPECT_EQ(received.load(), 20);
+
+        client->disconnectAsync(false);
+        listener->setCapture(nullptr);
+        workGuard.reset();
+        context.stop();
+        ioThread.join();
+    }
+
+    //Let the connections wind down, so the capture is closed.
+    context.restart();
+    context.run();
+
+    Parlo::TrafficReplay replay("CaptureTestsConnection.bin");
+    std::atomic<int> replayed{ 0 };
+    replay.replay([&](uint32_t, const Parlo::Packet& packet) {
+        if (packet.getID() == 1)
+            replayed++;
+    });
+
+    EXPECT_EQ(replayed.load(), 20);
+
+    std::remove("CaptureTestsConnection.bin");
+}
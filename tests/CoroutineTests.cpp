@@ -0,0 +1,207 @@
+#include "pch.h"
+#include <gtest/gtest.h>
+#include <future>
+#include <system_error>
+#include <vector>
+#include "Parlo.h"
+#include "RPCChannel.h"
+#include "Socket.h"
+
+class CoroutineTests : public ::testing::Test {
+protected:
+    void SetUp() override {
+        workGuard = std::make_unique<asio::executor_work_guard<asio::io_context::executor_type>>(context.get_executor());
+        ioThread = std::thread([this]() { context.run(); });
+    }
+
+    void TearDown() override {
+        workGuard.reset();
+        context.stop();
+        if (ioThread.joinable())
+            ioThread.join();
+    }
+
+    //Disconnects, and waits for the goodbye to go out before the socket goes out of scope.
+    static void disconnect(const std::shared_ptr<Parlo::NetworkClient>& client, Parlo::Socket& socket) {
+        client->disconnectAsync();
+
+        auto start = std::chrono::steady_clock::now();
+        while (socket.isOpen() && std::chrono::steady_clock::now() - start < std::chrono::seconds(1))
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    //Runs a coroutine on the io_context, and waits for it to finish. Rethrows whatever it threw.
+    template<typename T>
+    T run(asio::awaitable<T> coroutine) {
+        std::promise<T> result;
+        auto future = result.get_future();
+
+        if constexpr (std::is_void_v<T>) {
+            asio::co_spawn(context, std::move(coroutine), [&result](std::exception_ptr e) {
+                if (e)
+                    result.set_exception(e);
+                else
+                    result.set_value();
+            });
+        }
+        else {
+            asio::co_spawn(context, std::move(coroutine), [&result](std::exception_ptr e, T value) {
+                if (e)
+                    result.set_exception(e);
+                else
+                    result.set_value(std::move(value));
+            });
+        }
+
+        EXPECT_EQ(future.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+        return future.get();
+    }
+
+    //Echoes every packet a connection sends, until it's lost.
+    static asio::awaitable<void> echo(std::shared_ptr<Parlo::Listener> listener) {
+        auto client = co_await listener->accept();
+
+        try {
+            for (;;) {
+                auto packet = co_await client->receive();
+                co_await client->send(Parlo::Packet(packet->getID(), packet->getData(), false));
+            }
+        }
+        catch (const std::system_error&) {
+        }
+    }
+
+    //Sends a connection numbered packets, then says goodbye.
+    static asio::awaitable<void> sendAndDisconnect(std::shared_ptr<Parlo::Listener> listener, uint8_t count) {
+        auto client = co_await listener->accept();
+        for (uint8_t i = 0; i < count; i++)
+            co_await client->send(Parlo::Packet(1, std::vector<uint8_t>(1, i), false));
+
+        client->disconnectAsync();
+    }
+
+    //Tells whether accept() threw.
+    static asio::awaitable<void> acceptThrows(std::shared_ptr<Parlo::Listener> listener, std::promise<bool>* threw) {
+        try {
+            co_await listener->accept();
+            threw->set_value(false);
+        }
+        catch (const std::system_error&) {
+            threw->set_value(true);
+        }
+    }
+
+    asio::io_context context;
+    std::unique_ptr<asio::executor_work_guard<asio::io_context::executor_type>> workGuard;
+    std::thread ioThread;
+};
+
+/*Test for echoing packets with a coroutine on each end, in order.*/
+TEST_F(CoroutineTests, TestEcho) {
+    auto listener = std::make_shared<Parlo::Listener>(context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    asio::co_spawn(context, echo(listener), asio::detached);
+
+    Parlo::Socket socket(context);
+    auto client = std::make_shared<Parlo::NetworkClient>(socket);
+
+    int echoed = run([&]() -> asio::awaitable<int> {
+        co_await client->connect(listener->getLocalEndpoint());
+
+        int count = 0;
+        for (uint8_t i = 0; i < 100; i++) {
+            co_await client->send(Parlo::Packet(1, std::vector<uint8_t>(i + 1, i), false));
+            auto packet = co_await client->receive();
+
+            if (packet->getData() == std::vector<uint8_t>(i + 1, i))
+                count++;
+        }
+
+        co_return count;
+    }());
+
+    EXPECT_EQ(echoed, 100);
+    disconnect(client, socket);
+}
+
+/*Test that receive() returns what arrived before the connection was lost, then throws.*/
+TEST_F(CoroutineTests, TestConnectionLost) {
+    auto listener = std::make_shared<Parlo::Listener>(context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+
+    asio::co_spawn(context, sendAndDisconnect(listener, 10), asio::detached);
+
+    Parlo::Socket socket(context);
+    auto client = std::make_shared<Parlo::NetworkClient>(socket);
+    std::vector<uint8_t> received;
+
+    EXPECT_THROW(run([&]() -> asio::awaitable<void> {
+        co_await client->connect(listener->getLocalEndpoint());
+
+        for (;;)
+            received.push_back((co_await client->receive())->getData()[0]);
+    }()), std::system_error);
+
+    ASSERT_EQ(received.size(), 10u);
+    for (uint8_t i = 0; i < received.size(); i++)
+        EXPECT_EQ(received[i], i);
+}
+
+/*Test that accept() throws once the Listener stops accepting, and connect() throws if nobody is listening.*/
+TEST_F(CoroutineTests, TestErrors) {
+    auto listener = std::make_shared<Parlo::Listener>(context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    auto endpoint = listener->getLocalEndpoint();
+
+    std::promise<bool> threw;
+    asio::co_spawn(context, acceptThrows(listener, &threw), asio::detached);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    listener->stopAccepting();
+    auto future = threw.get_future();
+    ASSERT_EQ(future.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    EXPECT_TRUE(future.get());
+
+    listener.reset(); //Nobody is listening on the port now.
+
+    Parlo::Socket socket(context);
+    auto client = std::make_shared<Parlo::NetworkClient>(socket);
+    EXPECT_THROW(run(client->connect(endpoint)), std::system_error);
+}
+
+/*Test for awaiting calls on a RPCChannel, including one that fails.*/
+TEST_F(CoroutineTests, TestRPC) {
+    auto listener = std::make_shared<Parlo::Listener>(context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    std::shared_ptr<Parlo::RPCChannel> server;
+    listener->setOnClientConnectedHandler([&server](const std::shared_ptr<Parlo::NetworkClient>& client) {
+        server = std::make_shared<Parlo::RPCChannel>(client);
+        server->setHandler(1, [](const std::vector<uint8_t>& request) {
+            return std::vector<uint8_t>(1, static_cast<uint8_t>(request[0] * 2));
+        });
+    });
+    listener->startAccepting();
+
+    Parlo::Socket socket(context);
+    auto client = std::make_shared<Parlo::NetworkClient>(socket);
+    Parlo::RPCChannel channel(client);
+    bool unknownMethod = false;
+
+    int sum = run([&]() -> asio::awaitable<int> {
+        co_await client->connect(listener->getLocalEndpoint());
+
+        int total = 0;
+        for (uint8_t i = 0; i < 50; i++)
+            total += (co_await channel.call(1, std::vector<uint8_t>(1, i)))[0];
+
+        try {
+            co_await channel.call(2, std::vector<uint8_t>(1, 0));
+        }
+        catch (const std::system_error& e) {
+            unknownMethod = e.code() == Parlo::RPCError::UnknownMethod;
+        }
+
+        co_return total;
+    }());
+
+    EXPECT_EQ(sum, 49 * 50);
+    EXPECT_TRUE(unknownMethod);
+    disconnect(client, socket);
+    listener->stopAccepting();
+}
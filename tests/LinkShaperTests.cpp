@@ -0,0 +1,251 @@
+#include "pch.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Parlo.h"
+#include "LinkShaper.h"
+#include "Socket.h"
+
+/*Waits for a condition to become true, or for a timeout to pass.*/
+template <typename Condition>
+static bool waitFor(Condition condition, std::chrono::milliseconds timeout = std::chrono::milliseconds(2000)) {
+    auto start = std::chrono::steady_clock::now();
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() - start > timeout)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    return true;
+}
+
+/*Test that stream data is delayed by the latency, and stays in order despite jitter.*/
+TEST(LinkShaperTests, TestStreamLatencyAndOrder) {
+    asio::io_context context;
+    auto workGuard = asio::make_work_guard(context);
+    std::thread ioThread([&context]() { context.run(); });
+
+    Parlo::LinkConditions conditions;
+    conditions.latency = std::chrono::milliseconds(30);
+    conditions.jitter = std::chrono::milliseconds(20);
+    Parlo::LinkShaper shaper(context, conditions);
+
+    std::mutex mutex;
+    std::vector<uint8_t> received;
+    std::chrono::steady_clock::time_point firstArrival;
+    auto sent = std::chrono::steady_clock::now();
+
+    for (uint8_t i = 0; i < 50; i++) {
+        shaper.submit({ i }, true, [&](std::vector<uint8_t> data) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (received.empty())
+                firstArrival = std::chrono::steady_clock::now();
+            received.push_back(data[0]);
+        });
+    }
+
+    EXPECT_TRUE(waitFor([&]() { std::lock_guard<std::mutex> lock(mutex); return received.size() == 50; }));
+
+    workGuard.reset();
+    context.stop();
+    ioThread.join();
+
+    ASSERT_EQ(received.size(), 50u);
+    for (uint8_t i = 0; i < received.size(); i++)
+        EXPECT_EQ(received[i], i);
+    EXPECT_GE(firstArrival - sent, std::chrono::milliseconds(10)); //Latency less the most jitter.
+    EXPECT_EQ(shaper.getStats().delivered, 50u);
+}
+
+/*Test that data queues up behind a bandwidth cap.*/
+TEST(LinkShaperTests, TestBandwidth) {
+    asio::io_context context;
+    auto workGuard = asio::make_work_guard(context);
+    std::thread ioThread([&context]() { context.run(); });
+
+    Parlo::LinkConditions conditions;
+    conditions.bandwidth = 100000; //10 KB takes 100 ms.
+    Parlo::LinkShaper shaper(context, conditions);
+
+    std::atomic<int> received{ 0 };
+    auto sent = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < 10; i++)
+        shaper.submit(std::vector<uint8_t>(1000), true, [&](std::vector<uint8_t>) { received++; });
+
+    EXPECT_TRUE(waitFor([&]() { return received.load() == 10; }));
+    auto elapsed = std::chrono::steady_clock::now() - sent;
+
+    workGuard.reset();
+    context.stop();
+    ioThread.join();
+
+    EXPECT_GE(elapsed, std::chrono::milliseconds(95));
+}
+
+/*Test that datagrams are lost and reordered, and streams never are.*/
+TEST(LinkShaperTests, TestLossAndReorder) {
+    asio::io_context context;
+    auto workGuard = asio::make_work_guard(context);
+    std::thread ioThread([&context]() { context.run(); });
+
+    Parlo::LinkConditions conditions;
+    conditions.lossRate = 0.5;
+    conditions.reorderRate = 0.2;
+    conditions.reorderDelay = std::chrono::milliseconds(5);
+    Parlo::LinkShaper shaper(context, conditions);
+
+    std::mutex mutex;
+    std::vector<int> datagrams;
+    std::atomic<int> streamed{ 0 };
+
+    for (int i = 0; i < 1000; i++) {
+        shaper.submit({ 0 }, false, [&, i](std::vector<uint8_t>) {
+            std::lock_guard<std::mutex> lock(mutex);
+            datagrams.push_back(i);
+        });
+        shaper.submit({ 0 }, true, [&](std::vector<uint8_t>) { streamed++; });
+    }
+
+    Parlo::LinkShaperStats stats = shaper.getStats();
+    EXPECT_TRUE(waitFor([&]() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return streamed.load() == 1000 && datagrams.size() == 1000 - stats.dropped;
+    }));
+
+    workGuard.reset();
+    context.stop();
+    ioThread.join();
+
+    EXPECT_EQ(streamed.load(), 1000);
+    EXPECT_GT(stats.dropped, 350u);
+    EXPECT_LT(stats.dropped, 650u);
+    EXPECT_GT(stats.reordered, 0u);
+
+    bool outOfOrder = false;
+    for (size_t i = 1; i < datagrams.size(); i++)
+        outOfOrder |= datagrams[i] < datagrams[i - 1];
+    EXPECT_TRUE(outOfOrder);
+}
+
+/*Test that lost stream data arrives after the retransmission delay, and holds up whatever was sent after it.*/
+TEST(LinkShaperTests, TestStreamRetransmission) {
+    asio::io_context context;
+    auto workGuard = asio::make_work_guard(context);
+    std::thread ioThread([&context]() { context.run(); });
+
+    Parlo::LinkConditions conditions;
+    conditions.lossRate = 1.0;
+    conditions.retransmitDelay = std::chrono::milliseconds(50);
+    Parlo::LinkShaper shaper(context, conditions);
+
+    std::mutex mutex;
+    std::vector<uint8_t> received;
+    std::chrono::steady_clock::time_point lastArrival;
+    auto sent = std::chrono::steady_clock::now();
+
+    shaper.submit({ 0 }, true, [&](std::vector<uint8_t> data) {
+        std::lock_guard<std::mutex> lock(mutex);
+        received.push_back(data[0]);
+    });
+
+    conditions.lossRate = 0.0;
+    shaper.setConditions(conditions);
+    shaper.submit({ 1 }, true, [&](std::vector<uint8_t> data) {
+        std::lock_guard<std::mutex> lock(mutex);
+        received.push_back(data[0]);
+        lastArrival = std::chrono::steady_clock::now();
+    });
+
+    EXPECT_TRUE(waitFor([&]() { std::lock_guard<std::mutex> lock(mutex); return received.size() == 2; }));
+
+    workGuard.reset();
+    context.stop();
+    ioThread.join();
+
+    EXPECT_EQ(received, std::vector<uint8_t>({ 0, 1 }));
+    EXPECT_GE(lastArrival - sent, std::chrono::milliseconds(50));
+    EXPECT_EQ(shaper.getStats().retransmitted, 1u);
+    EXPECT_EQ(shaper.getStats().dropped, 0u);
+}
+
+/*Test that a shaped TCP connection sees the emulated round trip in its RTT estimate.*/
+TEST(LinkShaperTests, TestShapedConnectionRTT) {
+    asio::io_context context;
+    auto workGuard = asio::make_work_guard(context);
+    std::thread ioThread([&context]() { context.run(); });
+
+    Parlo::LinkConditions conditions;
+    conditions.latency = std::chrono::milliseconds(25);
+    auto shaper = std::make_shared<Parlo::LinkShaper>(context, conditions);
+
+    Parlo::Socket socket(context);
+    auto listener = std::make_shared<Parlo::Listener>(context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    listener->setLinkShaper(shaper);
+    listener->startAccepting();
+
+    auto client = std::make_shared<Parlo::NetworkClient>(socket);
+    client->setLinkShaper(shaper);
+    client->connectAsync(listener->getLocalEndpoint());
+    EXPECT_TRUE(waitFor([&]() { return client->isConnected(); }));
+
+    client->measureRTTAsync();
+    EXPECT_TRUE(waitFor([&]() { return client->getRTTStats().sampleCount > 0; }));
+
+    Parlo::RTTStats rtt = client->getRTTStats();
+    EXPECT_GE(rtt.latestRTT, std::chrono::milliseconds(45));
+
+    client->disconnectAsync(false);
+    listener->stopAccepting();
+    workGuard.reset();
+    context.stop();
+    ioThread.join();
+}
+
+/*Test that reliable UDP packets all arrive, in order, over a lossy link that reorders datagrams.*/
+TEST(LinkShaperTests, TestReliableOverLossyLink) {
+    asio::io_context context;
+    auto workGuard = asio::make_work_guard(context);
+    std::thread ioThread([&context]() { context.run(); });
+
+    Parlo::LinkConditions conditions;
+    conditions.latency = std::chrono::milliseconds(5);
+    conditions.lossRate = 0.1;
+    conditions.reorderRate = 0.1;
+    auto shaper = std::make_shared<Parlo::LinkShaper>(context, conditions);
+
+    std::atomic<int> received{ 0 };
+    std::atomic<bool> inOrder{ true };
+
+    auto listener = std::make_shared<Parlo::UDPListener>(context, asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+    listener->setLinkShaper(shaper);
+    listener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::UDPNetworkClient>& client) {
+        client->setOnReceivedDataHandler([&](const std::shared_ptr<Parlo::UDPNetworkClient>&,
+            const std::shared_ptr<Parlo::Packet>& packet) {
+            if (packet->getData()[0] != static_cast<uint8_t>(received.load()))
+                inOrder = false;
+            received++;
+        });
+    });
+    listener->startAccepting();
+
+    auto client = std::make_shared<Parlo::UDPNetworkClient>(context);
+    client->setLinkShaper(shaper);
+    client->connectAsync(listener->getLocalEndpoint());
+
+    for (int i = 0; i < 50; i++)
+        client->sendAsync(Parlo::Packet(4, std::vector<uint8_t>(200, static_cast<uint8_t>(i)), false, true).buildPacket());
+
+    EXPECT_TRUE(waitFor([&]() { return received.load() == 50; }, std::chrono::milliseconds(10000)));
+    EXPECT_TRUE(inOrder.load());
+    EXPECT_GT(shaper->getStats().dropped, 0u);
+
+    client->disconnectAsync(false);
+    listener->stopAccepting();
+    workGuard.reset();
+    context.stop();
+    ioThread.join();
+}
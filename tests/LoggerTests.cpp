@@ -0,0 +1,177 @@
+#include "pch.h"
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <future>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include "Logger.h"
+
+/*Collects every message logged while it is alive.*/
+class LogCapture
+{
+public:
+    LogCapture() {
+        Parlo::Logger::onMessageLogged = [this](const Parlo::LogMessage& msg) {
+            std::lock_guard<std::mutex> lock(mutex);
+            messages.push_back(msg.message);
+        };
+    }
+
+    ~LogCapture() {
+        Parlo::Logger::flush();
+        Parlo::Logger::onMessageLogged = nullptr;
+    }
+
+    std::vector<std::string> take() {
+        Parlo::Logger::flush();
+        std::lock_guard<std::mutex> lock(mutex);
+        return std::move(messages);
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<std::string> messages;
+};
+
+/*Test for formatting literal, integer, string and error_code arguments on the logging thread.*/
+TEST(LoggerTests, TestFormatting) {
+    LogCapture capture;
+    std::string name = "client";
+
+    Parlo::Logger::LogFormat(Parlo::LogLevel::info, "Plain message");
+    Parlo::Logger::LogFormat(Parlo::LogLevel::info, "{} {} on port {}", "Listening", name, 3077);
+    Parlo::Logger::LogFormat(Parlo::LogLevel::error, "Error: {}", std::make_error_code(std::errc::connection_reset));
+    Parlo::Logger::LogFormat(Parlo::LogLevel::warn, "{} and {}, {}", -1, 2u, 0.5);
+    Parlo::Logger::LogFormat(Parlo::LogLevel::warn, "Missing {} {}", 1);
+
+    std::vector<std::string> messages = capture.take();
+    ASSERT_EQ(messages.size(), 5u);
+    EXPECT_EQ(messages[0], "Plain message");
+    EXPECT_EQ(messages[1], "Listening client on port 3077");
+    EXPECT_EQ(messages[2], "Error: " + std::make_error_code(std::errc::connection_reset).message());
+    EXPECT_EQ(messages[3], "-1 and 2, 0.5");
+    EXPECT_EQ(messages[4], "Missing 1 {}");
+}
+
+/*Test that string arguments are copied when they're logged rather than when they're formatted, and cut short if they're long.*/
+TEST(LoggerTests, TestStringArguments) {
+    std::promise<void> entered;
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    std::mutex mutex;
+    std::vector<std::string> messages;
+    bool first = true;
+
+    //Stall the logging thread, so nothing is formatted until the strings are gone.
+    Parlo::Logger::onMessageLogged = [&](const Parlo::LogMessage& msg) {
+        if (first) {
+            first = false;
+            entered.set_value();
+            released.wait();
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        messages.push_back(msg.message);
+    };
+
+    Parlo::Logger::LogFormat(Parlo::LogLevel::info, "Blocking");
+    entered.get_future().wait();
+
+    char buffer[16] = "client";
+    Parlo::Logger::LogFormat(Parlo::LogLevel::info, "Name {}", static_cast<const char*>(buffer));
+    Parlo::Logger::LogFormat(Parlo::LogLevel::info, "Name {}", buffer);
+    std::string name = "server";
+    Parlo::Logger::LogFormat(Parlo::LogLevel::info, "Name {}", name);
+    std::string longName(100, 'x');
+    Parlo::Logger::LogFormat(Parlo::LogLevel::info, "Name {}", longName);
+    std::string longMessage(200, 'y');
+    Parlo::Logger::Log(longMessage, Parlo::LogLevel::error);
+    std::snprintf(buffer, sizeof(buffer), "overwritten");
+    name = "overwritten";
+
+    release.set_value();
+    Parlo::Logger::flush();
+    Parlo::Logger::onMessageLogged = nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ASSERT_EQ(messages.size(), Parlo::Logger::isEnabled(Parlo::LogLevel::error) ? 5u : 4u);
+    EXPECT_EQ(messages[0], "Name client");
+    EXPECT_EQ(messages[1], "Name client");
+    EXPECT_EQ(messages[2], "Name server");
+    EXPECT_EQ(messages[3], "Name " + std::string(Parlo::LOG_ARGUMENT_TEXT_SIZE - 1, 'x'));
+    if (messages.size() == 5) {
+        EXPECT_EQ(messages[4], longMessage);
+    }
+}
+
+/*Test that messages from several threads are all delivered, and in order per thread.*/
+TEST(LoggerTests, TestManyThreads) {
+    LogCapture capture;
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < 4; i++) {
+        threads.emplace_back([i]() {
+            for (int j = 0; j < 100; j++) {
+                Parlo::Logger::LogFormat(Parlo::LogLevel::verbose, "{}:{}", i, j);
+                std::this_thread::yield();
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    std::vector<std::string> messages = capture.take();
+    EXPECT_EQ(messages.size(), 400u);
+
+    std::vector<int> next(4, 0);
+    for (auto& message : messages) {
+        int thread = std::stoi(message.substr(0, message.find(':')));
+        EXPECT_EQ(std::stoi(message.substr(message.find(':') + 1)), next[thread]++);
+    }
+}
+
+/*Test that a full ring drops messages rather than blocking the caller.*/
+TEST(LoggerTests, TestDropsWhenFull) {
+    std::promise<void> entered;
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    bool first = true;
+
+    //Stall the logging thread inside the handler so the ring fills up.
+    Parlo::Logger::onMessageLogged = [&](const Parlo::LogMessage&) {
+        if (first) {
+            first = false;
+            entered.set_value();
+            released.wait();
+        }
+    };
+
+    uint64_t droppedBefore = Parlo::Logger::getDroppedCount();
+    Parlo::Logger::LogFormat(Parlo::LogLevel::info, "Blocking");
+    entered.get_future().wait();
+
+    for (int i = 0; i < 300; i++)
+        Parlo::Logger::LogFormat(Parlo::LogLevel::info, "Message {}", i);
+
+    release.set_value();
+    Parlo::Logger::flush();
+    Parlo::Logger::onMessageLogged = nullptr;
+
+    EXPECT_GE(Parlo::Logger::getDroppedCount() - droppedBefore, 300u - Parlo::LOG_RING_CAPACITY);
+}
+
+/*Test the runtime level.*/
+TEST(LoggerTests, TestRuntimeLevel) {
+    Parlo::LogLevel previous = Parlo::Logger::getLevel();
+
+    Parlo::Logger::setLevel(Parlo::LogLevel::error);
+    EXPECT_FALSE(Parlo::Logger::isEnabled(Parlo::LogLevel::warn));
+    EXPECT_EQ(Parlo::Logger::isEnabled(Parlo::LogLevel::error), PARLO_COMPILED_LOG_LEVEL >= 1);
+
+    Parlo::Logger::setLevel(previous);
+}
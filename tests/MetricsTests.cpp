@@ -0,0 +1,119 @@
+#include "pch.h"
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include "Parlo.h"
+#include "Metrics.h"
+#include "Histogram.h"
+
+/*Test for a StripedCounter written from many threads at once.*/
+TEST(MetricsTests, TestStripedCounter) {
+    Parlo::StripedCounter counter;
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < 32; i++) {
+        threads.emplace_back([&counter]() {
+            for (int j = 0; j < 10000; j++)
+                counter.add();
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    EXPECT_EQ(counter.load(), 32u * 10000u);
+}
+
+/*Test for using a StripedCounter as a gauge, with adds and subtracts on different threads.*/
+TEST(MetricsTests, TestStripedGauge) {
+    Parlo::StripedCounter gauge;
+
+    gauge.add(5);
+    std::thread([&gauge]() { gauge.subtract(3); }).join();
+
+    EXPECT_EQ(static_cast<int64_t>(gauge.load()), 2);
+}
+
+/*Test for connection counters also counting towards the totals of the Listener that accepted them.*/
+TEST(MetricsTests, TestRecorderTotals) {
+    auto totals = std::make_shared<Parlo::ConnectionCounters>();
+    Parlo::ConnectionMetricsRecorder first, second;
+    first.setTotals(totals);
+    second.setTotals(totals);
+
+    first.add(Parlo::ConnectionCounter::Reads);
+    first.add(Parlo::ConnectionCounter::PacketsReceived, 3);
+    second.add(Parlo::ConnectionCounter::Reads);
+    second.add(Parlo::ConnectionCounter::PacketsReceived);
+
+    EXPECT_DOUBLE_EQ(first.snapshot().framesPerRead, 3.0);
+    EXPECT_EQ(second.snapshot().packetsReceived, 1u);
+
+    Parlo::ConnectionMetrics total = totals->snapshot();
+    EXPECT_EQ(total.reads, 2u);
+    EXPECT_EQ(total.packetsReceived, 4u);
+    EXPECT_DOUBLE_EQ(total.framesPerRead, 2.0);
+
+    //Only the totals are striped, so a connection's own counters stay small.
+    EXPECT_LE(sizeof(Parlo::ConnectionMetricsRecorder), 2 * Parlo::CACHE_LINE_SIZE + sizeof(totals));
+}
+
+/*Test for the Listener's periodic metrics handler.*/
+TEST(MetricsTests, TestListenerMetricsHandler) {
+    asio::io_context context;
+    auto listener = std::make_shared<Parlo::Listener>(context,
+        asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    int calls = 0;
+
+    listener->setMetricsHandler([&](const Parlo::ListenerMetrics& metrics) {
+        EXPECT_EQ(metrics.accepts, 0u);
+        EXPECT_EQ(metrics.activeConnections, 0);
+
+        if (++calls == 3)
+            listener->setMetricsHandler(nullptr, std::chrono::milliseconds(0));
+    }, std::chrono::milliseconds(5));
+
+    context.run_for(std::chrono::seconds(1));
+    EXPECT_EQ(calls, 3);
+}
+
+/*Test for the histogram's buckets covering every value, with bounded relative error.*/
+TEST(MetricsTests, TestHistogramBuckets) {
+    for (uint64_t value : { 0ull, 1ull, 31ull, 32ull, 33ull, 1000ull, 123456789ull, 1ull << 40 }) {
+        size_t index = Parlo::LatencyHistogram::bucketIndex(value);
+        uint64_t upper = Parlo::LatencyHistogram::bucketUpperBound(index);
+
+        EXPECT_GE(upper, value);
+        EXPECT_LE(upper - value, value / Parlo::HISTOGRAM_SUB_BUCKETS);
+        if (index > 0) {
+            EXPECT_LT(Parlo::LatencyHistogram::bucketUpperBound(index - 1), value);
+        }
+    }
+
+    EXPECT_EQ(Parlo::LatencyHistogram::bucketIndex(UINT64_MAX), Parlo::HISTOGRAM_BUCKET_COUNT - 1);
+}
+
+/*Test for histogram percentiles and reset.*/
+TEST(MetricsTests, TestHistogramPercentiles) {
+    Parlo::LatencyHistogram histogram;
+
+    //1..1000 microseconds, once each.
+    for (int i = 1; i <= 1000; i++)
+        histogram.record(std::chrono::microseconds(i));
+
+    Parlo::LatencySnapshot snapshot = histogram.snapshot();
+    EXPECT_EQ(snapshot.count, 1000u);
+    EXPECT_EQ(snapshot.min, std::chrono::microseconds(1));
+    EXPECT_EQ(snapshot.max, std::chrono::microseconds(1000));
+
+    auto near = [](std::chrono::nanoseconds actual, std::chrono::nanoseconds expected) {
+        return actual >= expected && actual <= expected + expected / Parlo::HISTOGRAM_SUB_BUCKETS;
+    };
+
+    EXPECT_TRUE(near(snapshot.p50, std::chrono::microseconds(500)));
+    EXPECT_TRUE(near(snapshot.p99, std::chrono::microseconds(990)));
+    EXPECT_EQ(snapshot.p999, std::chrono::microseconds(1000)); //Clamped to max.
+
+    histogram.reset();
+    EXPECT_EQ(histogram.snapshot().count, 0u);
+}
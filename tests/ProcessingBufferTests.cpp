@@ -92,6 +92,115 @@ TEST_F(ProcessingBufferTests, TestProcessingPacket) {
     std::cout << "Passed test!" << std::endl;;
 }
 
+/*Test that compact headers round trip, around the length escape and with a channel, and are only read once complete.*/
+TEST_F(ProcessingBufferTests, TestCompactHeader) {
+    struct Case { size_t payloadSize; uint8_t channel; size_t headerSize; };
+    for (Case c : { Case{ 0, 0, 2 }, Case{ 62, 0, 2 }, Case{ 63, 0, 3 }, Case{ 190, 0, 3 }, Case{ 191, 9, 5 },
+        Case{ 70000, 0, 5 }, Case{ 70000, 255, 6 } }) {
+        uint8_t bytes[Parlo::MAX_COMPACT_HEADER_SIZE];
+        ASSERT_EQ(Parlo::writeCompactHeader(bytes, 42, true, c.payloadSize, c.channel), c.headerSize);
+
+        Parlo::FrameHeader header;
+        EXPECT_FALSE(Parlo::readCompactHeader(bytes, c.headerSize - 1, header));
+        ASSERT_TRUE(Parlo::readCompactHeader(bytes, c.headerSize, header));
+        EXPECT_EQ(header.id, 42);
+        EXPECT_TRUE(header.compressed);
+        EXPECT_EQ(header.channel, c.channel);
+        EXPECT_EQ(header.headerSize, c.headerSize);
+        EXPECT_EQ(header.payloadSize, c.payloadSize);
+    }
+}
+
+/*Test that a ProcessingBuffer parses compact headers, however the data is split up.*/
+TEST_F(ProcessingBufferTests, TestProcessingCompactPackets) {
+    Parlo::ProcessingBuffer processingBuffer;
+    processingBuffer.setHeaderFormat(Parlo::HeaderFormat::Compact);
+
+    std::vector<uint8_t> stream;
+    std::vector<size_t> sizes = { 1, 5, 62, 63, 300, 1000 };
+    for (size_t size : sizes) {
+        uint8_t header[Parlo::MAX_COMPACT_HEADER_SIZE];
+        size_t headerSize = Parlo::writeCompactHeader(header, static_cast<uint8_t>(size), false, size);
+        stream.insert(stream.end(), header, header + headerSize);
+        stream.insert(stream.end(), size, static_cast<uint8_t>(size));
+    }
+
+    std::vector<std::pair<uint8_t, size_t>> packets;
+    size_t packetBytes = 0;
+    processingBuffer.setOnPacketProcessedHandler([&](const Parlo::Packet& packet) {
+        packets.emplace_back(packet.getID(), packet.getData().size());
+        packetBytes += processingBuffer.getPacketSize();
+    });
+
+    for (uint8_t byte : stream)
+        processingBuffer.addData({ byte });
+    processingBuffer.waitUntilProcessed();
+
+    ASSERT_EQ(packets.size(), sizes.size());
+    for (size_t i = 0; i < sizes.size(); i++) {
+        EXPECT_EQ(packets[i].first, static_cast<uint8_t>(sizes[i]));
+        EXPECT_EQ(packets[i].second, sizes[i]);
+    }
+    EXPECT_EQ(packetBytes, stream.size());
+    EXPECT_EQ(processingBuffer.bufferCount(), 0u);
+}
+
+/*Test that compact lengths encoded with more bytes than they need, or that don't fit in a size_t, are malformed.*/
+TEST_F(ProcessingBufferTests, TestMalformedCompactHeader) {
+    std::vector<std::vector<uint8_t>> malformed = {
+        { 1, 0x3F, 0x80, 0x00 },                                                       //A trailing zero byte.
+        { 1, 0x3F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x7F },       //Bits past the 64th.
+        { 1, 0x3F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x81, 0x01 }, //Longer than ten bytes.
+        { 1, 0x3F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01 }        //Wraps around when added up.
+    };
+
+    for (const auto& bytes : malformed) {
+        Parlo::FrameHeader header;
+        ASSERT_TRUE(Parlo::readCompactHeader(bytes, bytes.size(), header));
+        EXPECT_TRUE(header.malformed);
+    }
+
+    uint8_t bytes[Parlo::MAX_COMPACT_HEADER_SIZE];
+    size_t size = Parlo::writeCompactHeader(bytes, 1, false, 0x3F + 0x80);
+    Parlo::FrameHeader header;
+    ASSERT_TRUE(Parlo::readCompactHeader(bytes, size, header));
+    EXPECT_FALSE(header.malformed);
+}
+
+/*Test that a ProcessingBuffer gives up on a stream with a frame that's malformed or too large, instead of waiting for it.*/
+TEST_F(ProcessingBufferTests, TestInvalidFrame) {
+    struct Case { Parlo::HeaderFormat format; size_t maxFrameSize; std::vector<uint8_t> data; };
+    for (const Case& c : { Case{ Parlo::HeaderFormat::Legacy, static_cast<size_t>(Parlo::MAX_PACKET_SIZE), { 1, 0, 0xFF, 0xFF } },
+        Case{ Parlo::HeaderFormat::Legacy, 512, { 1, 0, 0x01, 0x02, 0 } },
+        Case{ Parlo::HeaderFormat::Compact, static_cast<size_t>(Parlo::MAX_PACKET_SIZE), { 1, 0x3F, 0xFF, 0xFF, 0x03 } },
+        Case{ Parlo::HeaderFormat::Compact, static_cast<size_t>(Parlo::MAX_PACKET_SIZE),
+            { 1, 0x3F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01 } } }) {
+        Parlo::ProcessingBuffer processingBuffer;
+        processingBuffer.setHeaderFormat(c.format);
+        processingBuffer.setMaxFrameSize(c.maxFrameSize);
+
+        std::atomic<int> invalidFrames{ 0 };
+        std::atomic<int> packets{ 0 };
+        processingBuffer.setOnInvalidFrameHandler([&]() { invalidFrames++; });
+        processingBuffer.setOnPacketProcessedHandler([&](const Parlo::Packet&) { packets++; });
+
+        uint8_t header[Parlo::MAX_COMPACT_HEADER_SIZE];
+        size_t headerSize = c.format == Parlo::HeaderFormat::Compact ? Parlo::writeCompactHeader(header, 1, false, 3) :
+            Parlo::writeLegacyHeader(header, 1, false, 3);
+        std::vector<uint8_t> packet(header, header + headerSize);
+        packet.insert(packet.end(), { 1, 2, 3 });
+        processingBuffer.addData(packet);
+        processingBuffer.waitUntilProcessed();
+        processingBuffer.addData(c.data);
+        processingBuffer.addData(std::vector<uint8_t>(Parlo::MAX_PACKET_SIZE, 0));
+        processingBuffer.waitUntilProcessed();
+
+        EXPECT_EQ(packets.load(), 1);
+        EXPECT_EQ(invalidFrames.load(), 1);
+        EXPECT_EQ(processingBuffer.bufferCount(), 0u);
+    }
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -0,0 +1,195 @@
+#include "pch.h"
+#include <gtest/gtest.h>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include "Parlo.h"
+#include "RPCChannel.h"
+#include "Socket.h"
+
+class RPCTests : public ::testing::Test {
+protected:
+    void SetUp() override {
+        workGuard = std::make_unique<asio::executor_work_guard<asio::io_context::executor_type>>(context.get_executor());
+        ioThread = std::thread([this]() { context.run(); });
+    }
+
+    void TearDown() override {
+        if (client)
+            client->disconnectAsync(false);
+        if (listener)
+            listener->stopAccepting();
+
+        workGuard.reset();
+        context.stop();
+        if (ioThread.joinable())
+            ioThread.join();
+    }
+
+    //Polls for a condition to become true, for at most a second.
+    template<typename Predicate>
+    bool waitFor(Predicate predicate) {
+        auto start = std::chrono::steady_clock::now();
+        while (!predicate() && std::chrono::steady_clock::now() - start < std::chrono::seconds(1))
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+        return predicate();
+    }
+
+    //Connects a client to a Listener, which hands its end of the connection to onAccepted.
+    void connect(std::function<void(const std::shared_ptr<Parlo::NetworkClient>&)> onAccepted) {
+        listener = std::make_shared<Parlo::Listener>(context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+        listener->setOnClientConnectedHandler([this, onAccepted](const std::shared_ptr<Parlo::NetworkClient>& accepted) {
+            onAccepted(accepted);
+            std::lock_guard<std::mutex> lock(serverMutex);
+            serverClient = accepted;
+        });
+        listener->startAccepting();
+
+        client = std::make_shared<Parlo::NetworkClient>(socket);
+        client->connectAsync(listener->getLocalEndpoint());
+        ASSERT_TRUE(waitFor([this]() {
+            std::lock_guard<std::mutex> lock(serverMutex);
+            return client->isConnected() && serverClient;
+        }));
+    }
+
+    //Connects a client to a Listener that serves method 1 by reversing the request, and method 2 by throwing.
+    void connectToServer() {
+        connect([this](const std::shared_ptr<Parlo::NetworkClient>& accepted) {
+            server = std::make_shared<Parlo::RPCChannel>(accepted);
+            server->setHandler(1, [](const std::vector<uint8_t>& request) {
+                return std::vector<uint8_t>(request.rbegin(), request.rend());
+            });
+            server->setHandler(2, [](const std::vector<uint8_t>&) -> std::vector<uint8_t> {
+                throw std::runtime_error("Nope");
+            });
+        });
+    }
+
+    asio::io_context context;
+    std::unique_ptr<asio::executor_work_guard<asio::io_context::executor_type>> workGuard;
+    std::thread ioThread;
+    Parlo::Socket socket{ context };
+    std::shared_ptr<Parlo::Listener> listener;
+    std::shared_ptr<Parlo::NetworkClient> client;
+    std::mutex serverMutex;
+    std::shared_ptr<Parlo::NetworkClient> serverClient;
+    std::shared_ptr<Parlo::RPCChannel> server;
+};
+
+/*Test for many calls outstanding at once, each completed with its own response.*/
+TEST_F(RPCTests, TestPipelinedCalls) {
+    connectToServer();
+    Parlo::RPCChannel channel(client);
+
+    std::vector<std::future<std::vector<uint8_t>>> responses;
+    for (int i = 0; i < 2000; i++)
+        responses.push_back(channel.callFuture(1, { static_cast<uint8_t>(i), static_cast<uint8_t>(i >> 8) }));
+
+    for (int i = 0; i < 2000; i++) {
+        ASSERT_EQ(responses[i].wait_for(std::chrono::seconds(5)), std::future_status::ready);
+        EXPECT_EQ(responses[i].get(), std::vector<uint8_t>({ static_cast<uint8_t>(i >> 8), static_cast<uint8_t>(i) }));
+    }
+
+    Parlo::RPCStats stats = channel.getStats();
+    EXPECT_EQ(stats.calls, 2000u);
+    EXPECT_EQ(stats.completed, 2000u);
+    EXPECT_EQ(stats.inFlight, 0u);
+    EXPECT_EQ(server->getStats().served, 2000u);
+}
+
+/*Test that handler failures and unknown methods are reported to the caller, and other packets still get through.*/
+TEST_F(RPCTests, TestRemoteErrors) {
+    connectToServer();
+    Parlo::RPCChannel channel(client);
+
+    std::promise<std::vector<uint8_t>> other;
+    channel.setOnReceivedDataHandler([&](const std::shared_ptr<Parlo::NetworkClient>&, const std::shared_ptr<Parlo::Packet>& packet) {
+        other.set_value(packet->getData());
+    });
+
+    try {
+        channel.callFuture(2, { 1 }).get();
+        FAIL() << "Expected the call to fail";
+    }
+    catch (const std::system_error& e) {
+        EXPECT_EQ(e.code(), Parlo::RPCError::RemoteError);
+        EXPECT_NE(std::string(e.what()).find("Nope"), std::string::npos);
+    }
+
+    std::promise<std::error_code> unknown;
+    channel.callAsync(3, { 1 }, [&](const std::error_code& ec, std::vector<uint8_t>) { unknown.set_value(ec); });
+    EXPECT_EQ(unknown.get_future().get(), Parlo::RPCError::UnknownMethod);
+
+    serverClient->sendAsync(Parlo::Packet(7, { 1, 2, 3 }, false).buildPacket());
+    auto received = other.get_future();
+    ASSERT_EQ(received.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    EXPECT_EQ(received.get(), std::vector<uint8_t>({ 1, 2, 3 }));
+}
+
+/*Test that calls fail once their deadline passes or they're cancelled, and their responses are dropped.*/
+TEST_F(RPCTests, TestDeadlineAndCancel) {
+    connectToServer();
+    server->setHandler(3, [](const std::vector<uint8_t>& request) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        return request;
+    });
+    Parlo::RPCChannel channel(client);
+
+    auto started = std::chrono::steady_clock::now();
+    auto timedOut = channel.callFuture(3, { 1 }, std::chrono::milliseconds(20));
+    try {
+        timedOut.get();
+        FAIL() << "Expected the call to time out";
+    }
+    catch (const std::system_error& e) {
+        EXPECT_EQ(e.code(), std::errc::timed_out);
+    }
+    EXPECT_LT(std::chrono::steady_clock::now() - started, std::chrono::milliseconds(90));
+
+    std::promise<std::error_code> cancelled;
+    uint32_t callID = channel.callAsync(3, { 2 }, [&](const std::error_code& ec, std::vector<uint8_t>) { cancelled.set_value(ec); });
+    EXPECT_TRUE(channel.cancel(callID));
+    EXPECT_FALSE(channel.cancel(callID));
+    EXPECT_EQ(cancelled.get_future().get(), std::errc::operation_canceled);
+
+    EXPECT_TRUE(waitFor([&]() { return channel.getStats().lateResponses == 2; }));
+    Parlo::RPCStats stats = channel.getStats();
+    EXPECT_EQ(stats.timedOut, 1u);
+    EXPECT_EQ(stats.cancelled, 1u);
+    EXPECT_EQ(stats.inFlight, 0u);
+}
+
+/*Test that outstanding calls fail when the connection goes away, and that the table of calls is bounded.*/
+TEST_F(RPCTests, TestConnectionLost) {
+    connect([](const std::shared_ptr<Parlo::NetworkClient>&) {}); //Nobody serves the calls.
+    Parlo::RPCChannel channel(client, 2);
+
+    std::promise<void> disconnected;
+    channel.setOnDisconnectedHandler([&](const std::shared_ptr<Parlo::NetworkClient>&) { disconnected.set_value(); });
+
+    auto first = channel.callFuture(1, { 1 });
+    auto second = channel.callFuture(1, { 2 });
+    EXPECT_THROW(channel.callFuture(1, { 3 }), std::runtime_error);
+    EXPECT_THROW(channel.callFuture(1, std::vector<uint8_t>(Parlo::RPCChannel::MAX_PAYLOAD_SIZE + 1)), std::overflow_error);
+
+    {
+        std::lock_guard<std::mutex> lock(serverMutex);
+        serverClient->disconnectAsync();
+    }
+
+    ASSERT_EQ(disconnected.get_future().wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    for (auto* response : { &first, &second }) {
+        try {
+            response->get();
+            FAIL() << "Expected the call to fail";
+        }
+        catch (const std::system_error& e) {
+            EXPECT_EQ(e.code(), std::errc::connection_aborted);
+        }
+    }
+
+    EXPECT_EQ(channel.getStats().failed, 2u);
+}
@@ -0,0 +1,299 @@
+#include "pch.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "Parlo.h"
+#include "SharedMemory.h"
+#include "SharedMemoryRing.h"
+
+#ifdef __linux__
+#include <unistd.h>
+
+class SharedMemoryTests : public ::testing::Test {
+protected:
+    void SetUp() override {
+        workGuard = std::make_unique<asio::executor_work_guard<asio::io_context::executor_type>>(context.get_executor());
+        ioThread = std::thread([this]() { context.run(); });
+    }
+
+    void TearDown() override {
+        workGuard.reset();
+        context.stop();
+        if (ioThread.joinable())
+            ioThread.join();
+    }
+
+    //Polls for a condition to become true, for at most five seconds.
+    template<typename Predicate>
+    bool waitFor(Predicate predicate) {
+        auto start = std::chrono::steady_clock::now();
+        while (!predicate() && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+        return predicate();
+    }
+
+    //A name no other test process uses at the same time.
+    std::string uniqueName(const std::string& test) {
+        return "test." + std::to_string(getpid()) + "." + test;
+    }
+
+    //Starts a SharedMemoryListener that echoes every packet it receives.
+    std::shared_ptr<Parlo::SharedMemoryListener> startEchoListener(const std::string& name) {
+        auto listener = std::make_shared<Parlo::SharedMemoryListener>(context, name);
+        listener->setOnClientConnectedHandler([](const std::shared_ptr<Parlo::SharedMemoryClient>& client) {
+            client->setOnReceivedDataHandler([](const std::shared_ptr<Parlo::SharedMemoryClient>& sender,
+                const std::shared_ptr<Parlo::Packet>& packet) {
+                sender->sendAsync(Parlo::Packet(packet->getID(), packet->getData(), false).buildPacket());
+            });
+        });
+        listener->startAccepting();
+        return listener;
+    }
+
+    asio::io_context context;
+    std::unique_ptr<asio::executor_work_guard<asio::io_context::executor_type>> workGuard;
+    std::thread ioThread;
+};
+
+/*Test that a ring keeps frames whole and in order as they wrap around, and refuses those it has no room for.*/
+TEST_F(SharedMemoryTests, TestRing) {
+    const size_t capacity = Parlo::MIN_SHARED_MEMORY_RING_SIZE;
+    std::vector<uint64_t> memory(Parlo::SharedMemoryRing::footprint(capacity) / sizeof(uint64_t) + 1);
+    new (memory.data()) Parlo::SharedMemoryRingControl();
+    Parlo::SharedMemoryRing ring(reinterpret_cast<uint8_t*>(memory.data()), capacity);
+
+    EXPECT_TRUE(ring.isEmpty());
+    EXPECT_TRUE(ring.prepareToSleep());
+
+    Parlo::FrameHeader header;
+    std::vector<uint8_t> payload;
+    EXPECT_FALSE(ring.peek(header));
+
+    //Frames of 1000 bytes don't divide the ring, so they end up straddling its end.
+    for (uint8_t round = 0; round < 20; round++) {
+        std::vector<uint8_t> frame = Parlo::Packet(round, std::vector<uint8_t>(996, round), false).buildPacket();
+        size_t written = 0;
+        while (ring.write(frame.data(), frame.size()))
+            written++;
+
+        EXPECT_EQ(written, round == 0 ? 4u : 1u);
+        EXPECT_FALSE(ring.hasRoom(frame.size()));
+        if (round == 0) {
+            EXPECT_TRUE(ring.wakeConsumer());
+        }
+        EXPECT_FALSE(ring.wakeConsumer());
+
+        ASSERT_TRUE(ring.peek(header));
+        EXPECT_EQ(header.id, round < 3 ? 0 : round - 3);
+        EXPECT_EQ(header.headerSize + header.payloadSize, frame.size());
+        ring.consume(header, payload);
+        EXPECT_EQ(payload, std::vector<uint8_t>(996, header.id));
+    }
+
+    EXPECT_TRUE(ring.prepareToBlock(Parlo::MIN_SHARED_MEMORY_RING_SIZE));
+    ASSERT_TRUE(ring.peek(header));
+    ring.consume(header, payload);
+    EXPECT_TRUE(ring.wakeProducer());
+    EXPECT_FALSE(ring.wakeProducer());
+    EXPECT_FALSE(ring.prepareToSleep());
+
+    EXPECT_TRUE(Parlo::isValidRingSize(Parlo::DEFAULT_SHARED_MEMORY_RING_SIZE));
+    EXPECT_FALSE(Parlo::isValidRingSize(Parlo::MIN_SHARED_MEMORY_RING_SIZE + 1));
+    EXPECT_FALSE(Parlo::isValidRingSize(Parlo::MIN_SHARED_MEMORY_RING_SIZE / 2));
+}
+
+/*Test that packets make a round trip through shared memory, in order.*/
+TEST_F(SharedMemoryTests, TestEcho) {
+    auto listener = startEchoListener(uniqueName("echo"));
+    auto client = std::make_shared<Parlo::SharedMemoryClient>(context);
+    std::mutex receivedMutex;
+    std::vector<std::vector<uint8_t>> received;
+
+    client->setOnReceivedDataHandler([&](const std::shared_ptr<Parlo::SharedMemoryClient>&,
+        const std::shared_ptr<Parlo::Packet>& packet) {
+        std::lock_guard<std::mutex> lock(receivedMutex);
+        received.push_back(packet->getData());
+    });
+    EXPECT_THROW(client->sendAsync(Parlo::Packet(1, { 1 }, false).buildPacket()), std::runtime_error);
+    client->connectAsync(listener->getName());
+    ASSERT_TRUE(waitFor([&]() { return client->isConnected(); }));
+
+    EXPECT_THROW(client->sendAsync({}), std::invalid_argument);
+    EXPECT_THROW(client->sendAsync({ 1, 0, 10, 0, 1 }), std::invalid_argument);
+    EXPECT_THROW(client->sendAsync(Parlo::Packet(1, std::vector<uint8_t>(Parlo::MAX_PACKET_SIZE), false).buildPacket()),
+        std::overflow_error);
+
+    for (int i = 1; i <= 200; i++)
+        client->sendAsync(Parlo::Packet(1, std::vector<uint8_t>(i, static_cast<uint8_t>(i)), false).buildPacket());
+
+    ASSERT_TRUE(waitFor([&]() {
+        std::lock_guard<std::mutex> lock(receivedMutex);
+        return received.size() == 200;
+    }));
+
+    {
+        std::lock_guard<std::mutex> lock(receivedMutex);
+        for (int i = 1; i <= 200; i++)
+            EXPECT_EQ(received[i - 1], std::vector<uint8_t>(i, static_cast<uint8_t>(i)));
+    }
+
+    Parlo::ConnectionMetrics metrics = client->getMetrics();
+    EXPECT_EQ(metrics.packetsSent, 200u);
+    EXPECT_EQ(metrics.packetsReceived, 200u);
+    EXPECT_EQ(metrics.oversizedFrames, 1u);
+    client->disconnectAsync();
+    listener->stopAccepting();
+}
+
+/*Test that packets wait for room in a full ring, and still arrive in order.*/
+TEST_F(SharedMemoryTests, TestFullRing) {
+    auto listener = std::make_shared<Parlo::SharedMemoryListener>(context, uniqueName("full"));
+    std::atomic<int> received{ 0 };
+    std::atomic<bool> inOrder{ true };
+
+    EXPECT_THROW(listener->setRingSize(Parlo::MIN_SHARED_MEMORY_RING_SIZE + 1), std::invalid_argument);
+    listener->setRingSize(Parlo::MIN_SHARED_MEMORY_RING_SIZE);
+    listener->setSpinTime(std::chrono::microseconds(0));
+    listener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::SharedMemoryClient>& client) {
+        client->setOnReceivedDataHandler([&](const std::shared_ptr<Parlo::SharedMemoryClient>&,
+            const std::shared_ptr<Parlo::Packet>& packet) {
+            if (packet->getData() != std::vector<uint8_t>(1000, static_cast<uint8_t>(received)))
+                inOrder = false;
+            received++;
+        });
+    });
+    listener->startAccepting();
+
+    auto client = std::make_shared<Parlo::SharedMemoryClient>(context);
+    client->connectAsync(listener->getName());
+    ASSERT_TRUE(waitFor([&]() { return client->isConnected(); }));
+
+    //A few hundred kilobytes through a ring of four.
+    for (int i = 0; i < 500; i++)
+        client->sendAsync(Parlo::Packet(1, std::vector<uint8_t>(1000, static_cast<uint8_t>(i)), false).buildPacket());
+
+    ASSERT_TRUE(waitFor([&]() { return received == 500; }));
+    EXPECT_TRUE(inOrder);
+    EXPECT_GT(client->getSharedMemoryStats().ringFull, 0u);
+    EXPECT_EQ(client->getMetrics().sendQueueDepth, 0u);
+    client->disconnectAsync();
+    listener->stopAccepting();
+}
+
+/*Test that both ends are told about a disconnection, whichever end disconnects.*/
+TEST_F(SharedMemoryTests, TestGoodbye) {
+    auto listener = std::make_shared<Parlo::SharedMemoryListener>(context, uniqueName("goodbye"));
+    std::mutex acceptedMutex;
+    std::vector<std::shared_ptr<Parlo::SharedMemoryClient>> accepted;
+    std::atomic<int> clientsDisconnected{ 0 };
+    std::atomic<int> lastPacket{ 0 };
+
+    listener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::SharedMemoryClient>& client) {
+        client->setOnReceivedDataHandler([&](const std::shared_ptr<Parlo::SharedMemoryClient>&,
+            const std::shared_ptr<Parlo::Packet>& packet) {
+            lastPacket = packet->getData()[0];
+        });
+        client->setOnClientDisconnectedHandler([&](const std::shared_ptr<Parlo::SharedMemoryClient>&) {
+            clientsDisconnected++;
+        });
+
+        std::lock_guard<std::mutex> lock(acceptedMutex);
+        accepted.push_back(client);
+    });
+    listener->startAccepting();
+
+    //The client says goodbye after its last packet.
+    auto first = std::make_shared<Parlo::SharedMemoryClient>(context);
+    first->connectAsync(listener->getName());
+    ASSERT_TRUE(waitFor([&]() { return first->isConnected(); }));
+    first->sendAsync(Parlo::Packet(1, { 42 }, false).buildPacket());
+    first->disconnectAsync();
+    EXPECT_FALSE(first->isConnected());
+    ASSERT_TRUE(waitFor([&]() { return clientsDisconnected == 1; }));
+    EXPECT_EQ(lastPacket, 42);
+
+    //The server says goodbye.
+    auto second = std::make_shared<Parlo::SharedMemoryClient>(context);
+    std::atomic<bool> serverDisconnected{ false };
+    std::atomic<bool> connectionLost{ false };
+    second->setOnServerDisconnectedHandler([&](const std::shared_ptr<Parlo::SharedMemoryClient>&) {
+        serverDisconnected = true;
+    });
+    second->setOnConnectionLostHandler([&](const std::shared_ptr<Parlo::SharedMemoryClient>&) {
+        connectionLost = true;
+    });
+    second->connectAsync(listener->getName());
+    ASSERT_TRUE(waitFor([&]() {
+        std::lock_guard<std::mutex> lock(acceptedMutex);
+        return accepted.size() == 2 && second->isConnected();
+    }));
+
+    {
+        std::lock_guard<std::mutex> lock(acceptedMutex);
+        accepted[1]->disconnectAsync();
+    }
+    ASSERT_TRUE(waitFor([&]() { return serverDisconnected.load(); }));
+    EXPECT_FALSE(second->isConnected());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(connectionLost);
+    listener->stopAccepting();
+}
+
+/*Test that an end is told when the other end goes away without saying goodbye.*/
+TEST_F(SharedMemoryTests, TestConnectionLost) {
+    auto listener = std::make_shared<Parlo::SharedMemoryListener>(context, uniqueName("lost"));
+    std::atomic<bool> connectionLost{ false };
+
+    listener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::SharedMemoryClient>& client) {
+        client->setOnConnectionLostHandler([&](const std::shared_ptr<Parlo::SharedMemoryClient>&) {
+            connectionLost = true;
+        });
+    });
+    listener->startAccepting();
+
+    auto client = std::make_shared<Parlo::SharedMemoryClient>(context);
+    client->connectAsync(listener->getName());
+    ASSERT_TRUE(waitFor([&]() { return client->isConnected(); }));
+    client->disconnectAsync(false);
+    ASSERT_TRUE(waitFor([&]() { return connectionLost.load(); }));
+
+    //Nobody listens under this name.
+    auto stray = std::make_shared<Parlo::SharedMemoryClient>(context);
+    std::atomic<bool> strayLost{ false };
+    stray->setOnConnectionLostHandler([&](const std::shared_ptr<Parlo::SharedMemoryClient>&) {
+        strayLost = true;
+    });
+    stray->connectAsync(uniqueName("nobody"));
+    ASSERT_TRUE(waitFor([&]() { return strayLost.load(); }));
+    EXPECT_FALSE(stray->isConnected());
+    listener->stopAccepting();
+}
+
+/*Test that a SharedMemoryListener for a TCP endpoint is found, so connections to it can skip TCP.*/
+TEST_F(SharedMemoryTests, TestReachable) {
+    asio::ip::tcp::acceptor acceptor(context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    asio::ip::tcp::endpoint endpoint = acceptor.local_endpoint();
+    asio::ip::tcp::endpoint remote(asio::ip::make_address("192.0.2.1"), endpoint.port());
+
+    EXPECT_FALSE(Parlo::SharedMemoryClient::isReachable(endpoint));
+
+    auto listener = std::make_shared<Parlo::SharedMemoryListener>(context, endpoint);
+    EXPECT_EQ(listener->getName(), Parlo::SharedMemoryListener::nameFor(endpoint));
+    EXPECT_THROW(std::make_shared<Parlo::SharedMemoryListener>(context, endpoint), std::runtime_error);
+    listener->startAccepting();
+
+    EXPECT_TRUE(Parlo::SharedMemoryClient::isReachable(endpoint));
+    EXPECT_TRUE(Parlo::SharedMemoryClient::isReachable(
+        asio::ip::tcp::endpoint(asio::ip::address_v6::loopback(), endpoint.port())));
+    EXPECT_FALSE(Parlo::SharedMemoryClient::isReachable(remote));
+
+    auto client = std::make_shared<Parlo::SharedMemoryClient>(context);
+    EXPECT_THROW(client->connectAsync(remote), std::invalid_argument);
+    client->connectAsync(endpoint);
+    ASSERT_TRUE(waitFor([&]() { return client->isConnected(); }));
+    client->disconnectAsync();
+    listener->stopAccepting();
+}
+#endif
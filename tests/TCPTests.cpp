@@ -0,0 +1,1015 @@
+#include "pch.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <future>
+#include <fstream>
+#include <mutex>
+#include <vector>
+#include "Parlo.h"
+#include "Socket.h"
+#include "IOBackend.h"
+#include "Capabilities.h"
+#include "ParloIDs.h"
+
+class TCPTests : public ::testing::Test {
+protected:
+    void SetUp() override {
+        workGuard = std::make_unique<asio::executor_work_guard<asio::io_context::executor_type>>(context.get_executor());
+        ioThread = std::thread([this]() { context.run(); });
+    }
+
+    void TearDown() override {
+        workGuard.reset();
+        context.stop();
+        if (ioThread.joinable())
+            ioThread.join();
+    }
+
+    //Polls for a condition to become true, for at most a second.
+    template<typename Predicate>
+    bool waitFor(Predicate predicate) {
+        auto start = std::chrono::steady_clock::now();
+        while (!predicate() && std::chrono::steady_clock::now() - start < std::chrono::seconds(1))
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+        return predicate();
+    }
+
+    //Starts a Listener on an ephemeral loopback port that echoes every packet it receives.
+    std::shared_ptr<Parlo::Listener> startEchoListener() {
+        auto listener = std::make_shared<Parlo::Listener>(context,
+            asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+
+        listener->setOnClientConnectedHandler([](const std::shared_ptr<Parlo::NetworkClient>& client) {
+            client->setOnReceivedDataHandler([](const std::shared_ptr<Parlo::NetworkClient>& sender,
+                const std::shared_ptr<Parlo::Packet>& packet) {
+                sender->sendAsync(Parlo::Packet(packet->getID(), packet->getData(), false).buildPacket());
+            });
+        });
+        listener->startAccepting();
+
+        return listener;
+    }
+
+    //Writes a file of a repeating pattern, which isn't aligned with file segments or chunks.
+    std::vector<uint8_t> writeTestFile(const std::string& path, size_t size) {
+        std::vector<uint8_t> contents(size);
+        for (size_t i = 0; i < size; i++)
+            contents[i] = static_cast<uint8_t>(i % 251);
+
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(contents.data()), contents.size());
+
+        return contents;
+    }
+
+    //Sends part of a file to a Listener's client, and returns what it received, and the sender's last progress.
+    std::vector<uint8_t> sendFile(const std::string& path, bool applyCompression, uint64_t offset, uint64_t length,
+        Parlo::FileTransferProgress& sent) {
+        auto listener = std::make_shared<Parlo::Listener>(context,
+            asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+        std::mutex receivedMutex;
+        std::vector<uint8_t> received;
+        std::atomic<bool> complete{ false };
+        std::atomic<int> packets{ 0 };
+
+        listener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::NetworkClient>& client) {
+            client->setOnFileDataHandler([&](const std::shared_ptr<Parlo::NetworkClient>&,
+                const Parlo::FileTransferProgress& progress, const std::vector<uint8_t>& data) {
+                std::lock_guard<std::mutex> lock(receivedMutex);
+                received.insert(received.end(), data.begin(), data.end());
+                EXPECT_EQ(progress.transferred, received.size());
+                complete = progress.isComplete();
+            });
+            client->setOnReceivedDataHandler([&](const std::shared_ptr<Parlo::NetworkClient>&,
+                const std::shared_ptr<Parlo::Packet>&) {
+                packets++;
+            });
+        });
+        listener->startAccepting();
+
+        Parlo::Socket socket(context);
+        auto client = std::make_shared<Parlo::NetworkClient>(socket);
+        client->setApplyCompression(applyCompression);
+        client->connectAsync(listener->getLocalEndpoint());
+        EXPECT_TRUE(waitFor([&]() { return listener->clients().count() == 1 && client->isConnected(); }));
+
+        std::mutex sentMutex;
+        client->sendFileAsync(path, offset, length, [&](const Parlo::FileTransferProgress& progress, const std::error_code& ec) {
+            EXPECT_FALSE(ec);
+            std::lock_guard<std::mutex> lock(sentMutex);
+            sent = progress;
+        });
+        //Goes out between segments, rather than after the whole file.
+        client->sendAsync(Parlo::Packet(1, { 1, 2, 3 }, false).buildPacket());
+
+        EXPECT_TRUE(waitFor([&]() { return complete.load() && packets.load() == 1; }));
+        //The socket goes out of scope here, so let the goodbye go out first.
+        client->disconnectAsync();
+        EXPECT_TRUE(waitFor([&]() { return !socket.isOpen(); }));
+
+        std::lock_guard<std::mutex> lock(receivedMutex);
+        std::lock_guard<std::mutex> sentLock(sentMutex);
+        return received;
+    }
+
+    asio::io_context context;
+    std::unique_ptr<asio::executor_work_guard<asio::io_context::executor_type>> workGuard;
+    std::thread ioThread;
+};
+
+/*Test for many clients echoing packets through a Listener, in order.*/
+TEST_F(TCPTests, TestEchoInOrder) {
+    auto listener = startEchoListener();
+    const int numClients = 4;
+    const int numPackets = 200;
+
+    std::vector<std::shared_ptr<Parlo::Socket>> sockets;
+    std::vector<std::shared_ptr<Parlo::NetworkClient>> clients;
+    std::vector<std::unique_ptr<std::atomic<int>>> received;
+    std::atomic<bool> outOfOrder{ false };
+
+    for (int i = 0; i < numClients; i++) {
+        sockets.push_back(std::make_shared<Parlo::Socket>(context));
+        clients.push_back(std::make_shared<Parlo::NetworkClient>(*sockets.back()));
+        received.push_back(std::make_unique<std::atomic<int>>(0));
+
+        std::atomic<int>& count = *received.back();
+        clients.back()->setOnReceivedDataHandler([&count, &outOfOrder](const std::shared_ptr<Parlo::NetworkClient>&,
+            const std::shared_ptr<Parlo::Packet>& packet) {
+            int expected = count.load();
+            const auto& data = packet->getData();
+            int sequence = data[0] | data[1] << 8;
+
+            if (sequence != expected)
+                outOfOrder = true;
+
+            count++;
+        });
+        clients.back()->connectAsync(listener->getLocalEndpoint());
+    }
+
+    ASSERT_TRUE(waitFor([&]() { return listener->clients().count() == numClients; }));
+    for (auto& client : clients)
+        ASSERT_TRUE(waitFor([&]() { return client->isConnected(); }));
+
+    //Sending from many threads at once mustn't interleave frames on the wire.
+    std::vector<std::thread> senders;
+    for (auto& client : clients) {
+        senders.emplace_back([client, numPackets]() {
+            std::vector<uint8_t> payload(300, 0xAB);
+            for (int i = 0; i < numPackets; i++) {
+                payload[0] = static_cast<uint8_t>(i & 0xFF);
+                payload[1] = static_cast<uint8_t>(i >> 8);
+                client->sendAsync(Parlo::Packet(1, payload, false).buildPacket());
+            }
+        });
+    }
+    for (auto& sender : senders)
+        sender.join();
+
+    for (auto& count : received)
+        EXPECT_TRUE(waitFor([&]() { return count->load() == numPackets; }));
+    EXPECT_FALSE(outOfOrder.load());
+
+    for (auto& client : clients)
+        client->disconnectAsync();
+}
+
+/*Test for a client's goodbye reaching the Listener after the data sent before it.*/
+TEST_F(TCPTests, TestDisconnect) {
+    auto listener = std::make_shared<Parlo::Listener>(context,
+        asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    std::atomic<int> serverPackets{ 0 };
+
+    listener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::NetworkClient>& client) {
+        client->setOnReceivedDataHandler([&](const std::shared_ptr<Parlo::NetworkClient>&,
+            const std::shared_ptr<Parlo::Packet>&) {
+            serverPackets++;
+        });
+    });
+    listener->startAccepting();
+
+    Parlo::Socket socket(context);
+    auto client = std::make_shared<Parlo::NetworkClient>(socket);
+    client->connectAsync(listener->getLocalEndpoint());
+
+    ASSERT_TRUE(waitFor([&]() { return listener->clients().count() == 1 && client->isConnected(); }));
+
+    client->sendAsync(Parlo::Packet(1, { 1, 2, 3 }, false).buildPacket());
+    client->disconnectAsync();
+
+    EXPECT_FALSE(client->isConnected());
+    EXPECT_TRUE(waitFor([&]() { return listener->clients().count() == 0; }));
+    EXPECT_EQ(serverPackets.load(), 1);
+    EXPECT_EQ(listener->getMetrics().disconnects, 1u);
+}
+
+/*Test that the Listener re-arms accepts as they complete, and stops when asked to.*/
+TEST_F(TCPTests, TestAcceptUntilStopped) {
+    auto listener = startEchoListener();
+    std::vector<std::shared_ptr<Parlo::Socket>> sockets;
+    std::vector<std::shared_ptr<Parlo::NetworkClient>> clients;
+
+    auto connect = [&]() {
+        sockets.push_back(std::make_shared<Parlo::Socket>(context));
+        clients.push_back(std::make_shared<Parlo::NetworkClient>(*sockets.back()));
+        clients.back()->connectAsync(listener->getLocalEndpoint());
+    };
+
+    for (size_t i = 1; i <= 3; i++) {
+        connect();
+        ASSERT_TRUE(waitFor([&]() { return listener->clients().count() == i && clients.back()->isConnected(); }));
+    }
+
+    listener->stopAccepting();
+    connect();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(listener->clients().count(), 3u);
+
+    for (auto& client : clients)
+        client->disconnectAsync();
+
+    EXPECT_TRUE(waitFor([&]() { return listener->clients().count() == 0; }));
+}
+
+/*Test that a heartbeat is echoed, and that the heartbeat timers don't keep a disconnected client alive.*/
+TEST_F(TCPTests, TestHeartbeat) {
+    auto listener = startEchoListener();
+    Parlo::Socket socket(context);
+    auto client = std::make_shared<Parlo::NetworkClient>(socket);
+    client->connectAsync(listener->getLocalEndpoint());
+
+    ASSERT_TRUE(waitFor([&]() { return listener->clients().count() == 1 && client->isConnected(); }));
+
+    client->measureRTTAsync();
+    EXPECT_TRUE(waitFor([&]() { return client->getRTTStats().sampleCount > 0; }));
+
+    std::weak_ptr<Parlo::NetworkClient> weakClient = client;
+    client->disconnectAsync();
+    client.reset();
+
+    EXPECT_TRUE(waitFor([&]() { return weakClient.expired(); }));
+    EXPECT_TRUE(waitFor([&]() { return listener->clients().count() == 0; }));
+}
+
+/*Test that a client can be released from its own packet handler, which runs on its ProcessingBuffer's thread.*/
+TEST_F(TCPTests, TestReleaseFromHandler) {
+    auto listener = startEchoListener();
+    Parlo::Socket socket(context);
+    auto client = std::make_shared<Parlo::NetworkClient>(socket);
+    std::weak_ptr<Parlo::NetworkClient> weakClient = client;
+
+    //The handler holds the last reference, and drops it.
+    client->setOnReceivedDataHandler([keepAlive = client](const std::shared_ptr<Parlo::NetworkClient>& sender,
+        const std::shared_ptr<Parlo::Packet>&) mutable {
+        sender->disconnectAsync();
+        keepAlive.reset();
+    });
+    client->connectAsync(listener->getLocalEndpoint());
+
+    ASSERT_TRUE(waitFor([&]() { return listener->clients().count() == 1 && client->isConnected(); }));
+
+    client->sendAsync(Parlo::Packet(1, { 1, 2, 3 }, false).buildPacket());
+    client.reset();
+
+    EXPECT_TRUE(waitFor([&]() { return weakClient.expired(); }));
+    EXPECT_TRUE(waitFor([&]() { return listener->clients().count() == 0; }));
+}
+
+/*Test that control packets go out first, and application lanes share the connection by weight.*/
+TEST_F(TCPTests, TestPriorityLanes) {
+    auto listener = std::make_shared<Parlo::Listener>(context,
+        asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    std::mutex receivedMutex;
+    std::vector<uint8_t> received;
+
+    listener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::NetworkClient>& client) {
+        client->setOnReceivedDataHandler([&](const std::shared_ptr<Parlo::NetworkClient>&,
+            const std::shared_ptr<Parlo::Packet>& packet) {
+            std::lock_guard<std::mutex> lock(receivedMutex);
+            received.push_back(packet->getID());
+        });
+    });
+    listener->startAccepting();
+
+    Parlo::Socket socket(context);
+    auto client = std::make_shared<Parlo::NetworkClient>(socket);
+    client->connectAsync(listener->getLocalEndpoint());
+    ASSERT_TRUE(waitFor([&]() { return listener->clients().count() == 1 && client->isConnected(); }));
+
+    //Hold up the io_context, so everything is queued before the first write is started.
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    asio::post(context, [released]() { released.wait(); });
+
+    std::vector<uint8_t> payload(1000, 0xAB);
+    for (int i = 0; i < 100; i++) {
+        client->sendAsync(Parlo::Packet(1, payload, false).buildPacket(), Parlo::SendPriority::Bulk);
+        client->sendAsync(Parlo::Packet(2, payload, false).buildPacket(), Parlo::SendPriority::Normal);
+    }
+    client->sendAsync(Parlo::Packet(3, { 1 }, false).buildPacket(), Parlo::SendPriority::Control);
+    release.set_value();
+
+    ASSERT_TRUE(waitFor([&]() { std::lock_guard<std::mutex> lock(receivedMutex); return received.size() == 201; }));
+
+    EXPECT_EQ(received[0], 3);
+    //Normal has twice the weight of Bulk, so it gets about two thirds of the packets while both are queued.
+    long normal = std::count(received.begin() + 1, received.begin() + 121, 2);
+    EXPECT_GE(normal, 70);
+    EXPECT_LE(normal, 90);
+
+    EXPECT_THROW(client->setLaneWeight(Parlo::SendPriority::Control, 1), std::invalid_argument);
+    EXPECT_THROW(client->setLaneWeight(Parlo::SendPriority::Bulk, 0), std::invalid_argument);
+    client->disconnectAsync();
+}
+
+/*Test that a queued packet is replaced by a newer one with the same coalescing key, keeping its place in the queue.*/
+TEST_F(TCPTests, TestCoalescing) {
+    auto listener = std::make_shared<Parlo::Listener>(context,
+        asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    std::mutex receivedMutex;
+    std::vector<std::vector<uint8_t>> received;
+
+    listener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::NetworkClient>& client) {
+        client->setOnReceivedDataHandler([&](const std::shared_ptr<Parlo::NetworkClient>&,
+            const std::shared_ptr<Parlo::Packet>& packet) {
+            std::lock_guard<std::mutex> lock(receivedMutex);
+            received.push_back({ packet->getID(), packet->getData()[0] });
+        });
+    });
+    listener->startAccepting();
+
+    Parlo::Socket socket(context);
+    auto client = std::make_shared<Parlo::NetworkClient>(socket);
+    client->connectAsync(listener->getLocalEndpoint());
+    ASSERT_TRUE(waitFor([&]() { return listener->clients().count() == 1 && client->isConnected(); }));
+
+    //Hold up the io_context, so nothing is written until every update has been queued.
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    asio::post(context, [released]() { released.wait(); });
+
+    const uint64_t position = Parlo::makeCoalescingKey(1, 42);
+    client->sendAsync(Parlo::Packet(2, { 0 }, false).buildPacket());
+    for (int i = 0; i < 100; i++)
+        client->sendAsync(Parlo::Packet(1, { static_cast<uint8_t>(i) }, false).buildPacket(), Parlo::SendPriority::Normal, position);
+    client->sendAsync(Parlo::Packet(2, { 1 }, false).buildPacket());
+    release.set_value();
+
+    ASSERT_TRUE(waitFor([&]() { std::lock_guard<std::mutex> lock(receivedMutex); return received.size() == 3; }));
+    EXPECT_EQ(received, std::vector<std::vector<uint8_t>>({ { 2, 0 }, { 1, 99 }, { 2, 1 } }));
+    EXPECT_EQ(client->getMetrics().supersededFrames, 99u);
+
+    //Once the update has been written, the next one is sent as well.
+    client->sendAsync(Parlo::Packet(1, { 100 }, false).buildPacket(), Parlo::SendPriority::Normal, position);
+    ASSERT_TRUE(waitFor([&]() { std::lock_guard<std::mutex> lock(receivedMutex); return received.size() == 4; }));
+    EXPECT_EQ(received[3], std::vector<uint8_t>({ 1, 100 }));
+
+    //A newer update in another lane doesn't replace the queued one, so both are sent.
+    std::promise<void> releaseLanes;
+    std::shared_future<void> lanesReleased = releaseLanes.get_future().share();
+    asio::post(context, [lanesReleased]() { lanesReleased.wait(); });
+    client->sendAsync(Parlo::Packet(1, { 101 }, false).buildPacket(), Parlo::SendPriority::Normal, position);
+    client->sendAsync(Parlo::Packet(1, { 102 }, false).buildPacket(), Parlo::SendPriority::High, position);
+    releaseLanes.set_value();
+
+    ASSERT_TRUE(waitFor([&]() { std::lock_guard<std::mutex> lock(receivedMutex); return received.size() == 6; }));
+    {
+        std::lock_guard<std::mutex> lock(receivedMutex);
+        std::vector<std::vector<uint8_t>> updates(received.begin() + 4, received.end());
+        std::sort(updates.begin(), updates.end());
+        EXPECT_EQ(updates, std::vector<std::vector<uint8_t>>({ { 1, 101 }, { 1, 102 } }));
+    }
+    EXPECT_EQ(client->getMetrics().supersededFrames, 99u);
+
+    //Nor does one that would take the send queue past its high watermark, which is rejected instead.
+    client->setSendWatermarks(2048, 5000);
+    std::promise<void> releaseFull;
+    std::shared_future<void> fullReleased = releaseFull.get_future().share();
+    asio::post(context, [fullReleased]() { fullReleased.wait(); });
+    client->sendAsync(Parlo::Packet(1, { 103 }, false).buildPacket(), Parlo::SendPriority::Normal, position);
+    std::vector<uint8_t> payload(1000, 0xAB);
+    for (int i = 0; i < 4; i++)
+        client->sendAsync(Parlo::Packet(2, payload, false).buildPacket());
+    payload[0] = 104;
+    try {
+        client->sendAsync(Parlo::Packet(1, payload, false).buildPacket(), Parlo::SendPriority::Normal, position);
+        FAIL() << "Expected the send queue to be full";
+    }
+    catch (const std::system_error& e) {
+        EXPECT_EQ(e.code(), std::errc::no_buffer_space);
+    }
+    releaseFull.set_value();
+
+    ASSERT_TRUE(waitFor([&]() { std::lock_guard<std::mutex> lock(receivedMutex); return received.size() == 11; }));
+    EXPECT_EQ(received[6], std::vector<uint8_t>({ 1, 103 }));
+    EXPECT_EQ(client->getMetrics().supersededFrames, 99u);
+    client->disconnectAsync();
+}
+
+/*Test that the send queue is bounded by its high watermark, and each overflow policy.*/
+TEST_F(TCPTests, TestSendWatermarks) {
+    auto listener = std::make_shared<Parlo::Listener>(context,
+        asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    std::mutex receivedMutex;
+    std::vector<uint8_t> received;
+
+    listener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::NetworkClient>& client) {
+        client->setOnReceivedDataHandler([&](const std::shared_ptr<Parlo::NetworkClient>&,
+            const std::shared_ptr<Parlo::Packet>& packet) {
+            std::lock_guard<std::mutex> lock(receivedMutex);
+            received.push_back(packet->getID());
+        });
+    });
+    listener->startAccepting();
+
+    Parlo::Socket socket(context);
+    auto client = std::make_shared<Parlo::NetworkClient>(socket);
+    std::atomic<int> writable{ 0 };
+    std::atomic<bool> lost{ false };
+    client->setOnWritableHandler([&](const std::shared_ptr<Parlo::NetworkClient>&) { writable++; });
+    client->setOnConnectionLostHandler([&](const std::shared_ptr<Parlo::NetworkClient>&) { lost = true; });
+    client->connectAsync(listener->getLocalEndpoint());
+    ASSERT_TRUE(waitFor([&]() { return listener->clients().count() == 1 && client->isConnected(); }));
+
+    EXPECT_THROW(client->setSendWatermarks(4096, 2048), std::invalid_argument);
+    EXPECT_THROW(client->setSendWatermarks(0, Parlo::MAX_PACKET_SIZE - 1), std::invalid_argument);
+    //Room for four packets of 1004 bytes.
+    client->setSendWatermarks(2048, 5000);
+
+    //Holds up the io_context, so nothing is written until it's released.
+    auto holdUp = [this]() {
+        auto release = std::make_shared<std::promise<void>>();
+        std::shared_future<void> released = release->get_future().share();
+        asio::post(context, [released]() { released.wait(); });
+        return release;
+    };
+
+    std::vector<uint8_t> payload(1000, 0xAB);
+    auto release = holdUp();
+    for (uint8_t id = 1; id <= 4; id++)
+        client->sendAsync(Parlo::Packet(id, payload, false).buildPacket());
+    EXPECT_EQ(client->getQueuedBytes(), 4016u);
+    try {
+        client->sendAsync(Parlo::Packet(5, payload, false).buildPacket());
+        FAIL() << "Expected the send queue to be full";
+    }
+    catch (const std::system_error& e) {
+        EXPECT_EQ(e.code(), std::errc::no_buffer_space);
+    }
+    release->set_value();
+
+    ASSERT_TRUE(waitFor([&]() { return writable == 1; }));
+    EXPECT_EQ(client->getQueuedBytes(), 0u);
+
+    client->setSendWatermarks(2048, 5000, Parlo::OverflowPolicy::DropOldest);
+    release = holdUp();
+    for (uint8_t id = 10; id < 20; id++)
+        client->sendAsync(Parlo::Packet(id, payload, false).buildPacket());
+    release->set_value();
+
+    ASSERT_TRUE(waitFor([&]() { std::lock_guard<std::mutex> lock(receivedMutex); return received.size() == 8; }));
+    EXPECT_EQ(received, std::vector<uint8_t>({ 1, 2, 3, 4, 16, 17, 18, 19 }));
+    EXPECT_TRUE(waitFor([&]() { return writable == 2; }));
+
+    Parlo::ConnectionMetrics metrics = client->getMetrics();
+    EXPECT_EQ(metrics.overflowedFrames, 7u);
+    EXPECT_EQ(metrics.droppedFrames, 6u);
+    EXPECT_EQ(metrics.sendQueueBytes, 0);
+
+    client->setSendWatermarks(2048, 5000, Parlo::OverflowPolicy::Disconnect);
+    release = holdUp();
+    for (uint8_t id = 20; id < 25; id++)
+        client->sendAsync(Parlo::Packet(id, payload, false).buildPacket());
+    release->set_value();
+
+    EXPECT_TRUE(waitFor([&]() { return lost.load(); }));
+    EXPECT_FALSE(client->isConnected());
+    //Nothing is handled after the Listener has seen the connection go.
+    EXPECT_TRUE(waitFor([&]() { return listener->getMetrics().disconnects == 1; }));
+}
+
+/*Test that reading stops while a slow handler is behind, and resumes once it has caught up.*/
+TEST_F(TCPTests, TestReceiveBudget) {
+    auto listener = std::make_shared<Parlo::Listener>(context,
+        asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    std::atomic<int> received{ 0 };
+    std::mutex acceptedMutex;
+    std::shared_ptr<Parlo::NetworkClient> accepted;
+
+    listener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::NetworkClient>& client) {
+        EXPECT_THROW(client->setReceiveBudget(Parlo::MAX_PACKET_SIZE), std::invalid_argument);
+        EXPECT_THROW(client->setReceiveBudget(16 * 1024, 0), std::invalid_argument);
+        client->setReceiveBudget(16 * 1024);
+        client->setOnReceivedDataHandler([&](const std::shared_ptr<Parlo::NetworkClient>&,
+            const std::shared_ptr<Parlo::Packet>&) {
+            released.wait();
+            received++;
+        });
+
+        std::lock_guard<std::mutex> lock(acceptedMutex);
+        accepted = client;
+    });
+    listener->startAccepting();
+
+    Parlo::Socket socket(context);
+    auto client = std::make_shared<Parlo::NetworkClient>(socket);
+    client->connectAsync(listener->getLocalEndpoint());
+    ASSERT_TRUE(waitFor([&]() { std::lock_guard<std::mutex> lock(acceptedMutex); return accepted && client->isConnected(); }));
+
+    std::vector<uint8_t> packet = Parlo::Packet(1, std::vector<uint8_t>(1000, 0xAB), false).buildPacket();
+    for (int i = 0; i < 1000; i++)
+        client->sendAsync(packet);
+
+    //The handler is stuck on the first packet, so at most a read beyond the budget piles up.
+    ASSERT_TRUE(waitFor([&]() { return accepted->getMetrics().readPauses > 0; }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_LE(accepted->getMetrics().receiveQueueBytes, 16 * 1024 + 64 * 1024);
+    EXPECT_EQ(received, 0);
+
+    release.set_value();
+    ASSERT_TRUE(waitFor([&]() { return received == 1000; }));
+    EXPECT_TRUE(waitFor([&]() { return accepted->getMetrics().receiveQueueBytes == 0; }));
+    client->disconnectAsync();
+}
+
+/*Test that batched packets are held until flush(), the batch delay or the batch size, and go out in one write.*/
+TEST_F(TCPTests, TestBatching) {
+    auto listener = std::make_shared<Parlo::Listener>(context,
+        asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    std::atomic<int> received{ 0 };
+
+    listener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::NetworkClient>& client) {
+        client->setOnReceivedDataHandler([&](const std::shared_ptr<Parlo::NetworkClient>&,
+            const std::shared_ptr<Parlo::Packet>&) {
+            received++;
+        });
+    });
+    listener->startAccepting();
+
+    Parlo::Socket socket(context);
+    auto client = std::make_shared<Parlo::NetworkClient>(socket);
+    client->connectAsync(listener->getLocalEndpoint());
+    ASSERT_TRUE(waitFor([&]() { return listener->clients().count() == 1 && client->isConnected(); }));
+
+    EXPECT_THROW(client->setBatching(std::chrono::microseconds(-1)), std::invalid_argument);
+    EXPECT_THROW(client->setBatching(std::chrono::milliseconds(1), 0), std::invalid_argument);
+
+    //Held until the end of the tick.
+    client->setBatching(std::chrono::seconds(10));
+    std::vector<uint8_t> packet = Parlo::Packet(1, std::vector<uint8_t>(10, 0xAB), false).buildPacket();
+    uint64_t writes = client->getMetrics().writes;
+    for (int i = 0; i < 20; i++)
+        client->sendAsync(packet);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    EXPECT_EQ(received, 0);
+    client->flush();
+    ASSERT_TRUE(waitFor([&]() { return received == 20; }));
+    //A heartbeat may have gone out meanwhile.
+    EXPECT_LE(client->getMetrics().writes - writes, 2u);
+
+    //Held until the delay has passed.
+    client->setBatching(std::chrono::milliseconds(20));
+    auto sent = std::chrono::steady_clock::now();
+    client->sendAsync(packet);
+    ASSERT_TRUE(waitFor([&]() { return received == 21; }));
+    EXPECT_GE(std::chrono::steady_clock::now() - sent, std::chrono::milliseconds(15));
+
+    //Held until there are enough bytes, I.E eight packets of 14 bytes.
+    client->setBatching(std::chrono::seconds(10), 100);
+    for (int i = 0; i < 8; i++)
+        client->sendAsync(packet);
+    ASSERT_TRUE(waitFor([&]() { return received == 29; }));
+
+    //Turning batching off writes whatever is held.
+    client->sendAsync(packet);
+    client->setBatching(std::chrono::microseconds(0));
+    ASSERT_TRUE(waitFor([&]() { return received == 30; }));
+    client->disconnectAsync();
+}
+
+/*Test that packets get across with compact headers, and take fewer bytes on the wire.*/
+TEST_F(TCPTests, TestCompactHeaders) {
+    auto listener = std::make_shared<Parlo::Listener>(context,
+        asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    std::mutex receivedMutex;
+    std::vector<std::vector<uint8_t>> received;
+    std::shared_ptr<Parlo::NetworkClient> accepted;
+
+    listener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::NetworkClient>& client) {
+        client->setHeaderFormat(Parlo::HeaderFormat::Compact);
+        client->setOnReceivedDataHandler([&](const std::shared_ptr<Parlo::NetworkClient>&,
+            const std::shared_ptr<Parlo::Packet>& packet) {
+            std::lock_guard<std::mutex> lock(receivedMutex);
+            received.push_back(packet->getData());
+        });
+
+        std::lock_guard<std::mutex> lock(receivedMutex);
+        accepted = client;
+    });
+    listener->startAccepting();
+
+    Parlo::Socket socket(context);
+    auto client = std::make_shared<Parlo::NetworkClient>(socket);
+    client->setHeaderFormat(Parlo::HeaderFormat::Compact);
+    client->connectAsync(listener->getLocalEndpoint());
+    ASSERT_TRUE(waitFor([&]() { return listener->clients().count() == 1 && client->isConnected(); }));
+
+    EXPECT_THROW(client->sendAsync({ 1, 2 }), std::invalid_argument);
+
+    //Around the escape, and up to the largest packet.
+    std::vector<size_t> sizes = { 1, 62, 63, 64, 190, 191, Parlo::MAX_PACKET_SIZE - Parlo::PacketHeaders::STANDARD };
+    uint64_t bytesSent = client->getMetrics().bytesSent;
+    for (size_t size : sizes)
+        client->sendAsync(Parlo::Packet(7, std::vector<uint8_t>(size, static_cast<uint8_t>(size)), false).buildPacket());
+
+    ASSERT_TRUE(waitFor([&]() {
+        std::lock_guard<std::mutex> lock(receivedMutex);
+        return received.size() == sizes.size();
+    }));
+
+    {
+        std::lock_guard<std::mutex> lock(receivedMutex);
+        for (size_t i = 0; i < sizes.size(); i++)
+            EXPECT_EQ(received[i], std::vector<uint8_t>(sizes[i], static_cast<uint8_t>(sizes[i])));
+    }
+
+    //2 byte headers up to 62 bytes, 3 up to 190 and 4 beyond. A heartbeat may have gone out meanwhile.
+    uint64_t payloadBytes = 0;
+    for (size_t size : sizes)
+        payloadBytes += size;
+    EXPECT_GE(client->getMetrics().bytesSent - bytesSent, payloadBytes + 2 + 2 + 3 + 3 + 3 + 4 + 4);
+    EXPECT_LT(client->getMetrics().bytesSent - bytesSent, payloadBytes + sizes.size() * Parlo::PacketHeaders::STANDARD);
+
+    //The receive budget is released by the packets' actual length.
+    std::lock_guard<std::mutex> lock(receivedMutex);
+    EXPECT_TRUE(waitFor([&]() { return accepted->getMetrics().receiveQueueBytes == 0; }));
+    client->disconnectAsync();
+}
+
+/*Test that capabilities survive serialization, and that both ends agree on the same ones.*/
+TEST_F(TCPTests, TestCapabilityNegotiation) {
+    Parlo::Capabilities client;
+    client.compressionLevel = 6;
+    client.maxBatchDelay = std::chrono::microseconds(500);
+    client.maxFrameSize = 512;
+    client.ciphers = { Parlo::Twofish, Parlo::AES };
+
+    Parlo::Capabilities parsed = Parlo::Capabilities::fromByteArray(client.toByteArray());
+    EXPECT_EQ(parsed.version, Parlo::PROTOCOL_VERSION);
+    EXPECT_EQ(parsed.codecs, client.codecs);
+    EXPECT_EQ(parsed.compressionLevel, 6);
+    EXPECT_EQ(parsed.headerFormats, client.headerFormats);
+    EXPECT_EQ(parsed.maxBatchDelay, client.maxBatchDelay);
+    EXPECT_EQ(parsed.maxFrameSize, 512u);
+    EXPECT_EQ(parsed.ciphers, client.ciphers);
+
+    Parlo::Capabilities server;
+    server.maxBatchDelay = std::chrono::milliseconds(2);
+    server.ciphers = { Parlo::AES, Parlo::Twofish };
+
+    for (auto agreed : { Parlo::Capabilities::negotiate(client, server), Parlo::Capabilities::negotiate(server, client) }) {
+        EXPECT_EQ(agreed.headerFormats, std::vector<Parlo::HeaderFormat>({ Parlo::HeaderFormat::Compact }));
+        EXPECT_EQ(agreed.codecs, std::vector<Parlo::Codec>({ Parlo::Codec::Zlib }));
+        EXPECT_EQ(agreed.compressionLevel, 6);
+        EXPECT_EQ(agreed.maxBatchDelay, std::chrono::microseconds(500));
+        EXPECT_EQ(agreed.maxFrameSize, 512u);
+        //Each end prefers a different cipher, so the tie goes to the same one either way.
+        EXPECT_EQ(agreed.ciphers, std::vector<Parlo::EncryptionMode>({ Parlo::Twofish }));
+    }
+
+    //An end that only frames the old way, can't decompress and won't batch.
+    server.headerFormats = { Parlo::HeaderFormat::Legacy };
+    server.codecs.clear();
+    server.maxBatchDelay = std::chrono::microseconds(0);
+    server.ciphers.clear();
+    Parlo::Capabilities agreed = Parlo::Capabilities::negotiate(client, server);
+    EXPECT_EQ(agreed.headerFormats, std::vector<Parlo::HeaderFormat>({ Parlo::HeaderFormat::Legacy }));
+    EXPECT_TRUE(agreed.codecs.empty());
+    EXPECT_EQ(agreed.maxBatchDelay.count(), 0);
+    EXPECT_TRUE(agreed.ciphers.empty());
+
+    //Values from a later version are skipped, and so are fields it appends.
+    std::vector<uint8_t> later = Parlo::Capabilities().toByteArray();
+    later[0] = 2;
+    later[2] = 9; //An unknown codec.
+    later.push_back(0xAB);
+    parsed = Parlo::Capabilities::fromByteArray(later);
+    EXPECT_EQ(parsed.version, 2);
+    EXPECT_TRUE(parsed.codecs.empty());
+    EXPECT_EQ(parsed.maxFrameSize, static_cast<size_t>(Parlo::MAX_PACKET_SIZE));
+
+    EXPECT_THROW(Parlo::Capabilities::fromByteArray({ 1, 1 }), std::runtime_error);
+
+    Parlo::Capabilities invalid;
+    invalid.maxFrameSize = 16;
+    EXPECT_THROW(invalid.validate(), std::invalid_argument);
+}
+
+/*Test that both ends switch to what they agreed on, including packets that were sent during the handshake.*/
+TEST_F(TCPTests, TestHandshake) {
+    auto listener = std::make_shared<Parlo::Listener>(context,
+        asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    std::mutex receivedMutex;
+    std::vector<std::vector<uint8_t>> received;
+    std::shared_ptr<Parlo::NetworkClient> accepted;
+
+    Parlo::Capabilities serverCapabilities;
+    serverCapabilities.ciphers = { Parlo::AES };
+    listener->setCapabilities(serverCapabilities);
+    listener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::NetworkClient>& client) {
+        client->setOnReceivedDataHandler([&](const std::shared_ptr<Parlo::NetworkClient>&,
+            const std::shared_ptr<Parlo::Packet>& packet) {
+            std::lock_guard<std::mutex> lock(receivedMutex);
+            received.push_back(packet->getData());
+        });
+
+        std::lock_guard<std::mutex> lock(receivedMutex);
+        accepted = client;
+    });
+    listener->startAccepting();
+
+    Parlo::Capabilities clientCapabilities;
+    clientCapabilities.maxFrameSize = 512;
+    clientCapabilities.ciphers = { Parlo::Twofish, Parlo::AES };
+
+    Parlo::Socket socket(context);
+    auto client = std::make_shared<Parlo::NetworkClient>(socket);
+    std::promise<Parlo::Capabilities> negotiated;
+    client->setOnNegotiatedHandler([&](const std::shared_ptr<Parlo::NetworkClient>&, const Parlo::Capabilities& agreed) {
+        negotiated.set_value(agreed);
+    });
+    EXPECT_THROW(client->setCapabilities(Parlo::Capabilities(), std::chrono::milliseconds(0)), std::invalid_argument);
+    client->setCapabilities(clientCapabilities);
+    client->connectAsync(listener->getLocalEndpoint());
+    ASSERT_TRUE(waitFor([&]() { return client->isConnected(); }));
+
+    //Most likely held back until the handshake completes, and reframed then.
+    for (uint8_t i = 1; i <= 3; i++)
+        client->sendAsync(Parlo::Packet(1, std::vector<uint8_t>(i * 10, i), false).buildPacket());
+
+    auto agreed = negotiated.get_future();
+    ASSERT_EQ(agreed.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    Parlo::Capabilities capabilities = agreed.get();
+    EXPECT_EQ(capabilities.headerFormats.front(), Parlo::HeaderFormat::Compact);
+    EXPECT_EQ(capabilities.maxFrameSize, 512u);
+    EXPECT_EQ(capabilities.ciphers, std::vector<Parlo::EncryptionMode>({ Parlo::AES }));
+    ASSERT_TRUE(client->getNegotiatedCapabilities().has_value());
+
+    for (uint8_t i = 4; i <= 5; i++)
+        client->sendAsync(Parlo::Packet(1, std::vector<uint8_t>(i * 10, i), false).buildPacket());
+    EXPECT_THROW(client->sendAsync(Parlo::Packet(1, std::vector<uint8_t>(600), false).buildPacket()), std::overflow_error);
+
+    ASSERT_TRUE(waitFor([&]() {
+        std::lock_guard<std::mutex> lock(receivedMutex);
+        return received.size() == 5;
+    }));
+
+    std::lock_guard<std::mutex> lock(receivedMutex);
+    for (uint8_t i = 1; i <= 5; i++)
+        EXPECT_EQ(received[i - 1], std::vector<uint8_t>(i * 10, i));
+    ASSERT_TRUE(accepted->getNegotiatedCapabilities().has_value());
+    EXPECT_EQ(accepted->getNegotiatedCapabilities()->maxFrameSize, 512u);
+    client->disconnectAsync();
+}
+
+/*Test that packets are sent the old way once an end that doesn't answer the handshake has had its time.*/
+TEST_F(TCPTests, TestHandshakeTimeout) {
+    asio::ip::tcp::acceptor acceptor(context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    Parlo::Socket socket(context);
+    auto client = std::make_shared<Parlo::NetworkClient>(socket);
+    client->setCapabilities(Parlo::Capabilities(), std::chrono::milliseconds(100));
+    client->connectAsync(acceptor.local_endpoint());
+
+    asio::ip::tcp::socket peer(context);
+    acceptor.accept(peer);
+    ASSERT_TRUE(waitFor([&]() { return client->isConnected(); }));
+    client->sendAsync(Parlo::Packet(1, { 7, 7, 7 }, false).buildPacket());
+
+    //Parsed the old way, as an older end would.
+    Parlo::ProcessingBuffer buffer;
+    std::mutex idsMutex;
+    std::vector<uint8_t> ids;
+    buffer.setOnPacketProcessedHandler([&](const Parlo::Packet& packet) {
+        std::lock_guard<std::mutex> lock(idsMutex);
+        ids.push_back(packet.getID());
+    });
+    auto readPacket = [&](uint8_t id) {
+        size_t available = peer.available();
+        if (available > 0) {
+            std::vector<uint8_t> chunk((std::min)(available, static_cast<size_t>(Parlo::MAX_PACKET_SIZE)));
+            peer.read_some(asio::buffer(chunk));
+            buffer.addData(chunk);
+            buffer.waitUntilProcessed();
+        }
+
+        std::lock_guard<std::mutex> lock(idsMutex);
+        return std::find(ids.begin(), ids.end(), id) != ids.end();
+    };
+
+    ASSERT_TRUE(waitFor([&]() { return readPacket(ParloIDs::Hello); }));
+    EXPECT_FALSE(readPacket(1));
+    ASSERT_TRUE(waitFor([&]() { return readPacket(1); }));
+    EXPECT_FALSE(client->getNegotiatedCapabilities().has_value());
+    client->disconnectAsync(false);
+}
+
+/*Test that a packet queued before the handshake completes can still be replaced by one sent after it.*/
+TEST_F(TCPTests, TestCoalescingAcrossHandshake) {
+    asio::ip::tcp::acceptor acceptor(context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    acceptor.set_option(asio::socket_base::receive_buffer_size(4096));
+
+    Parlo::Socket socket(context);
+    auto client = std::make_shared<Parlo::NetworkClient>(socket);
+    Parlo::SocketOptions options;
+    options.sendBufferSize = 4096;
+    client->setSocketOptions(options);
+    client->setCapabilities(Parlo::Capabilities(), std::chrono::seconds(5));
+    std::promise<void> negotiated;
+    client->setOnNegotiatedHandler([&](const std::shared_ptr<Parlo::NetworkClient>&, const Parlo::Capabilities&) {
+        negotiated.set_value();
+    });
+    client->connectAsync(acceptor.local_endpoint());
+
+    asio::ip::tcp::socket peer(context);
+    acceptor.accept(peer);
+    ASSERT_TRUE(waitFor([&]() { return client->isConnected(); }));
+
+    //Control packets aren't held back by the handshake, so these keep a write going that the peer doesn't read.
+    std::vector<uint8_t> payload(1000, 0xAB);
+    for (int i = 0; i < 1000; i++)
+        client->sendAsync(Parlo::Packet(1, payload, false).buildPacket(), Parlo::SendPriority::Control);
+
+    const uint64_t position = Parlo::makeCoalescingKey(2, 42);
+    client->sendAsync(Parlo::Packet(2, { 1 }, false).buildPacket(), Parlo::SendPriority::Normal, position);
+
+    //Agrees on the old framing and no compression, so the peer can parse everything the same way.
+    Parlo::Capabilities peerCapabilities;
+    peerCapabilities.codecs.clear();
+    peerCapabilities.headerFormats = { Parlo::HeaderFormat::Legacy };
+    std::vector<uint8_t> handshake = Parlo::Packet(ParloIDs::Hello, peerCapabilities.toByteArray(), false).buildPacket();
+    std::vector<uint8_t> ack = Parlo::Packet(ParloIDs::HelloAck, { Parlo::PROTOCOL_VERSION }, false).buildPacket();
+    handshake.insert(handshake.end(), ack.begin(), ack.end());
+    asio::write(peer, asio::buffer(handshake));
+
+    auto agreed = negotiated.get_future();
+    ASSERT_EQ(agreed.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    client->sendAsync(Parlo::Packet(2, { 2 }, false).buildPacket(), Parlo::SendPriority::Normal, position);
+    client->sendAsync(Parlo::Packet(3, { 0 }, false).buildPacket());
+
+    Parlo::ProcessingBuffer buffer;
+    std::mutex updatesMutex;
+    std::vector<uint8_t> updates;
+    bool finished = false;
+    buffer.setOnPacketProcessedHandler([&](const Parlo::Packet& packet) {
+        std::lock_guard<std::mutex> lock(updatesMutex);
+        if (packet.getID() == 2)
+            updates.push_back(packet.getData()[0]);
+        else if (packet.getID() == 3)
+            finished = true;
+    });
+
+    std::vector<uint8_t> chunk;
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+        size_t available = peer.available();
+        if (available == 0) {
+            std::lock_guard<std::mutex> lock(updatesMutex);
+            if (finished)
+                break;
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        chunk.resize((std::min)(available, static_cast<size_t>(Parlo::MAX_PACKET_SIZE)));
+        peer.read_some(asio::buffer(chunk));
+        buffer.addData(chunk);
+        buffer.waitUntilProcessed();
+    }
+
+    std::lock_guard<std::mutex> lock(updatesMutex);
+    EXPECT_TRUE(finished);
+    EXPECT_EQ(updates, std::vector<uint8_t>({ 2 }));
+    EXPECT_EQ(client->getMetrics().supersededFrames, 1u);
+    client->disconnectAsync(false);
+}
+
+/*Test that a Listener drops a connection that sends a frame larger than it accepts, rather than waiting for the rest of it.*/
+TEST_F(TCPTests, TestOversizedFrame) {
+    auto listener = std::make_shared<Parlo::Listener>(context,
+        asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    listener->startAccepting();
+
+    asio::ip::tcp::socket peer(context);
+    peer.connect(listener->getLocalEndpoint());
+    ASSERT_TRUE(waitFor([&]() { return listener->clients().count() == 1; }));
+
+    std::vector<uint8_t> header = { 1, 0, 0xFF, 0xFF };
+    asio::write(peer, asio::buffer(header));
+    ASSERT_TRUE(waitFor([&]() { return listener->clients().count() == 0; }));
+
+    //Whatever the Listener sent before is still there to read, and then the connection is closed.
+    std::vector<uint8_t> chunk(Parlo::MAX_PACKET_SIZE);
+    std::error_code ec;
+    while (!ec)
+        peer.read_some(asio::buffer(chunk), ec);
+    EXPECT_EQ(ec, asio::error::eof);
+}
+
+/*Test that socket options are applied on connect and on accept, and read back.*/
+TEST_F(TCPTests, TestSocketOptions) {
+    Parlo::SocketOptions options = Parlo::SocketOptions::lowLatency();
+    Parlo::SocketOptions overrides;
+    overrides.keepAlive = true;
+    overrides.notSentLowWatermark = 32 * 1024;
+    options.merge(overrides);
+
+    EXPECT_TRUE(*options.noDelay);
+    EXPECT_TRUE(*options.keepAlive);
+    EXPECT_EQ(*options.notSentLowWatermark, 32 * 1024);
+
+    auto listener = std::make_shared<Parlo::Listener>(context,
+        asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    std::mutex acceptedMutex;
+    std::shared_ptr<Parlo::NetworkClient> accepted;
+
+    listener->setSocketOptions(Parlo::SocketOptions::bulkThroughput());
+    listener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::NetworkClient>& client) {
+        std::lock_guard<std::mutex> lock(acceptedMutex);
+        accepted = client;
+    });
+    listener->startAccepting();
+
+    Parlo::Socket socket(context);
+    auto client = std::make_shared<Parlo::NetworkClient>(socket);
+    client->setSocketOptions(options);
+    client->connectAsync(listener->getLocalEndpoint());
+
+    ASSERT_TRUE(waitFor([&]() { return listener->clients().count() == 1 && client->isConnected(); }));
+
+    Parlo::SocketOptions effective = client->getSocketOptions();
+    ASSERT_TRUE(effective.noDelay.has_value());
+    EXPECT_TRUE(*effective.noDelay);
+    EXPECT_TRUE(*effective.keepAlive);
+#ifdef __linux__
+    ASSERT_TRUE(effective.notSentLowWatermark.has_value());
+    EXPECT_EQ(*effective.notSentLowWatermark, 32 * 1024);
+#endif
+
+    std::lock_guard<std::mutex> lock(acceptedMutex);
+    ASSERT_TRUE(accepted != nullptr);
+    Parlo::SocketOptions acceptedOptions = accepted->getSocketOptions();
+    EXPECT_FALSE(*acceptedOptions.noDelay);
+    EXPECT_TRUE(acceptedOptions.receiveBufferSize.has_value());
+    EXPECT_FALSE(acceptedOptions.linger.has_value()); //The default linger was replaced.
+
+    client->disconnectAsync();
+}
+
+/*Test that the I/O backend is reported, and that an io_uring build can actually run here.*/
+TEST_F(TCPTests, TestIOBackend) {
+    Parlo::IOBackend backend = Parlo::getIOBackend();
+    EXPECT_STRNE(Parlo::getIOBackendName(backend), "");
+
+    if (backend == Parlo::IOBackend::IOUring) {
+        EXPECT_TRUE(Parlo::isIOUringAvailable());
+    }
+}
+
+/*Test for sending a whole file, which is sent zero copy when compression isn't applied.*/
+TEST_F(TCPTests, TestSendFile) {
+    std::vector<uint8_t> contents = writeTestFile("TCPTestsSendFile.bin", 3 * Parlo::FILE_SEGMENT_SIZE / 2 + 7);
+
+    Parlo::FileTransferProgress sent;
+    std::vector<uint8_t> received = sendFile("TCPTestsSendFile.bin", false, 0, 0, sent);
+
+    EXPECT_EQ(received, contents);
+    EXPECT_TRUE(sent.isComplete());
+    EXPECT_EQ(sent.total, contents.size());
+
+    std::remove("TCPTestsSendFile.bin");
+}
+
+/*Test for sending part of a file as chunks, which is what happens when compression is applied.*/
+TEST_F(TCPTests, TestSendFileChunked) {
+    std::vector<uint8_t> contents = writeTestFile("TCPTestsSendFileChunked.bin", 200000);
+
+    Parlo::FileTransferProgress sent;
+    std::vector<uint8_t> received = sendFile("TCPTestsSendFileChunked.bin", true, 1234, 150000, sent);
+
+    EXPECT_EQ(received, std::vector<uint8_t>(contents.begin() + 1234, contents.begin() + 1234 + 150000));
+    EXPECT_EQ(sent.total, 150000u);
+
+    Parlo::Socket socket(context);
+    auto client = std::make_shared<Parlo::NetworkClient>(socket);
+    EXPECT_THROW(client->sendFileAsync("TCPTestsSendFileChunked.bin"), std::runtime_error); //Not connected.
+
+    std::remove("TCPTestsSendFileChunked.bin");
+}
@@ -0,0 +1,107 @@
+#include "pch.h"
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "Parlo.h"
+#include "Trace.h"
+
+static std::string readTrace(const std::string& path) {
+    std::ifstream file(path);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+static size_t countOccurrences(const std::string& text, const std::string& pattern) {
+    size_t count = 0;
+    for (size_t position = text.find(pattern); position != std::string::npos; position = text.find(pattern, position + 1))
+        count++;
+
+    return count;
+}
+
+/*Test that nothing is recorded while tracing is off.*/
+TEST(TraceTests, TestDisabled) {
+    Parlo::clearTrace();
+    Parlo::setTracingEnabled(false);
+
+    {
+        PARLO_TRACE_SCOPE("TraceTests::disabled");
+    }
+
+    Parlo::writeTrace("TraceTestsDisabled.json");
+    std::string trace = readTrace("TraceTestsDisabled.json");
+    std::remove("TraceTestsDisabled.json");
+
+    EXPECT_EQ(trace.find("TraceTests::disabled"), std::string::npos);
+    EXPECT_NE(trace.find("\"traceEvents\":["), std::string::npos);
+}
+
+/*Test that scopes and async spans from several threads are written as Chrome trace events.*/
+TEST(TraceTests, TestChromeTraceOutput) {
+    Parlo::clearTrace();
+    Parlo::setTracingEnabled(true);
+
+    auto work = []() {
+        PARLO_TRACE_SCOPE("TraceTests::outer");
+        {
+            PARLO_TRACE_SCOPE("TraceTests::inner");
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    };
+
+    std::thread other(work);
+    work();
+    other.join();
+
+    uint64_t start = Parlo::Tracing::now();
+    Parlo::Tracing::recordAsync("TraceTests::write", start, start + 1000);
+
+    Parlo::setTracingEnabled(false);
+    Parlo::writeTrace("TraceTests.json");
+    std::string trace = readTrace("TraceTests.json");
+    std::remove("TraceTests.json");
+
+    EXPECT_EQ(countOccurrences(trace, "\"name\":\"TraceTests::outer\""), 2u);
+    EXPECT_EQ(countOccurrences(trace, "\"name\":\"TraceTests::inner\""), 2u);
+    EXPECT_EQ(countOccurrences(trace, "\"ph\":\"X\""), 4u);
+    EXPECT_EQ(countOccurrences(trace, "\"ph\":\"b\""), 1u);
+    EXPECT_EQ(countOccurrences(trace, "\"ph\":\"e\""), 1u);
+
+    Parlo::clearTrace();
+    Parlo::writeTrace("TraceTestsCleared.json");
+    trace = readTrace("TraceTestsCleared.json");
+    std::remove("TraceTestsCleared.json");
+
+    EXPECT_EQ(trace.find("TraceTests::outer"), std::string::npos);
+}
+
+/*Test that the buffers of exited threads are only kept until they're written, and only so many of them.*/
+TEST(TraceTests, TestExitedThreads) {
+    Parlo::clearTrace();
+    Parlo::setTracingEnabled(true);
+
+    for (size_t i = 0; i < Parlo::TRACE_MAX_EXITED_BUFFERS + 4; i++) {
+        std::thread([]() {
+            PARLO_TRACE_SCOPE("TraceTests::exited");
+        }).join();
+    }
+
+    Parlo::setTracingEnabled(false);
+    Parlo::writeTrace("TraceTestsExited.json");
+    std::string trace = readTrace("TraceTestsExited.json");
+    EXPECT_EQ(countOccurrences(trace, "\"name\":\"TraceTests::exited\""), Parlo::TRACE_MAX_EXITED_BUFFERS);
+
+    Parlo::writeTrace("TraceTestsExited.json");
+    trace = readTrace("TraceTestsExited.json");
+    std::remove("TraceTestsExited.json");
+    EXPECT_EQ(trace.find("TraceTests::exited"), std::string::npos);
+}
+
+/*Test that a trace that can't be written throws.*/
+TEST(TraceTests, TestWriteFailure) {
+    EXPECT_THROW(Parlo::writeTrace("no/such/directory/trace.json"), std::runtime_error);
+}
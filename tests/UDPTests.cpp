@@ -0,0 +1,354 @@
+#include "pch.h"
+#include <gtest/gtest.h>
+#include <map>
+#include <mutex>
+#include <random>
+#include <vector>
+#include "Parlo.h"
+#include "ParloIDs.h"
+#include "ReliabilityLayer.h"
+#include "LinkShaper.h"
+
+class UDPTests : public ::testing::Test {
+protected:
+    void SetUp() override {
+        workGuard = std::make_unique<asio::executor_work_guard<asio::io_context::executor_type>>(context.get_executor());
+        ioThread = std::thread([this]() { context.run(); });
+    }
+
+    void TearDown() override {
+        workGuard.reset();
+        context.stop();
+        if (ioThread.joinable())
+            ioThread.join();
+    }
+
+    //Polls for a condition to become true, for at most a second.
+    template<typename Predicate>
+    bool waitFor(Predicate predicate) {
+        auto start = std::chrono::steady_clock::now();
+        while (!predicate() && std::chrono::steady_clock::now() - start < std::chrono::seconds(1))
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+        return predicate();
+    }
+
+    asio::io_context context;
+    std::unique_ptr<asio::executor_work_guard<asio::io_context::executor_type>> workGuard;
+    std::thread ioThread;
+};
+
+/*Test for sending a packet from a client to a UDPListener and back.*/
+TEST_F(UDPTests, TestRoundTrip) {
+    auto listener = std::make_shared<Parlo::UDPListener>(context,
+        asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+
+    std::atomic<int> serverPackets{ 0 };
+    std::atomic<int> clientPackets{ 0 };
+    std::atomic<bool> reliableFlag{ false };
+
+    listener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::UDPNetworkClient>& client) {
+        client->setOnReceivedDataHandler([&](const std::shared_ptr<Parlo::UDPNetworkClient>& sender,
+            const std::shared_ptr<Parlo::Packet>& packet) {
+            reliableFlag = packet->getIsReliable() != 0;
+            serverPackets++;
+            sender->sendAsync(Parlo::Packet(packet->getID(), packet->getData(), false, false).buildPacket());
+        });
+    });
+    listener->startAccepting();
+
+    auto client = std::make_shared<Parlo::UDPNetworkClient>(context);
+    client->setOnReceivedDataHandler([&](const std::shared_ptr<Parlo::UDPNetworkClient>&,
+        const std::shared_ptr<Parlo::Packet>& packet) {
+        if (packet->getID() == 1 && packet->getData() == std::vector<uint8_t>({ 5, 6, 7 }))
+            clientPackets++;
+    });
+    client->connectAsync(listener->getLocalEndpoint());
+
+    ASSERT_TRUE(waitFor([&]() { return listener->clients().count() == 1; }));
+
+    client->sendAsync(Parlo::Packet(1, { 5, 6, 7 }, false, true).buildPacket());
+
+    EXPECT_TRUE(waitFor([&]() { return clientPackets.load() == 1; }));
+    EXPECT_EQ(serverPackets.load(), 1);
+    EXPECT_TRUE(reliableFlag.load());
+}
+
+/*Test for many connections multiplexed over a single UDPListener socket.*/
+TEST_F(UDPTests, TestMultiplexing) {
+    auto listener = std::make_shared<Parlo::UDPListener>(context,
+        asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+    std::atomic<int> packets{ 0 };
+
+    listener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::UDPNetworkClient>& client) {
+        client->setOnReceivedDataHandler([&](const std::shared_ptr<Parlo::UDPNetworkClient>&,
+            const std::shared_ptr<Parlo::Packet>&) {
+            packets++;
+        });
+    });
+    listener->startAccepting();
+
+    std::vector<std::shared_ptr<Parlo::UDPNetworkClient>> clients;
+    for (int i = 0; i < 8; i++) {
+        clients.push_back(std::make_shared<Parlo::UDPNetworkClient>(context));
+        clients.back()->connectAsync(listener->getLocalEndpoint());
+    }
+
+    ASSERT_TRUE(waitFor([&]() { return listener->clients().count() == clients.size(); }));
+
+    //A burst of equally sized packets is what gets coalesced into GSO sends.
+    for (auto& client : clients) {
+        for (int i = 0; i < 16; i++)
+            client->sendAsync(Parlo::Packet(2, std::vector<uint8_t>(100, static_cast<uint8_t>(i)), false, false).buildPacket());
+    }
+
+    EXPECT_TRUE(waitFor([&]() { return packets.load() == 8 * 16; }));
+}
+
+/*Test for a client's goodbye removing its connection from the UDPListener.*/
+TEST_F(UDPTests, TestDisconnect) {
+    auto listener = std::make_shared<Parlo::UDPListener>(context,
+        asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+    std::atomic<bool> disconnected{ false };
+
+    listener->setOnClientDisconnectedHandler([&](const std::shared_ptr<Parlo::UDPNetworkClient>&) {
+        disconnected = true;
+    });
+    listener->startAccepting();
+
+    auto client = std::make_shared<Parlo::UDPNetworkClient>(context);
+    client->connectAsync(listener->getLocalEndpoint());
+    ASSERT_TRUE(waitFor([&]() { return listener->clients().count() == 1; }));
+
+    client->disconnectAsync();
+
+    EXPECT_TRUE(waitFor([&]() { return disconnected.load(); }));
+    EXPECT_EQ(listener->clients().count(), 0u);
+    EXPECT_THROW(client->sendAsync(Parlo::Packet(1, { 1 }, false, false).buildPacket()), std::runtime_error);
+}
+
+/*Test that a connection the application holds on to can still be disconnected once its UDPListener is gone.*/
+TEST_F(UDPTests, TestDisconnectAfterListener) {
+    auto listener = std::make_shared<Parlo::UDPListener>(context,
+        asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+    Parlo::LinkConditions conditions;
+    conditions.latency = std::chrono::milliseconds(100);
+    listener->setLinkShaper(std::make_shared<Parlo::LinkShaper>(context, conditions));
+
+    std::mutex acceptedMutex;
+    std::shared_ptr<Parlo::UDPNetworkClient> accepted;
+    listener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::UDPNetworkClient>& client) {
+        std::lock_guard<std::mutex> lock(acceptedMutex);
+        accepted = client;
+    });
+    listener->startAccepting();
+
+    auto client = std::make_shared<Parlo::UDPNetworkClient>(context);
+    client->connectAsync(listener->getLocalEndpoint());
+    ASSERT_TRUE(waitFor([&]() { std::lock_guard<std::mutex> lock(acceptedMutex); return accepted != nullptr; }));
+    ASSERT_TRUE(waitFor([&]() { return accepted->isConnected(); }));
+
+    //The goodbye is held up by the link shaper until after the UDPListener has been destroyed.
+    client->disconnectAsync();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    listener.reset();
+
+    EXPECT_TRUE(waitFor([&]() { return !accepted->isConnected(); }));
+}
+
+/*A lossy, jittery link between two ReliabilityLayers, driven by virtual time so runs are deterministic.*/
+class LossyLink {
+public:
+    using Clock = Parlo::ReliabilityLayer::Clock;
+
+    LossyLink(double lossRate, unsigned int seed) : random(seed), loss(lossRate) {}
+
+    Parlo::ReliabilityLayer sender;
+    Parlo::ReliabilityLayer receiver;
+    std::vector<Parlo::ReliablePacket> delivered;
+    Clock::time_point now;
+
+    //Runs the link in 1ms steps until everything sent has been acknowledged, or the time limit is hit.
+    bool run(std::chrono::seconds limit) {
+        Clock::time_point end = now + limit;
+
+        while (now < end) {
+            deliver(toReceiver, receiver, true);
+            deliver(toSender, sender, false);
+            transmit(sender.poll(now), toReceiver);
+            transmit(receiver.poll(now), toSender);
+
+            if (!sender.hasUnackedData() && toReceiver.empty() && toSender.empty())
+                return true;
+
+            now += std::chrono::milliseconds(1);
+        }
+
+        return false;
+    }
+
+private:
+    std::mt19937 random;
+    double loss;
+    std::multimap<Clock::time_point, std::vector<uint8_t>> toReceiver, toSender;
+
+    //20ms of one-way delay with up to 5ms of jitter, which also reorders datagrams.
+    void transmit(const std::vector<std::vector<uint8_t>>& datagrams, std::multimap<Clock::time_point, std::vector<uint8_t>>& link) {
+        for (auto& datagram : datagrams) {
+            if (std::uniform_real_distribution<double>(0.0, 1.0)(random) < loss)
+                continue;
+
+            auto delay = std::chrono::milliseconds(20 + std::uniform_int_distribution<int>(0, 5)(random));
+            link.emplace(now + delay, datagram);
+        }
+    }
+
+    void deliver(std::multimap<Clock::time_point, std::vector<uint8_t>>& link, Parlo::ReliabilityLayer& layer, bool isReceiver) {
+        while (!link.empty() && link.begin()->first <= now) {
+            std::vector<uint8_t> datagram = std::move(link.begin()->second);
+            link.erase(link.begin());
+
+            //Split the datagram into packets the same way UDPNetworkClient does.
+            size_t offset = 0;
+            while (offset + 5 <= datagram.size()) {
+                uint8_t* header = &datagram[offset];
+                size_t length = static_cast<size_t>(header[4] << 8 | header[3]);
+                std::vector<uint8_t> payload(header + 5, header + length);
+                offset += length;
+
+                if (header[0] == ParloIDs::Ack)
+                    layer.onAckReceived(payload, now);
+                else if (header[2] != 0) {
+                    auto packets = layer.onPacketReceived(header[0], header[1] != 0, payload, now);
+                    if (isReceiver)
+                        delivered.insert(delivered.end(), packets.begin(), packets.end());
+                }
+            }
+        }
+    }
+};
+
+static uint32_t packetIndex(const Parlo::ReliablePacket& packet) {
+    return static_cast<uint32_t>(packet.payload[0]) | static_cast<uint32_t>(packet.payload[1]) << 8 |
+        static_cast<uint32_t>(packet.payload[2]) << 16 | static_cast<uint32_t>(packet.payload[3]) << 24;
+}
+
+static void sendIndexed(Parlo::ReliabilityLayer& layer, uint8_t id, uint8_t channel, uint32_t index) {
+    std::vector<uint8_t> payload(64, 0xAB);
+    for (int i = 0; i < 4; i++)
+        payload[i] = static_cast<uint8_t>(index >> (i * 8));
+
+    layer.send(id, false, channel, payload.data(), payload.size());
+}
+
+/*Test for exactly once, in order delivery on an ordered channel over a link that drops 15% of datagrams.*/
+TEST(ReliabilityTests, TestOrderedDeliveryUnderLoss) {
+    for (unsigned int seed = 1; seed <= 4; seed++) {
+        LossyLink link(0.15, seed);
+        const uint32_t count = 2000;
+
+        for (uint32_t i = 0; i < count; i++)
+            sendIndexed(link.sender, 1, 0, i);
+
+        ASSERT_TRUE(link.run(std::chrono::seconds(120))) << "seed " << seed;
+        ASSERT_EQ(link.delivered.size(), count) << "seed " << seed;
+
+        for (uint32_t i = 0; i < count; i++)
+            ASSERT_EQ(packetIndex(link.delivered[i]), i) << "seed " << seed;
+
+        Parlo::ReliabilityStats stats = link.sender.getStats();
+        EXPECT_EQ(stats.packetsSent, count);
+        EXPECT_GT(stats.retransmissions, 0u);
+        EXPECT_EQ(stats.bytesInFlight, 0u);
+    }
+}
+
+/*Test for exactly once delivery on an unordered channel, and for channels not blocking each other.*/
+TEST(ReliabilityTests, TestUnorderedDeliveryUnderLoss) {
+    LossyLink link(0.2, 42);
+    link.sender.setChannelOrder(1, Parlo::DeliveryOrder::Unordered);
+    link.receiver.setChannelOrder(1, Parlo::DeliveryOrder::Unordered);
+    const uint32_t count = 1000;
+
+    for (uint32_t i = 0; i < count; i++) {
+        sendIndexed(link.sender, 2, 1, i);
+        sendIndexed(link.sender, 3, 2, i);
+    }
+
+    ASSERT_TRUE(link.run(std::chrono::seconds(120)));
+
+    std::vector<int> unordered(count, 0);
+    uint32_t nextOrdered = 0;
+
+    for (auto& packet : link.delivered) {
+        if (packet.id == 2)
+            unordered[packetIndex(packet)]++;
+        else
+            EXPECT_EQ(packetIndex(packet), nextOrdered++);
+    }
+
+    EXPECT_EQ(nextOrdered, count);
+    for (uint32_t i = 0; i < count; i++)
+        EXPECT_EQ(unordered[i], 1) << "packet " << i;
+}
+
+/*Test for reliable packets over a real socket; acks must come back and empty the send window.*/
+TEST_F(UDPTests, TestReliableLoopback) {
+    auto listener = std::make_shared<Parlo::UDPListener>(context,
+        asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+    std::atomic<int> received{ 0 };
+    std::atomic<bool> inOrder{ true };
+
+    listener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::UDPNetworkClient>& client) {
+        client->setOnReceivedDataHandler([&](const std::shared_ptr<Parlo::UDPNetworkClient>&,
+            const std::shared_ptr<Parlo::Packet>& packet) {
+            if (packet->getData()[0] != static_cast<uint8_t>(received.load()))
+                inOrder = false;
+            received++;
+        });
+    });
+    listener->startAccepting();
+
+    auto client = std::make_shared<Parlo::UDPNetworkClient>(context);
+    client->connectAsync(listener->getLocalEndpoint());
+    ASSERT_TRUE(waitFor([&]() { return listener->clients().count() == 1; }));
+
+    for (int i = 0; i < 200; i++)
+        client->sendAsync(Parlo::Packet(4, std::vector<uint8_t>(200, static_cast<uint8_t>(i)), false, true).buildPacket());
+
+    EXPECT_TRUE(waitFor([&]() { return received.load() == 200; }));
+    EXPECT_TRUE(inOrder.load());
+    EXPECT_TRUE(waitFor([&]() { return client->getReliabilityStats().bytesInFlight == 0; }));
+    EXPECT_EQ(client->getReliabilityStats().packetsSent, 200u);
+}
+
+/*Test for RTT samples from heartbeat echoes, on both ends of a connection.*/
+TEST_F(UDPTests, TestHeartbeatRTT) {
+    auto listener = std::make_shared<Parlo::UDPListener>(context,
+        asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+    std::shared_ptr<Parlo::UDPNetworkClient> serverSide;
+
+    listener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::UDPNetworkClient>& connected) {
+        serverSide = connected;
+    });
+    listener->startAccepting();
+
+    auto client = std::make_shared<Parlo::UDPNetworkClient>(context);
+    client->connectAsync(listener->getLocalEndpoint());
+    ASSERT_TRUE(waitFor([&]() { return listener->clients().count() == 1; }));
+
+    //The heartbeat that announced the connection is echoed by the listener.
+    EXPECT_TRUE(waitFor([&]() { return client->getRTTStats().sampleCount == 1; }));
+
+    ASSERT_TRUE(serverSide != nullptr);
+    EXPECT_EQ(serverSide->getRTTStats().sampleCount, 0u);
+
+    serverSide->measureRTTAsync();
+    EXPECT_TRUE(waitFor([&]() { return serverSide->getRTTStats().sampleCount == 1; }));
+
+    Parlo::RTTStats stats = client->getRTTStats();
+    EXPECT_GT(stats.latestRTT.count(), 0);
+    EXPECT_LT(stats.latestRTT, std::chrono::seconds(1));
+    EXPECT_EQ(stats.minRTT, stats.latestRTT);
+    EXPECT_EQ(stats.smoothedRTT, stats.latestRTT);
+}
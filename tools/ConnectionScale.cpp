@@ -0,0 +1,372 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+/*parlo-connscale: Measures what connections cost. Opens a population of idle loopback connections
+to a Listener and reports memory, threads, file descriptors and CPU per connection while they idle,
+then churns connections on top of the population and reports the connect/disconnect rate.
+Accept latency, from connectAsync() until the Listener's onClientConnected handler runs, is
+recorded for every connection.
+
+Both ends of every connection live in this process, so per connection figures cover a client
+and a server side NetworkClient. Run with --json to track the results per build.*/
+
+#include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Parlo.h"
+#include "Socket.h"
+#include "Histogram.h"
+#include "ProcessStats.h"
+
+namespace
+{
+    struct Options
+    {
+        int connections = 10000;
+        int threads = 2;
+        /*Connections opened at once while building the population.*/
+        int batch = 256;
+        double idle = 5;
+        double churn = 5;
+        bool json = false;
+    };
+
+    void printUsage()
+    {
+        std::cout <<
+            "Usage: parlo-connscale [options]\n"
+            "  --connections N     Size of the idle population (default 10000)\n"
+            "  --threads N         Threads running the io_context (default 2)\n"
+            "  --batch N           Connections opened at once (default 256)\n"
+            "  --idle SECONDS      How long to measure the idle population (default 5)\n"
+            "  --churn SECONDS     How long to open and close connections (default 5, 0 to skip)\n"
+            "  --json              Print the results as JSON\n";
+    }
+
+    Options parseOptions(int argc, char* argv[])
+    {
+        Options options;
+
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+
+            if (arg == "--help" || arg == "-h") {
+                printUsage();
+                std::exit(0);
+            }
+            if (arg == "--json") {
+                options.json = true;
+                continue;
+            }
+
+            if (i + 1 >= argc)
+                throw std::invalid_argument("Missing value for " + arg);
+            std::string value = argv[++i];
+
+            if (arg == "--connections")
+                options.connections = std::stoi(value);
+            else if (arg == "--threads")
+                options.threads = std::stoi(value);
+            else if (arg == "--batch")
+                options.batch = std::stoi(value);
+            else if (arg == "--idle")
+                options.idle = std::stod(value);
+            else if (arg == "--churn")
+                options.churn = std::stod(value);
+            else
+                throw std::invalid_argument("Unknown option: " + arg);
+        }
+
+        if (options.connections < 0 || options.threads < 1 || options.batch < 1 || options.idle <= 0 || options.churn < 0)
+            throw std::invalid_argument("--threads, --batch and --idle must be positive");
+
+        return options;
+    }
+
+    /*Identifies a connection by the client's address and port, which is the server side's remote endpoint.*/
+    uint64_t endpointKey(const asio::ip::tcp::endpoint& endpoint)
+    {
+        return static_cast<uint64_t>(endpoint.address().to_v4().to_uint()) << 16 | endpoint.port();
+    }
+
+    /*A client side connection. The NetworkClient doesn't own its socket, so the socket is kept here.*/
+    struct Connection
+    {
+        std::unique_ptr<Parlo::Socket> socket;
+        std::shared_ptr<Parlo::NetworkClient> client;
+    };
+
+    /*Opens connections to the Listener and records how long each one took to be accepted.*/
+    class Connector
+    {
+    public:
+        Connector(asio::io_context& context, std::shared_ptr<Parlo::Listener> listener) :
+            context(context), listener(listener), target(listener->getLocalEndpoint()) {
+            listener->setOnClientConnectedHandler([this](const std::shared_ptr<Parlo::NetworkClient>& client) {
+                std::error_code ec;
+                auto remote = client->getSocket()->native_handle().remote_endpoint(ec);
+                if (ec)
+                    return;
+
+                std::chrono::steady_clock::time_point started;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    auto it = pending.find(endpointKey(remote));
+                    if (it == pending.end())
+                        return;
+
+                    started = it->second;
+                    pending.erase(it);
+                }
+
+                acceptLatency.record(std::chrono::steady_clock::now() - started);
+                accepted++;
+            });
+        }
+
+        /*Starts connecting a new client. Clients are spread over the 127.0.0.0/8 addresses,
+        so the population isn't limited by the number of ephemeral ports on a single address.*/
+        Connection connect() {
+            Connection connection;
+            connection.socket = std::make_unique<Parlo::Socket>(context);
+
+            auto& socket = connection.socket->native_handle();
+            socket.open(asio::ip::tcp::v4());
+            std::error_code ec;
+            socket.bind(asio::ip::tcp::endpoint(asio::ip::address_v4(0x7F000000u | (1 + nextAddress++ % 250)), 0), ec);
+            if (ec) //Only 127.0.0.1 is configured on some platforms.
+                socket.bind(asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+
+            connection.client = std::make_shared<Parlo::NetworkClient>(*connection.socket);
+            connection.client->setOnConnectionLostHandler([this](const std::shared_ptr<Parlo::NetworkClient>&) {
+                failures++;
+            });
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending[endpointKey(socket.local_endpoint())] = std::chrono::steady_clock::now();
+            }
+
+            connection.client->connectAsync(target);
+            return connection;
+        }
+
+        /*Waits until the Listener has this many clients, for at most ten seconds.*/
+        bool waitForClients(size_t count) {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+            while (listener->clients().count() != count) {
+                if (std::chrono::steady_clock::now() > deadline)
+                    return false;
+
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+
+            return true;
+        }
+
+        Parlo::LatencyHistogram acceptLatency;
+        std::atomic<uint64_t> accepted{ 0 };
+        std::atomic<uint64_t> failures{ 0 };
+
+    private:
+        asio::io_context& context;
+        std::shared_ptr<Parlo::Listener> listener;
+        asio::ip::tcp::endpoint target;
+        uint32_t nextAddress = 0;
+
+        std::mutex mutex;
+        std::unordered_map<uint64_t, std::chrono::steady_clock::time_point> pending;
+    };
+
+    /*A snapshot of the process' resource usage.*/
+    struct Usage
+    {
+        int64_t residentBytes = ProcessStats::residentBytes();
+        int64_t threads = ProcessStats::threadCount();
+        int64_t descriptors = ProcessStats::openDescriptors();
+    };
+
+    /*The difference per connection, or -1 if either value couldn't be read.*/
+    double perConnection(int64_t before, int64_t after, size_t connections)
+    {
+        if (before < 0 || after < 0 || connections == 0)
+            return -1;
+
+        return static_cast<double>(after - before) / connections;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    try {
+        options = parseOptions(argc, argv);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "parlo-connscale: " << e.what() << "\n\n";
+        printUsage();
+        return 1;
+    }
+
+    //Both ends of every connection are in this process.
+    int64_t descriptorLimit = ProcessStats::raiseDescriptorLimit();
+    if (descriptorLimit >= 0 && descriptorLimit < 2LL * options.connections + 64)
+        std::cerr << "parlo-connscale: Warning: the descriptor limit of " << descriptorLimit << " is too low for "
+            << options.connections << " connections\n";
+
+    asio::io_context context;
+    auto workGuard = asio::make_work_guard(context);
+    std::vector<std::thread> ioThreads;
+    for (int i = 0; i < options.threads; i++)
+        ioThreads.emplace_back([&context]() { context.run(); });
+
+    auto listener = std::make_shared<Parlo::Listener>(context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    Connector connector(context, listener);
+    listener->startAccepting();
+
+    Usage baseline;
+
+    //Build the idle population, a batch at a time. Stop early if the system runs out of something.
+    std::vector<Connection> population;
+    population.reserve(options.connections);
+    auto populateStart = std::chrono::steady_clock::now();
+    std::string stoppedBecause;
+
+    while (population.size() < static_cast<size_t>(options.connections)) {
+        size_t batchEnd = (std::min)(population.size() + options.batch, static_cast<size_t>(options.connections));
+
+        try {
+            while (population.size() < batchEnd)
+                population.push_back(connector.connect());
+        }
+        catch (const std::exception& e) {
+            stoppedBecause = e.what();
+        }
+
+        if (!connector.waitForClients(population.size()) && stoppedBecause.empty())
+            stoppedBecause = "Timed out waiting for connections to be accepted";
+        if (!stoppedBecause.empty())
+            break;
+    }
+
+    double populateTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - populateStart).count();
+    size_t established = listener->clients().count();
+
+    if (!stoppedBecause.empty())
+        std::cerr << "parlo-connscale: Stopped at " << established << " connections: " << stoppedBecause << "\n";
+
+    //Let the connections settle, then see what they cost while idle.
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    Usage idleUsage;
+    auto idleCPUStart = ProcessStats::cpuTime();
+    auto idleStart = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.idle));
+    double idleTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - idleStart).count();
+    double idleCPU = std::chrono::duration<double>(ProcessStats::cpuTime() - idleCPUStart).count() / idleTime * 100;
+
+    //Churn: open and close batches of connections on top of the idle population.
+    //Churned sockets are kept until the end, since a NetworkClient doesn't own its socket.
+    std::vector<std::unique_ptr<Parlo::Socket>> retiredSockets;
+    uint64_t churned = 0;
+    double churnTime = 0;
+
+    if (options.churn > 0 && stoppedBecause.empty()) {
+        size_t churnBatch = (std::min)(options.batch, 64);
+        auto churnStart = std::chrono::steady_clock::now();
+        auto churnEnd = churnStart + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(options.churn));
+
+        while (std::chrono::steady_clock::now() < churnEnd) {
+            std::vector<Connection> batch;
+            try {
+                for (size_t i = 0; i < churnBatch; i++)
+                    batch.push_back(connector.connect());
+            }
+            catch (const std::exception& e) {
+                std::cerr << "parlo-connscale: Churn stopped: " << e.what() << "\n";
+                break;
+            }
+
+            if (!connector.waitForClients(established + batch.size()))
+                break;
+
+            for (auto& connection : batch)
+                connection.client->disconnectAsync();
+
+            if (!connector.waitForClients(established))
+                break;
+
+            churned += batch.size();
+            for (auto& connection : batch)
+                retiredSockets.push_back(std::move(connection.socket));
+        }
+
+        churnTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - churnStart).count();
+    }
+
+    double churnRate = churnTime > 0 ? churned / churnTime : 0;
+    Parlo::LatencySnapshot acceptLatency = connector.acceptLatency.snapshot();
+    uint64_t failures = connector.failures;
+
+    for (auto& connection : population)
+        connection.client->disconnectAsync(false);
+
+    listener->stopAccepting();
+    workGuard.reset();
+    context.stop();
+    for (auto& thread : ioThreads)
+        thread.join();
+
+    double rssPerConnection = perConnection(baseline.residentBytes, idleUsage.residentBytes, established);
+    double threadsPerConnection = perConnection(baseline.threads, idleUsage.threads, established);
+    double descriptorsPerConnection = perConnection(baseline.descriptors, idleUsage.descriptors, established);
+
+    if (options.json) {
+        std::cout << "{\n"
+            << "  \"connections_requested\": " << options.connections << ",\n"
+            << "  \"connections\": " << established << ",\n"
+            << "  \"threads\": " << options.threads << ",\n"
+            << "  \"connect_failures\": " << failures << ",\n"
+            << "  \"populate_s\": " << populateTime << ",\n"
+            << "  \"idle\": { \"rss_bytes\": " << idleUsage.residentBytes << ", \"threads\": " << idleUsage.threads
+            << ", \"descriptors\": " << idleUsage.descriptors << ", \"cpu_percent\": " << idleCPU << " },\n"
+            << "  \"per_connection\": { \"rss_bytes\": " << rssPerConnection << ", \"threads\": " << threadsPerConnection
+            << ", \"descriptors\": " << descriptorsPerConnection << " },\n"
+            << "  \"churn\": { \"connections\": " << churned << ", \"connections_per_second\": " << churnRate << " },\n"
+            << "  \"accept_latency_ns\": { \"count\": " << acceptLatency.count << ", \"min\": " << acceptLatency.min.count()
+            << ", \"p50\": " << acceptLatency.p50.count() << ", \"p90\": " << acceptLatency.p90.count()
+            << ", \"p99\": " << acceptLatency.p99.count() << ", \"p999\": " << acceptLatency.p999.count()
+            << ", \"max\": " << acceptLatency.max.count() << " }\n"
+            << "}\n";
+    }
+    else {
+        std::cout << established << " connections in " << populateTime << " s (" << failures << " failed), "
+            << options.threads << " io threads\n"
+            << "idle         RSS " << idleUsage.residentBytes / (1024 * 1024) << " MB, " << idleUsage.threads << " threads, "
+            << idleUsage.descriptors << " descriptors, " << idleCPU << "% CPU\n"
+            << "per conn     RSS " << rssPerConnection / 1024 << " KB, " << threadsPerConnection << " threads, "
+            << descriptorsPerConnection << " descriptors\n"
+            << "churn        " << churned << " connections, " << churnRate << " connections/s\n"
+            << "accept       p50 " << acceptLatency.p50.count() / 1000 << " us, p90 " << acceptLatency.p90.count() / 1000
+            << " us, p99 " << acceptLatency.p99.count() / 1000 << " us, max " << acceptLatency.max.count() / 1000 << " us\n";
+    }
+
+    return stoppedBecause.empty() ? 0 : 2;
+}
@@ -0,0 +1,823 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+/*parlo-loadgen: Starts a Listener and a number of NetworkClients over loopback, drives a mix of
+messages through them and reports throughput, CPU per message and latency percentiles.
+Every message is echoed by the Listener, and latency is measured from when the message was
+supposed to be sent until its echo was handled.
+
+In closed loop mode (the default), each client keeps --window messages in flight.
+In open loop mode (--rate), each client sends at a fixed rate no matter how far behind the
+echoes are, and latency is measured from the intended send time so that stalls aren't hidden
+(I.E coordinated omission).
+
+System calls per message are reported so the epoll and io_uring backends can be compared:
+run a build configured with -DPARLO_IO_URING=ON against one without.
+
+With --transport shm, the clients connect through shared memory instead of the TCP loopback,
+so the two can be compared on the same host.
+
+With --transport udp, the clients send reliable packets to a UDPListener instead. Together with
+--loss, which loses datagrams and makes TCP resend lost segments after --retransmit, this compares
+the tail latency of reliable UDP against TCP on a lossy link. The clients share the emulated link,
+so a TCP resend holds up every client's stream; use --clients 1 to compare a single connection.*/
+
+#include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Parlo.h"
+#include "Socket.h"
+#include "Compression.h"
+#include "EncryptedPacket.h"
+#include "Histogram.h"
+#include "IOBackend.h"
+#include "LinkShaper.h"
+#include "PacketHeaders.h"
+#include "ProcessStats.h"
+#include "SharedMemory.h"
+
+namespace
+{
+    /*The ID of the packets sent by the load generator.*/
+    const uint8_t LOAD_PACKET_ID = 1;
+
+    /*Each payload starts with the intended send time in nanoseconds and a sequence number.*/
+    const size_t PAYLOAD_HEADER_SIZE = sizeof(uint64_t) + sizeof(uint32_t);
+
+    /*Room for the padding added by CBC mode encryption.*/
+    const size_t ENCRYPTION_OVERHEAD = 16;
+
+    struct Options
+    {
+        int clients = 8;
+        int threads = 2;
+        double duration = 10;
+        double warmup = 2;
+        /*Messages per second per client. 0 means closed loop.*/
+        double rate = 0;
+        /*Messages in flight per client in closed loop mode.*/
+        int window = 16;
+        /*Payload sizes and their weights.*/
+        std::vector<size_t> sizes{ 64 };
+        std::vector<double> weights{ 1 };
+        bool compress = false;
+        bool encrypt = false;
+        Parlo::EncryptionMode encryptionMode = Parlo::EncryptionMode::AES;
+        bool json = false;
+        /*Emulated link conditions, applied in each direction.*/
+        double latency = 0;
+        double jitter = 0;
+        uint64_t bandwidth = 0;
+        double loss = 0;
+        /*How long TCP takes to resend a lost segment, in milliseconds. Linux's minimum RTO by default.*/
+        double retransmit = 200;
+        /*default, low-latency or bulk.*/
+        std::string socketPreset = "default";
+        /*tcp, shm or udp.*/
+        std::string transport = "tcp";
+    };
+
+    void printUsage()
+    {
+        std::cout <<
+            "Usage: parlo-loadgen [options]\n"
+            "  --clients N            Number of connections (default 8)\n"
+            "  --threads N            Threads running the io_context (default 2)\n"
+            "  --duration SECONDS     Length of the measurement (default 10)\n"
+            "  --warmup SECONDS       Length of the warmup, which isn't measured (default 2)\n"
+            "  --rate MSGS            Open loop: messages per second per client\n"
+            "  --window N             Closed loop: messages in flight per client (default 16)\n"
+            "  --sizes SIZE:WEIGHT,.. Payload sizes in bytes and their weights (default 64:1)\n"
+            "  --compress             Compress every payload\n"
+            "  --encryption MODE      none, aes or twofish (default none)\n"
+            "  --socket PRESET        Socket options: default, low-latency or bulk (default default)\n"
+            "  --latency MS           Emulated one way latency (default 0)\n"
+            "  --jitter MS            Emulated jitter, either way (default 0)\n"
+            "  --bandwidth BYTES      Emulated bandwidth in bytes per second each way, shared by all clients (default unlimited)\n"
+            "  --loss FRACTION        Emulated loss rate each way, from 0 to 1 (default 0)\n"
+            "  --retransmit MS        How long TCP takes to resend a lost segment (default 200)\n"
+            "  --transport NAME       tcp, shm for shared memory on Linux, or udp for reliable UDP (default tcp)\n"
+            "  --json                 Print the results as JSON\n";
+    }
+
+    /*Parses a list like 64:80,1024:20 into sizes and weights. The weight is optional.*/
+    void parseSizes(const std::string& list, Options& options)
+    {
+        options.sizes.clear();
+        options.weights.clear();
+
+        std::stringstream stream(list);
+        std::string entry;
+        while (std::getline(stream, entry, ',')) {
+            auto colon = entry.find(':');
+            options.sizes.push_back(static_cast<size_t>(std::stoul(entry.substr(0, colon))));
+            options.weights.push_back(colon == std::string::npos ? 1.0 : std::stod(entry.substr(colon + 1)));
+        }
+
+        if (options.sizes.empty())
+            throw std::invalid_argument("--sizes needs at least one size");
+    }
+
+    Options parseOptions(int argc, char* argv[])
+    {
+        Options options;
+
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+
+            if (arg == "--help" || arg == "-h") {
+                printUsage();
+                std::exit(0);
+            }
+            if (arg == "--compress") {
+                options.compress = true;
+                continue;
+            }
+            if (arg == "--json") {
+                options.json = true;
+                continue;
+            }
+
+            if (i + 1 >= argc)
+                throw std::invalid_argument("Missing value for " + arg);
+            std::string value = argv[++i];
+
+            if (arg == "--clients")
+                options.clients = std::stoi(value);
+            else if (arg == "--threads")
+                options.threads = std::stoi(value);
+            else if (arg == "--duration")
+                options.duration = std::stod(value);
+            else if (arg == "--warmup")
+                options.warmup = std::stod(value);
+            else if (arg == "--rate")
+                options.rate = std::stod(value);
+            else if (arg == "--window")
+                options.window = std::stoi(value);
+            else if (arg == "--sizes")
+                parseSizes(value, options);
+            else if (arg == "--latency")
+                options.latency = std::stod(value);
+            else if (arg == "--jitter")
+                options.jitter = std::stod(value);
+            else if (arg == "--bandwidth")
+                options.bandwidth = std::stoull(value);
+            else if (arg == "--loss")
+                options.loss = std::stod(value);
+            else if (arg == "--retransmit")
+                options.retransmit = std::stod(value);
+            else if (arg == "--socket") {
+                if (value != "default" && value != "low-latency" && value != "bulk")
+                    throw std::invalid_argument("Unknown socket preset: " + value);
+                options.socketPreset = value;
+            }
+            else if (arg == "--transport") {
+                if (value != "tcp" && value != "shm" && value != "udp")
+                    throw std::invalid_argument("Unknown transport: " + value);
+                options.transport = value;
+            }
+            else if (arg == "--encryption") {
+                if (value == "none")
+                    options.encrypt = false;
+                else if (value == "aes") {
+                    options.encrypt = true;
+                    options.encryptionMode = Parlo::EncryptionMode::AES;
+                }
+                else if (value == "twofish") {
+                    options.encrypt = true;
+                    options.encryptionMode = Parlo::EncryptionMode::Twofish;
+                }
+                else
+                    throw std::invalid_argument("Unknown encryption mode: " + value);
+            }
+            else
+                throw std::invalid_argument("Unknown option: " + arg);
+        }
+
+        size_t header = options.transport == "udp" ? Parlo::PacketHeaders::UDP : Parlo::PacketHeaders::STANDARD;
+        size_t maxSize = Parlo::MAX_PACKET_SIZE - header - (options.encrypt ? ENCRYPTION_OVERHEAD : 0);
+        for (size_t size : options.sizes) {
+            if (size < PAYLOAD_HEADER_SIZE || size > maxSize)
+                throw std::invalid_argument("Sizes must be between " + std::to_string(PAYLOAD_HEADER_SIZE) +
+                    " and " + std::to_string(maxSize) + " bytes");
+        }
+
+        if (options.clients < 1 || options.threads < 1 || options.window < 1 || options.duration <= 0 || options.warmup < 0)
+            throw std::invalid_argument("--clients, --threads, --window and --duration must be positive");
+
+        if (options.latency < 0 || options.jitter < 0)
+            throw std::invalid_argument("--latency and --jitter can't be negative");
+
+        if (options.loss < 0 || options.loss >= 1 || options.retransmit <= 0)
+            throw std::invalid_argument("--loss must be from 0 to below 1, and --retransmit positive");
+
+        if (options.transport == "shm") {
+            if (!Parlo::isSharedMemoryAvailable())
+                throw std::invalid_argument("--transport shm is only available on Linux");
+            if (options.latency > 0 || options.jitter > 0 || options.bandwidth > 0 || options.loss > 0)
+                throw std::invalid_argument("--latency, --jitter, --bandwidth and --loss can't be emulated with --transport shm");
+        }
+
+        if (options.transport == "udp" && options.socketPreset != "default")
+            throw std::invalid_argument("--socket only applies to --transport tcp");
+
+        return options;
+    }
+
+    /*The socket options for a preset, or nullptr to leave the sockets alone.*/
+    std::unique_ptr<Parlo::SocketOptions> socketOptionsFor(const std::string& preset)
+    {
+        if (preset == "low-latency")
+            return std::make_unique<Parlo::SocketOptions>(Parlo::SocketOptions::lowLatency());
+        if (preset == "bulk")
+            return std::make_unique<Parlo::SocketOptions>(Parlo::SocketOptions::bulkThroughput());
+
+        return nullptr;
+    }
+
+    std::string formatOption(const std::optional<bool>& option)
+    {
+        return !option ? "n/a" : (*option ? "on" : "off");
+    }
+
+    std::string formatOption(const std::optional<int>& option)
+    {
+        return !option ? "n/a" : std::to_string(*option);
+    }
+
+    uint64_t nowNanoseconds()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    /*Turns payloads into packets and back, applying the compression and encryption chosen on the command line.
+    Compression is applied before encryption, since encrypted data doesn't compress.*/
+    class Codec
+    {
+    public:
+        Codec(const Options& options) : compress(options.compress), reliable(options.transport == "udp")
+        {
+            if (options.encrypt) {
+                args = std::make_shared<Parlo::EncryptionArgs>();
+                args->Mode = options.encryptionMode;
+                args->Key = "parlo-loadgen key";
+                args->Salt = "parlo-loadgen salt";
+            }
+        }
+
+        std::vector<uint8_t> encode(const std::vector<uint8_t>& payload) const
+        {
+            std::vector<uint8_t> body = compress ? Parlo::compressData(payload) : payload;
+
+            if (args) {
+                std::vector<uint8_t> packet = Parlo::EncryptedPacket(args, LOAD_PACKET_ID, body).buildPacket();
+                if (!reliable)
+                    return packet;
+
+                //EncryptedPacket frames for TCP, so the encrypted body is framed again as a reliable UDP packet.
+                body.assign(packet.begin() + Parlo::PacketHeaders::STANDARD, packet.end());
+                return Parlo::Packet(LOAD_PACKET_ID, body, false, true).buildPacket();
+            }
+
+            //The NetworkClient and UDPNetworkClient decompress packets flagged as compressed before handing them over.
+            if (reliable)
+                return Parlo::Packet(LOAD_PACKET_ID, body, compress, true).buildPacket();
+
+            return Parlo::Packet(LOAD_PACKET_ID, body, compress).buildPacket();
+        }
+
+        std::vector<uint8_t> decode(const Parlo::Packet& packet) const
+        {
+            if (!args)
+                return packet.getData();
+
+            std::vector<uint8_t> body = Parlo::EncryptedPacket(args, packet.getID(), packet.getData()).decryptPacket();
+            return compress ? Parlo::decompressData(body) : body;
+        }
+
+    private:
+        bool compress;
+        /*Build reliable UDP packets rather than TCP packets.*/
+        bool reliable;
+        std::shared_ptr<Parlo::EncryptionArgs> args;
+    };
+
+    /*Counters shared by every client. Only the measurement phase is counted.*/
+    struct Results
+    {
+        /*Cleared once the measurement is over, after which no new messages are sent.*/
+        std::atomic<bool> sending{ true };
+        std::atomic<bool> measuring{ false };
+        std::atomic<uint64_t> messages{ 0 };
+        std::atomic<uint64_t> bytes{ 0 };
+        std::atomic<uint64_t> errors{ 0 };
+        Parlo::LatencyHistogram latency;
+    };
+
+    /*One connection to the Listener, and what it needs to generate load.*/
+    struct LoadClient
+    {
+        LoadClient(asio::io_context& context, const Options& options, unsigned int seed) :
+            socket(std::make_unique<Parlo::Socket>(context)), random(seed),
+            sizes(options.weights.begin(), options.weights.end()) {}
+
+        std::unique_ptr<Parlo::Socket> socket;
+        /*One of these is set, depending on the transport.*/
+        std::shared_ptr<Parlo::NetworkClient> client;
+        std::shared_ptr<Parlo::SharedMemoryClient> sharedClient;
+        std::shared_ptr<Parlo::UDPNetworkClient> udpClient;
+
+        std::mutex mutex;
+        std::mt19937 random;
+        std::discrete_distribution<size_t> sizes;
+        uint32_t sequence = 0;
+
+        /*When the next message is due, in open loop mode.*/
+        uint64_t nextSend = 0;
+
+        void sendAsync(const std::vector<uint8_t>& data)
+        {
+            if (sharedClient)
+                sharedClient->sendAsync(data);
+            else if (udpClient)
+                udpClient->sendAsync(data);
+            else
+                client->sendAsync(data);
+        }
+
+        bool isConnected() const
+        {
+            if (udpClient)
+                return udpClient->isConnected();
+
+            return sharedClient ? sharedClient->isConnected() : client->isConnected();
+        }
+
+        void disconnectAsync()
+        {
+            if (sharedClient)
+                sharedClient->disconnectAsync();
+            else if (udpClient)
+                udpClient->disconnectAsync();
+            else
+                client->disconnectAsync();
+        }
+    };
+
+    /*Sends one message, stamped with the time it was supposed to be sent.*/
+    void sendMessage(LoadClient& loadClient, const Options& options, const Codec& codec, Results& results, uint64_t intended)
+    {
+        std::vector<uint8_t> payload;
+
+        {
+            std::lock_guard<std::mutex> lock(loadClient.mutex);
+            payload.resize(options.sizes[loadClient.sizes(loadClient.random)]);
+
+            //Padding is a repeating pattern, so --compress has something to do.
+            for (size_t i = PAYLOAD_HEADER_SIZE; i < payload.size(); i++)
+                payload[i] = static_cast<uint8_t>(i % 16);
+
+            std::memcpy(payload.data(), &intended, sizeof(intended));
+            std::memcpy(payload.data() + sizeof(intended), &loadClient.sequence, sizeof(loadClient.sequence));
+            loadClient.sequence++;
+        }
+
+        try {
+            loadClient.sendAsync(codec.encode(payload));
+        }
+        catch (const std::exception&) {
+            results.errors++;
+        }
+    }
+
+    /*Echoes a message back, decoding and re-encoding it like a real server would.*/
+    template <typename Client>
+    void echoMessage(const std::shared_ptr<Client>& sender, const Parlo::Packet& packet, const Codec& codec, Results& results)
+    {
+        try {
+            sender->sendAsync(codec.encode(codec.decode(packet)));
+        }
+        catch (const std::exception&) {
+            results.errors++;
+        }
+    }
+
+    /*Records the latency of an echo, and in closed loop mode sends the next message.*/
+    void handleEcho(LoadClient& loadClient, const Parlo::Packet& packet, const Options& options, const Codec& codec, Results& results)
+    {
+        uint64_t received = nowNanoseconds();
+        std::vector<uint8_t> payload;
+
+        try {
+            payload = codec.decode(packet);
+        }
+        catch (const std::exception&) {
+            results.errors++;
+            return;
+        }
+
+        if (payload.size() < PAYLOAD_HEADER_SIZE) {
+            results.errors++;
+            return;
+        }
+
+        uint64_t intended;
+        std::memcpy(&intended, payload.data(), sizeof(intended));
+
+        if (results.measuring) {
+            results.latency.record(std::chrono::nanoseconds(received - intended));
+            results.messages++;
+            results.bytes += payload.size();
+        }
+
+        //Closed loop: every echo frees up a slot in the window.
+        if (options.rate <= 0 && results.sending)
+            sendMessage(loadClient, options, codec, results, nowNanoseconds());
+    }
+
+    std::string formatLatency(std::chrono::nanoseconds latency)
+    {
+        std::ostringstream stream;
+        stream.precision(1);
+        stream << std::fixed << latency.count() / 1000.0 << " us";
+        return stream.str();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    try {
+        options = parseOptions(argc, argv);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "parlo-loadgen: " << e.what() << "\n\n";
+        printUsage();
+        return 1;
+    }
+
+    const Parlo::IOBackend backend = Parlo::getIOBackend();
+    if (backend == Parlo::IOBackend::IOUring && !Parlo::isIOUringAvailable()) {
+        std::cerr << "parlo-loadgen: This build uses io_uring, which this kernel doesn't allow. Use a build without PARLO_IO_URING.\n";
+        return 1;
+    }
+
+    Codec codec(options);
+    Results results;
+
+    asio::io_context context;
+    auto workGuard = asio::make_work_guard(context);
+    std::vector<std::thread> ioThreads;
+    for (int i = 0; i < options.threads; i++)
+        ioThreads.emplace_back([&context]() { context.run(); });
+
+    //The server echoes every message.
+    auto listener = std::make_shared<Parlo::Listener>(context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    listener->setOnClientConnectedHandler([&codec, &results](const std::shared_ptr<Parlo::NetworkClient>& client) {
+        client->setOnReceivedDataHandler([&codec, &results](const std::shared_ptr<Parlo::NetworkClient>& sender,
+            const std::shared_ptr<Parlo::Packet>& packet) {
+            echoMessage(sender, *packet, codec, results);
+        });
+    });
+
+    //Serves the same port through shared memory, so the clients find it like any client on this host would.
+    const bool sharedMemory = options.transport == "shm";
+    std::shared_ptr<Parlo::SharedMemoryListener> sharedListener;
+    std::mutex acceptedMutex;
+    std::vector<std::shared_ptr<Parlo::SharedMemoryClient>> accepted;
+    if (sharedMemory) {
+        try {
+            sharedListener = std::make_shared<Parlo::SharedMemoryListener>(context, listener->getLocalEndpoint());
+        }
+        catch (const std::exception& e) {
+            std::cerr << "parlo-loadgen: " << e.what() << "\n";
+            return 1;
+        }
+
+        sharedListener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::SharedMemoryClient>& client) {
+            client->setOnReceivedDataHandler([&codec, &results](const std::shared_ptr<Parlo::SharedMemoryClient>& sender,
+                const std::shared_ptr<Parlo::Packet>& packet) {
+                echoMessage(sender, *packet, codec, results);
+            });
+
+            std::lock_guard<std::mutex> lock(acceptedMutex);
+            accepted.push_back(client);
+        });
+        sharedListener->startAccepting();
+    }
+
+    //Reliable UDP is served on a port of its own.
+    const bool udp = options.transport == "udp";
+    std::shared_ptr<Parlo::UDPListener> udpListener;
+    std::vector<std::shared_ptr<Parlo::UDPNetworkClient>> udpAccepted;
+    if (udp) {
+        udpListener = std::make_shared<Parlo::UDPListener>(context, asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+        udpListener->setOnClientConnectedHandler([&](const std::shared_ptr<Parlo::UDPNetworkClient>& client) {
+            client->setOnReceivedDataHandler([&codec, &results](const std::shared_ptr<Parlo::UDPNetworkClient>& sender,
+                const std::shared_ptr<Parlo::Packet>& packet) {
+                echoMessage(sender, *packet, codec, results);
+            });
+
+            std::lock_guard<std::mutex> lock(acceptedMutex);
+            udpAccepted.push_back(client);
+        });
+    }
+
+    //One shaper per direction, so the clients share the emulated link like they'd share a bottleneck.
+    std::shared_ptr<Parlo::LinkShaper> uplink, downlink;
+    if (options.latency > 0 || options.jitter > 0 || options.bandwidth > 0 || options.loss > 0) {
+        Parlo::LinkConditions conditions;
+        conditions.latency = std::chrono::microseconds(static_cast<int64_t>(options.latency * 1000));
+        conditions.jitter = std::chrono::microseconds(static_cast<int64_t>(options.jitter * 1000));
+        conditions.bandwidth = options.bandwidth;
+        conditions.lossRate = options.loss;
+        if (options.loss > 0)
+            conditions.retransmitDelay = std::chrono::microseconds(static_cast<int64_t>(options.retransmit * 1000));
+
+        uplink = std::make_shared<Parlo::LinkShaper>(context, conditions);
+        downlink = std::make_shared<Parlo::LinkShaper>(context, conditions);
+        listener->setLinkShaper(uplink);
+        if (udpListener)
+            udpListener->setLinkShaper(uplink);
+    }
+
+    auto socketOptions = socketOptionsFor(options.socketPreset);
+    if (socketOptions)
+        listener->setSocketOptions(*socketOptions);
+
+    listener->startAccepting();
+    if (udpListener)
+        udpListener->startAccepting();
+
+    std::vector<std::unique_ptr<LoadClient>> loadClients;
+    for (int i = 0; i < options.clients; i++) {
+        loadClients.push_back(std::make_unique<LoadClient>(context, options, static_cast<unsigned int>(i + 1)));
+        LoadClient& loadClient = *loadClients.back();
+
+        if (sharedMemory && Parlo::SharedMemoryClient::isReachable(listener->getLocalEndpoint())) {
+            loadClient.sharedClient = std::make_shared<Parlo::SharedMemoryClient>(context);
+            loadClient.sharedClient->setOnReceivedDataHandler([&loadClient, &options, &codec, &results](
+                const std::shared_ptr<Parlo::SharedMemoryClient>&, const std::shared_ptr<Parlo::Packet>& packet) {
+                handleEcho(loadClient, *packet, options, codec, results);
+            });
+            loadClient.sharedClient->connectAsync(listener->getLocalEndpoint());
+            continue;
+        }
+
+        if (udp) {
+            loadClient.udpClient = std::make_shared<Parlo::UDPNetworkClient>(context);
+            if (downlink)
+                loadClient.udpClient->setLinkShaper(downlink);
+
+            loadClient.udpClient->setOnReceivedDataHandler([&loadClient, &options, &codec, &results](
+                const std::shared_ptr<Parlo::UDPNetworkClient>&, const std::shared_ptr<Parlo::Packet>& packet) {
+                handleEcho(loadClient, *packet, options, codec, results);
+            });
+            loadClient.udpClient->connectAsync(udpListener->getLocalEndpoint());
+            continue;
+        }
+
+        loadClient.client = std::make_shared<Parlo::NetworkClient>(*loadClient.socket);
+        if (downlink)
+            loadClient.client->setLinkShaper(downlink);
+
+        loadClient.client->setOnReceivedDataHandler([&loadClient, &options, &codec, &results](
+            const std::shared_ptr<Parlo::NetworkClient>&, const std::shared_ptr<Parlo::Packet>& packet) {
+            handleEcho(loadClient, *packet, options, codec, results);
+        });
+
+        if (socketOptions)
+            loadClient.client->setSocketOptions(*socketOptions);
+
+        loadClient.client->connectAsync(listener->getLocalEndpoint());
+    }
+
+    auto connectDeadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    for (auto& loadClient : loadClients) {
+        while (!loadClient->isConnected() && std::chrono::steady_clock::now() < connectDeadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        if (!loadClient->isConnected()) {
+            std::cerr << "parlo-loadgen: Timed out connecting to the Listener\n";
+            return 1;
+        }
+    }
+
+    //What the OS actually applied, read back from a client. Shared memory and UDP connections have no socket options.
+    Parlo::SocketOptions effective;
+    if (loadClients.front()->client)
+        effective = loadClients.front()->client->getSocketOptions();
+
+    //Wakeups are what a shared memory connection makes system calls for, so they're counted at both ends.
+    auto countWakeups = [&]() {
+        uint64_t wakeups = 0;
+        for (auto& loadClient : loadClients) {
+            if (loadClient->sharedClient)
+                wakeups += loadClient->sharedClient->getSharedMemoryStats().wakeupsSent;
+        }
+
+        std::lock_guard<std::mutex> lock(acceptedMutex);
+        for (auto& client : accepted)
+            wakeups += client->getSharedMemoryStats().wakeupsSent;
+        return wakeups;
+    };
+
+    std::thread pacer;
+
+    if (options.rate > 0) {
+        //A single thread paces every client. If it falls behind, it catches up by sending the
+        //overdue messages right away; their latency still counts from when they were due.
+        pacer = std::thread([&]() {
+            auto interval = static_cast<uint64_t>(1e9 / options.rate);
+            uint64_t start = nowNanoseconds();
+
+            //Spread the clients out over the first interval, so they don't send in lockstep.
+            for (size_t i = 0; i < loadClients.size(); i++)
+                loadClients[i]->nextSend = start + interval * i / loadClients.size();
+
+            while (results.sending) {
+                uint64_t now = nowNanoseconds();
+                uint64_t earliest = UINT64_MAX;
+
+                for (auto& loadClient : loadClients) {
+                    while (loadClient->nextSend <= now && results.sending) {
+                        sendMessage(*loadClient, options, codec, results, loadClient->nextSend);
+                        loadClient->nextSend += interval;
+                    }
+
+                    earliest = (std::min)(earliest, loadClient->nextSend);
+                }
+
+                uint64_t after = nowNanoseconds();
+                if (earliest > after)
+                    std::this_thread::sleep_for(std::chrono::nanoseconds(earliest - after));
+            }
+        });
+    }
+    else {
+        for (auto& loadClient : loadClients) {
+            for (int i = 0; i < options.window; i++)
+                sendMessage(*loadClient, options, codec, results, nowNanoseconds());
+        }
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.warmup));
+
+    results.latency.reset();
+    results.messages = 0;
+    results.bytes = 0;
+    results.errors = 0;
+    auto cpuStart = ProcessStats::cpuTime();
+    auto switchesStart = ProcessStats::contextSwitches();
+    ProcessStats::SyscallCounter syscalls;
+    uint64_t wakeupsStart = countWakeups();
+    auto wallStart = std::chrono::steady_clock::now();
+    results.measuring = true;
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+
+    results.measuring = false;
+    auto wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    auto cpuTime = ProcessStats::cpuTime() - cpuStart;
+    int64_t syscallCount = syscalls.read();
+    int64_t switches = ProcessStats::contextSwitches() - switchesStart;
+    uint64_t wakeups = countWakeups() - wakeupsStart;
+
+    //Reliable UDP resends lost packets itself, where TCP's resends are emulated by the LinkShaper.
+    uint64_t retransmissions = 0;
+    for (auto& loadClient : loadClients) {
+        if (loadClient->udpClient)
+            retransmissions += loadClient->udpClient->getReliabilityStats().retransmissions;
+    }
+    {
+        std::lock_guard<std::mutex> lock(acceptedMutex);
+        for (auto& client : udpAccepted)
+            retransmissions += client->getReliabilityStats().retransmissions;
+    }
+    if (downlink && !udp)
+        retransmissions += downlink->getStats().retransmitted + uplink->getStats().retransmitted;
+
+    results.sending = false;
+    if (pacer.joinable())
+        pacer.join();
+
+    uint64_t messages = results.messages;
+    uint64_t bytes = results.bytes;
+    uint64_t errors = results.errors;
+    Parlo::LatencySnapshot latency = results.latency.snapshot();
+
+    double messagesPerSecond = messages / wallTime;
+    double megabytesPerSecond = bytes / wallTime / (1024.0 * 1024.0);
+    double cpuPerMessage = messages > 0 ? static_cast<double>(cpuTime.count()) / messages : 0;
+    //-1 when the system calls couldn't be counted.
+    double syscallsPerMessage = syscallCount < 0 ? -1 : (messages > 0 ? static_cast<double>(syscallCount) / messages : 0);
+    double switchesPerMessage = messages > 0 ? static_cast<double>(switches) / messages : 0;
+    //-1 over TCP, which has no wakeups of its own.
+    double wakeupsPerMessage = !sharedMemory ? -1 : (messages > 0 ? static_cast<double>(wakeups) / messages : 0);
+
+    for (auto& loadClient : loadClients)
+        loadClient->disconnectAsync();
+
+    //Give the goodbyes a chance to go out before the io_context stops.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    listener->stopAccepting();
+    if (sharedListener)
+        sharedListener->stopAccepting();
+    if (udpListener)
+        udpListener->stopAccepting();
+    workGuard.reset();
+    context.stop();
+    for (auto& thread : ioThreads)
+        thread.join();
+
+    std::string mode = options.rate > 0 ? "open" : "closed";
+    std::string encryption = !options.encrypt ? "none" :
+        (options.encryptionMode == Parlo::EncryptionMode::AES ? "aes" : "twofish");
+
+    if (options.json) {
+        std::cout << "{\n"
+            << "  \"backend\": \"" << Parlo::getIOBackendName(backend) << "\",\n"
+            << "  \"transport\": \"" << options.transport << "\",\n"
+            << "  \"clients\": " << options.clients << ",\n"
+            << "  \"threads\": " << options.threads << ",\n"
+            << "  \"mode\": \"" << mode << "\",\n"
+            << "  \"rate\": " << options.rate << ",\n"
+            << "  \"window\": " << options.window << ",\n"
+            << "  \"compress\": " << (options.compress ? "true" : "false") << ",\n"
+            << "  \"encryption\": \"" << encryption << "\",\n"
+            << "  \"socket\": { \"preset\": \"" << options.socketPreset << "\", \"no_delay\": \"" << formatOption(effective.noDelay)
+            << "\", \"send_buffer\": \"" << formatOption(effective.sendBufferSize) << "\", \"receive_buffer\": \""
+            << formatOption(effective.receiveBufferSize) << "\", \"not_sent_lowat\": \"" << formatOption(effective.notSentLowWatermark) << "\" },\n"
+            << "  \"link\": { \"latency_ms\": " << options.latency << ", \"jitter_ms\": " << options.jitter
+            << ", \"bandwidth\": " << options.bandwidth << ", \"loss\": " << options.loss
+            << ", \"retransmit_ms\": " << options.retransmit << " },\n"
+            << "  \"retransmissions\": " << retransmissions << ",\n"
+            << "  \"duration_s\": " << wallTime << ",\n"
+            << "  \"messages\": " << messages << ",\n"
+            << "  \"errors\": " << errors << ",\n"
+            << "  \"messages_per_second\": " << messagesPerSecond << ",\n"
+            << "  \"megabytes_per_second\": " << megabytesPerSecond << ",\n"
+            << "  \"cpu_us_per_message\": " << cpuPerMessage << ",\n"
+            << "  \"syscalls_per_message\": " << syscallsPerMessage << ",\n"
+            << "  \"context_switches_per_message\": " << switchesPerMessage << ",\n"
+            << "  \"wakeups_per_message\": " << wakeupsPerMessage << ",\n"
+            << "  \"latency_ns\": { \"min\": " << latency.min.count() << ", \"mean\": " << latency.mean.count()
+            << ", \"p50\": " << latency.p50.count() << ", \"p90\": " << latency.p90.count()
+            << ", \"p99\": " << latency.p99.count() << ", \"p999\": " << latency.p999.count()
+            << ", \"max\": " << latency.max.count() << " }\n"
+            << "}\n";
+    }
+    else {
+        std::cout << options.clients << " clients over " << options.transport << ", " << options.threads << " threads on "
+            << Parlo::getIOBackendName(backend) << ", " << mode << " loop";
+        if (options.rate > 0)
+            std::cout << " at " << options.rate << " msgs/s per client";
+        else
+            std::cout << " with a window of " << options.window;
+        std::cout << ", compression " << (options.compress ? "on" : "off") << ", encryption " << encryption << "\n";
+        std::cout << "socket       " << options.socketPreset << ": nodelay " << formatOption(effective.noDelay)
+            << ", sndbuf " << formatOption(effective.sendBufferSize) << ", rcvbuf " << formatOption(effective.receiveBufferSize)
+            << ", notsent_lowat " << formatOption(effective.notSentLowWatermark) << "\n";
+        if (uplink)
+            std::cout << "link         " << options.latency << " ms latency, " << options.jitter << " ms jitter, "
+                << (options.bandwidth > 0 ? std::to_string(options.bandwidth) + " B/s" : std::string("unlimited")) << ", "
+                << options.loss * 100 << "% loss each way\n";
+        if (options.loss > 0)
+            std::cout << "resends      " << retransmissions << "\n";
+
+        std::cout << "messages     " << messages << " in " << wallTime << " s (" << errors << " errors)\n"
+            << "msgs/s       " << messagesPerSecond << "\n"
+            << "MB/s         " << megabytesPerSecond << "\n"
+            << "CPU/msg      " << cpuPerMessage << " us\n"
+            << "syscalls/msg " << (syscallsPerMessage < 0 ? std::string("n/a (needs tracefs and perf_event access)") : std::to_string(syscallsPerMessage)) << "\n"
+            << "switches/msg " << switchesPerMessage << "\n";
+        if (sharedMemory)
+            std::cout << "wakeups/msg  " << wakeupsPerMessage << "\n";
+        std::cout << "latency      min " << formatLatency(latency.min) << ", p50 " << formatLatency(latency.p50)
+            << ", p90 " << formatLatency(latency.p90) << ", p99 " << formatLatency(latency.p99)
+            << ", p99.9 " << formatLatency(latency.p999) << ", max " << formatLatency(latency.max) << "\n";
+    }
+
+    return errors > 0 ? 2 : 0;
+}
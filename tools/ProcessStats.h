@@ -0,0 +1,250 @@
+/*This Source Code Form is subject to the terms of the Mozilla Public License, v. 2.0.
+If a copy of the MPL was not distributed with this file, You can obtain one at
+http://mozilla.org/MPL/2.0/.
+
+The Original Code is the Parlo library.
+
+The Initial Developer of the Original Code is
+Mats 'Afr0' Vederhus. All Rights Reserved.
+
+Contributor(s): ______________________________________.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#include <tlhelp32.h>
+#else
+#include <dirent.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+/*Resource usage of the current process, for the tools. Values that can't be read on a platform are -1.*/
+namespace ProcessStats
+{
+    /*User plus system CPU time used by this process.*/
+    inline std::chrono::microseconds cpuTime()
+    {
+#ifdef _WIN32
+        FILETIME creation, exit, kernel, user;
+        GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+
+        auto toMicroseconds = [](const FILETIME& time) {
+            ULARGE_INTEGER value;
+            value.LowPart = time.dwLowDateTime;
+            value.HighPart = time.dwHighDateTime;
+            return static_cast<int64_t>(value.QuadPart / 10); //100 nanosecond intervals.
+        };
+
+        return std::chrono::microseconds(toMicroseconds(kernel) + toMicroseconds(user));
+#else
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+
+        return std::chrono::microseconds(
+            (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+#endif
+    }
+
+    /*Resident set size in bytes.*/
+    inline int64_t residentBytes()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters;
+        if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+            return -1;
+
+        return static_cast<int64_t>(counters.WorkingSetSize);
+#else
+        std::ifstream statm("/proc/self/statm");
+        int64_t size = 0, resident = 0;
+        if (!(statm >> size >> resident))
+            return -1;
+
+        return resident * sysconf(_SC_PAGESIZE);
+#endif
+    }
+
+    /*Number of threads in this process.*/
+    inline int64_t threadCount()
+    {
+#ifdef _WIN32
+        HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+        if (snapshot == INVALID_HANDLE_VALUE)
+            return -1;
+
+        int64_t count = 0;
+        THREADENTRY32 entry;
+        entry.dwSize = sizeof(entry);
+        for (BOOL more = Thread32First(snapshot, &entry); more; more = Thread32Next(snapshot, &entry)) {
+            if (entry.th32OwnerProcessID == GetCurrentProcessId())
+                count++;
+        }
+
+        CloseHandle(snapshot);
+        return count;
+#else
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.compare(0, 8, "Threads:") == 0)
+                return std::stoll(line.substr(8));
+        }
+
+        return -1;
+#endif
+    }
+
+    /*Number of open file descriptors, or handles on Windows.*/
+    inline int64_t openDescriptors()
+    {
+#ifdef _WIN32
+        DWORD count = 0;
+        if (!GetProcessHandleCount(GetCurrentProcess(), &count))
+            return -1;
+
+        return count;
+#else
+        DIR* directory = opendir("/proc/self/fd");
+        if (!directory)
+            return -1;
+
+        int64_t count = 0;
+        while (dirent* entry = readdir(directory)) {
+            if (entry->d_name[0] != '.')
+                count++;
+        }
+
+        closedir(directory);
+        return count - 1; //The descriptor used to read the directory.
+#endif
+    }
+
+    /*Voluntary plus involuntary context switches made by this process.*/
+    inline int64_t contextSwitches()
+    {
+#ifdef _WIN32
+        return -1;
+#else
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+
+        return static_cast<int64_t>(usage.ru_nvcsw + usage.ru_nivcsw);
+#endif
+    }
+
+    /*Counts the system calls made by the threads that exist when it's created, through the
+    raw_syscalls:sys_enter tracepoint. Needs tracefs mounted and permission to open the tracepoint
+    (root, CAP_PERFMON or a low enough kernel.perf_event_paranoid), so it's Linux only and read()
+    returns -1 when it isn't available.*/
+    class SyscallCounter
+    {
+    public:
+        SyscallCounter()
+        {
+#ifdef __linux__
+            int64_t id = tracepointID();
+            if (id < 0)
+                return;
+
+            DIR* tasks = opendir("/proc/self/task");
+            if (!tasks)
+                return;
+
+            while (dirent* entry = readdir(tasks)) {
+                if (entry->d_name[0] == '.')
+                    continue;
+
+                perf_event_attr attributes = {};
+                attributes.type = PERF_TYPE_TRACEPOINT;
+                attributes.size = sizeof(attributes);
+                attributes.config = static_cast<uint64_t>(id);
+
+                long fd = syscall(__NR_perf_event_open, &attributes, std::stoi(entry->d_name), -1, -1, 0);
+                if (fd >= 0)
+                    descriptors.push_back(static_cast<int>(fd));
+            }
+
+            closedir(tasks);
+#endif
+        }
+
+        ~SyscallCounter()
+        {
+#ifdef __linux__
+            for (int fd : descriptors)
+                close(fd);
+#endif
+        }
+
+        SyscallCounter(const SyscallCounter&) = delete;
+        SyscallCounter& operator=(const SyscallCounter&) = delete;
+
+        /*System calls made since the counter was created, or -1 if they can't be counted.*/
+        int64_t read() const
+        {
+            if (descriptors.empty())
+                return -1;
+
+            int64_t total = 0;
+#ifdef __linux__
+            for (int fd : descriptors) {
+                uint64_t count = 0;
+                if (::read(fd, &count, sizeof(count)) == sizeof(count))
+                    total += static_cast<int64_t>(count);
+            }
+#endif
+            return total;
+        }
+
+    private:
+        std::vector<int> descriptors;
+
+#ifdef __linux__
+        static int64_t tracepointID()
+        {
+            for (const char* path : { "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+                "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id" }) {
+                std::ifstream file(path);
+                int64_t id = -1;
+                if (file >> id)
+                    return id;
+            }
+
+            return -1;
+        }
+#endif
+    };
+
+    /*Raises the limit on open file descriptors as far as allowed. Returns the new limit.*/
+    inline int64_t raiseDescriptorLimit()
+    {
+#ifdef _WIN32
+        return -1;
+#else
+        rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+            return -1;
+
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+
+        return static_cast<int64_t>(limit.rlim_cur);
+#endif
+    }
+}